@@ -0,0 +1,878 @@
+#include "chunk.hpp"
+#include "chunk_codec.hpp"
+#include "compress.hpp"
+#include "mesher.hpp"
+#include "physics.hpp"
+#include "world.hpp"
+#include "worldgen.hpp"
+#include <Arena.h>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+
+// Microbenchmarks for the hot paths: arena patterns, palette + payload codecs, LZ, meshing,
+// noise and physics queries. Every case checks its results before it is timed, a failed check fails the run.
+// A sample runs a case enough times to take at least BENCH_MIN_SAMPLE_NS, after BENCH_WARMUP
+// samples are thrown away. Reported per op: median, mean with a 95% confidence interval (t
+// distribution), min, and the median absolute deviation as a noise indicator. Chunk cases go
+// over the whole generated area per op, so every sample sees the same mix of terrain.
+//
+// MicroBench [--samples N] [--filter SUBSTRING] [--json FILE]
+
+#define BENCH_SEED 1337
+#define BENCH_MIN_SAMPLE_NS 2000000.0 // 2 ms
+#define BENCH_WARMUP 3
+#define BENCH_DEFAULT_SAMPLES 31
+#define BENCH_MAX_SAMPLES 1000
+#define BENCH_NOISY_MAD 0.05 // relative, flagged in the output
+
+#define WORLD_COLUMNS 4 // chunks per side of the generated test area
+#define WORLD_LAYERS 4
+#define WORLD_CHUNKS (WORLD_COLUMNS * WORLD_COLUMNS * WORLD_LAYERS)
+#define NOISE_SAMPLES 4096 // per op
+#define PHYSICS_QUERIES 4096 // per op
+#define PHYSICS_ENTITIES 4096
+#define PHYSICS_CHECK_COLUMNS 256
+
+#define ARENA_ALLOCS 64 // per op
+#define SCRATCH_ALLOCS 32
+#define SCRATCH_ALLOC_BYTES 1024
+#define SCRATCH_REGION_BYTES (8 * 1024) // small, so every scratch pass spills into new regions
+
+typedef void (*BenchFn)(void* data, uint32_t iterations);
+
+struct BenchCase {
+    const char* name;
+    BenchFn fn;
+    void* data;
+    uint32_t items; // per op, for the throughput column
+    const char* item_unit;
+};
+
+struct BenchStats {
+    uint32_t iterations; // per sample
+    uint32_t samples;
+    double median; // ns per op
+    double mean;
+    double ci95; // +- around the mean
+    double min;
+    double mad; // median absolute deviation, relative to the median
+};
+
+static volatile uint64_t bench_sink; // results go here so the work can't be optimized out
+
+static void keep(uint64_t value)
+{
+    bench_sink = bench_sink ^ value;
+}
+
+static double now_ns()
+{
+    return (double)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Two sided 95% quantile of Student's t, by degrees of freedom
+static double t_95(uint32_t df)
+{
+    static const double table[] = { 0.0, 12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262, 2.228,
+        2.201, 2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 2.093, 2.086,
+        2.080, 2.074, 2.069, 2.064, 2.060, 2.056, 2.052, 2.048, 2.045, 2.042 };
+    if (df < sizeof(table) / sizeof(table[0])) {
+        return table[df];
+    }
+    return df < 60 ? 2.000 : df < 120 ? 1.980 : 1.960;
+}
+
+static double median_sorted(const double* values, uint32_t count)
+{
+    return count % 2 ? values[count / 2] : 0.5 * (values[count / 2 - 1] + values[count / 2]);
+}
+
+static BenchStats run_case(const BenchCase* bench, uint32_t samples)
+{
+    BenchStats stats {};
+
+    // Grow the batch until one sample is long enough for the clock
+    uint32_t iterations = 1;
+    while (true) {
+        double start = now_ns();
+        bench->fn(bench->data, iterations);
+        double elapsed = now_ns() - start;
+        if (elapsed >= BENCH_MIN_SAMPLE_NS || iterations >= (1u << 30)) {
+            break;
+        }
+        double scale = elapsed > 0.0 ? BENCH_MIN_SAMPLE_NS / elapsed : 16.0;
+        iterations = (uint32_t)std::min(std::max(iterations * 2.0, iterations * scale * 1.2), (double)(1u << 30));
+    }
+    for (uint32_t i = 0; i < BENCH_WARMUP; i++) {
+        bench->fn(bench->data, iterations);
+    }
+
+    double values[BENCH_MAX_SAMPLES];
+    for (uint32_t i = 0; i < samples; i++) {
+        double start = now_ns();
+        bench->fn(bench->data, iterations);
+        values[i] = (now_ns() - start) / iterations;
+    }
+
+    std::sort(values, values + samples);
+    double sum = 0.0;
+    for (uint32_t i = 0; i < samples; i++) {
+        sum += values[i];
+    }
+    double mean = sum / samples;
+    double variance = 0.0;
+    for (uint32_t i = 0; i < samples; i++) {
+        variance += (values[i] - mean) * (values[i] - mean);
+    }
+    variance = samples > 1 ? variance / (samples - 1) : 0.0;
+
+    stats.iterations = iterations;
+    stats.samples = samples;
+    stats.median = median_sorted(values, samples);
+    stats.mean = mean;
+    stats.ci95 = samples > 1 ? t_95(samples - 1) * sqrt(variance / samples) : 0.0;
+    stats.min = values[0];
+
+    double deviations[BENCH_MAX_SAMPLES];
+    for (uint32_t i = 0; i < samples; i++) {
+        deviations[i] = fabs(values[i] - stats.median);
+    }
+    std::sort(deviations, deviations + samples);
+    stats.mad = stats.median > 0.0 ? median_sorted(deviations, samples) / stats.median : 0.0;
+    return stats;
+}
+
+// ===========================================
+// ------------------ARENA--------------------
+// ===========================================
+
+struct ArenaBench {
+    Arena* arr;
+    Arena* scratch;
+};
+
+static const uint32_t ALLOC_SIZES[8] = { 8, 24, 64, 16, 256, 40, 128, 12 };
+
+static void bench_arena_alloc(void* data, uint32_t iterations)
+{
+    ArenaBench* bench = (ArenaBench*)data;
+    uint64_t sum = 0;
+    for (uint32_t it = 0; it < iterations; it++) {
+        for (uint32_t i = 0; i < ARENA_ALLOCS; i++) {
+            sum += (uintptr_t)arena_allocate(bench->arr, ALLOC_SIZES[i & 7]);
+        }
+        arena_reset(bench->arr);
+    }
+    keep(sum);
+}
+
+static void bench_arena_scratch(void* data, uint32_t iterations)
+{
+    ArenaBench* bench = (ArenaBench*)data;
+    uint64_t sum = 0;
+    for (uint32_t it = 0; it < iterations; it++) {
+        ArenaMark mark = arena_scratch(bench->scratch);
+        for (uint32_t i = 0; i < SCRATCH_ALLOCS; i++) {
+            sum += (uintptr_t)arena_allocate(bench->scratch, SCRATCH_ALLOC_BYTES);
+        }
+        arena_pop_scratch(bench->scratch, mark);
+    }
+    keep(sum);
+}
+
+static bool check_arena()
+{
+    bool ok = true;
+    Arena* arr = create_arena(1024);
+
+    // Allocations are aligned, don't overlap and spill into new regions
+    uint8_t* blocks[256];
+    for (uint32_t i = 0; i < 256; i++) {
+        uint32_t size = ALLOC_SIZES[i & 7];
+        blocks[i] = (uint8_t*)arena_allocate(arr, size);
+        ok &= blocks[i] && (uintptr_t)blocks[i] % sizeof(uintptr_t) == 0;
+        memset(blocks[i], (int)i, size);
+    }
+    for (uint32_t i = 0; i < 256 && ok; i++) {
+        for (uint32_t b = 0; b < ALLOC_SIZES[i & 7]; b++) {
+            ok &= blocks[i][b] == (uint8_t)i;
+        }
+    }
+    ok &= arr->start != arr->end;
+
+    // Reset hands out the same memory again
+    arena_reset(arr);
+    ok &= arena_allocate(arr, ALLOC_SIZES[0]) == blocks[0];
+
+    // Popping a scratch that spilled into later regions rewinds all of them
+    ArenaMark mark = arena_scratch(arr);
+    void* first = arena_allocate(arr, 64);
+    for (uint32_t i = 0; i < 64; i++) {
+        arena_allocate(arr, 512);
+    }
+    Region* spilled = arr->end;
+    arena_pop_scratch(arr, mark);
+    ok &= arr->end == mark.reg && mark.reg->data_count == mark.count;
+    ok &= spilled != mark.reg && spilled->data_count == 0;
+    ok &= arena_allocate(arr, 64) == first;
+
+    arena_free(arr);
+    if (!ok) {
+        printf("arena: check failed\n");
+    }
+    return ok;
+}
+
+// ===========================================
+// ------------------CHUNKS-------------------
+// ===========================================
+
+struct ChunkBench {
+    ChunkPool pool;
+    Chunk* chunks[WORLD_CHUNKS];
+
+    uint8_t* palette[WORLD_CHUNKS]; // palette_encode output per chunk
+    uint32_t palette_size[WORLD_CHUNKS];
+    uint8_t* payload[WORLD_CHUNKS]; // chunk_encode output per chunk
+    uint32_t payload_size[WORLD_CHUNKS];
+    uint64_t palette_bytes; // all chunks, for the ratio
+    uint64_t payload_bytes;
+
+    uint8_t* out; // scratch for the op under test
+    uint8_t* scratch;
+    BlockID* blocks;
+    uint32_t out_capacity;
+
+    Arena* mesh_arena;
+    const Chunk* neighbors[WORLD_CHUNKS][FACE_COUNT];
+    uint32_t mesh_chunks[WORLD_CHUNKS]; // ones with every horizontal neighbour
+    uint32_t num_mesh_chunks;
+};
+
+static Chunk* chunk_at(ChunkBench* bench, int32_t x, int32_t y, int32_t z)
+{
+    if (x < 0 || y < 0 || z < 0 || x >= WORLD_COLUMNS || y >= WORLD_LAYERS || z >= WORLD_COLUMNS) {
+        return nullptr;
+    }
+    return bench->chunks[(y * WORLD_COLUMNS + z) * WORLD_COLUMNS + x];
+}
+
+static void init_chunks(Arena* arr, ChunkBench* bench)
+{
+    chunk_pool_init(arr, &bench->pool, WORLD_CHUNKS);
+    for (int32_t y = 0; y < WORLD_LAYERS; y++) {
+        for (int32_t z = 0; z < WORLD_COLUMNS; z++) {
+            for (int32_t x = 0; x < WORLD_COLUMNS; x++) {
+                Chunk* chunk = chunk_pool_acquire(&bench->pool);
+                chunk->pos = { x, y, z };
+                generate_chunk(BENCH_SEED, chunk);
+                memset(chunk->light, LIGHT_FULL, CHUNK_VOLUME);
+                chunk->light_state = CHUNK_LIGHT_DONE;
+                chunk->state.store(CHUNK_STATE_READY, std::memory_order_relaxed);
+                bench->chunks[(y * WORLD_COLUMNS + z) * WORLD_COLUMNS + x] = chunk;
+            }
+        }
+    }
+
+    static const int32_t FACE_STEP[FACE_COUNT][3] = { { 1, 0, 0 }, { -1, 0, 0 }, { 0, 1, 0 }, { 0, -1, 0 }, { 0, 0, 1 }, { 0, 0, -1 } };
+    for (uint32_t i = 0; i < WORLD_CHUNKS; i++) {
+        ChunkPos pos = bench->chunks[i]->pos;
+        for (uint32_t f = 0; f < FACE_COUNT; f++) {
+            bench->neighbors[i][f] = chunk_at(bench, pos.x + FACE_STEP[f][0], pos.y + FACE_STEP[f][1], pos.z + FACE_STEP[f][2]);
+        }
+        bool inner = pos.x > 0 && pos.z > 0 && pos.x < WORLD_COLUMNS - 1 && pos.z < WORLD_COLUMNS - 1;
+        if (inner) {
+            bench->mesh_chunks[bench->num_mesh_chunks++] = i;
+        }
+    }
+
+    bench->out_capacity = CHUNK_PAYLOAD_MAX_BYTES > PALETTE_MAX_BYTES ? CHUNK_PAYLOAD_MAX_BYTES : PALETTE_MAX_BYTES;
+    bench->out = (uint8_t*)arena_allocate(arr, bench->out_capacity);
+    bench->scratch = (uint8_t*)arena_allocate(arr, CHUNK_CODEC_SCRATCH_BYTES);
+    bench->blocks = (BlockID*)arena_allocate(arr, CHUNK_VOLUME * sizeof(BlockID));
+    for (uint32_t i = 0; i < WORLD_CHUNKS; i++) {
+        bench->palette_size[i] = palette_encode(bench->chunks[i]->blocks, bench->out, PALETTE_MAX_BYTES);
+        bench->palette[i] = (uint8_t*)arena_allocate(arr, bench->palette_size[i]);
+        memcpy(bench->palette[i], bench->out, bench->palette_size[i]);
+        bench->palette_bytes += bench->palette_size[i];
+
+        bench->payload_size[i] = chunk_encode(bench->chunks[i]->blocks, bench->out, CHUNK_PAYLOAD_MAX_BYTES, bench->scratch);
+        bench->payload[i] = (uint8_t*)arena_allocate(arr, bench->payload_size[i]);
+        memcpy(bench->payload[i], bench->out, bench->payload_size[i]);
+        bench->payload_bytes += bench->payload_size[i];
+    }
+
+    bench->mesh_arena = create_arena(24 * 1024 * 1024);
+}
+
+static void bench_palette_encode(void* data, uint32_t iterations)
+{
+    ChunkBench* bench = (ChunkBench*)data;
+    uint64_t sum = 0;
+    for (uint32_t it = 0; it < iterations; it++) {
+        for (uint32_t i = 0; i < WORLD_CHUNKS; i++) {
+            sum += palette_encode(bench->chunks[i]->blocks, bench->out, PALETTE_MAX_BYTES);
+        }
+    }
+    keep(sum);
+}
+
+static void bench_palette_decode(void* data, uint32_t iterations)
+{
+    ChunkBench* bench = (ChunkBench*)data;
+    uint64_t sum = 0;
+    for (uint32_t it = 0; it < iterations; it++) {
+        for (uint32_t i = 0; i < WORLD_CHUNKS; i++) {
+            sum += palette_decode(bench->palette[i], bench->palette_size[i], bench->blocks);
+        }
+    }
+    keep(sum + bench->blocks[0]);
+}
+
+static void bench_lz_compress(void* data, uint32_t iterations)
+{
+    ChunkBench* bench = (ChunkBench*)data;
+    uint64_t sum = 0;
+    for (uint32_t it = 0; it < iterations; it++) {
+        for (uint32_t i = 0; i < WORLD_CHUNKS; i++) {
+            sum += lz_compress(bench->palette[i], bench->palette_size[i], bench->out, bench->out_capacity);
+        }
+    }
+    keep(sum);
+}
+
+static void bench_payload_encode(void* data, uint32_t iterations)
+{
+    ChunkBench* bench = (ChunkBench*)data;
+    uint64_t sum = 0;
+    for (uint32_t it = 0; it < iterations; it++) {
+        for (uint32_t i = 0; i < WORLD_CHUNKS; i++) {
+            sum += chunk_encode(bench->chunks[i]->blocks, bench->out, CHUNK_PAYLOAD_MAX_BYTES, bench->scratch);
+        }
+    }
+    keep(sum);
+}
+
+static void bench_payload_decode(void* data, uint32_t iterations)
+{
+    ChunkBench* bench = (ChunkBench*)data;
+    uint64_t sum = 0;
+    for (uint32_t it = 0; it < iterations; it++) {
+        for (uint32_t i = 0; i < WORLD_CHUNKS; i++) {
+            sum += chunk_decode(bench->payload[i], bench->payload_size[i], bench->blocks, bench->scratch);
+        }
+    }
+    keep(sum + bench->blocks[0]);
+}
+
+static void bench_mesh_chunk(void* data, uint32_t iterations)
+{
+    ChunkBench* bench = (ChunkBench*)data;
+    uint64_t sum = 0;
+    for (uint32_t it = 0; it < iterations; it++) {
+        for (uint32_t m = 0; m < bench->num_mesh_chunks; m++) {
+            uint32_t i = bench->mesh_chunks[m];
+            ArenaMark mark = arena_scratch(bench->mesh_arena);
+            ChunkMesh mesh {};
+            mesh_chunk(bench->mesh_arena, bench->chunks[i], bench->neighbors[i], 0, &mesh);
+            sum += mesh.num_quads;
+            arena_pop_scratch(bench->mesh_arena, mark);
+        }
+    }
+    keep(sum);
+}
+
+static void bench_generate_chunk(void* data, uint32_t iterations)
+{
+    ChunkBench* bench = (ChunkBench*)data;
+    Chunk* chunk = bench->chunks[0]; // regenerated in place, same seed and position
+    for (uint32_t it = 0; it < iterations; it++) {
+        generate_chunk(BENCH_SEED, chunk);
+    }
+    keep(chunk->blocks[0]);
+}
+
+static bool check_codecs(ChunkBench* bench)
+{
+    bool ok = true;
+    for (uint32_t i = 0; i < WORLD_CHUNKS; i++) {
+        const BlockID* blocks = bench->chunks[i]->blocks;
+        bool palette_ok = palette_decode(bench->palette[i], bench->palette_size[i], bench->blocks)
+            && memcmp(blocks, bench->blocks, CHUNK_VOLUME * sizeof(BlockID)) == 0;
+        bool payload_ok = bench->payload_size[i] > 0 && chunk_decode(bench->payload[i], bench->payload_size[i], bench->blocks, bench->scratch)
+            && memcmp(blocks, bench->blocks, CHUNK_VOLUME * sizeof(BlockID)) == 0;
+
+        uint32_t compressed = lz_compress(bench->palette[i], bench->palette_size[i], bench->out, bench->out_capacity);
+        bool lz_ok = compressed > 0 && lz_decompress(bench->out, compressed, bench->scratch, CHUNK_CODEC_SCRATCH_BYTES) == bench->palette_size[i]
+            && memcmp(bench->scratch, bench->palette[i], bench->palette_size[i]) == 0;
+
+        if (!palette_ok || !payload_ok || !lz_ok) {
+            printf("codecs: chunk %u round trip failed (palette %d, payload %d, lz %d)\n", i, palette_ok, payload_ok, lz_ok);
+            ok = false;
+        }
+    }
+
+    // Random blocks don't compress but round trip. More unique ids than a palette holds falls
+    // back to raw, which only ids past BLOCK_COUNT can reach, and those are refused on decode.
+    BlockID* noisy = (BlockID*)bench->scratch;
+    uint32_t state = 12345;
+    for (uint32_t i = 0; i < CHUNK_VOLUME; i++) {
+        state = state * 1664525u + 1013904223u;
+        noisy[i] = (BlockID)(state >> 16);
+    }
+    uint8_t* payload = (uint8_t*)malloc(CHUNK_PAYLOAD_MAX_BYTES);
+    uint8_t* codec_scratch = (uint8_t*)malloc(CHUNK_CODEC_SCRATCH_BYTES);
+    uint32_t size = chunk_encode(noisy, payload, CHUNK_PAYLOAD_MAX_BYTES, codec_scratch);
+    bool raw_ok = size > 0 && !chunk_decode(payload, size, bench->blocks, codec_scratch);
+    for (uint32_t i = 0; i < CHUNK_VOLUME; i++) {
+        noisy[i] %= BLOCK_COUNT;
+    }
+    size = chunk_encode(noisy, payload, CHUNK_PAYLOAD_MAX_BYTES, codec_scratch);
+    bool noisy_ok = size > 0 && chunk_decode(payload, size, bench->blocks, codec_scratch) && memcmp(noisy, bench->blocks, CHUNK_VOLUME * sizeof(BlockID)) == 0;
+    free(payload);
+    free(codec_scratch);
+    if (!raw_ok || !noisy_ok) {
+        printf("codecs: noisy chunk checks failed (unknown ids refused %d, round trip %d)\n", raw_ok, noisy_ok);
+        ok = false;
+    }
+    return ok;
+}
+
+static bool mesh_equal(const ChunkMesh* a, const ChunkMesh* b)
+{
+    return a->num_quads == b->num_quads && memcmp(a->lods, b->lods, sizeof(a->lods)) == 0
+        && memcmp(a->vertices, b->vertices, (size_t)a->num_quads * 4 * sizeof(ChunkVertex)) == 0;
+}
+
+static bool check_mesher(ChunkBench* bench)
+{
+    bool ok = true;
+    uint64_t total_quads = 0;
+    for (uint32_t m = 0; m < bench->num_mesh_chunks; m++) {
+        uint32_t i = bench->mesh_chunks[m];
+        ArenaMark mark = arena_scratch(bench->mesh_arena);
+        ChunkMesh first {};
+        ChunkMesh second {};
+        mesh_chunk(bench->mesh_arena, bench->chunks[i], bench->neighbors[i], 0, &first);
+        mesh_chunk(bench->mesh_arena, bench->chunks[i], bench->neighbors[i], 0, &second);
+        if (!mesh_equal(&first, &second)) {
+            printf("mesher: chunk %u meshes differently twice\n", i);
+            ok = false;
+        }
+        total_quads += first.num_quads;
+        arena_pop_scratch(bench->mesh_arena, mark);
+    }
+    if (total_quads == 0) {
+        printf("mesher: no quads for the whole test area\n");
+        ok = false;
+    }
+    return ok;
+}
+
+// ===========================================
+// ------------------NOISE--------------------
+// ===========================================
+
+static void bench_noise(void* data, uint32_t iterations)
+{
+    float sum = 0.0f;
+    for (uint32_t it = 0; it < iterations; it++) {
+        for (uint32_t i = 0; i < NOISE_SAMPLES; i++) {
+            sum += noise_2d(BENCH_SEED, (float)(i & 63) * 0.37f, (float)(i >> 6) * 0.37f + (float)it);
+        }
+    }
+    keep((uint64_t)(sum * 1000.0f));
+}
+
+static void bench_fbm(void* data, uint32_t iterations)
+{
+    float sum = 0.0f;
+    for (uint32_t it = 0; it < iterations; it++) {
+        for (uint32_t i = 0; i < NOISE_SAMPLES; i++) {
+            sum += fbm_2d(BENCH_SEED, (float)(i & 63) * 0.01f, (float)(i >> 6) * 0.01f + (float)it, 5);
+        }
+    }
+    keep((uint64_t)(sum * 1000.0f));
+}
+
+static void bench_terrain_height(void* data, uint32_t iterations)
+{
+    int64_t sum = 0;
+    for (uint32_t it = 0; it < iterations; it++) {
+        for (uint32_t i = 0; i < NOISE_SAMPLES; i++) {
+            sum += terrain_height(BENCH_SEED, (int32_t)(i & 63), (int32_t)(i >> 6) + (int32_t)it * 64);
+        }
+    }
+    keep((uint64_t)sum);
+}
+
+static bool check_noise()
+{
+    bool ok = true;
+    for (uint32_t i = 0; i < 100000 && ok; i++) {
+        float x = (float)(i % 317) * 0.713f - 100.0f;
+        float z = (float)(i / 317) * 0.529f - 100.0f;
+        float n = noise_2d(BENCH_SEED, x, z);
+        ok &= n >= -1.0f && n <= 1.0f && n == noise_2d(BENCH_SEED, x, z);
+        float f = fbm_2d(BENCH_SEED, x, z, 5);
+        ok &= f >= -1.0f && f <= 1.0f;
+    }
+    if (!ok) {
+        printf("noise: out of range or not deterministic\n");
+    }
+    return ok;
+}
+
+// ===========================================
+// -----------------PHYSICS-------------------
+// ===========================================
+
+// Queries run against a World holding the same generated area as the chunk cases, the batches on
+// a job system of their own. Queries are deterministic, every op runs the same ones.
+struct PhysicsBench {
+    JobSystem* jobs;
+    World* world;
+    PhysicsBatcher* batcher;
+    RayQuery* rays;
+    SweepQuery* sweeps;
+
+    SpatialHash* hash;
+    Aabb* boxes;
+    Vec3* velocities;
+    uint32_t* found;
+};
+
+static const Vec3 BODY_HALF_SIZE = { 0.3f, 0.9f, 0.3f };
+
+static float random_float(uint32_t* state, float lo, float hi)
+{
+    *state = *state * 1664525u + 1013904223u;
+    return lo + (hi - lo) * (float)(*state >> 8) / (float)(1u << 24);
+}
+
+static void init_physics(Arena* arr, PhysicsBench* bench)
+{
+    bench->jobs = JobSystem::Create(arr);
+    bench->world = World::Create(arr, bench->jobs, nullptr, nullptr, BENCH_SEED, WORLD_CHUNKS);
+    for (int32_t y = 0; y < WORLD_LAYERS; y++) {
+        for (int32_t z = 0; z < WORLD_COLUMNS; z++) {
+            for (int32_t x = 0; x < WORLD_COLUMNS; x++) {
+                while (!world_request_chunk(bench->world, { x, y, z }, 0.0f)) {
+                    world_update(bench->world);
+                }
+            }
+        }
+    }
+    uint32_t ready = 0;
+    while (ready < WORLD_CHUNKS) {
+        world_update(bench->world);
+        std::this_thread::yield();
+        ready = 0;
+        for (uint32_t i = 0; i < bench->world->pool.capacity; i++) {
+            ready += bench->world->pool.chunks[i].state.load(std::memory_order_acquire) == CHUNK_STATE_READY;
+        }
+    }
+    bench->batcher = PhysicsBatcher::Create(arr, bench->jobs);
+
+    // Rays look down and around from above the ground, bodies start in the air and move about a tick's worth
+    const float side = (float)(WORLD_COLUMNS * CHUNK_SIZE);
+    const float top = (float)(WORLD_LAYERS * CHUNK_SIZE);
+    uint32_t state = 4242;
+    bench->rays = (RayQuery*)arena_allocate(arr, PHYSICS_QUERIES * sizeof(RayQuery));
+    for (uint32_t i = 0; i < PHYSICS_QUERIES; i++) {
+        RayQuery* q = &bench->rays[i];
+        q->origin = { random_float(&state, 8.0f, side - 8.0f), random_float(&state, top * 0.6f, top - 2.0f), random_float(&state, 8.0f, side - 8.0f) };
+        q->dir = normalize({ random_float(&state, -1.0f, 1.0f), random_float(&state, -1.0f, -0.1f), random_float(&state, -1.0f, 1.0f) });
+        q->max_distance = 64.0f;
+    }
+    bench->sweeps = (SweepQuery*)arena_allocate(arr, PHYSICS_QUERIES * sizeof(SweepQuery));
+    for (uint32_t i = 0; i < PHYSICS_QUERIES; i++) {
+        SweepQuery* q = &bench->sweeps[i];
+        do {
+            Vec3 center = { random_float(&state, 8.0f, side - 8.0f), random_float(&state, 8.0f, top - 2.0f), random_float(&state, 8.0f, side - 8.0f) };
+            q->box = { center - BODY_HALF_SIZE, center + BODY_HALF_SIZE };
+        } while (physics_aabb_overlaps_solid(bench->world, q->box));
+        q->delta = { random_float(&state, -0.5f, 0.5f), random_float(&state, -2.0f, 0.5f), random_float(&state, -0.5f, 0.5f) };
+    }
+
+    bench->hash = SpatialHash::Create(arr, PHYSICS_ENTITIES);
+    bench->boxes = (Aabb*)arena_allocate(arr, PHYSICS_ENTITIES * sizeof(Aabb));
+    bench->velocities = (Vec3*)arena_allocate(arr, PHYSICS_ENTITIES * sizeof(Vec3));
+    bench->found = (uint32_t*)arena_allocate(arr, PHYSICS_ENTITIES * sizeof(uint32_t));
+    for (uint32_t i = 0; i < PHYSICS_ENTITIES; i++) {
+        Vec3 center = { random_float(&state, 0.0f, side), random_float(&state, 0.0f, top), random_float(&state, 0.0f, side) };
+        bench->boxes[i] = { center - BODY_HALF_SIZE, center + BODY_HALF_SIZE };
+        bench->velocities[i] = { random_float(&state, -0.4f, 0.4f), random_float(&state, -0.1f, 0.1f), random_float(&state, -0.4f, 0.4f) };
+        spatial_hash_insert(bench->hash, i, bench->boxes[i]);
+    }
+}
+
+static void bench_raycast_batch(void* data, uint32_t iterations)
+{
+    PhysicsBench* bench = (PhysicsBench*)data;
+    uint64_t hits = 0;
+    for (uint32_t it = 0; it < iterations; it++) {
+        physics_raycast_batch(bench->batcher, bench->world, bench->rays, PHYSICS_QUERIES);
+        hits += bench->rays[it % PHYSICS_QUERIES].hit;
+    }
+    keep(hits);
+}
+
+static void bench_sweep_batch(void* data, uint32_t iterations)
+{
+    PhysicsBench* bench = (PhysicsBench*)data;
+    uint64_t grounded = 0;
+    for (uint32_t it = 0; it < iterations; it++) {
+        physics_sweep_batch(bench->batcher, bench->world, bench->sweeps, PHYSICS_QUERIES);
+        grounded += bench->sweeps[it % PHYSICS_QUERIES].result.grounded;
+    }
+    keep(grounded);
+}
+
+// Every entity steps by its velocity, turning around at the edges of the area
+static void bench_spatial_move(void* data, uint32_t iterations)
+{
+    PhysicsBench* bench = (PhysicsBench*)data;
+    const float side = (float)(WORLD_COLUMNS * CHUNK_SIZE);
+    for (uint32_t it = 0; it < iterations; it++) {
+        for (uint32_t i = 0; i < PHYSICS_ENTITIES; i++) {
+            Aabb* box = &bench->boxes[i];
+            Vec3* v = &bench->velocities[i];
+            if (box->min.x + v->x < 0.0f || box->max.x + v->x > side) {
+                v->x = -v->x;
+            }
+            if (box->min.z + v->z < 0.0f || box->max.z + v->z > side) {
+                v->z = -v->z;
+            }
+            *box = { box->min + *v, box->max + *v };
+            spatial_hash_move(bench->hash, i, *box);
+        }
+    }
+    keep(bench->hash->count);
+}
+
+static void bench_spatial_query(void* data, uint32_t iterations)
+{
+    PhysicsBench* bench = (PhysicsBench*)data;
+    uint64_t found = 0;
+    for (uint32_t it = 0; it < iterations; it++) {
+        for (uint32_t i = 0; i < PHYSICS_ENTITIES; i++) {
+            found += spatial_hash_query(bench->hash, bench->boxes[i], bench->found, PHYSICS_ENTITIES);
+        }
+    }
+    keep(found);
+}
+
+static bool same_hit(bool hit_a, const RayHit& a, bool hit_b, const RayHit& b)
+{
+    if (hit_a != hit_b) {
+        return false;
+    }
+    return !hit_a || (a.x == b.x && a.y == b.y && a.z == b.z && a.face == b.face && a.inside == b.inside && a.distance == b.distance);
+}
+
+static bool check_physics(PhysicsBench* bench)
+{
+    bool ok = true;
+    World* world = bench->world;
+    const int32_t top = WORLD_LAYERS * CHUNK_SIZE - 1;
+
+    // Straight down a column: the ray stops on the highest solid block through its top face, a
+    // falling body lands on it
+    uint32_t state = 777;
+    uint32_t columns = 0;
+    for (uint32_t i = 0; i < PHYSICS_CHECK_COLUMNS; i++) {
+        int32_t x = (int32_t)random_float(&state, 1.0f, (float)(WORLD_COLUMNS * CHUNK_SIZE - 1));
+        int32_t z = (int32_t)random_float(&state, 1.0f, (float)(WORLD_COLUMNS * CHUNK_SIZE - 1));
+        int32_t ground = top;
+        while (ground >= 0 && !block_is_solid(world_get_block(world, x, ground, z))) {
+            ground--;
+        }
+        if (ground < 0 || ground > top - 3) {
+            continue; // no ground, or no room above it for a body
+        }
+        columns++;
+
+        Vec3 origin = { x + 0.5f, top + 0.5f, z + 0.5f };
+        RayHit hit;
+        bool ray_ok = physics_raycast(world, origin, { 0.0f, -1.0f, 0.0f }, (float)top + 1.0f, &hit) && hit.x == x && hit.y == ground
+            && hit.z == z && hit.face == FACE_POS_Y && !hit.inside && fabsf(hit.distance - (origin.y - (ground + 1))) < 1e-3f;
+
+        Aabb body = { { x + 0.2f, (float)top - 1.8f, z + 0.2f }, { x + 0.8f, (float)top, z + 0.8f } };
+        SweepResult fall = physics_sweep_aabb(world, body, { 0.0f, -(float)top, 0.0f });
+        bool sweep_ok = fall.grounded && fall.blocked == 2 && fabsf(body.min.y + fall.moved.y - (ground + 1)) < 1e-3f;
+        if (!ray_ok || !sweep_ok) {
+            printf("physics: column (%d, %d) ground %d, ray %d, sweep %d\n", x, z, ground, ray_ok, sweep_ok);
+            ok = false;
+        }
+    }
+    if (columns == 0) {
+        printf("physics: no column to check\n");
+        ok = false;
+    }
+
+    // Sideways into a placed block, through its -x face
+    int32_t bx = WORLD_COLUMNS * CHUNK_SIZE / 2;
+    int32_t by = top - 1;
+    int32_t bz = bx;
+    BlockID old = world_get_block(world, bx, by, bz);
+    world_set_block(world, bx, by, bz, BLOCK_STONE);
+    RayHit side;
+    bool side_ok = physics_raycast(world, { bx - 3.5f, by + 0.5f, bz + 0.5f }, { 1.0f, 0.0f, 0.0f }, 8.0f, &side) && side.x == bx && side.y == by
+        && side.z == bz && side.face == FACE_NEG_X && fabsf(side.distance - 3.5f) < 1e-3f;
+    world_set_block(world, bx, by, bz, old);
+    if (!side_ok) {
+        printf("physics: sideways ray missed the placed block\n");
+        ok = false;
+    }
+
+    // Batches answer exactly what the single queries do
+    physics_raycast_batch(bench->batcher, world, bench->rays, PHYSICS_QUERIES);
+    physics_sweep_batch(bench->batcher, world, bench->sweeps, PHYSICS_QUERIES);
+    uint32_t mismatches = 0;
+    for (uint32_t i = 0; i < PHYSICS_QUERIES; i++) {
+        const RayQuery* r = &bench->rays[i];
+        RayHit hit;
+        bool got = physics_raycast(world, r->origin, r->dir, r->max_distance, &hit);
+        mismatches += !same_hit(got, hit, r->hit, r->result);
+
+        const SweepQuery* q = &bench->sweeps[i];
+        SweepResult single = physics_sweep_aabb(world, q->box, q->delta);
+        mismatches += memcmp(&single.moved, &q->result.moved, sizeof(Vec3)) != 0 || single.blocked != q->result.blocked
+            || single.grounded != q->result.grounded;
+    }
+    if (mismatches > 0) {
+        printf("physics: %u batched queries differ from single ones\n", mismatches);
+        ok = false;
+    }
+
+    // The hash finds exactly the overlapping boxes, also after moves
+    bench_spatial_move(bench, 3);
+    for (uint32_t i = 0; i < PHYSICS_ENTITIES; i += 97) {
+        uint32_t found = spatial_hash_query(bench->hash, bench->boxes[i], bench->found, PHYSICS_ENTITIES);
+        uint32_t expected = 0;
+        for (uint32_t j = 0; j < PHYSICS_ENTITIES; j++) {
+            expected += aabb_overlaps(bench->boxes[i], bench->boxes[j]);
+        }
+        if (found != expected) {
+            printf("physics: entity %u overlaps %u boxes, the hash found %u\n", i, expected, found);
+            ok = false;
+        }
+    }
+    return ok;
+}
+
+// ===========================================
+// -------------------MAIN--------------------
+// ===========================================
+
+int main(int argc, char** argv)
+{
+    uint32_t samples = BENCH_DEFAULT_SAMPLES;
+    const char* filter = nullptr;
+    const char* json_path = nullptr;
+    for (int i = 1; i + 1 < argc; i += 2) {
+        if (strcmp(argv[i], "--samples") == 0) {
+            samples = (uint32_t)std::min(std::max(atoi(argv[i + 1]), 2), BENCH_MAX_SAMPLES);
+        } else if (strcmp(argv[i], "--filter") == 0) {
+            filter = argv[i + 1];
+        } else if (strcmp(argv[i], "--json") == 0) {
+            json_path = argv[i + 1];
+        } else {
+            printf("Unknown option %s\n", argv[i]);
+            return 1;
+        }
+    }
+
+    Arena* arr = create_arena(16 MB);
+
+    ArenaBench arena_bench {};
+    arena_bench.arr = create_arena(4 * 1024);
+    arena_bench.scratch = create_arena(SCRATCH_REGION_BYTES);
+
+    ChunkBench* chunk_bench = (ChunkBench*)arena_allocate(arr, sizeof(ChunkBench));
+    memset(chunk_bench, 0, sizeof(*chunk_bench));
+    init_chunks(arr, chunk_bench);
+
+    PhysicsBench* physics_bench = (PhysicsBench*)arena_allocate(arr, sizeof(PhysicsBench));
+    memset(physics_bench, 0, sizeof(*physics_bench));
+    init_physics(arr, physics_bench);
+
+    bool ok = check_arena();
+    ok &= check_codecs(chunk_bench);
+    ok &= check_mesher(chunk_bench);
+    ok &= check_noise();
+    ok &= check_physics(physics_bench);
+    if (!ok) {
+        printf("Correctness checks failed, not timing anything\n");
+        return 1;
+    }
+    printf("Palette %.1f KB per chunk, payload %.1f KB per chunk (%.1fx smaller than raw)\n\n",
+        chunk_bench->palette_bytes / 1024.0 / WORLD_CHUNKS, chunk_bench->payload_bytes / 1024.0 / WORLD_CHUNKS,
+        (double)CHUNK_VOLUME * sizeof(BlockID) * WORLD_CHUNKS / chunk_bench->payload_bytes);
+
+    const BenchCase cases[] = {
+        { "arena_alloc_reset", bench_arena_alloc, &arena_bench, ARENA_ALLOCS, "allocs" },
+        { "arena_scratch_pop", bench_arena_scratch, &arena_bench, SCRATCH_ALLOCS, "allocs" },
+        { "palette_encode", bench_palette_encode, chunk_bench, WORLD_CHUNKS * CHUNK_VOLUME, "blocks" },
+        { "palette_decode", bench_palette_decode, chunk_bench, WORLD_CHUNKS * CHUNK_VOLUME, "blocks" },
+        { "lz_compress_palette", bench_lz_compress, chunk_bench, WORLD_CHUNKS * CHUNK_VOLUME, "blocks" },
+        { "payload_encode", bench_payload_encode, chunk_bench, WORLD_CHUNKS * CHUNK_VOLUME, "blocks" },
+        { "payload_decode", bench_payload_decode, chunk_bench, WORLD_CHUNKS * CHUNK_VOLUME, "blocks" },
+        { "mesh_chunk", bench_mesh_chunk, chunk_bench, chunk_bench->num_mesh_chunks, "chunks" },
+        { "generate_chunk", bench_generate_chunk, chunk_bench, 1, "chunks" },
+        { "noise_2d", bench_noise, nullptr, NOISE_SAMPLES, "samples" },
+        { "fbm_2d_5_octaves", bench_fbm, nullptr, NOISE_SAMPLES, "samples" },
+        { "terrain_height", bench_terrain_height, nullptr, NOISE_SAMPLES, "samples" },
+        { "raycast_batch", bench_raycast_batch, physics_bench, PHYSICS_QUERIES, "rays" },
+        { "sweep_batch", bench_sweep_batch, physics_bench, PHYSICS_QUERIES, "sweeps" },
+        { "spatial_hash_move", bench_spatial_move, physics_bench, PHYSICS_ENTITIES, "moves" },
+        { "spatial_hash_query", bench_spatial_query, physics_bench, PHYSICS_ENTITIES, "queries" },
+    };
+    uint32_t num_cases = sizeof(cases) / sizeof(cases[0]);
+
+    FILE* json = nullptr;
+    if (json_path) {
+        json = fopen(json_path, "w");
+        if (!json) {
+            printf("Failed to open %s for writing\n", json_path);
+            return 1;
+        }
+        fprintf(json, "{\n  \"samples\": %u,\n  \"cases\": [", samples);
+    }
+
+    printf("%-22s %10s %12s %20s %12s %7s %18s\n", "case", "iters", "median ns", "mean +- 95% ns", "min ns", "mad", "throughput / s");
+    bool first = true;
+    for (uint32_t c = 0; c < num_cases; c++) {
+        const BenchCase* bench = &cases[c];
+        if (filter && !strstr(bench->name, filter)) {
+            continue;
+        }
+        BenchStats stats = run_case(bench, samples);
+        double per_second = stats.median > 0.0 ? bench->items * 1e9 / stats.median : 0.0;
+        printf("%-22s %10u %12.1f %12.1f +- %-6.1f %12.1f %6.1f%% %10.4g %s%s\n", bench->name, stats.iterations, stats.median, stats.mean,
+            stats.ci95, stats.min, stats.mad * 100.0, per_second, bench->item_unit, stats.mad > BENCH_NOISY_MAD ? " (noisy)" : "");
+        if (json) {
+            fprintf(json, "%s\n    { \"name\": \"%s\", \"iterations\": %u, \"median_ns\": %.3f, \"mean_ns\": %.3f, \"ci95_ns\": %.3f, \"min_ns\": %.3f, \"mad\": %.4f, \"%s_per_second\": %.1f }",
+                first ? "" : ",", bench->name, stats.iterations, stats.median, stats.mean, stats.ci95, stats.min, stats.mad, bench->item_unit, per_second);
+        }
+        first = false;
+    }
+
+    if (json) {
+        fprintf(json, "\n  ]\n}\n");
+        fclose(json);
+    }
+
+    job_system_destroy(physics_bench->jobs);
+    arena_free(chunk_bench->mesh_arena);
+    arena_free(arena_bench.arr);
+    arena_free(arena_bench.scratch);
+    arena_free(arr);
+    return 0;
+}
@@ -0,0 +1,425 @@
+#include "camera.hpp"
+#include "cpu_raymarcher.hpp"
+#include "light.hpp"
+#include "memory.hpp"
+#include "profiler.hpp"
+#include "streaming.hpp"
+#include "trace.hpp"
+#include "world.hpp"
+#include <Arena.h>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <sys/resource.h>
+
+// Headless benchmark: a fixed seed world streamed, lit and meshed around a camera that flies a
+// spline at a fixed time step, with the CPU ray marcher standing in for the GPU. Nothing is read
+// from or written to disk, so every run does the same work. Results go out as JSON.
+//
+// VoxelBench [--path FILE] [--frames N] [--radius CHUNKS] [--width W --height H] [--no-raymarch]
+//            [--trace FILE] [--out FILE]
+//
+// FILE paths hold one keyframe per line, "x y z yaw pitch", the engine appends the current
+// camera to camera_path.txt on K.
+
+#define BENCH_SEED 1337
+#define BENCH_MIN_CHUNK_Y 0
+#define BENCH_MAX_CHUNK_Y 3
+#define BENCH_MEMORY_BUDGET (768ull * 1024 * 1024)
+#define BENCH_DT (1.0f / 60.0f) // seconds of camera path per frame
+#define BENCH_KEY_SECONDS 2.0f // between keyframes
+#define BENCH_MAX_KEYS 1024
+#define BENCH_LOAD_TIMEOUT 120.0 // seconds, for the initial load
+#define BENCH_SETTLE_FRAMES 8 // frames without any streaming work before the load counts as done
+#define BENCH_MAX_MESHES 65536
+
+struct CameraKey {
+    Vec3 position;
+    float yaw;
+    float pitch;
+};
+
+// A short lap over the hills at about 50 blocks per second, turning and looking around. Kept
+// short, with the defaults below a run takes a bit over a minute on one core.
+static const CameraKey DEFAULT_PATH[] = {
+    { { 0.0f, 100.0f, 0.0f }, 0.0f, -0.3f },
+    { { 0.0f, 100.0f, -90.0f }, 0.0f, -0.3f },
+    { { 70.0f, 95.0f, -160.0f }, 0.9f, -0.2f },
+    { { 160.0f, 100.0f, -110.0f }, 2.2f, -0.4f },
+    { { 110.0f, 100.0f, -10.0f }, 3.6f, -0.2f },
+    { { 0.0f, 100.0f, 0.0f }, 6.28f, -0.3f },
+};
+
+struct CameraPath {
+    CameraKey keys[BENCH_MAX_KEYS];
+    uint32_t num_keys;
+};
+
+// Meshes only get counted, there is no GPU to put them on
+struct MeshSink {
+    uint32_t sizes[BENCH_MAX_MESHES];
+    uint32_t free_list[BENCH_MAX_MESHES];
+    uint32_t num_free;
+    uint64_t bytes;
+    uint64_t peak_bytes;
+    uint64_t uploads;
+    uint64_t uploaded_bytes;
+    uint64_t patches;
+};
+
+struct BenchOptions {
+    const char* path;
+    const char* out;
+    const char* trace;
+    uint32_t frames; // 0 = the length of the path
+    int32_t radius;
+    uint32_t width;
+    uint32_t height;
+    bool raymarch;
+};
+
+static uint32_t sink_upload(void* user, ChunkPos pos, const ChunkMesh* mesh)
+{
+    MeshSink* sink = (MeshSink*)user;
+    if (sink->num_free == 0) {
+        return MESH_HANDLE_NONE;
+    }
+    uint32_t handle = sink->free_list[--sink->num_free];
+    uint32_t size = mesh->num_quads * 4 * sizeof(ChunkVertex);
+    sink->sizes[handle] = size;
+    sink->bytes += size;
+    sink->peak_bytes = std::max(sink->peak_bytes, sink->bytes);
+    sink->uploads++;
+    sink->uploaded_bytes += size;
+    return handle;
+}
+
+static void sink_release(void* user, uint32_t handle)
+{
+    MeshSink* sink = (MeshSink*)user;
+    sink->bytes -= sink->sizes[handle];
+    sink->free_list[sink->num_free++] = handle;
+}
+
+// The resident size stays, only the rebuilt sections go up
+static bool sink_patch(void* user, uint32_t handle, const ChunkMesh* mesh)
+{
+    MeshSink* sink = (MeshSink*)user;
+    uint32_t size = 0;
+    for (uint32_t i = 0; i < MESH_SECTIONS; i++) {
+        if (mesh_section_patched(mesh, i)) {
+            size += mesh->sections[i].capacity * 4 * sizeof(ChunkVertex);
+        }
+    }
+    sink->patches++;
+    sink->uploaded_bytes += size;
+    return true;
+}
+
+static bool load_path(const char* file_path, CameraPath* path)
+{
+    FILE* file = fopen(file_path, "r");
+    if (!file) {
+        printf("Failed to open camera path %s\n", file_path);
+        return false;
+    }
+    path->num_keys = 0;
+    char line[256];
+    while (fgets(line, sizeof(line), file) && path->num_keys < BENCH_MAX_KEYS) {
+        CameraKey key;
+        if (sscanf(line, "%f %f %f %f %f", &key.position.x, &key.position.y, &key.position.z, &key.yaw, &key.pitch) == 5) {
+            path->keys[path->num_keys++] = key;
+        }
+    }
+    fclose(file);
+    if (path->num_keys < 2) {
+        printf("Camera path %s needs at least 2 keyframes\n", file_path);
+        return false;
+    }
+    return true;
+}
+
+static float catmull_rom(float p0, float p1, float p2, float p3, float t)
+{
+    float t2 = t * t;
+    float t3 = t2 * t;
+    return 0.5f * (2.0f * p1 + (p2 - p0) * t + (2.0f * p0 - 5.0f * p1 + 4.0f * p2 - p3) * t2 + (3.0f * p1 - p0 - 3.0f * p2 + p3) * t3);
+}
+
+// Camera at time seconds, the spline passes through every keyframe
+static void sample_path(const CameraPath* path, float time, Camera* camera)
+{
+    float u = std::min(time / BENCH_KEY_SECONDS, (float)(path->num_keys - 1));
+    uint32_t i = std::min((uint32_t)u, path->num_keys - 2);
+    float t = u - (float)i;
+
+    const CameraKey* k0 = &path->keys[i > 0 ? i - 1 : 0];
+    const CameraKey* k1 = &path->keys[i];
+    const CameraKey* k2 = &path->keys[i + 1];
+    const CameraKey* k3 = &path->keys[std::min(i + 2, path->num_keys - 1)];
+
+    camera->position.x = catmull_rom(k0->position.x, k1->position.x, k2->position.x, k3->position.x, t);
+    camera->position.y = catmull_rom(k0->position.y, k1->position.y, k2->position.y, k3->position.y, t);
+    camera->position.z = catmull_rom(k0->position.z, k1->position.z, k2->position.z, k3->position.z, t);
+    camera->yaw = catmull_rom(k0->yaw, k1->yaw, k2->yaw, k3->yaw, t);
+    camera->pitch = catmull_rom(k0->pitch, k1->pitch, k2->pitch, k3->pitch, t);
+}
+
+static bool stream_busy(const StreamManager* stream, const MeshSink* sink, uint64_t uploads_before)
+{
+    return stream->pending_loads > 0 || stream->mesh_jobs > 0 || sink->uploads != uploads_before;
+}
+
+static double seconds_since(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Nearest rank, values gets sorted
+static float percentile(float* values, uint32_t count, float p)
+{
+    if (count == 0) {
+        return 0.0f;
+    }
+    std::sort(values, values + count);
+    uint32_t rank = (uint32_t)ceilf(p * (float)count);
+    return values[std::min(std::max(rank, 1u), count) - 1];
+}
+
+static void write_distribution(FILE* out, const char* name, float* values, uint32_t count, bool last)
+{
+    double sum = 0.0;
+    for (uint32_t i = 0; i < count; i++) {
+        sum += values[i];
+    }
+    double mean = count ? sum / count : 0.0;
+    float p50 = percentile(values, count, 0.50f);
+    float p95 = percentile(values, count, 0.95f);
+    float p99 = percentile(values, count, 0.99f);
+    float max = count ? values[count - 1] : 0.0f;
+    fprintf(out, "    \"%s\": { \"mean\": %.3f, \"p50\": %.3f, \"p95\": %.3f, \"p99\": %.3f, \"max\": %.3f }%s\n",
+        name, mean, p50, p95, p99, max, last ? "" : ",");
+}
+
+static bool parse_options(int argc, char** argv, BenchOptions* options)
+{
+    *options = {};
+    options->radius = 8;
+    options->width = 240;
+    options->height = 135;
+    options->raymarch = true;
+
+    for (int i = 1; i < argc; i++) {
+        const char* arg = argv[i];
+        const char* value = i + 1 < argc ? argv[i + 1] : nullptr;
+        if (strcmp(arg, "--no-raymarch") == 0) {
+            options->raymarch = false;
+            continue;
+        }
+        if (!value) {
+            printf("Unknown or incomplete option %s\n", arg);
+            return false;
+        }
+        if (strcmp(arg, "--path") == 0) {
+            options->path = value;
+        } else if (strcmp(arg, "--out") == 0) {
+            options->out = value;
+        } else if (strcmp(arg, "--trace") == 0) {
+            options->trace = value;
+        } else if (strcmp(arg, "--frames") == 0) {
+            options->frames = (uint32_t)atoi(value);
+        } else if (strcmp(arg, "--radius") == 0) {
+            options->radius = atoi(value);
+        } else if (strcmp(arg, "--width") == 0) {
+            options->width = (uint32_t)atoi(value);
+        } else if (strcmp(arg, "--height") == 0) {
+            options->height = (uint32_t)atoi(value);
+        } else {
+            printf("Unknown option %s\n", arg);
+            return false;
+        }
+        i++;
+    }
+    if (options->radius <= 0 || options->width == 0 || options->height == 0) {
+        printf("Radius and image size must be positive\n");
+        return false;
+    }
+    return true;
+}
+
+int main(int argc, char** argv)
+{
+    BenchOptions options;
+    if (!parse_options(argc, argv, &options)) {
+        return 1;
+    }
+
+    Arena* arr = create_arena(10 MB);
+    Arena* world_arena = create_arena_tagged(10 MB, MEM_CHUNKS);
+
+    CameraPath* path = (CameraPath*)arena_allocate(arr, sizeof(CameraPath));
+    if (options.path) {
+        if (!load_path(options.path, path)) {
+            return 1;
+        }
+    } else {
+        path->num_keys = sizeof(DEFAULT_PATH) / sizeof(DEFAULT_PATH[0]);
+        memcpy(path->keys, DEFAULT_PATH, sizeof(DEFAULT_PATH));
+    }
+    uint32_t num_frames = options.frames;
+    if (num_frames == 0) {
+        num_frames = (uint32_t)((path->num_keys - 1) * BENCH_KEY_SECONDS / BENCH_DT) + 1;
+    }
+
+    Tracer* tracer = Tracer::Create(arr);
+    trace_name_thread("main");
+
+    JobSystem* jobs = JobSystem::Create(arr);
+    uint32_t max_chunks = BENCH_MEMORY_BUDGET / sizeof(Chunk);
+    LightEngine* light = LightEngine::Create(world_arena, jobs, max_chunks, BENCH_MIN_CHUNK_Y, BENCH_MAX_CHUNK_Y);
+    World* world = World::Create(world_arena, jobs, nullptr, light, BENCH_SEED, max_chunks);
+
+    MeshSink* sink = (MeshSink*)arena_allocate(arr, sizeof(MeshSink));
+    memset(sink, 0, sizeof(*sink));
+    for (uint32_t i = 0; i < BENCH_MAX_MESHES; i++) {
+        sink->free_list[sink->num_free++] = BENCH_MAX_MESHES - 1 - i;
+    }
+
+    StreamConfig stream_config {};
+    stream_config.radius = options.radius;
+    stream_config.min_chunk_y = BENCH_MIN_CHUNK_Y;
+    stream_config.max_chunk_y = BENCH_MAX_CHUNK_Y;
+    stream_config.memory_budget = BENCH_MEMORY_BUDGET;
+    stream_config.max_pending_loads = 64;
+    stream_config.max_mesh_jobs = 32;
+    stream_config.max_uploads_per_frame = 32;
+    StreamManager* stream = StreamManager::Create(arr, world, jobs, stream_config, { sink, sink_upload, sink_release, sink_patch });
+
+    CpuRaymarchConfig raymarch_config {};
+    raymarch_config.max_distance = (float)(options.radius * CHUNK_SIZE);
+    raymarch_config.min_chunk_y = BENCH_MIN_CHUNK_Y;
+    raymarch_config.max_chunk_y = BENCH_MAX_CHUNK_Y;
+    CpuRaymarcher* raymarcher = CpuRaymarcher::Create(arr, jobs, options.width, options.height, raymarch_config);
+
+    Profiler* profiler = Profiler::Create(arr);
+    Camera camera = camera_create({}, (float)options.width / (float)options.height);
+    sample_path(path, 0.0f, &camera);
+
+    if (options.trace) {
+        trace_start(tracer);
+    }
+
+    // Initial load: stream in everything around the start of the path, then let it settle
+    uint64_t stream_peak = 0;
+    auto load_start = std::chrono::steady_clock::now();
+    uint32_t idle_frames = 0;
+    while (idle_frames < BENCH_SETTLE_FRAMES && seconds_since(load_start) < BENCH_LOAD_TIMEOUT) {
+        uint64_t uploads_before = sink->uploads;
+        world_update(world);
+        streaming_update(stream, &camera);
+        stream_peak = std::max(stream_peak, streaming_memory_used(stream));
+        idle_frames = stream_busy(stream, sink, uploads_before) ? 0 : idle_frames + 1;
+    }
+    double load_seconds = seconds_since(load_start);
+    uint64_t load_chunks = stream->chunks_loaded;
+    uint64_t load_meshes = sink->uploads;
+    if (idle_frames < BENCH_SETTLE_FRAMES) {
+        printf("Initial load didn't settle within %.0f s\n", BENCH_LOAD_TIMEOUT);
+    }
+
+    // Playback, one path step per frame however long the frame took
+    FrameStats* frames = (FrameStats*)arena_allocate(arr, num_frames * sizeof(FrameStats));
+    uint64_t chunks_before_run = stream->chunks_loaded;
+    uint64_t uploads_before_run = sink->uploads;
+    uint64_t uploaded_bytes_before_run = sink->uploaded_bytes;
+    auto run_start = std::chrono::steady_clock::now();
+    for (uint32_t f = 0; f < num_frames; f++) {
+        sample_path(path, (float)f * BENCH_DT, &camera);
+
+        profiler_begin_frame(profiler);
+        profiler_begin(profiler, CPU_SCOPE_FRAME);
+
+        profiler_begin(profiler, CPU_SCOPE_WORLD);
+        world_update(world);
+        profiler_end(profiler, CPU_SCOPE_WORLD);
+
+        profiler_begin(profiler, CPU_SCOPE_STREAMING);
+        streaming_update(stream, &camera);
+        profiler_end(profiler, CPU_SCOPE_STREAMING);
+
+        if (options.raymarch) {
+            profiler_begin(profiler, CPU_SCOPE_RAYMARCH);
+            cpu_raymarch(raymarcher, world, &camera, options.width, options.height);
+            profiler_end(profiler, CPU_SCOPE_RAYMARCH);
+        }
+
+        profiler_end(profiler, CPU_SCOPE_FRAME);
+        frames[f] = profiler->frames[profiler->frame % PROFILER_HISTORY];
+        stream_peak = std::max(stream_peak, streaming_memory_used(stream));
+    }
+    double run_seconds = seconds_since(run_start);
+    uint64_t run_chunks = stream->chunks_loaded - chunks_before_run;
+    uint64_t run_meshes = sink->uploads - uploads_before_run;
+    uint64_t run_mesh_bytes = sink->uploaded_bytes - uploaded_bytes_before_run;
+
+    if (options.trace) {
+        trace_stop(tracer);
+        trace_dump_json(tracer, options.trace);
+    }
+
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    uint64_t rss_peak = (uint64_t)usage.ru_maxrss * 1024;
+
+    FILE* out = stdout;
+    if (options.out) {
+        out = fopen(options.out, "w");
+        if (!out) {
+            printf("Failed to open %s for writing\n", options.out);
+            return 1;
+        }
+    }
+
+    float* values = (float*)arena_allocate(arr, num_frames * sizeof(float));
+    fprintf(out, "{\n");
+    fprintf(out, "  \"config\": { \"seed\": %u, \"radius\": %d, \"frames\": %u, \"keyframes\": %u, \"workers\": %u, \"raymarch\": %s, \"width\": %u, \"height\": %u },\n",
+        BENCH_SEED, options.radius, num_frames, path->num_keys, jobs->num_workers, options.raymarch ? "true" : "false", options.width, options.height);
+    fprintf(out, "  \"load\": { \"seconds\": %.3f, \"chunks\": %llu, \"chunks_per_second\": %.1f, \"meshes\": %llu, \"settled\": %s },\n",
+        load_seconds, (unsigned long long)load_chunks, load_chunks / std::max(load_seconds, 1e-9), (unsigned long long)load_meshes,
+        idle_frames >= BENCH_SETTLE_FRAMES ? "true" : "false");
+    fprintf(out, "  \"playback\": { \"seconds\": %.3f, \"chunks\": %llu, \"chunks_per_second\": %.1f, \"meshes\": %llu, \"mesh_bytes\": %llu, \"patches\": %llu },\n",
+        run_seconds, (unsigned long long)run_chunks, run_chunks / std::max(run_seconds, 1e-9), (unsigned long long)run_meshes,
+        (unsigned long long)run_mesh_bytes, (unsigned long long)sink->patches);
+
+    static const CpuScope scopes[] = { CPU_SCOPE_FRAME, CPU_SCOPE_WORLD, CPU_SCOPE_STREAMING, CPU_SCOPE_RAYMARCH };
+    uint32_t num_scopes = options.raymarch ? 4 : 3;
+    fprintf(out, "  \"cpu_ms\": {\n");
+    for (uint32_t s = 0; s < num_scopes; s++) {
+        for (uint32_t f = 0; f < num_frames; f++) {
+            values[f] = frames[f].cpu_ms[scopes[s]];
+        }
+        write_distribution(out, profiler_scope_name(scopes[s]), values, num_frames, s + 1 == num_scopes);
+    }
+    fprintf(out, "  },\n");
+
+    fprintf(out, "  \"memory\": { \"stream_peak_bytes\": %llu, \"mesh_peak_bytes\": %llu, \"rss_peak_bytes\": %llu, \"cpu_tag_peak_bytes\": {",
+        (unsigned long long)stream_peak, (unsigned long long)sink->peak_bytes, (unsigned long long)rss_peak);
+    for (uint32_t t = 0; t < MEM_TAG_COUNT; t++) {
+        fprintf(out, "%s \"%s\": %llu", t ? "," : "", memory_tag_name((MemTag)t), (unsigned long long)memory_peak(MEM_CPU, (MemTag)t));
+    }
+    fprintf(out, " } }\n");
+    fprintf(out, "}\n");
+    if (out != stdout) {
+        fclose(out);
+    }
+
+    streaming_destroy(stream);
+    light_destroy(light, world);
+    job_system_destroy(jobs);
+    arena_free(world_arena);
+    arena_free(arr);
+    return 0;
+}
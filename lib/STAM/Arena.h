@@ -21,6 +21,7 @@ typedef struct Region {
 typedef struct Arena {
     Region* start;
     Region* end;
+    uint32_t tag; // user defined, passed on to arena_region_hook
 } Arena;
 
 typedef struct ArenaMark {
@@ -43,6 +44,12 @@ void print_arena(Arena* arena);
 ArenaMark arena_scratch(Arena* arena);
 void arena_pop_scratch(Arena* arena, ArenaMark m);
 
+Arena* create_arena_tagged(uint32_t size_bytes, uint32_t tag);
+
+// Optional, told about every region an arena mallocs (bytes > 0) or frees (bytes < 0)
+typedef void (*ArenaRegionHook)(const Arena* arena, int64_t bytes);
+extern ArenaRegionHook arena_region_hook;
+
 #ifdef ARENA_CPP
 
 struct ArenaCPP {
@@ -80,6 +87,15 @@ private:
 
 #ifdef ARENA_IMPLEMENTATION
 
+ArenaRegionHook arena_region_hook = NULL;
+
+static inline void arena_notify(const Arena* arena, Region* reg, int64_t sign)
+{
+    if (arena_region_hook && reg) {
+        arena_region_hook(arena, sign * (int64_t)(sizeof(Region) + reg->capacity * sizeof(uintptr_t)));
+    }
+}
+
 Region* create_region(uint32_t size_bytes)
 {
     size_t size = ALIGN_SIZE(size_bytes);
@@ -133,14 +149,21 @@ void print_region(Region* reg)
 }
 
 Arena* create_arena(uint32_t size_bytes)
+{
+    return create_arena_tagged(size_bytes, 0);
+};
+
+Arena* create_arena_tagged(uint32_t size_bytes, uint32_t tag)
 {
     Arena* arena = (Arena*)malloc(sizeof(Arena));
 
     arena->start = create_region(size_bytes);
     arena->end = arena->start;
+    arena->tag = tag;
+    arena_notify(arena, arena->start, 1);
 
     return arena;
-};
+}
 
 void* arena_allocate(Arena* arena, uint32_t size_bytes)
 {
@@ -150,8 +173,9 @@ void* arena_allocate(Arena* arena, uint32_t size_bytes)
 
     while (curr->capacity - curr->data_count < size) {
         if (curr->next == NULL) {
-            uint32_t new_size = curr->capacity;
-            if (size > curr->capacity) {
+            // Grow by the first region's size, an oversized region shouldn't set the size of the next ones
+            uint32_t new_size = arena->start->capacity;
+            if (size > new_size) {
                 new_size = size;
             }
             curr->next = create_region(new_size * sizeof(uintptr_t));
@@ -159,6 +183,7 @@ void* arena_allocate(Arena* arena, uint32_t size_bytes)
                 printf("Failed to allocate new region for arena\n");
                 return NULL;
             }
+            arena_notify(arena, curr->next, 1);
         }
         curr = curr->next;
     }
@@ -168,7 +193,7 @@ void* arena_allocate(Arena* arena, uint32_t size_bytes)
 
 ArenaMark arena_scratch(Arena* arena)
 {
-    ArenaMark mark;
+    ArenaMark mark = { NULL, 0 };
     if (arena->end == NULL) {
         printf("Tried to make a scrach arena for an uninitialized arena");
         return mark;
@@ -188,6 +213,7 @@ void arena_pop_scratch(Arena* arena, ArenaMark m)
     Region* curr = m.reg->next;
     while (curr) {
         curr->data_count = 0;
+        curr = curr->next;
     }
     arena->end = m.reg;
 }
@@ -207,6 +233,7 @@ void arena_free(Arena* arena)
     Region* curr = arena->start;
     while (curr) {
         Region* tmp = curr->next;
+        arena_notify(arena, curr, -1);
         region_free(curr);
         curr = tmp;
     }
@@ -0,0 +1,414 @@
+#include "jobs.hpp"
+#include "memory.hpp"
+#include "replication.hpp"
+#include "server.hpp"
+#include "trace.hpp"
+#include "world_io.hpp"
+#include <Arena.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cerrno>
+#include <cmath>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+
+// Dedicated server: hosts many worlds in one process, no window and no GPU. Every world gets
+// its own arena and memory budget (see server.hpp), they all share one job system and one IO
+// context, and the main thread ticks them one after another at a fixed rate, sleeping for
+// whatever is left of the tick. Stops on SIGINT / SIGTERM, or after --ticks, and saves on the way out.
+//
+// VoxelServer [--worlds N] [--radius CHUNKS] [--budget MB] [--dir DIR | --no-save] [--seed S]
+//             [--workers N] [--ticks N] [--bots N]
+//
+// World i lives in DIR/world_i with seed S + i. --bots connects N replication clients to every
+// world over a loopback transport, each watching the spawn, to see what joining and edits cost
+// on the wire. Bots also walk around like players would: their bodies fall and slide through one
+// batched sweep per world and tick, and now and then they aim at a block with a batched raycast
+// and break it or build on it.
+
+#define SERVER_TICK_HZ 20
+#define SERVER_MIN_CHUNK_Y 0
+#define SERVER_MAX_CHUNK_Y 3
+#define SERVER_AUTOSAVE_SECONDS 60
+#define SERVER_STATS_SECONDS 10
+#define SERVER_MAX_WORLDS 4096
+#define SERVER_MAX_BOTS 64
+#define BOT_EDIT_TICKS (2 * SERVER_TICK_HZ) // on average between a bot's edits
+#define BOT_TURN_TICKS (3 * SERVER_TICK_HZ) // on average between changes of direction
+#define BOT_SPEED 4.0f // blocks per second
+#define BOT_GRAVITY 28.0f
+#define BOT_REACH 5.0f
+
+struct ServerOptions {
+    uint32_t worlds;
+    int32_t radius;
+    uint64_t budget; // bytes per world
+    const char* dir; // null = --no-save
+    uint64_t seed;
+    uint32_t workers; // 0 = one per core
+    uint64_t ticks; // 0 = until stopped
+    uint32_t bots; // per world
+};
+
+struct Bot {
+    ReplicaClient* client;
+    ChunkPos center;
+    int32_t radius;
+    Vec3 position; // feet
+    Vec3 velocity;
+};
+
+// Per tick, for the bots of one world
+struct BotQueries {
+    SweepQuery* sweeps;
+    RayQuery* rays;
+    uint32_t* movers; // bot of each sweep
+    uint32_t* editors; // bot of each ray
+};
+
+static const Vec3 BOT_HALF_SIZE = { 0.3f, 0.9f, 0.3f };
+
+static std::atomic<bool> stop_requested { false };
+
+static void handle_stop(int)
+{
+    stop_requested.store(true, std::memory_order_relaxed);
+}
+
+static bool parse_options(int argc, char** argv, ServerOptions* options)
+{
+    *options = {};
+    options->worlds = 1;
+    options->radius = 4;
+    options->budget = 64ull * 1024 * 1024;
+    options->dir = "worlds";
+    options->seed = 1337;
+
+    for (int i = 1; i < argc; i++) {
+        const char* arg = argv[i];
+        const char* value = i + 1 < argc ? argv[i + 1] : nullptr;
+        if (strcmp(arg, "--no-save") == 0) {
+            options->dir = nullptr;
+            continue;
+        }
+        if (!value) {
+            printf("Unknown or incomplete option %s\n", arg);
+            return false;
+        }
+        if (strcmp(arg, "--worlds") == 0) {
+            options->worlds = (uint32_t)atoi(value);
+        } else if (strcmp(arg, "--radius") == 0) {
+            options->radius = atoi(value);
+        } else if (strcmp(arg, "--budget") == 0) {
+            options->budget = (uint64_t)atoll(value) * 1024 * 1024;
+        } else if (strcmp(arg, "--dir") == 0) {
+            options->dir = value;
+        } else if (strcmp(arg, "--seed") == 0) {
+            options->seed = (uint64_t)atoll(value);
+        } else if (strcmp(arg, "--workers") == 0) {
+            options->workers = (uint32_t)atoi(value);
+        } else if (strcmp(arg, "--ticks") == 0) {
+            options->ticks = (uint64_t)atoll(value);
+        } else if (strcmp(arg, "--bots") == 0) {
+            options->bots = (uint32_t)atoi(value);
+        } else {
+            printf("Unknown option %s\n", arg);
+            return false;
+        }
+        i++;
+    }
+    if (options->worlds == 0 || options->worlds > SERVER_MAX_WORLDS || options->radius <= 0) {
+        printf("Worlds must be 1 - %u and the radius positive\n", SERVER_MAX_WORLDS);
+        return false;
+    }
+    if (options->bots > SERVER_MAX_BOTS) {
+        printf("At most %u bots per world\n", SERVER_MAX_BOTS);
+        return false;
+    }
+    if (options->budget < sizeof(Chunk) * 64) {
+        printf("Budget must be at least %llu MB\n", (unsigned long long)(sizeof(Chunk) * 64 / (1024 * 1024) + 1));
+        return false;
+    }
+    return true;
+}
+
+// Resident set of the whole process, ru_maxrss only has the peak
+static uint64_t current_rss()
+{
+    FILE* file = fopen("/proc/self/statm", "r");
+    if (!file) {
+        return 0;
+    }
+    unsigned long long size = 0, resident = 0;
+    if (fscanf(file, "%llu %llu", &size, &resident) != 2) {
+        resident = 0;
+    }
+    fclose(file);
+    return resident * (uint64_t)sysconf(_SC_PAGESIZE);
+}
+
+static double cpu_seconds()
+{
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_utime.tv_sec + usage.ru_utime.tv_usec * 1e-6 + usage.ru_stime.tv_sec + usage.ru_stime.tv_usec * 1e-6;
+}
+
+static float random_unit()
+{
+    return (float)rand() / (float)RAND_MAX * 2.0f - 1.0f;
+}
+
+static Aabb bot_box(const Bot* bot)
+{
+    Vec3 center = bot->position + Vec3 { 0.0f, BOT_HALF_SIZE.y, 0.0f };
+    return { center - BOT_HALF_SIZE, center + BOT_HALF_SIZE };
+}
+
+// Wanders inside what the bot sees, turning back toward the middle when it gets to the edge
+static void bot_steer(Bot* bot)
+{
+    float edge = (bot->radius * 0.8f + 0.5f) * CHUNK_SIZE;
+    float dx = bot->position.x - (bot->center.x + 0.5f) * CHUNK_SIZE;
+    float dz = bot->position.z - (bot->center.z + 0.5f) * CHUNK_SIZE;
+    if (fabsf(dx) > edge || fabsf(dz) > edge) {
+        Vec3 back = normalize({ -dx, 0.0f, -dz });
+        bot->velocity.x = back.x * BOT_SPEED;
+        bot->velocity.z = back.z * BOT_SPEED;
+    } else if (rand() % BOT_TURN_TICKS == 0) {
+        float angle = (float)rand() / (float)RAND_MAX * 6.2831853f;
+        bot->velocity.x = cosf(angle) * BOT_SPEED;
+        bot->velocity.z = sinf(angle) * BOT_SPEED;
+    }
+}
+
+// Bots of one world, right after its server_world_update. The queries run from this thread
+// before the next update, so nothing changes the world under them (see physics.hpp).
+static void bots_update(ServerWorld* instance, Bot* bots, uint32_t count, BotQueries* queries)
+{
+    const float dt = 1.0f / SERVER_TICK_HZ;
+    World* world = instance->world;
+
+    uint32_t num_sweeps = 0;
+    uint32_t num_rays = 0;
+    for (uint32_t b = 0; b < count; b++) {
+        Bot* bot = &bots[b];
+        replica_client_update(bot->client);
+
+        // Until the ground under it is loaded the bot stays put, it would fall through
+        Aabb box = bot_box(bot);
+        Aabb reach = { box.min - Vec3 { 1.0f, 2.0f, 1.0f }, box.max + Vec3 { 1.0f, 1.0f, 1.0f } };
+        if (!physics_region_loaded(world, reach, SERVER_MIN_CHUNK_Y, SERVER_MAX_CHUNK_Y)) {
+            continue;
+        }
+        bot_steer(bot);
+        bot->velocity.y -= BOT_GRAVITY * dt;
+        queries->sweeps[num_sweeps] = { box, bot->velocity * dt, {} };
+        queries->movers[num_sweeps++] = b;
+
+        if (rand() % BOT_EDIT_TICKS == 0) {
+            Vec3 eye = bot->position + Vec3 { 0.0f, 1.6f, 0.0f };
+            Vec3 dir = normalize({ random_unit(), random_unit() - 0.5f, random_unit() });
+            queries->rays[num_rays] = { eye, dir, BOT_REACH, false, {} };
+            queries->editors[num_rays++] = b;
+        }
+    }
+
+    physics_sweep_batch(instance->physics, world, queries->sweeps, num_sweeps);
+    for (uint32_t i = 0; i < num_sweeps; i++) {
+        Bot* bot = &bots[queries->movers[i]];
+        const SweepResult& r = queries->sweeps[i].result;
+        bot->position = bot->position + r.moved;
+        if (r.blocked & 2) {
+            bot->velocity.y = 0.0f;
+        }
+        if (r.blocked & 5) {
+            bot->velocity.x = -bot->velocity.x; // walked into a wall, back off
+            bot->velocity.z = -bot->velocity.z;
+        }
+        if (bot->position.y < SERVER_MIN_CHUNK_Y * CHUNK_SIZE) {
+            bot->position = instance->config.spawn; // dug through the bottom of the world
+            bot->velocity = {};
+        }
+    }
+
+    // Breaks what it looks at or builds on the face it sees, half and half
+    physics_raycast_batch(instance->physics, world, queries->rays, num_rays);
+    for (uint32_t i = 0; i < num_rays; i++) {
+        const RayQuery* q = &queries->rays[i];
+        if (!q->hit || q->result.inside) {
+            continue;
+        }
+        const RayHit& hit = q->result;
+        Bot* bot = &bots[queries->editors[i]];
+        if (rand() % 2 == 0) {
+            replica_client_send_edit(bot->client, hit.x, hit.y, hit.z, BLOCK_AIR);
+            continue;
+        }
+        int32_t x = hit.x + FACE_NORMALS[hit.face][0];
+        int32_t y = hit.y + FACE_NORMALS[hit.face][1];
+        int32_t z = hit.z + FACE_NORMALS[hit.face][2];
+        Aabb block = { { (float)x, (float)y, (float)z }, { x + 1.0f, y + 1.0f, z + 1.0f } };
+        if (!aabb_overlaps(block, bot_box(bot))) {
+            replica_client_send_edit(bot->client, x, y, z, (BlockID)(1 + rand() % (BLOCK_COUNT - 1)));
+        }
+    }
+}
+
+static void print_replication_stats(ServerWorld** worlds, uint32_t num_worlds, uint32_t bots)
+{
+    uint64_t joined = 0, join_ticks = 0, chunks = 0, chunk_bytes = 0, edits = 0, edit_bytes = 0, resends = 0;
+    for (uint32_t i = 0; i < num_worlds; i++) {
+        ReplicaServer* replica = worlds[i]->replica;
+        for (uint32_t c = 0; c < bots; c++) {
+            const ReplicaConnection* conn = &replica->connections[c];
+            if (conn->joined_tick) {
+                joined++;
+                join_ticks += conn->joined_tick - conn->connected_tick;
+            }
+            chunks += conn->chunks_sent;
+            chunk_bytes += conn->chunk_bytes;
+            edits += conn->edits_sent;
+            edit_bytes += conn->edit_bytes;
+            resends += conn->resends;
+        }
+    }
+    printf("  bots joined %llu / %llu in %.2f s on average | %llu chunks at %.0f B | %llu edits at %.1f B | %llu resent\n",
+        (unsigned long long)joined, (unsigned long long)num_worlds * bots, joined ? (double)join_ticks / joined / SERVER_TICK_HZ : 0.0,
+        (unsigned long long)chunks, chunks ? (double)chunk_bytes / chunks : 0.0,
+        (unsigned long long)edits, edits ? (double)edit_bytes / edits : 0.0, (unsigned long long)resends);
+}
+
+static void print_stats(ServerWorld** worlds, uint32_t num_worlds, double wall_seconds, double cpu_used)
+{
+    uint64_t chunks = 0, arena_bytes = 0, tick_us = 0;
+    uint32_t peak_us = 0;
+    for (uint32_t i = 0; i < num_worlds; i++) {
+        chunks += worlds[i]->world->chunks.count;
+        arena_bytes += server_world_arena_bytes(worlds[i]);
+        tick_us += worlds[i]->tick_us;
+        peak_us = std::max(peak_us, worlds[i]->peak_tick_us);
+        worlds[i]->peak_tick_us = 0;
+    }
+    uint64_t rss = current_rss();
+    printf("%u worlds | %llu chunks | rss %.1f MB (%.2f per world) | arenas %.1f MB | tick %.2f ms per world (peak %.2f) | cpu %.1f%%\n",
+        num_worlds, (unsigned long long)chunks, rss / (1024.0 * 1024.0), rss / (1024.0 * 1024.0) / num_worlds,
+        arena_bytes / (1024.0 * 1024.0), tick_us / 1000.0 / num_worlds, peak_us / 1000.0, 100.0 * cpu_used / std::max(wall_seconds, 1e-9));
+}
+
+int main(int argc, char** argv)
+{
+    ServerOptions options;
+    if (!parse_options(argc, argv, &options)) {
+        return 1;
+    }
+
+    std::signal(SIGINT, handle_stop);
+    std::signal(SIGTERM, handle_stop);
+
+    Arena* arr = create_arena(1 MB);
+    trace_name_thread("main");
+
+    JobSystem* jobs = JobSystem::Create(arr, options.workers);
+    IOContext* io = IOContext::Create(arr);
+
+    if (options.dir && mkdir(options.dir, 0755) != 0 && errno != EEXIST) {
+        printf("Failed to create %s: %s\n", options.dir, strerror(errno));
+        return 1;
+    }
+
+    ServerWorld** worlds = (ServerWorld**)arena_allocate(arr, options.worlds * sizeof(ServerWorld*));
+    Bot* bots = (Bot*)arena_allocate(arr, options.worlds * options.bots * sizeof(Bot));
+    BotQueries bot_queries {};
+    bot_queries.sweeps = (SweepQuery*)arena_allocate(arr, options.bots * sizeof(SweepQuery));
+    bot_queries.rays = (RayQuery*)arena_allocate(arr, options.bots * sizeof(RayQuery));
+    bot_queries.movers = (uint32_t*)arena_allocate(arr, options.bots * sizeof(uint32_t));
+    bot_queries.editors = (uint32_t*)arena_allocate(arr, options.bots * sizeof(uint32_t));
+    char dir[256];
+    for (uint32_t i = 0; i < options.worlds; i++) {
+        snprintf(dir, sizeof(dir), "%s/world_%u", options.dir ? options.dir : "", i);
+        ServerWorldConfig config {};
+        config.dir = options.dir ? dir : nullptr;
+        config.seed = options.seed + i;
+        config.memory_budget = options.budget;
+        config.radius = options.radius;
+        config.min_chunk_y = SERVER_MIN_CHUNK_Y;
+        config.max_chunk_y = SERVER_MAX_CHUNK_Y;
+        config.spawn = { 0.0f, 100.0f, 0.0f };
+        config.autosave_ticks = SERVER_AUTOSAVE_SECONDS * SERVER_TICK_HZ;
+        config.autosave_offset = i % config.autosave_ticks;
+
+        LoopbackTransport* loopback = nullptr;
+        if (options.bots > 0) {
+            loopback = LoopbackTransport::Create(arr, options.bots);
+            config.max_connections = options.bots;
+            config.transport = loopback_server_transport(loopback);
+        }
+        worlds[i] = ServerWorld::Create(jobs, io, config);
+
+        // Streaming loads a circle, the bots' square views stay inside it
+        for (uint32_t b = 0; b < options.bots; b++) {
+            Bot* bot = &bots[i * options.bots + b];
+            bot->client = ReplicaClient::Create(arr, loopback_client_transport(loopback), b, {});
+            bot->center = chunk_pos_from_block((int32_t)config.spawn.x, (int32_t)config.spawn.y, (int32_t)config.spawn.z);
+            bot->radius = std::max(1, (int32_t)(options.radius * 0.7f));
+            bot->position = config.spawn + Vec3 { random_unit() * 8.0f, 0.0f, random_unit() * 8.0f };
+            bot->velocity = {};
+            replica_connect(worlds[i]->replica, b);
+            replica_client_send_view(bot->client, bot->center, bot->radius);
+        }
+    }
+    printf("Hosting %u worlds, radius %d, %llu MB each, %u workers\n", options.worlds, options.radius,
+        (unsigned long long)(options.budget / (1024 * 1024)), jobs->num_workers);
+
+    auto tick_length = std::chrono::nanoseconds(1000000000 / SERVER_TICK_HZ);
+    auto next_tick = std::chrono::steady_clock::now();
+    auto stats_start = next_tick;
+    double stats_cpu = cpu_seconds();
+    uint64_t tick = 0;
+    while (!stop_requested.load(std::memory_order_relaxed) && (options.ticks == 0 || tick < options.ticks)) {
+        for (uint32_t i = 0; i < options.worlds; i++) {
+            server_world_update(worlds[i]);
+            if (options.bots > 0) {
+                bots_update(worlds[i], &bots[i * options.bots], options.bots, &bot_queries);
+            }
+        }
+        tick++;
+
+        auto now = std::chrono::steady_clock::now();
+        double wall = std::chrono::duration<double>(now - stats_start).count();
+        if (wall >= SERVER_STATS_SECONDS) {
+            double cpu = cpu_seconds();
+            print_stats(worlds, options.worlds, wall, cpu - stats_cpu);
+            if (options.bots > 0) {
+                print_replication_stats(worlds, options.worlds, options.bots);
+            }
+            stats_start = now;
+            stats_cpu = cpu;
+        }
+
+        // A late tick starts the next one right away, ticks that didn't fit at all are dropped
+        next_tick += tick_length;
+        if (next_tick < now) {
+            next_tick = now;
+        }
+        std::this_thread::sleep_until(next_tick);
+    }
+
+    printf("Saving %u worlds\n", options.worlds);
+    for (uint32_t i = 0; i < options.worlds; i++) {
+        server_world_destroy(worlds[i]);
+    }
+    io_destroy(io);
+    job_system_destroy(jobs);
+    memory_print();
+    arena_free(arr);
+    return 0;
+}
@@ -0,0 +1,14 @@
+#version 450
+
+layout(set = 0, binding = 0) uniform sampler2DArray blockTextures;
+
+layout(location = 0) in vec4 fragColor;
+layout(location = 1) in vec2 fragUV;
+layout(location = 2) flat in uint fragLayer;
+
+layout(location = 0) out vec4 outColor;
+
+void main() {
+    vec3 albedo = texture(blockTextures, vec3(fragUV, float(fragLayer))).rgb;
+    outColor = vec4(albedo * fragColor.rgb, 1.0);
+}
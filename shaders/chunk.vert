@@ -0,0 +1,39 @@
+#version 450
+
+layout(push_constant) uniform PushConstants {
+    mat4 view_proj;
+} pc;
+
+// Min corner of every draw's chunk in world space, indexed by the draw's first instance
+layout(std430, set = 1, binding = 0) readonly buffer Origins {
+    vec4 origins[];
+};
+
+layout(location = 0) in uint inPacked; // x | y << 6 | z << 12 | face << 18 | layer << 21
+layout(location = 1) in vec4 inColor;
+
+layout(location = 0) out vec4 fragColor;
+layout(location = 1) out vec2 fragUV;
+layout(location = 2) flat out uint fragLayer;
+
+// Same depth as chunk_depth.vert, the equal test after the pre-pass depends on it
+invariant gl_Position;
+
+void main() {
+    vec3 local = vec3(inPacked & 63u, (inPacked >> 6) & 63u, (inPacked >> 12) & 63u);
+    vec3 position = origins[gl_InstanceIndex].xyz + local;
+    gl_Position = pc.view_proj * vec4(position, 1.0);
+    fragColor = inColor;
+
+    // One texture repeat per block, straight from the world position. Side faces run v down
+    // from the top of the block so textures stay upright.
+    uint face = (inPacked >> 18) & 7u;
+    if (face < 2u) {
+        fragUV = vec2(position.z, -position.y);
+    } else if (face < 4u) {
+        fragUV = position.xz;
+    } else {
+        fragUV = vec2(position.x, -position.y);
+    }
+    fragLayer = inPacked >> 21;
+}
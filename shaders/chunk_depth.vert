@@ -0,0 +1,20 @@
+#version 450
+
+// Depth pre-pass, has to land on exactly the depth chunk.vert writes
+layout(push_constant) uniform PushConstants {
+    mat4 view_proj;
+} pc;
+
+layout(std430, set = 1, binding = 0) readonly buffer Origins {
+    vec4 origins[];
+};
+
+layout(location = 0) in uint inPacked;
+
+invariant gl_Position;
+
+void main() {
+    vec3 local = vec3(inPacked & 63u, (inPacked >> 6) & 63u, (inPacked >> 12) & 63u);
+    vec3 position = origins[gl_InstanceIndex].xyz + local;
+    gl_Position = pc.view_proj * vec4(position, 1.0);
+}
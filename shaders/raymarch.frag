@@ -0,0 +1,118 @@
+#version 450
+
+// Must match brickmap.hpp
+#define CHUNK_SIZE 32
+#define BRICK_SIZE 8
+#define BRICKS_PER_AXIS (CHUNK_SIZE / BRICK_SIZE)
+#define BRICK_WORDS (BRICK_SIZE * BRICK_SIZE * BRICK_SIZE / 4)
+#define WINDOW_XZ 64
+#define WINDOW_Y 8
+#define REF_EMPTY 0xffffffffu
+#define REF_UNIFORM 0x80000000u
+
+#define MAX_STEPS 512
+
+layout(push_constant) uniform PushConstants {
+    vec4 position;
+    vec4 forward;
+    vec4 right;
+    vec4 up;
+    ivec4 origin;
+} pc;
+
+layout(std430, set = 0, binding = 0) readonly buffer Grid { uint grid[]; };
+layout(std430, set = 0, binding = 1) readonly buffer Nodes { uint nodes[]; };
+layout(std430, set = 0, binding = 2) readonly buffer Voxels { uint voxels[]; };
+
+layout(location = 0) in vec2 ndc;
+
+layout(location = 0) out vec4 outColor;
+
+// Same as the mesher
+const vec3 BLOCK_COLORS[7] = vec3[](
+    vec3(0.0),
+    vec3(0x80, 0x80, 0x80) / 255.0,
+    vec3(0x86, 0x5a, 0x2b) / 255.0,
+    vec3(0x4a, 0xa0, 0x3a) / 255.0,
+    vec3(0xdc, 0xc8, 0x88) / 255.0,
+    vec3(0x30, 0x80, 0xd0) / 255.0,
+    vec3(0xf0, 0xd0, 0x60) / 255.0
+);
+const vec3 FACE_SHADE = vec3(0.8, 1.0, 0.65); // x, +y, z. -y is 0.5
+const vec3 SKY = vec3(0.53, 0.72, 0.92);
+
+uint slot_of(ivec3 chunk) {
+    ivec3 s = chunk & ivec3(WINDOW_XZ - 1, WINDOW_Y - 1, WINDOW_XZ - 1);
+    return uint((s.y * WINDOW_XZ + s.z) * WINDOW_XZ + s.x);
+}
+
+// Block at voxel v. When it is air, cell is the size of the empty cell around v that can be
+// skipped in one step.
+uint lookup(ivec3 v, out int cell) {
+    cell = CHUNK_SIZE;
+    uint ref = grid[slot_of(v >> 5)];
+    if (ref == REF_EMPTY) {
+        return 0;
+    }
+    if ((ref & REF_UNIFORM) != 0) {
+        return ref & 0xffff;
+    }
+
+    ivec3 local = v & (CHUNK_SIZE - 1);
+    ivec3 b = local / BRICK_SIZE;
+    cell = BRICK_SIZE;
+    uint brick = nodes[ref * 64 + (b.y * BRICKS_PER_AXIS + b.z) * BRICKS_PER_AXIS + b.x];
+    if (brick == REF_EMPTY) {
+        return 0;
+    }
+    if ((brick & REF_UNIFORM) != 0) {
+        return brick & 0xffff;
+    }
+
+    ivec3 l = local & (BRICK_SIZE - 1);
+    uint i = uint((l.y * BRICK_SIZE + l.z) * BRICK_SIZE + l.x);
+    cell = 1;
+    return (voxels[brick * BRICK_WORDS + i / 4] >> ((i % 4) * 8)) & 0xff;
+}
+
+void main() {
+    vec3 ro = pc.position.xyz;
+    // Vulkan's y points down the screen
+    vec3 rd = normalize(pc.forward.xyz + ndc.x * pc.right.xyz - ndc.y * pc.up.xyz);
+    vec3 inv = 1.0 / rd;
+
+    // Clip to the window
+    vec3 box_min = vec3(pc.origin.xyz * CHUNK_SIZE);
+    vec3 box_max = box_min + vec3(WINDOW_XZ, WINDOW_Y, WINDOW_XZ) * CHUNK_SIZE;
+    vec3 t0 = (box_min - ro) * inv;
+    vec3 t1 = (box_max - ro) * inv;
+    vec3 t_near = min(t0, t1);
+    vec3 t_far = max(t0, t1);
+    float t_enter = max(max(t_near.x, t_near.y), t_near.z);
+    float t_exit = min(min(t_far.x, t_far.y), t_far.z);
+
+    vec3 color = SKY;
+    float t = max(t_enter, 0.0);
+    int axis = t_near.x == t_enter ? 0 : (t_near.y == t_enter ? 1 : 2);
+    for (int i = 0; i < MAX_STEPS && t < t_exit; i++) {
+        // Nudged past the boundary just crossed, so floor lands in the next cell
+        vec3 p = ro + rd * (t + 1e-3 + t * 1e-5);
+        ivec3 v = ivec3(floor(p));
+        int cell;
+        uint block = lookup(v, cell);
+        if (block != 0) {
+            block = block > 6u ? 5u : block; // flowing water looks like water
+            float shade = axis == 1 ? (rd.y < 0.0 ? FACE_SHADE.y : 0.5) : FACE_SHADE[axis];
+            color = mix(BLOCK_COLORS[block] * shade, SKY, clamp(t / (WINDOW_XZ * CHUNK_SIZE * 0.5), 0.0, 1.0));
+            break;
+        }
+
+        // Step to where the ray leaves the empty cell
+        vec3 cell_min = vec3(v & ~(cell - 1));
+        vec3 tm = (cell_min + step(0.0, rd) * float(cell) - ro) * inv;
+        t = min(min(tm.x, tm.y), tm.z);
+        axis = tm.x == t ? 0 : (tm.y == t ? 1 : 2);
+    }
+
+    outColor = vec4(color, 1.0);
+}
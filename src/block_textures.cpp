@@ -0,0 +1,128 @@
+#include "block_textures.hpp"
+#include <cstdio>
+#include <cstring>
+
+#define TEXTURE_PACK_MAX_BYTES (1ull << 31) // arena allocations are 32 bit
+
+struct PackHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t size;
+    uint32_t layers;
+    uint32_t mips; // always the full chain, stored in order after the header
+};
+
+TexturePack* TexturePack::Create(Arena* arr, uint32_t size, uint32_t layers)
+{
+    TexturePack* pack = (TexturePack*)arena_allocate(arr, sizeof(TexturePack));
+    memset(pack, 0, sizeof(*pack));
+    pack->size = size;
+    pack->layers = layers;
+    while ((size >> pack->mips) > 0 && pack->mips < TEXTURE_MAX_MIPS) {
+        pack->mip_offsets[pack->mips] = pack->bytes;
+        pack->bytes += texture_mip_bytes(pack, pack->mips);
+        pack->mips++;
+    }
+    pack->pixels = (uint8_t*)arena_allocate(arr, (uint32_t)pack->bytes);
+    return pack;
+}
+
+void texture_pack_build_mips(TexturePack* pack)
+{
+    for (uint32_t mip = 1; mip < pack->mips; mip++) {
+        uint32_t size = texture_mip_size(pack, mip);
+        uint32_t src_size = size * 2;
+        for (uint32_t layer = 0; layer < pack->layers; layer++) {
+            const uint8_t* src = texture_pack_pixels(pack, mip - 1, layer);
+            uint8_t* dst = texture_pack_pixels(pack, mip, layer);
+            for (uint32_t y = 0; y < size; y++) {
+                for (uint32_t x = 0; x < size; x++) {
+                    const uint8_t* s = src + ((y * 2) * src_size + x * 2) * 4;
+                    for (uint32_t c = 0; c < 4; c++) {
+                        uint32_t sum = s[c] + s[4 + c] + s[src_size * 4 + c] + s[src_size * 4 + 4 + c];
+                        dst[(y * size + x) * 4 + c] = (uint8_t)((sum + 2) / 4);
+                    }
+                }
+            }
+        }
+    }
+}
+
+static inline uint32_t texel_hash(uint32_t layer, uint32_t x, uint32_t y)
+{
+    uint64_t h = ((uint64_t)layer * 0x9E3779B185EBCA87ULL) ^ ((uint64_t)x * 0xC2B2AE3D27D4EB4FULL) ^ ((uint64_t)y * 0x165667B19E3779F9ULL);
+    h ^= h >> 29;
+    h *= 0xBF58476D1CE4E5B9ULL;
+    h ^= h >> 32;
+    return (uint32_t)h;
+}
+
+// Block the flat color of each texture comes from
+static const BlockID TEXTURE_BLOCKS[TEX_COUNT] = { BLOCK_STONE, BLOCK_DIRT, BLOCK_GRASS, BLOCK_DIRT, BLOCK_SAND, BLOCK_WATER, BLOCK_LAMP };
+
+#define GRASS_SIDE_ROWS 3 // of 16, grass hanging over the side of the dirt
+
+TexturePack* texture_pack_default(Arena* arr, uint32_t size)
+{
+    TexturePack* pack = TexturePack::Create(arr, size, TEX_COUNT);
+    for (uint32_t layer = 0; layer < TEX_COUNT; layer++) {
+        uint32_t* dst = (uint32_t*)texture_pack_pixels(pack, 0, layer);
+        for (uint32_t y = 0; y < size; y++) {
+            for (uint32_t x = 0; x < size; x++) {
+                // Rows start at the top of the block, see chunk.vert
+                BlockID block = TEXTURE_BLOCKS[layer];
+                if (layer == TEX_GRASS_SIDE && y * 16 < GRASS_SIDE_ROWS * size) {
+                    block = BLOCK_GRASS;
+                }
+                // The color scaled by 0.85 - 1.0, alpha kept
+                float shade = 0.85f + (texel_hash(layer, x, y) & 0xff) * (0.15f / 255.0f);
+                dst[y * size + x] = shade_color(BLOCK_COLORS[block], shade);
+            }
+        }
+    }
+    texture_pack_build_mips(pack);
+    return pack;
+}
+
+bool texture_pack_save(const TexturePack* pack, const char* path)
+{
+    FILE* file = fopen(path, "wb");
+    if (!file) {
+        printf("Failed to open %s for writing\n", path);
+        return false;
+    }
+    PackHeader header = { TEXTURE_PACK_MAGIC, TEXTURE_PACK_VERSION, pack->size, pack->layers, pack->mips };
+    bool ok = fwrite(&header, sizeof(header), 1, file) == 1 && fwrite(pack->pixels, 1, pack->bytes, file) == pack->bytes;
+    ok = fclose(file) == 0 && ok;
+    if (!ok) {
+        printf("Failed to write texture pack %s\n", path);
+    }
+    return ok;
+}
+
+TexturePack* texture_pack_load(Arena* arr, const char* path)
+{
+    FILE* file = fopen(path, "rb");
+    if (!file) {
+        return nullptr;
+    }
+
+    PackHeader header;
+    bool valid = fread(&header, sizeof(header), 1, file) == 1 && header.magic == TEXTURE_PACK_MAGIC && header.version == TEXTURE_PACK_VERSION;
+    valid = valid && header.size > 0 && (header.size & (header.size - 1)) == 0 && header.size < (1u << TEXTURE_MAX_MIPS);
+    valid = valid && header.layers >= TEX_COUNT && header.layers <= VERTEX_MAX_LAYERS && (uint64_t)header.size * header.size * 4 * header.layers * 4 / 3 < TEXTURE_PACK_MAX_BYTES;
+    if (!valid) {
+        printf("%s is not a texture pack this version can read\n", path);
+        fclose(file);
+        return nullptr;
+    }
+
+    TexturePack* pack = TexturePack::Create(arr, header.size, header.layers);
+    if (header.mips != pack->mips || fread(pack->pixels, 1, pack->bytes, file) != pack->bytes) {
+        printf("Texture pack %s is truncated\n", path);
+        fclose(file);
+        return nullptr;
+    }
+    fclose(file);
+    return pack;
+}
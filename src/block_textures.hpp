@@ -0,0 +1,59 @@
+#ifndef BLOCK_TEXTURES_HPP
+#define BLOCK_TEXTURES_HPP
+
+#include "mesher.hpp"
+#include <Arena.h>
+#include <cstdint>
+
+// Block face textures as the CPU holds them: one square RGBA8 image per BlockTexture, all the
+// same size, with the full mip chain down to 1x1. Packs are baked offline (texture_pack_build_mips,
+// then texture_pack_save) and loaded as is, nothing is filtered at startup.
+// Pixels are laid out mip by mip, every layer of a mip back to back, which is also how the
+// texture array copies want them.
+
+#define TEXTURE_PACK_MAGIC 0x31505856 // "VXP1"
+#define TEXTURE_PACK_VERSION 1
+#define TEXTURE_MAX_MIPS 13 // 4096px
+#define TEXTURE_DEFAULT_SIZE 16
+
+struct TexturePack {
+    uint32_t size; // of mip 0, a power of two
+    uint32_t layers; // at least TEX_COUNT, at most VERTEX_MAX_LAYERS
+    uint32_t mips;
+    uint64_t mip_offsets[TEXTURE_MAX_MIPS]; // into pixels
+    uint64_t bytes;
+    uint8_t* pixels;
+
+    // Pixels uninitialized
+    static TexturePack* Create(Arena* arr, uint32_t size, uint32_t layers);
+};
+
+inline uint32_t texture_mip_size(const TexturePack* pack, uint32_t mip)
+{
+    return pack->size >> mip;
+}
+
+// Every layer of the mip
+inline uint64_t texture_mip_bytes(const TexturePack* pack, uint32_t mip)
+{
+    uint64_t size = texture_mip_size(pack, mip);
+    return size * size * 4 * pack->layers;
+}
+
+inline uint8_t* texture_pack_pixels(const TexturePack* pack, uint32_t mip, uint32_t layer)
+{
+    uint64_t size = texture_mip_size(pack, mip);
+    return pack->pixels + pack->mip_offsets[mip] + layer * size * size * 4;
+}
+
+// Box filters every mip from the one above it, mip 0 has to be filled in
+void texture_pack_build_mips(TexturePack* pack);
+
+// Flat colors from BLOCK_COLORS with some noise, for running without a pack. Mips included.
+TexturePack* texture_pack_default(Arena* arr, uint32_t size = TEXTURE_DEFAULT_SIZE);
+
+bool texture_pack_save(const TexturePack* pack, const char* path);
+// Null if the file is missing, broken or has too few layers
+TexturePack* texture_pack_load(Arena* arr, const char* path);
+
+#endif // BLOCK_TEXTURES_HPP
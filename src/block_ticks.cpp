@@ -0,0 +1,464 @@
+#include "block_ticks.hpp"
+#include "light.hpp"
+#include "trace.hpp"
+#include <algorithm>
+#include <cstring>
+#include <new>
+
+#define CLAIM_SIDE (CHUNK_SIZE + 2)
+#define CLAIM_WORDS ((CLAIM_SIDE * CLAIM_SIDE * CLAIM_SIDE + 63) / 64)
+
+static const uint32_t HORIZONTAL_FACES[4] = { FACE_POS_X, FACE_NEG_X, FACE_POS_Z, FACE_NEG_Z };
+
+BlockTicks* BlockTicks::Create(Arena* arr, World* world, JobSystem* jobs, uint32_t max_chunks)
+{
+    BlockTicks* ticks = new (arena_allocate(arr, sizeof(BlockTicks))) BlockTicks();
+    ticks->arena = arr;
+    ticks->jobs = jobs;
+    ticks->world = world;
+
+    ticks->chunks = (ChunkTicks*)arena_allocate(arr, max_chunks * sizeof(ChunkTicks));
+    memset(ticks->chunks, 0, max_chunks * sizeof(ChunkTicks));
+    ticks->active = (uint32_t*)arena_allocate(arr, max_chunks * sizeof(uint32_t));
+    ticks->candidates = (uint32_t*)arena_allocate(arr, max_chunks * sizeof(uint32_t));
+    ticks->phases = (uint32_t*)arena_allocate(arr, max_chunks * sizeof(uint32_t));
+
+    for (uint32_t j = 0; j < BLOCK_TICK_JOBS; j++) {
+        TickJob* job = &ticks->tick_jobs[j];
+        job->ticks = ticks;
+        job->due = (uint16_t*)arena_allocate(arr, BLOCK_TICKS_PER_CHUNK * sizeof(uint16_t));
+        job->changes = (BlockChange*)arena_allocate(arr, BLOCK_TICK_MAX_CHANGES * sizeof(BlockChange));
+        job->claimed = (uint64_t*)arena_allocate(arr, CLAIM_WORDS * sizeof(uint64_t));
+    }
+
+    world->ticks = ticks;
+    return ticks;
+}
+
+// ---Scheduling (main thread)---
+
+static inline uint32_t tick_delay(BlockID block)
+{
+    if (block == BLOCK_SAND) {
+        return SAND_TICK_DELAY;
+    }
+    return block_is_water(block) ? WATER_TICK_DELAY : 0;
+}
+
+static void schedule(BlockTicks* ticks, Chunk* chunk, uint32_t index, uint32_t delay)
+{
+    if (ticks->scheduled == BLOCK_TICK_MAX_SCHEDULED) {
+        ticks->dropped++;
+        return;
+    }
+    uint32_t slot = (uint32_t)(chunk - ticks->world->pool.chunks);
+    ChunkTicks* queue = &ticks->chunks[slot];
+    TickBlock* block = queue->last;
+    if (!block || block->count == TICK_BLOCK_ENTRIES) {
+        TickBlock* fresh = ticks->free_blocks;
+        if (fresh) {
+            ticks->free_blocks = fresh->next;
+        } else {
+            fresh = (TickBlock*)arena_allocate(ticks->arena, sizeof(TickBlock));
+        }
+        fresh->next = nullptr;
+        fresh->count = 0;
+        if (block) {
+            block->next = fresh;
+        } else {
+            queue->first = fresh;
+        }
+        queue->last = fresh;
+        block = fresh;
+    }
+
+    uint32_t due = ticks->tick + delay;
+    block->ticks[block->count++] = { due, (uint16_t)index };
+    queue->next_due = queue->count == 0 ? due : std::min(queue->next_due, due);
+    queue->count++;
+    ticks->scheduled++;
+    if (!queue->listed) {
+        queue->listed = true;
+        ticks->active[ticks->num_active++] = slot;
+    }
+}
+
+void block_ticks_block_changed(BlockTicks* ticks, Chunk* chunk, int32_t x, int32_t y, int32_t z)
+{
+    World* world = ticks->world;
+    uint32_t index = chunk_index(x, y, z);
+    uint32_t delay = tick_delay(chunk->blocks[index]);
+    if (delay > 0) {
+        schedule(ticks, chunk, index, delay);
+    }
+
+    for (uint32_t f = 0; f < FACE_COUNT; f++) {
+        int32_t nx = x + FACE_NORMALS[f][0];
+        int32_t ny = y + FACE_NORMALS[f][1];
+        int32_t nz = z + FACE_NORMALS[f][2];
+        Chunk* n = chunk;
+        if (nx < 0 || nx >= CHUNK_SIZE || ny < 0 || ny >= CHUNK_SIZE || nz < 0 || nz >= CHUNK_SIZE) {
+            n = world_get_chunk(world, { chunk->pos.x + FACE_NORMALS[f][0], chunk->pos.y + FACE_NORMALS[f][1], chunk->pos.z + FACE_NORMALS[f][2] });
+            if (!n || n->state.load(std::memory_order_acquire) != CHUNK_STATE_READY) {
+                continue;
+            }
+        }
+        uint32_t n_index = chunk_index(nx & CHUNK_MASK, ny & CHUNK_MASK, nz & CHUNK_MASK);
+        delay = tick_delay(n->blocks[n_index]);
+        if (delay > 0) {
+            schedule(ticks, n, n_index, delay);
+        }
+    }
+}
+
+// Keeps the first `count` entries, the blocks after them go back to the free list
+static void trim_queue(BlockTicks* ticks, ChunkTicks* queue, uint32_t count)
+{
+    ticks->scheduled -= queue->count - count;
+    queue->count = count;
+
+    TickBlock* last = nullptr;
+    TickBlock* block = queue->first;
+    while (block && count > 0) {
+        block->count = std::min(count, (uint32_t)TICK_BLOCK_ENTRIES);
+        count -= block->count;
+        last = block;
+        block = block->next;
+    }
+    while (block) {
+        TickBlock* next = block->next;
+        block->next = ticks->free_blocks;
+        ticks->free_blocks = block;
+        block = next;
+    }
+    if (last) {
+        last->next = nullptr;
+    } else {
+        queue->first = nullptr;
+    }
+    queue->last = last;
+}
+
+void block_ticks_chunk_released(BlockTicks* ticks, Chunk* chunk)
+{
+    ChunkTicks* queue = &ticks->chunks[chunk - ticks->world->pool.chunks];
+    trim_queue(ticks, queue, 0);
+}
+
+// ---Rules (jobs)---
+
+static inline uint32_t claim_index(int32_t x, int32_t y, int32_t z)
+{
+    return (uint32_t)(((y + 1) * CLAIM_SIDE + (z + 1)) * CLAIM_SIDE + (x + 1));
+}
+
+static inline bool is_claimed(const TickJob* job, int32_t x, int32_t y, int32_t z)
+{
+    uint32_t i = claim_index(x, y, z);
+    return job->claimed[i >> 6] & (1ull << (i & 63));
+}
+
+// Cells of the neighbours are only ever one step outside the chunk
+static inline uint32_t outside_face(int32_t x, int32_t y, int32_t z)
+{
+    if (x < 0) {
+        return FACE_NEG_X;
+    }
+    if (x >= CHUNK_SIZE) {
+        return FACE_POS_X;
+    }
+    if (y < 0) {
+        return FACE_NEG_Y;
+    }
+    if (y >= CHUNK_SIZE) {
+        return FACE_POS_Y;
+    }
+    if (z < 0) {
+        return FACE_NEG_Z;
+    }
+    if (z >= CHUNK_SIZE) {
+        return FACE_POS_Z;
+    }
+    return FACE_COUNT;
+}
+
+static inline BlockID read_block(const TickJob* job, int32_t x, int32_t y, int32_t z)
+{
+    uint32_t face = outside_face(x, y, z);
+    uint32_t index = chunk_index(x & CHUNK_MASK, y & CHUNK_MASK, z & CHUNK_MASK);
+    if (face == FACE_COUNT) {
+        return job->chunk->blocks[index];
+    }
+    const Chunk* n = job->neighbors[face];
+    return n ? n->blocks[index] : BLOCK_STONE;
+}
+
+static inline void change(TickJob* job, int32_t x, int32_t y, int32_t z, BlockID block)
+{
+    uint32_t i = claim_index(x, y, z);
+    job->claimed[i >> 6] |= 1ull << (i & 63);
+    uint32_t index = chunk_index(x & CHUNK_MASK, y & CHUNK_MASK, z & CHUNK_MASK);
+    job->changes[job->num_changes++] = { (uint16_t)index, block, (uint8_t)outside_face(x, y, z) };
+}
+
+// Anything that isn't solid gives way
+static void update_sand(TickJob* job, int32_t x, int32_t y, int32_t z)
+{
+    BlockID below = read_block(job, x, y - 1, z);
+    if (block_is_solid(below) || is_claimed(job, x, y - 1, z)) {
+        return;
+    }
+    change(job, x, y, z, BLOCK_AIR);
+    change(job, x, y - 1, z, BLOCK_SAND);
+}
+
+// Flowing water takes its level from the water around it: 1 under water, else one more than
+// the lowest level beside it, drying up past WATER_FLOW_LEVELS. Then it falls into what is
+// below or, resting on something solid, spreads sideways one level higher.
+static void update_water(TickJob* job, int32_t x, int32_t y, int32_t z, BlockID block)
+{
+    uint32_t level = water_level(block);
+    if (level > 0) {
+        uint32_t supported = WATER_FLOW_LEVELS + 1;
+        if (block_is_water(read_block(job, x, y + 1, z))) {
+            supported = 1;
+        } else {
+            for (uint32_t f : HORIZONTAL_FACES) {
+                BlockID n = read_block(job, x + FACE_NORMALS[f][0], y, z + FACE_NORMALS[f][2]);
+                if (block_is_water(n)) {
+                    supported = std::min(supported, water_level(n) + 1);
+                }
+            }
+        }
+        if (supported > WATER_FLOW_LEVELS) {
+            change(job, x, y, z, BLOCK_AIR);
+            return;
+        }
+        if (supported != level) {
+            change(job, x, y, z, water_flow(supported));
+            level = supported;
+        }
+    }
+
+    BlockID below = read_block(job, x, y - 1, z);
+    if (below == BLOCK_AIR || (block_is_water(below) && water_level(below) > 1)) {
+        if (!is_claimed(job, x, y - 1, z)) {
+            change(job, x, y - 1, z, water_flow(1));
+        }
+        return;
+    }
+    if (!block_is_solid(below) || level == WATER_FLOW_LEVELS) {
+        return;
+    }
+    for (uint32_t f : HORIZONTAL_FACES) {
+        int32_t nx = x + FACE_NORMALS[f][0];
+        int32_t nz = z + FACE_NORMALS[f][2];
+        BlockID n = read_block(job, nx, y, nz);
+        bool open = n == BLOCK_AIR || (block_is_water(n) && water_level(n) > level + 1);
+        if (open && !is_claimed(job, nx, y, nz)) {
+            change(job, nx, y, nz, water_flow(level + 1));
+        }
+    }
+}
+
+static void tick_job(void* data)
+{
+    TRACE_SCOPE("block tick job");
+    TickJob* job = (TickJob*)data;
+    ChunkTicks* queue = job->queue;
+
+    // Due cells out, the rest packed to the front of the chain
+    uint32_t num_due = 0;
+    job->kept = 0;
+    job->next_due = UINT32_MAX;
+    TickBlock* write = queue->first;
+    uint32_t write_at = 0;
+    for (TickBlock* block = queue->first; block; block = block->next) {
+        for (uint32_t i = 0; i < block->count; i++) {
+            ScheduledTick tick = block->ticks[i];
+            if (tick.due <= job->tick && num_due < BLOCK_TICKS_PER_CHUNK) {
+                job->due[num_due++] = tick.index;
+                continue;
+            }
+            if (write_at == TICK_BLOCK_ENTRIES) {
+                write = write->next;
+                write_at = 0;
+            }
+            write->ticks[write_at++] = tick;
+            job->kept++;
+            job->next_due = std::min(job->next_due, tick.due);
+        }
+    }
+
+    // Bottom up, each cell once
+    std::sort(job->due, job->due + num_due);
+    num_due = (uint32_t)(std::unique(job->due, job->due + num_due) - job->due);
+
+    memset(job->claimed, 0, CLAIM_WORDS * sizeof(uint64_t));
+    job->num_changes = 0;
+    job->updates = num_due;
+    for (uint32_t i = 0; i < num_due; i++) {
+        uint32_t index = job->due[i];
+        int32_t x = index & CHUNK_MASK;
+        int32_t z = (index >> CHUNK_SHIFT) & CHUNK_MASK;
+        int32_t y = index >> (CHUNK_SHIFT * 2);
+        if (is_claimed(job, x, y, z)) {
+            continue; // something moved in this tick, it gets scheduled again when that lands
+        }
+        BlockID block = job->chunk->blocks[index];
+        if (block == BLOCK_SAND) {
+            update_sand(job, x, y, z);
+        } else if (block_is_water(block)) {
+            update_water(job, x, y, z, block);
+        }
+    }
+}
+
+// ---Ticks (main thread)---
+
+static inline Chunk* ready_chunk(World* world, ChunkPos pos)
+{
+    Chunk* chunk = world_get_chunk(world, pos);
+    if (!chunk || chunk->state.load(std::memory_order_acquire) != CHUNK_STATE_READY) {
+        return nullptr;
+    }
+    return chunk;
+}
+
+// A job writes into its chunk and the face neighbours, the world has to allow edits in all of them
+static bool edits_blocked(World* world, const Chunk* chunk, Chunk* const* neighbors)
+{
+    if (chunk->readers > 0) {
+        return true;
+    }
+    for (uint32_t f = 0; f < FACE_COUNT; f++) {
+        if (neighbors[f] && neighbors[f]->readers > 0) {
+            return true;
+        }
+    }
+    if (!world->light) {
+        return false;
+    }
+    if (light_edit_blocked(world->light, world, chunk->pos)) {
+        return true;
+    }
+    // Light reaches the columns around the neighbours too, the ones above and below share ours
+    for (uint32_t f : HORIZONTAL_FACES) {
+        if (neighbors[f] && light_edit_blocked(world->light, world, neighbors[f]->pos)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static void apply_changes(BlockTicks* ticks, TickJob* job)
+{
+    for (uint32_t i = 0; i < job->num_changes; i++) {
+        const BlockChange& c = job->changes[i];
+        Chunk* chunk = c.target == FACE_COUNT ? job->chunk : job->neighbors[c.target];
+        int32_t x = chunk->pos.x * CHUNK_SIZE + (c.index & CHUNK_MASK);
+        int32_t z = chunk->pos.z * CHUNK_SIZE + ((c.index >> CHUNK_SHIFT) & CHUNK_MASK);
+        int32_t y = chunk->pos.y * CHUNK_SIZE + (c.index >> (CHUNK_SHIFT * 2));
+        world_set_block(ticks->world, x, y, z, c.block);
+    }
+    ticks->updates += job->updates;
+    ticks->changes += job->num_changes;
+}
+
+static void run_phase(BlockTicks* ticks, const uint32_t* slots, uint32_t count)
+{
+    World* world = ticks->world;
+    for (uint32_t start = 0; start < count; start += BLOCK_TICK_JOBS) {
+        uint32_t num_jobs = std::min(count - start, (uint32_t)BLOCK_TICK_JOBS);
+        for (uint32_t j = 0; j < num_jobs; j++) {
+            TickJob* job = &ticks->tick_jobs[j];
+            Chunk* chunk = &world->pool.chunks[slots[start + j]];
+            job->chunk = chunk;
+            job->queue = &ticks->chunks[slots[start + j]];
+            job->tick = ticks->tick;
+            for (uint32_t f = 0; f < FACE_COUNT; f++) {
+                job->neighbors[f] = ready_chunk(world, { chunk->pos.x + FACE_NORMALS[f][0], chunk->pos.y + FACE_NORMALS[f][1], chunk->pos.z + FACE_NORMALS[f][2] });
+            }
+            job_submit(ticks->jobs, tick_job, job, &ticks->counter);
+        }
+        job_wait(ticks->jobs, &ticks->counter);
+
+        // In job order, so the result doesn't depend on which finished first
+        for (uint32_t j = 0; j < num_jobs; j++) {
+            TickJob* job = &ticks->tick_jobs[j];
+            trim_queue(ticks, job->queue, job->kept);
+            job->queue->next_due = job->next_due;
+            apply_changes(ticks, job);
+        }
+    }
+}
+
+static void run_tick(BlockTicks* ticks)
+{
+    TRACE_SCOPE("block tick");
+    uint64_t start = trace_now();
+    World* world = ticks->world;
+    ticks->tick++;
+    ticks->updates = 0;
+    ticks->changes = 0;
+
+    // Due chunks the world lets us edit, by phase. Empty queues leave the active list.
+    uint32_t num_candidates = 0;
+    uint32_t kept = 0;
+    memset(ticks->phase_counts, 0, sizeof(ticks->phase_counts));
+    for (uint32_t i = 0; i < ticks->num_active; i++) {
+        uint32_t slot = ticks->active[i];
+        ChunkTicks* queue = &ticks->chunks[slot];
+        if (queue->count == 0) {
+            queue->listed = false;
+            continue;
+        }
+        ticks->active[kept++] = slot;
+        Chunk* chunk = &world->pool.chunks[slot];
+        if (queue->next_due > ticks->tick || ready_chunk(world, chunk->pos) != chunk) {
+            continue;
+        }
+        Chunk* neighbors[FACE_COUNT];
+        for (uint32_t f = 0; f < FACE_COUNT; f++) {
+            neighbors[f] = ready_chunk(world, { chunk->pos.x + FACE_NORMALS[f][0], chunk->pos.y + FACE_NORMALS[f][1], chunk->pos.z + FACE_NORMALS[f][2] });
+        }
+        if (edits_blocked(world, chunk, neighbors)) {
+            continue; // still due next tick
+        }
+        ticks->candidates[num_candidates++] = slot;
+        ticks->phase_counts[(chunk->pos.x & 1) | (chunk->pos.y & 1) << 1 | (chunk->pos.z & 1) << 2]++;
+    }
+    ticks->num_active = kept;
+    ticks->due_chunks = num_candidates;
+
+    uint32_t offsets[8];
+    uint32_t offset = 0;
+    for (uint32_t p = 0; p < 8; p++) {
+        offsets[p] = offset;
+        offset += ticks->phase_counts[p];
+    }
+    for (uint32_t i = 0; i < num_candidates; i++) {
+        ChunkPos pos = world->pool.chunks[ticks->candidates[i]].pos;
+        ticks->phases[offsets[(pos.x & 1) | (pos.y & 1) << 1 | (pos.z & 1) << 2]++] = ticks->candidates[i];
+    }
+
+    offset = 0;
+    for (uint32_t p = 0; p < 8; p++) {
+        run_phase(ticks, ticks->phases + offset, ticks->phase_counts[p]);
+        offset += ticks->phase_counts[p];
+    }
+    ticks->tick_us = (uint32_t)((trace_now() - start) / 1000);
+}
+
+void block_ticks_update(BlockTicks* ticks, float dt)
+{
+    const float step = 1.0f / BLOCK_TICK_HZ;
+    ticks->time += dt;
+    for (uint32_t i = 0; i < BLOCK_TICK_MAX_CATCHUP && ticks->time >= step; i++) {
+        ticks->time -= step;
+        run_tick(ticks);
+    }
+    if (ticks->time >= step) {
+        ticks->time = 0.0f;
+    }
+}
@@ -0,0 +1,121 @@
+#ifndef BLOCK_TICKS_HPP
+#define BLOCK_TICKS_HPP
+
+#include "chunk.hpp"
+#include "jobs.hpp"
+#include "mesher.hpp"
+#include "world.hpp"
+#include <Arena.h>
+#include <cstdint>
+
+// Blocks that update on their own: sand falls, water flows out of sources and dries up when
+// they're gone. Every block write schedules the block and its neighbours, when they have a rule,
+// a few block ticks ahead. Each chunk keeps the cells scheduled in it, and a block tick only looks
+// at chunks with some of them due.
+//
+// Due chunks are updated by jobs in 8 phases, one per parity of the chunk coordinates, so chunks
+// of a phase are never neighbours. A job reads the blocks of its chunk and the face neighbours
+// and writes what changes into a buffer of its own, never into the blocks; a rule only changes
+// the cell it runs for and cells next to it, so jobs of a phase never touch the same cells.
+// Between phases the main thread applies the buffers through the world (meshes, light, saves
+// and follow-up ticks), so every phase sees what the ones before it did, and the result
+// doesn't depend on the number of workers or the order jobs finish in.
+//
+// Scheduled ticks aren't saved, a chunk that is reloaded holds still until something near it changes.
+
+#define BLOCK_TICK_HZ 20
+#define BLOCK_TICK_MAX_CATCHUP 2 // ticks run in one update after a stall, the rest are dropped
+#define SAND_TICK_DELAY 1
+#define WATER_TICK_DELAY 4
+#define BLOCK_TICK_JOBS 16 // chunks updated at once, a phase with more runs in batches
+#define BLOCK_TICKS_PER_CHUNK 4096 // cells updated per chunk and tick, the rest wait for the next one
+#define BLOCK_TICK_MAX_SCHEDULED (1 << 20) // cells scheduled in all chunks, beyond that writes don't schedule
+#define BLOCK_TICK_MAX_CHANGES (BLOCK_TICKS_PER_CHUNK * 5) // a cell changes itself and 4 neighbours at most
+#define TICK_BLOCK_ENTRIES 1023
+
+struct ScheduledTick {
+    uint32_t due; // block tick
+    uint16_t index; // chunk_index
+};
+
+struct TickBlock {
+    TickBlock* next;
+    uint32_t count;
+    ScheduledTick ticks[TICK_BLOCK_ENTRIES];
+};
+
+// Cells scheduled in one chunk, by pool index
+struct ChunkTicks {
+    TickBlock* first; // only the last block in the chain may be partly filled
+    TickBlock* last;
+    uint32_t count;
+    uint32_t next_due;
+    bool listed; // in BlockTicks::active
+};
+
+// A cell of the job's chunk (target FACE_COUNT) or of the neighbour across a face
+struct BlockChange {
+    uint16_t index;
+    BlockID block;
+    uint8_t target;
+};
+
+struct TickJob {
+    struct BlockTicks* ticks;
+    Chunk* chunk;
+    ChunkTicks* queue;
+    Chunk* neighbors[FACE_COUNT]; // ready ones, cells beyond a missing neighbour are walls
+    uint32_t tick;
+
+    uint16_t* due; // BLOCK_TICKS_PER_CHUNK
+    BlockChange* changes; // BLOCK_TICK_MAX_CHANGES
+    uint32_t num_changes;
+    uint32_t updates;
+    uint64_t* claimed; // cells already changed, chunk padded by one, see claim_index
+
+    // What is left in the queue, written back over its front
+    uint32_t kept;
+    uint32_t next_due;
+};
+
+struct BlockTicks {
+    Arena* arena; // tick blocks, freed ones are reused
+    JobSystem* jobs;
+    World* world;
+    uint32_t tick;
+    float time; // seconds not yet ticked
+
+    ChunkTicks* chunks; // per pool chunk
+    uint32_t* active; // pool indices of chunks with cells scheduled
+    uint32_t num_active;
+    uint32_t* candidates; // pool indices of the chunks due this tick
+    uint32_t* phases; // the same by phase
+    uint32_t phase_counts[8];
+
+    TickBlock* free_blocks;
+    uint32_t scheduled;
+
+    TickJob tick_jobs[BLOCK_TICK_JOBS];
+    JobCounter counter;
+
+    // Last tick, for stats
+    uint32_t tick_us;
+    uint32_t updates; // cells updated
+    uint32_t changes; // blocks written
+    uint32_t due_chunks;
+    uint64_t dropped; // schedules that didn't fit, ever
+
+    // Hooks into the world, from then on its block writes schedule ticks
+    static BlockTicks* Create(Arena* arr, World* world, JobSystem* jobs, uint32_t max_chunks);
+};
+
+// From the world: schedules the cell at local x, y, z and its neighbours, whichever have a rule
+void block_ticks_block_changed(BlockTicks* ticks, Chunk* chunk, int32_t x, int32_t y, int32_t z);
+
+// From the world, before the chunk goes back to the pool
+void block_ticks_chunk_released(BlockTicks* ticks, Chunk* chunk);
+
+// Main thread, after world_update. Runs the block ticks dt seconds hold, see BLOCK_TICK_HZ.
+void block_ticks_update(BlockTicks* ticks, float dt);
+
+#endif // BLOCK_TICKS_HPP
@@ -0,0 +1,188 @@
+#include "brickmap.hpp"
+#include <cstring>
+
+BrickMap* BrickMap::Create(Arena* arr, uint32_t max_bricks, BrickMapHooks hooks)
+{
+    BrickMap* map = (BrickMap*)arena_allocate(arr, sizeof(BrickMap));
+    memset(map, 0, sizeof(*map));
+
+    map->hooks = hooks;
+    map->max_bricks = max_bricks;
+
+    map->grid = (uint32_t*)arena_allocate(arr, BRICKMAP_SLOTS * sizeof(uint32_t));
+    map->nodes = (uint32_t*)arena_allocate(arr, BRICKMAP_SLOTS * CHUNK_REGIONS * sizeof(uint32_t));
+    map->slot_pos = (ChunkPos*)arena_allocate(arr, BRICKMAP_SLOTS * sizeof(ChunkPos));
+    map->slot_revision = (uint32_t*)arena_allocate(arr, BRICKMAP_SLOTS * sizeof(uint32_t));
+    map->slot_num_bricks = (uint32_t*)arena_allocate(arr, BRICKMAP_SLOTS * sizeof(uint32_t));
+    for (uint32_t i = 0; i < BRICKMAP_SLOTS; i++) {
+        map->grid[i] = BRICK_REF_EMPTY;
+        map->slot_pos[i] = { INT32_MAX, INT32_MAX, INT32_MAX };
+        map->slot_revision[i] = BRICKMAP_NOT_ENCODED;
+        map->slot_num_bricks[i] = 0;
+    }
+
+    map->free_bricks = (uint32_t*)arena_allocate(arr, max_bricks * sizeof(uint32_t));
+    for (uint32_t i = 0; i < max_bricks; i++) {
+        map->free_bricks[i] = max_bricks - 1 - i;
+    }
+    map->num_free_bricks = max_bricks;
+
+    return map;
+}
+
+uint64_t brickmap_buffer_size(BrickBuffer buffer, uint32_t max_bricks)
+{
+    switch (buffer) {
+    case BRICK_BUFFER_GRID:
+        return BRICKMAP_SLOTS * sizeof(uint32_t);
+    case BRICK_BUFFER_NODES:
+        return (uint64_t)BRICKMAP_SLOTS * CHUNK_REGIONS * sizeof(uint32_t);
+    case BRICK_BUFFER_VOXELS:
+        return (uint64_t)max_bricks * BRICK_WORDS * sizeof(uint32_t);
+    default:
+        return 0;
+    }
+}
+
+uint64_t brickmap_memory_used(BrickMap* map)
+{
+    return (uint64_t)(map->max_bricks - map->num_free_bricks) * BRICK_WORDS * sizeof(uint32_t);
+}
+
+// Voxel n of region r, in the order bricks store them
+static inline BlockID region_block(const Chunk* chunk, uint32_t r, uint32_t n)
+{
+    const uint32_t per_axis = CHUNK_REGIONS_PER_AXIS;
+    uint32_t x = ((r % per_axis) << CHUNK_REGION_SHIFT) + (n % CHUNK_REGION_SIZE);
+    uint32_t z = (((r / per_axis) % per_axis) << CHUNK_REGION_SHIFT) + ((n / CHUNK_REGION_SIZE) % CHUNK_REGION_SIZE);
+    uint32_t y = ((r / (per_axis * per_axis)) << CHUNK_REGION_SHIFT) + (n / (CHUNK_REGION_SIZE * CHUNK_REGION_SIZE));
+    return chunk->blocks[chunk_index(x, y, z)];
+}
+
+static inline uint32_t uniform_ref(BlockID block)
+{
+    return block == BLOCK_AIR ? BRICK_REF_EMPTY : BRICK_REF_UNIFORM | block;
+}
+
+static void write_grid(BrickMap* map, uint32_t slot, uint32_t ref)
+{
+    map->grid[slot] = ref;
+    map->hooks.write(map->hooks.user, BRICK_BUFFER_GRID, slot * sizeof(uint32_t), &ref, sizeof(uint32_t));
+}
+
+static void free_slot_bricks(BrickMap* map, uint32_t slot)
+{
+    if (map->grid[slot] != slot) {
+        return;
+    }
+    const uint32_t* refs = &map->nodes[slot * CHUNK_REGIONS];
+    for (uint32_t r = 0; r < CHUNK_REGIONS; r++) {
+        if (refs[r] != BRICK_REF_EMPTY && !(refs[r] & BRICK_REF_UNIFORM)) {
+            map->free_bricks[map->num_free_bricks++] = refs[r];
+        }
+    }
+    map->slot_num_bricks[slot] = 0;
+}
+
+static bool clear_slot(BrickMap* map, uint32_t slot)
+{
+    if (map->slot_revision[slot] == BRICKMAP_NOT_ENCODED) {
+        return true;
+    }
+    if (!map->hooks.fits(map->hooks.user, sizeof(uint32_t), 1)) {
+        return false;
+    }
+    free_slot_bricks(map, slot);
+    write_grid(map, slot, BRICK_REF_EMPTY);
+    map->slot_revision[slot] = BRICKMAP_NOT_ENCODED;
+    return true;
+}
+
+static bool encode_slot(BrickMap* map, uint32_t slot, const Chunk* chunk)
+{
+    uint32_t refs[CHUNK_REGIONS];
+    uint64_t mixed = 0;
+    uint32_t num_bricks = 0;
+    for (uint32_t r = 0; r < CHUNK_REGIONS; r++) {
+        BlockID first = region_block(chunk, r, 0);
+        refs[r] = uniform_ref(first);
+        for (uint32_t n = 1; n < CHUNK_REGION_VOLUME; n++) {
+            if (region_block(chunk, r, n) != first) {
+                mixed |= 1ull << r;
+                num_bricks++;
+                break;
+            }
+        }
+    }
+
+    bool uniform = mixed == 0;
+    for (uint32_t r = 1; r < CHUNK_REGIONS && uniform; r++) {
+        uniform = refs[r] == refs[0];
+    }
+
+    if (num_bricks > map->num_free_bricks + map->slot_num_bricks[slot]) {
+        return false;
+    }
+    uint64_t size = sizeof(uint32_t) + (uniform ? 0 : CHUNK_REGIONS * sizeof(uint32_t)) + num_bricks * BRICK_WORDS * sizeof(uint32_t);
+    if (!map->hooks.fits(map->hooks.user, size, 1 + !uniform + num_bricks)) {
+        return false;
+    }
+
+    // The GPU still draws the old bricks this frame, the copies replacing them are ordered after it
+    free_slot_bricks(map, slot);
+    map->slot_revision[slot] = chunk->revision;
+    if (uniform) {
+        write_grid(map, slot, refs[0]);
+        return true;
+    }
+
+    uint32_t words[BRICK_WORDS];
+    for (uint32_t r = 0; r < CHUNK_REGIONS; r++) {
+        if (!(mixed & (1ull << r))) {
+            continue;
+        }
+        memset(words, 0, sizeof(words));
+        for (uint32_t n = 0; n < CHUNK_REGION_VOLUME; n++) {
+            words[n / 4] |= (uint32_t)(region_block(chunk, r, n) & 0xff) << ((n % 4) * 8);
+        }
+        uint32_t brick = map->free_bricks[--map->num_free_bricks];
+        map->hooks.write(map->hooks.user, BRICK_BUFFER_VOXELS, (uint64_t)brick * sizeof(words), words, sizeof(words));
+        refs[r] = brick;
+    }
+    map->slot_num_bricks[slot] = num_bricks;
+
+    uint32_t* node = &map->nodes[slot * CHUNK_REGIONS];
+    memcpy(node, refs, sizeof(refs));
+    map->hooks.write(map->hooks.user, BRICK_BUFFER_NODES, (uint64_t)slot * sizeof(refs), node, sizeof(refs));
+    write_grid(map, slot, slot);
+    return true;
+}
+
+void brickmap_update(BrickMap* map, World* world, ChunkPos center)
+{
+    map->origin = { center.x - BRICKMAP_SIZE_XZ / 2, center.y - BRICKMAP_SIZE_Y / 2, center.z - BRICKMAP_SIZE_XZ / 2 };
+
+    uint32_t encodes = 0;
+    for (int32_t y = 0; y < BRICKMAP_SIZE_Y; y++) {
+        for (int32_t z = 0; z < BRICKMAP_SIZE_XZ; z++) {
+            for (int32_t x = 0; x < BRICKMAP_SIZE_XZ; x++) {
+                ChunkPos pos = { map->origin.x + x, map->origin.y + y, map->origin.z + z };
+                uint32_t slot = brickmap_slot(pos);
+
+                Chunk* chunk = world_get_chunk(world, pos);
+                bool ready = chunk && chunk->state.load(std::memory_order_acquire) == CHUNK_STATE_READY;
+                if (map->slot_pos[slot] != pos || !ready) {
+                    if (!clear_slot(map, slot)) {
+                        continue;
+                    }
+                    map->slot_pos[slot] = pos;
+                }
+                if (!ready || map->slot_revision[slot] == chunk->revision || encodes == BRICKMAP_ENCODES_PER_FRAME) {
+                    continue;
+                }
+                encode_slot(map, slot, chunk);
+                encodes++;
+            }
+        }
+    }
+}
@@ -0,0 +1,75 @@
+#ifndef BRICKMAP_HPP
+#define BRICKMAP_HPP
+
+#include "chunk.hpp"
+#include "world.hpp"
+#include <Arena.h>
+#include <cstdint>
+
+// Sparse three level grid of the chunks around the camera, for ray marching on the GPU:
+// a window of chunk slots -> 4^3 bricks per chunk (the 8^3 edit regions) -> voxels.
+// Rays step over empty chunks and bricks whole, and chunks or bricks made of a single block
+// store no voxels at all, so solid ground and open sky cost next to nothing.
+
+#define BRICKMAP_SIZE_XZ 64 // chunks, powers of two. Slots wrap around as the window moves.
+#define BRICKMAP_SIZE_Y 8
+#define BRICKMAP_SLOTS (BRICKMAP_SIZE_XZ * BRICKMAP_SIZE_Y * BRICKMAP_SIZE_XZ)
+#define BRICK_WORDS (CHUNK_REGION_VOLUME / 4) // one byte per voxel, x fastest then z then y
+
+// Chunk and brick level references. Anything else is a slot (chunk level) or a brick index.
+#define BRICK_REF_EMPTY 0xffffffffu
+#define BRICK_REF_UNIFORM 0x80000000u // | block, every voxel is that block
+
+#define BRICKMAP_ENCODES_PER_FRAME 64
+#define BRICKMAP_NOT_ENCODED UINT32_MAX
+
+// The GPU buffers, laid out as the ray marching shader reads them
+enum BrickBuffer : uint32_t {
+    BRICK_BUFFER_GRID, // uint32 ref per slot
+    BRICK_BUFFER_NODES, // CHUNK_REGIONS brick refs per slot, in chunk_region_index order
+    BRICK_BUFFER_VOXELS, // BRICK_WORDS per brick
+    BRICK_BUFFER_COUNT
+};
+
+struct BrickMapHooks {
+    void* user;
+    // True if num_copies writes totalling size bytes can still be taken this frame
+    bool (*fits)(void* user, uint64_t size, uint32_t num_copies);
+    void (*write)(void* user, BrickBuffer buffer, uint64_t offset, const void* data, uint64_t size);
+};
+
+struct BrickMap {
+    BrickMapHooks hooks;
+    ChunkPos origin; // chunk at the min corner of the window
+
+    // Per slot
+    uint32_t* grid;
+    uint32_t* nodes;
+    ChunkPos* slot_pos;
+    uint32_t* slot_revision; // chunk revision that was encoded, BRICKMAP_NOT_ENCODED if none
+    uint32_t* slot_num_bricks;
+
+    uint32_t* free_bricks;
+    uint32_t num_free_bricks;
+    uint32_t max_bricks;
+
+    static BrickMap* Create(Arena* arr, uint32_t max_bricks, BrickMapHooks hooks);
+};
+
+uint64_t brickmap_buffer_size(BrickBuffer buffer, uint32_t max_bricks);
+
+inline uint32_t brickmap_slot(ChunkPos pos)
+{
+    uint32_t x = pos.x & (BRICKMAP_SIZE_XZ - 1);
+    uint32_t y = pos.y & (BRICKMAP_SIZE_Y - 1);
+    uint32_t z = pos.z & (BRICKMAP_SIZE_XZ - 1);
+    return (y * BRICKMAP_SIZE_XZ + z) * BRICKMAP_SIZE_XZ + x;
+}
+
+// Centres the window on `center`, clears slots that left it or lost their chunk and encodes
+// chunks that are new or were edited, as many as the hooks take this frame
+void brickmap_update(BrickMap* map, World* world, ChunkPos center);
+
+uint64_t brickmap_memory_used(BrickMap* map);
+
+#endif // BRICKMAP_HPP
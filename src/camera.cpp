@@ -0,0 +1,58 @@
+#include "camera.hpp"
+#include <cmath>
+
+#define MAX_PITCH 1.55f
+
+Camera camera_create(Vec3 position, float aspect)
+{
+    Camera camera = {};
+    camera.position = position;
+    camera.fov_y = 70.0f * (3.14159265f / 180.0f);
+    camera.aspect = aspect;
+    camera.near_z = 0.1f;
+    camera.far_z = 2000.0f;
+    return camera;
+}
+
+Vec3 camera_forward(const Camera* camera)
+{
+    float cp = cosf(camera->pitch);
+    return { sinf(camera->yaw) * cp, sinf(camera->pitch), -cosf(camera->yaw) * cp };
+}
+
+Vec3 camera_right(const Camera* camera)
+{
+    return { cosf(camera->yaw), 0.0f, sinf(camera->yaw) };
+}
+
+Mat4 camera_view_proj(const Camera* camera)
+{
+    Mat4 view = mat4_look_dir(camera->position, camera_forward(camera), { 0.0f, 1.0f, 0.0f });
+    Mat4 proj = mat4_perspective(camera->fov_y, camera->aspect, camera->near_z, camera->far_z);
+    return mat4_mul(proj, view);
+}
+
+ChunkPos camera_chunk(const Camera* camera)
+{
+    return chunk_pos_from_block((int32_t)floorf(camera->position.x), (int32_t)floorf(camera->position.y), (int32_t)floorf(camera->position.z));
+}
+
+void camera_move(Camera* camera, Vec3 move, float speed, float dt)
+{
+    Vec3 forward = camera_forward(camera);
+    Vec3 right = camera_right(camera);
+    Vec3 delta = right * move.x + Vec3 { 0.0f, move.y, 0.0f } + forward * move.z;
+    camera->position = camera->position + delta * (speed * dt);
+}
+
+void camera_look(Camera* camera, float d_yaw, float d_pitch)
+{
+    camera->yaw = fmodf(camera->yaw + d_yaw, 2.0f * 3.14159265f);
+    camera->pitch += d_pitch;
+    if (camera->pitch > MAX_PITCH) {
+        camera->pitch = MAX_PITCH;
+    }
+    if (camera->pitch < -MAX_PITCH) {
+        camera->pitch = -MAX_PITCH;
+    }
+}
@@ -0,0 +1,31 @@
+#ifndef CAMERA_HPP
+#define CAMERA_HPP
+
+#include "chunk.hpp"
+#include "math.hpp"
+
+struct Camera {
+    Vec3 position;
+    float yaw; // radians, 0 looks down -Z
+    float pitch;
+
+    float fov_y;
+    float aspect;
+    float near_z;
+    float far_z;
+};
+
+Camera camera_create(Vec3 position, float aspect);
+
+Vec3 camera_forward(const Camera* camera);
+Vec3 camera_right(const Camera* camera);
+
+Mat4 camera_view_proj(const Camera* camera);
+
+ChunkPos camera_chunk(const Camera* camera);
+
+// Fly camera: move is (right, up, forward) in camera space, look is (yaw, pitch) deltas
+void camera_move(Camera* camera, Vec3 move, float speed, float dt);
+void camera_look(Camera* camera, float d_yaw, float d_pitch);
+
+#endif // CAMERA_HPP
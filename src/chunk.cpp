@@ -0,0 +1,153 @@
+#include "chunk.hpp"
+#include <cstdio>
+#include <cstring>
+
+#define MAP_EMPTY UINT64_MAX
+
+void chunk_map_init(Arena* arr, ChunkMap* map, uint32_t max_entries)
+{
+    uint32_t capacity = 16;
+    while (capacity < max_entries * 2) { // keep load factor under 0.5
+        capacity <<= 1;
+    }
+
+    map->keys = (uint64_t*)arena_allocate(arr, capacity * sizeof(*map->keys));
+    map->values = (Chunk**)arena_allocate(arr, capacity * sizeof(*map->values));
+    map->capacity = capacity;
+    chunk_map_clear(map);
+}
+
+void chunk_map_clear(ChunkMap* map)
+{
+    memset(map->keys, 0xff, map->capacity * sizeof(*map->keys));
+    memset(map->values, 0, map->capacity * sizeof(*map->values));
+    map->count = 0;
+}
+
+bool chunk_map_slot_used(ChunkMap* map, uint32_t slot)
+{
+    return map->keys[slot] != MAP_EMPTY;
+}
+
+Chunk* chunk_map_get(ChunkMap* map, uint64_t key)
+{
+    uint32_t mask = map->capacity - 1;
+    uint32_t slot = chunk_key_hash(key) & mask;
+    for (uint32_t i = 0; i < map->capacity; i++) {
+        uint64_t k = map->keys[slot];
+        if (k == key) {
+            return map->values[slot];
+        }
+        if (k == MAP_EMPTY) {
+            return nullptr;
+        }
+        slot = (slot + 1) & mask;
+    }
+    return nullptr;
+}
+
+bool chunk_map_insert(ChunkMap* map, uint64_t key, Chunk* chunk)
+{
+    uint32_t mask = map->capacity - 1;
+    uint32_t slot = chunk_key_hash(key) & mask;
+    for (uint32_t i = 0; i < map->capacity; i++) {
+        uint64_t k = map->keys[slot];
+        if (k == key) {
+            map->values[slot] = chunk;
+            return true;
+        }
+        if (k == MAP_EMPTY) {
+            break;
+        }
+        slot = (slot + 1) & mask;
+    }
+
+    if ((map->count + 1) * 2 > map->capacity) {
+        printf("ChunkMap is full (%u entries)\n", map->count);
+        return false;
+    }
+    map->keys[slot] = key;
+    map->values[slot] = chunk;
+    map->count++;
+    return true;
+}
+
+Chunk* chunk_map_remove(ChunkMap* map, uint64_t key)
+{
+    uint32_t mask = map->capacity - 1;
+    uint32_t slot = chunk_key_hash(key) & mask;
+    for (uint32_t i = 0; i < map->capacity; i++) {
+        uint64_t k = map->keys[slot];
+        if (k == MAP_EMPTY) {
+            return nullptr;
+        }
+        if (k == key) {
+            break;
+        }
+        slot = (slot + 1) & mask;
+    }
+    if (map->keys[slot] != key) {
+        return nullptr;
+    }
+
+    Chunk* chunk = map->values[slot];
+    map->count--;
+
+    // Backward shift deletion, so probe chains never need tombstones
+    uint32_t hole = slot;
+    uint32_t next = (hole + 1) & mask;
+    while (map->keys[next] != MAP_EMPTY) {
+        uint32_t home = chunk_key_hash(map->keys[next]) & mask;
+        // move the entry into the hole if the hole lies on its probe path
+        if (((next - home) & mask) >= ((next - hole) & mask)) {
+            map->keys[hole] = map->keys[next];
+            map->values[hole] = map->values[next];
+            hole = next;
+        }
+        next = (next + 1) & mask;
+    }
+    map->keys[hole] = MAP_EMPTY;
+    map->values[hole] = nullptr;
+
+    return chunk;
+}
+
+void chunk_pool_init(Arena* arr, ChunkPool* pool, uint32_t capacity)
+{
+    pool->chunks = (Chunk*)arena_allocate(arr, capacity * sizeof(*pool->chunks));
+    pool->free_list = (uint32_t*)arena_allocate(arr, capacity * sizeof(*pool->free_list));
+    pool->capacity = capacity;
+    pool->num_free = capacity;
+
+    // hand out low indices first
+    for (uint32_t i = 0; i < capacity; i++) {
+        pool->free_list[i] = capacity - 1 - i;
+    }
+}
+
+Chunk* chunk_pool_acquire(ChunkPool* pool)
+{
+    if (pool->num_free == 0) {
+        return nullptr;
+    }
+    Chunk* chunk = &pool->chunks[pool->free_list[--pool->num_free]];
+    chunk->flags = 0;
+    chunk->state.store(CHUNK_STATE_EMPTY, std::memory_order_relaxed);
+    chunk->cancelled.store(false, std::memory_order_relaxed);
+    chunk->readers = 0;
+    chunk->dirty_borders = 0;
+    chunk->dirty_regions = 0;
+    chunk->revision = 0;
+    chunk->light_state = CHUNK_LIGHT_NONE;
+    return chunk;
+}
+
+void chunk_pool_release(ChunkPool* pool, Chunk* chunk)
+{
+    uint32_t index = (uint32_t)(chunk - pool->chunks);
+    if (index >= pool->capacity) {
+        printf("Tried to release a chunk that does not belong to the pool\n");
+        return;
+    }
+    pool->free_list[pool->num_free++] = index;
+}
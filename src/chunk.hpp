@@ -0,0 +1,210 @@
+#ifndef CHUNK_HPP
+#define CHUNK_HPP
+
+#include <Arena.h>
+#include <atomic>
+#include <cstdint>
+
+#define CHUNK_SHIFT 5
+#define CHUNK_SIZE (1 << CHUNK_SHIFT)
+#define CHUNK_MASK (CHUNK_SIZE - 1)
+#define CHUNK_AREA (CHUNK_SIZE * CHUNK_SIZE)
+#define CHUNK_VOLUME (CHUNK_SIZE * CHUNK_SIZE * CHUNK_SIZE)
+
+typedef uint16_t BlockID;
+
+#define WATER_FLOW_LEVELS 7 // how far water spreads sideways from a source
+
+enum Block : BlockID {
+    BLOCK_AIR = 0,
+    BLOCK_STONE,
+    BLOCK_DIRT,
+    BLOCK_GRASS,
+    BLOCK_SAND,
+    BLOCK_WATER,
+    BLOCK_LAMP,
+    BLOCK_WATER_FLOW_1, // flowing water, level 1 is next to a source or falling
+    BLOCK_WATER_FLOW_LAST = BLOCK_WATER_FLOW_1 + WATER_FLOW_LEVELS - 1,
+    BLOCK_COUNT
+};
+
+// A source (BLOCK_WATER) or flowing water
+constexpr bool block_is_water(BlockID block)
+{
+    return block == BLOCK_WATER || (block >= BLOCK_WATER_FLOW_1 && block <= BLOCK_WATER_FLOW_LAST);
+}
+
+// Blocks away from the nearest source, 0 for a source
+constexpr uint32_t water_level(BlockID block)
+{
+    return block == BLOCK_WATER ? 0 : block - BLOCK_WATER_FLOW_1 + 1;
+}
+
+constexpr BlockID water_flow(uint32_t level)
+{
+    return (BlockID)(BLOCK_WATER_FLOW_1 + level - 1);
+}
+
+// Blocks that stop light and hide the faces behind them (light, mesher, AO). Same answer as
+// block_is_solid for every block so far, kept apart for blocks like glass that are solid but
+// not opaque.
+constexpr bool block_is_opaque(BlockID block)
+{
+    return block != BLOCK_AIR && !block_is_water(block);
+}
+
+// Blocks entities collide with, picking rays stop at and sand and water rest on
+constexpr bool block_is_solid(BlockID block)
+{
+    return block != BLOCK_AIR && !block_is_water(block);
+}
+
+// Light is two 4 bit channels per voxel, sunlight in the high nibble and block light in the low one
+#define LIGHT_MAX 15
+#define LIGHT_SUN_SHIFT 4
+#define LIGHT_FULL (LIGHT_MAX << LIGHT_SUN_SHIFT) // open sky
+
+inline uint8_t block_light_emission(BlockID block)
+{
+    return block == BLOCK_LAMP ? LIGHT_MAX : 0;
+}
+
+inline uint8_t light_level(uint8_t light)
+{
+    uint8_t sun = light >> LIGHT_SUN_SHIFT;
+    uint8_t block = light & LIGHT_MAX;
+    return sun > block ? sun : block;
+}
+
+enum ChunkFlags : uint32_t {
+    CHUNK_FLAG_MODIFIED = 1 << 0, // blocks changed since the last save was queued
+    CHUNK_FLAG_SAVING = 1 << 1, // a save snapshot is in flight
+};
+
+enum ChunkState : uint32_t {
+    CHUNK_STATE_EMPTY, // allocated, contents undefined
+    CHUNK_STATE_LOADING,
+    CHUNK_STATE_GENERATING,
+    CHUNK_STATE_READY,
+};
+
+enum ChunkLightState : uint8_t {
+    CHUNK_LIGHT_NONE,
+    CHUNK_LIGHT_PENDING, // blocks ready, waiting to be lit
+    CHUNK_LIGHT_QUEUED, // a light job is filling it in
+    CHUNK_LIGHT_LOCAL, // lit on its own, light from the neighbours isn't merged yet
+    CHUNK_LIGHT_DONE,
+};
+
+struct ChunkPos {
+    int32_t x, y, z;
+};
+
+inline bool operator==(ChunkPos a, ChunkPos b)
+{
+    return a.x == b.x && a.y == b.y && a.z == b.z;
+}
+inline bool operator!=(ChunkPos a, ChunkPos b)
+{
+    return !(a == b);
+}
+
+// 21 bits per axis, biased so negative coordinates pack cleanly
+inline uint64_t chunk_key(ChunkPos p)
+{
+    const uint64_t bias = 1 << 20;
+    const uint64_t mask = (1 << 21) - 1;
+    return (((uint64_t)(p.x + bias) & mask) << 42) | (((uint64_t)(p.y + bias) & mask) << 21) | ((uint64_t)(p.z + bias) & mask);
+}
+
+inline uint32_t chunk_key_hash(uint64_t key)
+{
+    key ^= key >> 33;
+    key *= 0xff51afd7ed558ccdULL;
+    key ^= key >> 33;
+    key *= 0xc4ceb9fe1a85ec53ULL;
+    key ^= key >> 33;
+    return (uint32_t)key;
+}
+
+inline ChunkPos chunk_pos_from_block(int32_t x, int32_t y, int32_t z)
+{
+    return { x >> CHUNK_SHIFT, y >> CHUNK_SHIFT, z >> CHUNK_SHIFT };
+}
+
+// x fastest, then z, then y. Keeps horizontal slices contiguous for the mesher
+inline uint32_t chunk_index(uint32_t x, uint32_t y, uint32_t z)
+{
+    return (y << (CHUNK_SHIFT * 2)) | (z << CHUNK_SHIFT) | x;
+}
+
+// Edits are tracked per 8^3 region so only the touched part of the mesh gets rebuilt
+#define CHUNK_REGION_SHIFT 3
+#define CHUNK_REGIONS_PER_AXIS (CHUNK_SIZE >> CHUNK_REGION_SHIFT)
+#define CHUNK_REGIONS (CHUNK_REGIONS_PER_AXIS * CHUNK_REGIONS_PER_AXIS * CHUNK_REGIONS_PER_AXIS)
+#define CHUNK_REGION_SIZE (1 << CHUNK_REGION_SHIFT)
+#define CHUNK_REGION_VOLUME (CHUNK_REGION_SIZE * CHUNK_REGION_SIZE * CHUNK_REGION_SIZE)
+
+// Same order as chunk_index, one bit per region in Chunk::dirty_regions
+inline uint32_t chunk_region_index(uint32_t x, uint32_t y, uint32_t z)
+{
+    const uint32_t shift = CHUNK_SHIFT - CHUNK_REGION_SHIFT;
+    return ((y >> CHUNK_REGION_SHIFT) << (shift * 2)) | ((z >> CHUNK_REGION_SHIFT) << shift) | (x >> CHUNK_REGION_SHIFT);
+}
+
+struct Chunk {
+    ChunkPos pos;
+    uint32_t flags;
+    std::atomic<uint32_t> state; // written by worker jobs, read on the main thread
+    std::atomic<bool> cancelled; // released while a job or load was in flight, jobs skip their work
+
+    // Main thread only
+    uint16_t readers; // jobs reading blocks (meshing this chunk or a neighbour, lighting it), edits wait for 0
+    uint8_t dirty_borders; // faces (see Face) whose border blocks changed since the last mesh
+    uint64_t dirty_regions; // regions whose faces changed since the last mesh
+    uint32_t revision; // bumped by every edit, lets other copies of the blocks notice changes
+    uint8_t light_state; // ChunkLightState, light may only be read once it is done
+
+    BlockID blocks[CHUNK_VOLUME];
+    uint8_t light[CHUNK_VOLUME]; // same order as blocks
+};
+
+// ===========================================
+// ----------------CHUNK MAP------------------
+// ===========================================
+
+// Open addressing (linear probe) map from chunk_key to Chunk*. Capacity is fixed
+// at creation so it can live in an arena.
+struct ChunkMap {
+    uint64_t* keys;
+    Chunk** values;
+    uint32_t capacity; // power of two
+    uint32_t count;
+};
+
+void chunk_map_init(Arena* arr, ChunkMap* map, uint32_t max_entries);
+Chunk* chunk_map_get(ChunkMap* map, uint64_t key);
+bool chunk_map_insert(ChunkMap* map, uint64_t key, Chunk* chunk);
+Chunk* chunk_map_remove(ChunkMap* map, uint64_t key);
+void chunk_map_clear(ChunkMap* map);
+
+// Iterate with: for (uint32_t i = 0; i < map->capacity; i++) if (chunk_map_slot_used(map, i)) ...
+bool chunk_map_slot_used(ChunkMap* map, uint32_t slot);
+
+// ===========================================
+// ----------------CHUNK POOL-----------------
+// ===========================================
+
+// Fixed-size pool of chunks. Not thread safe, owned by the main thread.
+struct ChunkPool {
+    Chunk* chunks;
+    uint32_t* free_list;
+    uint32_t num_free;
+    uint32_t capacity;
+};
+
+void chunk_pool_init(Arena* arr, ChunkPool* pool, uint32_t capacity);
+Chunk* chunk_pool_acquire(ChunkPool* pool);
+void chunk_pool_release(ChunkPool* pool, Chunk* chunk);
+
+#endif // CHUNK_HPP
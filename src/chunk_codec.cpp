@@ -0,0 +1,214 @@
+#include "chunk_codec.hpp"
+#include "compress.hpp"
+#include <cstdio>
+#include <cstring>
+
+#define CHUNK_PAYLOAD_MAGIC 0x31435856 // "VXC1"
+
+struct PaletteHeader {
+    uint16_t num_entries; // 0 means raw 16 bit blocks follow
+    uint8_t bits;
+    uint8_t pad;
+};
+
+struct PayloadHeader {
+    uint32_t magic;
+    uint32_t raw_size; // size of the palette stream before compression
+};
+
+static inline uint32_t bits_for(uint32_t count)
+{
+    uint32_t bits = 0;
+    while ((1u << bits) < count) {
+        bits++;
+    }
+    return bits;
+}
+
+uint32_t palette_encode(const BlockID* blocks, uint8_t* out, uint32_t capacity)
+{
+    BlockID palette[PALETTE_MAX_ENTRIES];
+    uint32_t num_entries = 0;
+
+    // Terrain is mostly long runs, so checking the last hit first skips most of the palette scans
+    BlockID last_block = blocks[0];
+    palette[num_entries++] = last_block;
+    for (uint32_t i = 1; i < CHUNK_VOLUME; i++) {
+        BlockID b = blocks[i];
+        if (b == last_block) {
+            continue;
+        }
+        last_block = b;
+        uint32_t p = 0;
+        while (p < num_entries && palette[p] != b) {
+            p++;
+        }
+        if (p == num_entries) {
+            if (num_entries == PALETTE_MAX_ENTRIES) {
+                num_entries = 0; // too many unique ids, store raw
+                break;
+            }
+            palette[num_entries++] = b;
+        }
+    }
+
+    PaletteHeader header = {};
+    if (num_entries == 0) {
+        uint32_t size = sizeof(header) + CHUNK_VOLUME * sizeof(BlockID);
+        if (size > capacity) {
+            return 0;
+        }
+        memcpy(out, &header, sizeof(header));
+        memcpy(out + sizeof(header), blocks, CHUNK_VOLUME * sizeof(BlockID));
+        return size;
+    }
+
+    uint32_t bits = bits_for(num_entries);
+    header.num_entries = (uint16_t)num_entries;
+    header.bits = (uint8_t)bits;
+
+    uint32_t per_word = bits ? 64 / bits : 0;
+    uint32_t num_words = bits ? (CHUNK_VOLUME + per_word - 1) / per_word : 0;
+    uint32_t size = sizeof(header) + num_entries * sizeof(BlockID) + num_words * sizeof(uint64_t);
+    if (size > capacity) {
+        return 0;
+    }
+
+    uint8_t* op = out;
+    memcpy(op, &header, sizeof(header));
+    op += sizeof(header);
+    memcpy(op, palette, num_entries * sizeof(BlockID));
+    op += num_entries * sizeof(BlockID);
+
+    if (bits == 0) {
+        return size; // single block type, palette says it all
+    }
+
+    uint32_t current = 0;
+    uint32_t i = 0;
+    last_block = palette[0];
+    for (uint32_t w = 0; w < num_words; w++) {
+        uint64_t word = 0;
+        for (uint32_t k = 0; k < per_word && i < CHUNK_VOLUME; k++, i++) {
+            BlockID b = blocks[i];
+            if (b != last_block) {
+                current = 0;
+                while (palette[current] != b) {
+                    current++;
+                }
+                last_block = b;
+            }
+            word |= (uint64_t)current << (k * bits);
+        }
+        memcpy(op, &word, sizeof(word));
+        op += sizeof(word);
+    }
+
+    return size;
+}
+
+bool palette_decode(const uint8_t* in, uint32_t size, BlockID* blocks)
+{
+    PaletteHeader header;
+    if (size < sizeof(header)) {
+        return false;
+    }
+    memcpy(&header, in, sizeof(header));
+    in += sizeof(header);
+    size -= sizeof(header);
+
+    if (header.num_entries == 0) {
+        if (size < CHUNK_VOLUME * sizeof(BlockID)) {
+            return false;
+        }
+        memcpy(blocks, in, CHUNK_VOLUME * sizeof(BlockID));
+        for (uint32_t i = 0; i < CHUNK_VOLUME; i++) {
+            if (blocks[i] >= BLOCK_COUNT) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    if (header.num_entries > PALETTE_MAX_ENTRIES || size < header.num_entries * sizeof(BlockID)) {
+        return false;
+    }
+    BlockID palette[PALETTE_MAX_ENTRIES];
+    memcpy(palette, in, header.num_entries * sizeof(BlockID));
+    for (uint32_t i = 0; i < header.num_entries; i++) {
+        if (palette[i] >= BLOCK_COUNT) {
+            return false; // the tables indexed by block id would be read out of bounds
+        }
+    }
+    in += header.num_entries * sizeof(BlockID);
+    size -= header.num_entries * sizeof(BlockID);
+
+    uint32_t bits = header.bits;
+    if (bits == 0) {
+        for (uint32_t i = 0; i < CHUNK_VOLUME; i++) {
+            blocks[i] = palette[0];
+        }
+        return true;
+    }
+    if (bits > 16 || (1u << bits) < header.num_entries) {
+        return false;
+    }
+
+    uint32_t per_word = 64 / bits;
+    uint32_t num_words = (CHUNK_VOLUME + per_word - 1) / per_word;
+    if (size < num_words * sizeof(uint64_t)) {
+        return false;
+    }
+
+    uint64_t mask = (1ull << bits) - 1;
+    uint32_t i = 0;
+    for (uint32_t w = 0; w < num_words; w++) {
+        uint64_t word;
+        memcpy(&word, in + w * sizeof(word), sizeof(word));
+        for (uint32_t k = 0; k < per_word && i < CHUNK_VOLUME; k++, i++) {
+            uint32_t index = (uint32_t)((word >> (k * bits)) & mask);
+            if (index >= header.num_entries) {
+                return false;
+            }
+            blocks[i] = palette[index];
+        }
+    }
+    return true;
+}
+
+uint32_t chunk_encode(const BlockID* blocks, uint8_t* out, uint32_t capacity, uint8_t* scratch)
+{
+    uint32_t raw_size = palette_encode(blocks, scratch, CHUNK_CODEC_SCRATCH_BYTES);
+    if (raw_size == 0 || capacity < sizeof(PayloadHeader)) {
+        return 0;
+    }
+
+    uint32_t compressed = lz_compress(scratch, raw_size, out + sizeof(PayloadHeader), capacity - sizeof(PayloadHeader));
+    if (compressed == 0) {
+        return 0;
+    }
+
+    PayloadHeader header = { CHUNK_PAYLOAD_MAGIC, raw_size };
+    memcpy(out, &header, sizeof(header));
+    return sizeof(header) + compressed;
+}
+
+bool chunk_decode(const uint8_t* in, uint32_t size, BlockID* blocks, uint8_t* scratch)
+{
+    PayloadHeader header;
+    if (size < sizeof(header)) {
+        return false;
+    }
+    memcpy(&header, in, sizeof(header));
+    if (header.magic != CHUNK_PAYLOAD_MAGIC || header.raw_size > CHUNK_CODEC_SCRATCH_BYTES) {
+        printf("Corrupt chunk payload\n");
+        return false;
+    }
+
+    uint32_t raw_size = lz_decompress(in + sizeof(header), size - sizeof(header), scratch, CHUNK_CODEC_SCRATCH_BYTES);
+    if (raw_size != header.raw_size) {
+        printf("Corrupt chunk payload\n");
+        return false;
+    }
+    return palette_decode(scratch, raw_size, blocks);
+}
@@ -0,0 +1,25 @@
+#ifndef CHUNK_CODEC_HPP
+#define CHUNK_CODEC_HPP
+
+#include "chunk.hpp"
+#include <cstdint>
+
+// Palette encoding: unique block ids + bit packed indices (values never straddle a 64 bit word).
+// Chunks with more than PALETTE_MAX_ENTRIES unique ids are stored raw at 16 bits per block.
+#define PALETTE_MAX_ENTRIES 256
+#define PALETTE_MAX_BYTES (8 + PALETTE_MAX_ENTRIES * sizeof(BlockID) + CHUNK_VOLUME * sizeof(BlockID))
+
+// On disk chunk payload: header + lz compressed palette stream
+#define CHUNK_PAYLOAD_MAX_BYTES (PALETTE_MAX_BYTES + PALETTE_MAX_BYTES / 255 + 32)
+
+// Scratch needed by chunk_encode / chunk_decode
+#define CHUNK_CODEC_SCRATCH_BYTES PALETTE_MAX_BYTES
+
+uint32_t palette_encode(const BlockID* blocks, uint8_t* out, uint32_t capacity);
+bool palette_decode(const uint8_t* in, uint32_t size, BlockID* blocks);
+
+// Returns the payload size, or 0 on failure
+uint32_t chunk_encode(const BlockID* blocks, uint8_t* out, uint32_t capacity, uint8_t* scratch);
+bool chunk_decode(const uint8_t* in, uint32_t size, BlockID* blocks, uint8_t* scratch);
+
+#endif // CHUNK_CODEC_HPP
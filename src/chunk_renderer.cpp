@@ -0,0 +1,185 @@
+#include "chunk_renderer.hpp"
+#include "streaming.hpp"
+#include <cmath>
+#include <cstring>
+
+ChunkRenderer* ChunkRenderer::Create(Arena* arr, VulkanContext* ctx, uint32_t max_meshes)
+{
+    ChunkRenderer* renderer = (ChunkRenderer*)arena_allocate(arr, sizeof(ChunkRenderer));
+    memset(renderer, 0, sizeof(*renderer));
+
+    renderer->ctx = ctx;
+    renderer->max_meshes = max_meshes;
+    renderer->meshes = (GpuChunkMesh*)arena_allocate(arr, max_meshes * sizeof(GpuChunkMesh));
+    memset(renderer->meshes, 0, max_meshes * sizeof(GpuChunkMesh));
+    renderer->free_list = (uint32_t*)arena_allocate(arr, max_meshes * sizeof(uint32_t));
+    renderer->draws = (ChunkDraw*)arena_allocate(arr, max_meshes * sizeof(ChunkDraw));
+
+    for (uint32_t i = 0; i < max_meshes; i++) {
+        renderer->free_list[i] = max_meshes - 1 - i;
+    }
+    renderer->num_free = max_meshes;
+
+    return renderer;
+}
+
+uint32_t chunk_renderer_upload(ChunkRenderer* renderer, ChunkPos pos, const ChunkMesh* mesh)
+{
+    if (renderer->num_free == 0) {
+        return MESH_HANDLE_NONE;
+    }
+
+    VulkanContext* ctx = renderer->ctx;
+    VkDeviceSize size = mesh->num_quads * 4 * sizeof(ChunkVertex);
+
+    GpuBuffer buffer;
+    if (!create_gpu_buffer(ctx, size, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+            VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, MEM_MESHES, &buffer)) {
+        return MESH_HANDLE_NONE;
+    }
+    if (!upload_buffer(ctx, buffer.buffer, 0, mesh->vertices, size)) {
+        destroy_gpu_buffer(ctx, &buffer);
+        return MESH_HANDLE_NONE;
+    }
+
+    uint32_t handle = renderer->free_list[--renderer->num_free];
+    GpuChunkMesh* gpu = &renderer->meshes[handle];
+    gpu->vertices = buffer;
+    gpu->pos = pos;
+    memcpy(gpu->lods, mesh->lods, sizeof(gpu->lods));
+    gpu->in_use = true;
+    renderer->gpu_bytes += size;
+    return handle;
+}
+
+bool chunk_renderer_patch(ChunkRenderer* renderer, uint32_t handle, const ChunkMesh* mesh)
+{
+    VulkanContext* ctx = renderer->ctx;
+    GpuChunkMesh* gpu = &renderer->meshes[handle];
+
+    bool patched[MESH_SECTIONS];
+    VkDeviceSize size = 0;
+    uint32_t num_copies = 0;
+    for (uint32_t i = 0; i < MESH_SECTIONS; i++) {
+        patched[i] = mesh_section_patched(mesh, i);
+        if (patched[i]) {
+            size += mesh->sections[i].capacity * 4 * sizeof(ChunkVertex);
+            num_copies++;
+        }
+    }
+
+    // All or nothing, a half patched mesh would show for a frame
+    if (!upload_fits(ctx, size, num_copies)) {
+        return false;
+    }
+    for (uint32_t i = 0; i < MESH_SECTIONS; i++) {
+        if (!patched[i]) {
+            continue;
+        }
+        const MeshSection* section = &mesh->sections[i];
+        VkDeviceSize offset = section->first_quad * 4 * sizeof(ChunkVertex);
+        upload_buffer(ctx, gpu->vertices.buffer, offset, mesh->vertices + section->first_quad * 4,
+            section->capacity * 4 * sizeof(ChunkVertex));
+    }
+    return true;
+}
+
+void chunk_renderer_release(ChunkRenderer* renderer, uint32_t handle)
+{
+    GpuChunkMesh* gpu = &renderer->meshes[handle];
+    renderer->gpu_bytes -= gpu->vertices.size;
+    // Frames in flight may still be drawing it
+    defer_destroy_buffer(renderer->ctx, &gpu->vertices);
+    *gpu = {};
+    renderer->free_list[renderer->num_free++] = handle;
+}
+
+static uint32_t select_lod(Vec3 eye, ChunkPos pos, float max_error)
+{
+    Vec3 min = { (float)(pos.x * CHUNK_SIZE), (float)(pos.y * CHUNK_SIZE), (float)(pos.z * CHUNK_SIZE) };
+    Vec3 closest = {
+        fminf(fmaxf(eye.x, min.x), min.x + CHUNK_SIZE),
+        fminf(fmaxf(eye.y, min.y), min.y + CHUNK_SIZE),
+        fminf(fmaxf(eye.z, min.z), min.z + CHUNK_SIZE),
+    };
+    float distance = length(closest - eye);
+
+    // max_error is in blocks at distance 1
+    for (uint32_t lod = CHUNK_LODS - 1; lod > 0; lod--) {
+        if ((float)((1 << lod) - 1) <= max_error * distance) {
+            return lod;
+        }
+    }
+    return 0;
+}
+
+void chunk_renderer_build_draws(ChunkRenderer* renderer, const Camera* camera, float screen_height, DrawList* out)
+{
+    out->view_proj = camera_view_proj(camera);
+    Frustum frustum = frustum_from_matrix(out->view_proj);
+
+    float pixels_per_block = screen_height / (2.0f * tanf(camera->fov_y * 0.5f)); // at distance 1
+    float max_error = LOD_ERROR_PIXELS / pixels_per_block;
+
+    // Origins go straight into the frame ring, room for every mesh. Nothing is drawn without it.
+    VkDeviceSize ring_offset = 0;
+    float* origins = (float*)frame_ring_allocate(renderer->ctx, renderer->max_meshes * 4 * sizeof(float), &ring_offset);
+    uint32_t max_draws = origins ? renderer->max_meshes : 0;
+
+    uint32_t num_draws = 0;
+    uint64_t drawn_quads = 0;
+    for (uint32_t i = 0; i < renderer->max_meshes && num_draws < max_draws; i++) {
+        GpuChunkMesh* gpu = &renderer->meshes[i];
+        if (!gpu->in_use) {
+            continue;
+        }
+
+        Vec3 min = { (float)(gpu->pos.x * CHUNK_SIZE), (float)(gpu->pos.y * CHUNK_SIZE), (float)(gpu->pos.z * CHUNK_SIZE) };
+        Vec3 max = { min.x + CHUNK_SIZE, min.y + CHUNK_SIZE, min.z + CHUNK_SIZE };
+        if (!frustum_test_aabb(frustum, min, max)) {
+            continue;
+        }
+
+        uint32_t lod = select_lod(camera->position, gpu->pos, max_error);
+        const MeshRange* range = &gpu->lods[lod];
+
+        // Selection only depends on position, so neighbours' lods are known without a lookup
+        uint32_t num_quads = range->num_quads;
+        for (uint32_t f = 0; f < FACE_COUNT && num_quads == range->num_quads; f++) {
+            ChunkPos npos = { gpu->pos.x + FACE_NORMALS[f][0], gpu->pos.y + FACE_NORMALS[f][1], gpu->pos.z + FACE_NORMALS[f][2] };
+            if (select_lod(camera->position, npos, max_error) != lod) {
+                num_quads += range->num_skirt_quads;
+            }
+        }
+        if (num_quads == 0) {
+            continue;
+        }
+
+        float* origin = &origins[num_draws * 4];
+        origin[0] = min.x;
+        origin[1] = min.y;
+        origin[2] = min.z;
+        origin[3] = 0.0f;
+
+        ChunkDraw* draw = &renderer->draws[num_draws++];
+        draw->vertex_buffer = gpu->vertices.buffer;
+        draw->first_quad = range->first_quad;
+        draw->num_quads = num_quads;
+        drawn_quads += num_quads;
+    }
+
+    out->draws = renderer->draws;
+    out->num_draws = num_draws;
+    out->first_origin = (uint32_t)(ring_offset / (4 * sizeof(float)));
+    out->raymarch = nullptr;
+    renderer->drawn_quads = drawn_quads;
+}
+
+void chunk_renderer_destroy(ChunkRenderer* renderer)
+{
+    for (uint32_t i = 0; i < renderer->max_meshes; i++) {
+        if (renderer->meshes[i].in_use) {
+            destroy_gpu_buffer(renderer->ctx, &renderer->meshes[i].vertices);
+        }
+    }
+}
@@ -0,0 +1,51 @@
+#ifndef CHUNK_RENDERER_HPP
+#define CHUNK_RENDERER_HPP
+
+#include "camera.hpp"
+#include "chunk.hpp"
+#include "mesher.hpp"
+#include "vulkan.hpp"
+#include <Arena.h>
+#include <cstdint>
+
+// Screen space error a lod may cause before the next finer one is used. A mip with voxels
+// 2^lod blocks wide can move a surface by up to 2^lod - 1 blocks.
+#define LOD_ERROR_PIXELS 4.0f
+
+struct GpuChunkMesh {
+    GpuBuffer vertices; // every lod back to back
+    ChunkPos pos;
+    MeshRange lods[CHUNK_LODS];
+    bool in_use;
+};
+
+struct ChunkRenderer {
+    VulkanContext* ctx;
+
+    GpuChunkMesh* meshes;
+    uint32_t* free_list;
+    uint32_t num_free;
+    uint32_t max_meshes;
+
+    ChunkDraw* draws;
+    uint64_t gpu_bytes;
+    uint64_t drawn_quads; // last build_draws, skirts included
+
+    static ChunkRenderer* Create(Arena* arr, VulkanContext* ctx, uint32_t max_meshes);
+};
+
+// Returns MESH_HANDLE_NONE if no slot, memory or staging space is left this frame
+uint32_t chunk_renderer_upload(ChunkRenderer* renderer, ChunkPos pos, const ChunkMesh* mesh);
+// Overwrites the sections of a resident mesh that a patch rebuilt (see mesh_chunk_patch).
+// False if staging can't take all of them this frame.
+bool chunk_renderer_patch(ChunkRenderer* renderer, uint32_t handle, const ChunkMesh* mesh);
+// The vertex buffer goes on the deletion queue, see defer_destroy_buffer
+void chunk_renderer_release(ChunkRenderer* renderer, uint32_t handle);
+
+// Frustum culls every resident mesh and picks its lod by screen space error.
+// out stays valid until the next call.
+void chunk_renderer_build_draws(ChunkRenderer* renderer, const Camera* camera, float screen_height, DrawList* out);
+
+void chunk_renderer_destroy(ChunkRenderer* renderer);
+
+#endif // CHUNK_RENDERER_HPP
@@ -0,0 +1,183 @@
+#include "compress.hpp"
+#include <cstring>
+
+#define LZ_MIN_MATCH 4
+#define LZ_HASH_LOG 12
+#define LZ_MAX_OFFSET 65535
+#define LZ_LAST_LITERALS 5 // never start a match this close to the end
+
+static inline uint32_t read32(const uint8_t* p)
+{
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline uint32_t lz_hash(uint32_t seq)
+{
+    return (seq * 2654435761u) >> (32 - LZ_HASH_LOG);
+}
+
+static inline uint8_t* write_length(uint8_t* op, uint8_t* oend, uint32_t len)
+{
+    while (len >= 255) {
+        if (op >= oend) {
+            return nullptr;
+        }
+        *op++ = 255;
+        len -= 255;
+    }
+    if (op >= oend) {
+        return nullptr;
+    }
+    *op++ = (uint8_t)len;
+    return op;
+}
+
+static uint8_t* emit_sequence(uint8_t* op, uint8_t* oend, const uint8_t* literals, uint32_t num_literals, uint32_t offset, uint32_t match_len)
+{
+    if (op >= oend) {
+        return nullptr;
+    }
+    uint8_t* token = op++;
+    uint32_t lit_code = num_literals < 15 ? num_literals : 15;
+    uint32_t match_code = 0;
+    if (match_len) {
+        match_code = match_len - LZ_MIN_MATCH < 15 ? match_len - LZ_MIN_MATCH : 15;
+    }
+    *token = (uint8_t)((lit_code << 4) | match_code);
+
+    if (lit_code == 15 && !(op = write_length(op, oend, num_literals - 15))) {
+        return nullptr;
+    }
+    if (op + num_literals > oend) {
+        return nullptr;
+    }
+    memcpy(op, literals, num_literals);
+    op += num_literals;
+
+    if (!match_len) {
+        return op;
+    }
+    if (op + 2 > oend) {
+        return nullptr;
+    }
+    *op++ = (uint8_t)(offset & 0xff);
+    *op++ = (uint8_t)(offset >> 8);
+
+    if (match_code == 15 && !(op = write_length(op, oend, match_len - LZ_MIN_MATCH - 15))) {
+        return nullptr;
+    }
+    return op;
+}
+
+uint32_t lz_compress(const uint8_t* src, uint32_t src_size, uint8_t* dst, uint32_t dst_capacity)
+{
+    uint32_t table[1 << LZ_HASH_LOG];
+    memset(table, 0, sizeof(table));
+
+    const uint8_t* ip = src;
+    const uint8_t* anchor = src;
+    const uint8_t* iend = src + src_size;
+    const uint8_t* mflimit = src_size > LZ_LAST_LITERALS + LZ_MIN_MATCH ? iend - LZ_LAST_LITERALS : src;
+
+    uint8_t* op = dst;
+    uint8_t* oend = dst + dst_capacity;
+
+    while (ip + LZ_MIN_MATCH <= mflimit) {
+        uint32_t seq = read32(ip);
+        uint32_t h = lz_hash(seq);
+        const uint8_t* ref = src + table[h];
+        table[h] = (uint32_t)(ip - src);
+
+        if (ref >= ip || ip - ref > LZ_MAX_OFFSET || read32(ref) != seq) {
+            ip++;
+            continue;
+        }
+
+        uint32_t len = LZ_MIN_MATCH;
+        while (ip + len < mflimit && ref[len] == ip[len]) {
+            len++;
+        }
+
+        op = emit_sequence(op, oend, anchor, (uint32_t)(ip - anchor), (uint32_t)(ip - ref), len);
+        if (!op) {
+            return 0;
+        }
+        ip += len;
+        anchor = ip;
+    }
+
+    op = emit_sequence(op, oend, anchor, (uint32_t)(iend - anchor), 0, 0);
+    if (!op) {
+        return 0;
+    }
+    return (uint32_t)(op - dst);
+}
+
+static inline bool read_length(const uint8_t** ip, const uint8_t* iend, uint32_t* len)
+{
+    uint8_t b;
+    do {
+        if (*ip >= iend) {
+            return false;
+        }
+        b = *(*ip)++;
+        *len += b;
+    } while (b == 255);
+    return true;
+}
+
+uint32_t lz_decompress(const uint8_t* src, uint32_t src_size, uint8_t* dst, uint32_t dst_capacity)
+{
+    const uint8_t* ip = src;
+    const uint8_t* iend = src + src_size;
+    uint8_t* op = dst;
+    uint8_t* oend = dst + dst_capacity;
+
+    while (ip < iend) {
+        uint8_t token = *ip++;
+
+        uint32_t num_literals = token >> 4;
+        if (num_literals == 15 && !read_length(&ip, iend, &num_literals)) {
+            return 0;
+        }
+        if (ip + num_literals > iend || op + num_literals > oend) {
+            return 0;
+        }
+        memcpy(op, ip, num_literals);
+        ip += num_literals;
+        op += num_literals;
+
+        if (ip == iend) {
+            break; // last sequence carries no match
+        }
+
+        if (ip + 2 > iend) {
+            return 0;
+        }
+        uint32_t offset = ip[0] | (ip[1] << 8);
+        ip += 2;
+        if (offset == 0 || offset > (uint32_t)(op - dst)) {
+            return 0;
+        }
+
+        uint32_t match_len = token & 15;
+        if (match_len == 15 && !read_length(&ip, iend, &match_len)) {
+            return 0;
+        }
+        match_len += LZ_MIN_MATCH;
+        if (op + match_len > oend) {
+            return 0;
+        }
+
+        // byte copy, matches may overlap the output
+        const uint8_t* match = op - offset;
+        for (uint32_t i = 0; i < match_len; i++) {
+            op[i] = match[i];
+        }
+        op += match_len;
+    }
+
+    return (uint32_t)(op - dst);
+}
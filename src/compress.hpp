@@ -0,0 +1,20 @@
+#ifndef COMPRESS_HPP
+#define COMPRESS_HPP
+
+#include <cstdint>
+
+// Small LZ77 byte compressor using the LZ4 block layout (token, literals, 16 bit offset, match).
+// Fast enough to run per chunk on worker threads, decent ratio on paletted voxel data.
+
+inline uint32_t lz_bound(uint32_t size)
+{
+    return size + size / 255 + 16;
+}
+
+// Returns the compressed size, or 0 if dst_capacity is too small
+uint32_t lz_compress(const uint8_t* src, uint32_t src_size, uint8_t* dst, uint32_t dst_capacity);
+
+// Returns the decompressed size, or 0 on malformed input / overflow
+uint32_t lz_decompress(const uint8_t* src, uint32_t src_size, uint8_t* dst, uint32_t dst_capacity);
+
+#endif // COMPRESS_HPP
@@ -0,0 +1,246 @@
+#include "cpu_raymarcher.hpp"
+#include "mesher.hpp"
+#include "trace.hpp"
+#include <cmath>
+#include <new>
+
+#define SKY_COLOR 0xffebb887 // same as the clear color
+#define MAX_PACKET_STEPS 4096
+
+CpuRaymarcher* CpuRaymarcher::Create(Arena* arr, JobSystem* jobs, uint32_t max_width, uint32_t max_height, const CpuRaymarchConfig& config)
+{
+    CpuRaymarcher* rm = new (arena_allocate(arr, sizeof(CpuRaymarcher))) CpuRaymarcher();
+    rm->jobs = jobs;
+    rm->config = config;
+    rm->max_pixels = max_width * max_height;
+    rm->pixels = (uint32_t*)arena_allocate(arr, rm->max_pixels * sizeof(uint32_t));
+    return rm;
+}
+
+// Lanes are kept as structure of arrays, so the stepping loop runs all 8 at once
+struct RayPacket {
+    float ox[CPU_RAY_PACKET], oy[CPU_RAY_PACKET], oz[CPU_RAY_PACKET];
+    float dx[CPU_RAY_PACKET], dy[CPU_RAY_PACKET], dz[CPU_RAY_PACKET];
+
+    // DDA state
+    int32_t vx[CPU_RAY_PACKET], vy[CPU_RAY_PACKET], vz[CPU_RAY_PACKET]; // current voxel
+    int32_t sx[CPU_RAY_PACKET], sy[CPU_RAY_PACKET], sz[CPU_RAY_PACKET]; // step per axis, +-1
+    float tx[CPU_RAY_PACKET], ty[CPU_RAY_PACKET], tz[CPU_RAY_PACKET]; // t of the next boundary per axis
+    float ddx[CPU_RAY_PACKET], ddy[CPU_RAY_PACKET], ddz[CPU_RAY_PACKET]; // t per voxel per axis
+    float t[CPU_RAY_PACKET]; // where the current voxel was entered
+    int32_t axis[CPU_RAY_PACKET]; // of the boundary crossed into it
+
+    // Chunk of the current voxel, looked up again only when a lane leaves it
+    const Chunk* chunk[CPU_RAY_PACKET];
+    ChunkPos chunk_pos[CPU_RAY_PACKET];
+
+    uint32_t color[CPU_RAY_PACKET];
+};
+
+static inline float safe_inverse(float d)
+{
+    return fabsf(d) < 1e-8f ? 1e30f : 1.0f / d;
+}
+
+// (Re)starts the DDA of lane l at distance t along its ray
+static void lane_start(RayPacket* p, uint32_t l, float t, int32_t axis)
+{
+    float x = p->ox[l] + p->dx[l] * t;
+    float y = p->oy[l] + p->dy[l] * t;
+    float z = p->oz[l] + p->dz[l] * t;
+    p->vx[l] = (int32_t)floorf(x);
+    p->vy[l] = (int32_t)floorf(y);
+    p->vz[l] = (int32_t)floorf(z);
+    p->sx[l] = p->dx[l] >= 0.0f ? 1 : -1;
+    p->sy[l] = p->dy[l] >= 0.0f ? 1 : -1;
+    p->sz[l] = p->dz[l] >= 0.0f ? 1 : -1;
+
+    float ix = safe_inverse(p->dx[l]);
+    float iy = safe_inverse(p->dy[l]);
+    float iz = safe_inverse(p->dz[l]);
+    p->ddx[l] = fabsf(ix);
+    p->ddy[l] = fabsf(iy);
+    p->ddz[l] = fabsf(iz);
+    p->tx[l] = ((float)(p->vx[l] + (p->sx[l] > 0)) - p->ox[l]) * ix;
+    p->ty[l] = ((float)(p->vy[l] + (p->sy[l] > 0)) - p->oy[l]) * iy;
+    p->tz[l] = ((float)(p->vz[l] + (p->sz[l] > 0)) - p->oz[l]) * iz;
+    p->t[l] = t;
+    p->axis[l] = axis;
+}
+
+// Distance at which lane l leaves its current chunk
+static float chunk_exit(const RayPacket* p, uint32_t l)
+{
+    ChunkPos c = chunk_pos_from_block(p->vx[l], p->vy[l], p->vz[l]);
+    float bx = (float)(c.x * CHUNK_SIZE + (p->sx[l] > 0 ? CHUNK_SIZE : 0));
+    float by = (float)(c.y * CHUNK_SIZE + (p->sy[l] > 0 ? CHUNK_SIZE : 0));
+    float bz = (float)(c.z * CHUNK_SIZE + (p->sz[l] > 0 ? CHUNK_SIZE : 0));
+    float ex = (bx - p->ox[l]) * safe_inverse(p->dx[l]);
+    float ey = (by - p->oy[l]) * safe_inverse(p->dy[l]);
+    float ez = (bz - p->oz[l]) * safe_inverse(p->dz[l]);
+    return fminf(ex, fminf(ey, ez));
+}
+
+static uint32_t shade_hit(const RayPacket* p, uint32_t l, BlockID block, float max_distance)
+{
+    uint32_t face = p->axis[l] * 2 + (p->axis[l] == 0 ? p->sx[l] > 0 : p->axis[l] == 1 ? p->sy[l] > 0 : p->sz[l] > 0);
+    uint32_t lit = shade_color(BLOCK_COLORS[block], FACE_SHADE[face]);
+
+    // Fade into the sky towards the far end
+    float fog = fminf(p->t[l] / max_distance, 1.0f);
+    uint32_t out = 0xff000000;
+    for (uint32_t c = 0; c < 24; c += 8) {
+        float a = (float)((lit >> c) & 0xff);
+        float b = (float)((SKY_COLOR >> c) & 0xff);
+        out |= (uint32_t)(a + (b - a) * fog) << c;
+    }
+    return out;
+}
+
+static void trace_packet(const CpuRaymarcher* rm, RayPacket* p)
+{
+    const CpuRaymarchConfig& config = rm->config;
+    const int32_t min_y = config.min_chunk_y * CHUNK_SIZE;
+    const int32_t max_y = (config.max_chunk_y + 1) * CHUNK_SIZE;
+
+    uint32_t active = (1u << CPU_RAY_PACKET) - 1;
+    for (uint32_t l = 0; l < CPU_RAY_PACKET; l++) {
+        lane_start(p, l, 0.0f, 1);
+        p->chunk[l] = nullptr;
+        p->chunk_pos[l] = { INT32_MAX, INT32_MAX, INT32_MAX };
+        p->color[l] = SKY_COLOR;
+    }
+
+    for (uint32_t step = 0; step < MAX_PACKET_STEPS && active; step++) {
+        // Per lane: sample the voxel, gathers don't vectorize
+        for (uint32_t l = 0; l < CPU_RAY_PACKET; l++) {
+            if (!(active & (1u << l))) {
+                continue;
+            }
+            if (p->t[l] > config.max_distance) {
+                active &= ~(1u << l);
+                continue;
+            }
+
+            // Above or below the world: done if heading away, otherwise skip ahead to it
+            int32_t y = p->vy[l];
+            if (y < min_y || y >= max_y) {
+                if ((y < min_y) == (p->sy[l] < 0)) {
+                    active &= ~(1u << l);
+                } else {
+                    lane_start(p, l, chunk_exit(p, l) + 1e-3f, 1);
+                }
+                continue;
+            }
+
+            ChunkPos c = chunk_pos_from_block(p->vx[l], y, p->vz[l]);
+            if (c != p->chunk_pos[l]) {
+                Chunk* chunk = world_get_chunk(rm->world, c);
+                bool ready = chunk && chunk->state.load(std::memory_order_acquire) == CHUNK_STATE_READY;
+                p->chunk[l] = ready ? chunk : nullptr;
+                p->chunk_pos[l] = c;
+            }
+            if (!p->chunk[l]) {
+                float t = chunk_exit(p, l);
+                int32_t axis = p->axis[l];
+                lane_start(p, l, t + 1e-3f, axis);
+                continue;
+            }
+
+            BlockID block = p->chunk[l]->blocks[chunk_index(p->vx[l] & CHUNK_MASK, y & CHUNK_MASK, p->vz[l] & CHUNK_MASK)];
+            if (block != BLOCK_AIR) {
+                p->color[l] = shade_hit(p, l, block, config.max_distance);
+                active &= ~(1u << l);
+            }
+        }
+
+        // All lanes: step to the next voxel along the closest boundary. Branch free, lanes
+        // that are done step too and get ignored.
+        for (uint32_t l = 0; l < CPU_RAY_PACKET; l++) {
+            bool step_x = p->tx[l] <= p->ty[l] && p->tx[l] <= p->tz[l];
+            bool step_y = !step_x && p->ty[l] <= p->tz[l];
+            bool step_z = !step_x && !step_y;
+            p->t[l] = step_x ? p->tx[l] : (step_y ? p->ty[l] : p->tz[l]);
+            p->vx[l] += step_x ? p->sx[l] : 0;
+            p->vy[l] += step_y ? p->sy[l] : 0;
+            p->vz[l] += step_z ? p->sz[l] : 0;
+            p->tx[l] += step_x ? p->ddx[l] : 0.0f;
+            p->ty[l] += step_y ? p->ddy[l] : 0.0f;
+            p->tz[l] += step_z ? p->ddz[l] : 0.0f;
+            p->axis[l] = step_x ? 0 : (step_y ? 1 : 2);
+        }
+    }
+}
+
+static void trace_tile(CpuRaymarcher* rm, uint32_t tile)
+{
+    uint32_t x0 = (tile % rm->tiles_x) * CPU_TILE_SIZE;
+    uint32_t y0 = (tile / rm->tiles_x) * CPU_TILE_SIZE;
+    const uint32_t packet_height = CPU_RAY_PACKET / CPU_PACKET_WIDTH;
+
+    RayPacket p;
+    for (uint32_t py = y0; py < y0 + CPU_TILE_SIZE && py < rm->height; py += packet_height) {
+        for (uint32_t px = x0; px < x0 + CPU_TILE_SIZE && px < rm->width; px += CPU_PACKET_WIDTH) {
+            for (uint32_t l = 0; l < CPU_RAY_PACKET; l++) {
+                float nx = ((float)(px + l % CPU_PACKET_WIDTH) + 0.5f) / rm->width * 2.0f - 1.0f;
+                float ny = ((float)(py + l / CPU_PACKET_WIDTH) + 0.5f) / rm->height * 2.0f - 1.0f;
+                // Image rows go down, like the swapchain
+                Vec3 d = normalize(rm->forward + rm->right * nx - rm->up * ny);
+                p.ox[l] = rm->origin.x;
+                p.oy[l] = rm->origin.y;
+                p.oz[l] = rm->origin.z;
+                p.dx[l] = d.x;
+                p.dy[l] = d.y;
+                p.dz[l] = d.z;
+            }
+
+            trace_packet(rm, &p);
+
+            for (uint32_t l = 0; l < CPU_RAY_PACKET; l++) {
+                uint32_t x = px + l % CPU_PACKET_WIDTH;
+                uint32_t y = py + l / CPU_PACKET_WIDTH;
+                if (x < rm->width && y < rm->height) {
+                    rm->pixels[y * rm->width + x] = p.color[l];
+                }
+            }
+        }
+    }
+}
+
+static void tile_job(void* data)
+{
+    TRACE_SCOPE("raymarch tiles");
+    CpuRaymarcher* rm = (CpuRaymarcher*)data;
+    uint32_t tile;
+    while ((tile = rm->next_tile.fetch_add(1, std::memory_order_relaxed)) < rm->num_tiles) {
+        trace_tile(rm, tile);
+    }
+}
+
+void cpu_raymarch(CpuRaymarcher* rm, World* world, const Camera* camera, uint32_t width, uint32_t height)
+{
+    if (width * height > rm->max_pixels) {
+        printf("CPU ray march of %ux%u is larger than the %u pixel buffer\n", width, height, rm->max_pixels);
+        return;
+    }
+
+    float half_height = tanf(camera->fov_y * 0.5f);
+    float aspect = (float)width / (float)height;
+    rm->world = world;
+    rm->width = width;
+    rm->height = height;
+    rm->origin = camera->position;
+    rm->forward = camera_forward(camera);
+    rm->right = camera_right(camera) * (half_height * aspect);
+    rm->up = cross(camera_right(camera), rm->forward) * half_height;
+
+    rm->tiles_x = (width + CPU_TILE_SIZE - 1) / CPU_TILE_SIZE;
+    rm->num_tiles = rm->tiles_x * ((height + CPU_TILE_SIZE - 1) / CPU_TILE_SIZE);
+    rm->next_tile.store(0, std::memory_order_relaxed);
+
+    // One puller per thread, job_wait has the calling thread take one as well
+    for (uint32_t i = 0; i <= rm->jobs->num_workers; i++) {
+        job_submit(rm->jobs, tile_job, rm, &rm->counter);
+    }
+    job_wait(rm->jobs, &rm->counter);
+}
@@ -0,0 +1,53 @@
+#ifndef CPU_RAYMARCHER_HPP
+#define CPU_RAYMARCHER_HPP
+
+#include "camera.hpp"
+#include "jobs.hpp"
+#include "world.hpp"
+#include <Arena.h>
+#include <atomic>
+#include <cstdint>
+
+// Software ray marcher over the loaded chunks. Runs without a GPU (thumbnails and map previews
+// on servers) and is the baseline the GPU path gets compared against.
+// The image is cut into tiles that every worker pulls from a shared counter. Each tile is traced
+// in packets of 8 rays (4x2 pixels) that take their DDA steps together.
+
+#define CPU_RAY_PACKET 8
+#define CPU_PACKET_WIDTH 4
+#define CPU_TILE_SIZE 32 // pixels, a multiple of the packet size
+
+struct CpuRaymarchConfig {
+    float max_distance; // blocks, fades into the sky
+    int32_t min_chunk_y; // vertical extent of the world, in chunks
+    int32_t max_chunk_y;
+};
+
+struct CpuRaymarcher {
+    JobSystem* jobs;
+    CpuRaymarchConfig config;
+
+    uint32_t* pixels; // RGBA8 (0xAABBGGRR), width * height
+    uint32_t width;
+    uint32_t height;
+    uint32_t max_pixels;
+
+    // The frame being traced, read by the tile jobs
+    World* world;
+    Vec3 origin;
+    Vec3 forward;
+    Vec3 right; // scaled to the edge of the screen
+    Vec3 up;
+    uint32_t tiles_x;
+    uint32_t num_tiles;
+    std::atomic<uint32_t> next_tile;
+    JobCounter counter;
+
+    static CpuRaymarcher* Create(Arena* arr, JobSystem* jobs, uint32_t max_width, uint32_t max_height, const CpuRaymarchConfig& config);
+};
+
+// Traces a width x height image into rm->pixels and blocks until it is done, the calling
+// thread traces too. Reads chunks without locking, so nothing may change the world meanwhile.
+void cpu_raymarch(CpuRaymarcher* rm, World* world, const Camera* camera, uint32_t width, uint32_t height);
+
+#endif // CPU_RAYMARCHER_HPP
@@ -0,0 +1,297 @@
+#include "host_allocator.hpp"
+#include "memory.hpp"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+
+#define HOST_MAX_ALIGNMENT 4096
+
+enum BlockSource : uint8_t {
+    SOURCE_MALLOC,
+    SOURCE_POOL,
+    SOURCE_COMMAND,
+};
+
+// In front of every allocation handed to the driver, which keeps them 16 byte aligned
+struct BlockHeader {
+    void* owner; // HostPool or CommandArena, null for malloc
+    uint32_t size; // as requested
+    uint16_t offset; // from what was allocated to the allocation
+    BlockSource source;
+    uint8_t scope;
+};
+static_assert(sizeof(BlockHeader) == 16, "allocations have to stay 16 byte aligned");
+
+struct CommandArena {
+    uint8_t* base;
+    uint32_t used;
+    std::atomic<int32_t> live; // freed from any thread, only reset by the owner
+
+    ~CommandArena()
+    {
+        if (base) {
+            free(base);
+            memory_track(MEM_CPU, MEM_DRIVER, -(int64_t)HOST_COMMAND_ARENA_BYTES);
+        }
+    }
+};
+
+static thread_local CommandArena command_arena {};
+
+static inline BlockHeader* header_of(void* memory)
+{
+    return (BlockHeader*)memory - 1;
+}
+
+// ---Command scope---
+
+static uint8_t* command_allocate(HostAllocator* allocator, size_t bytes)
+{
+    CommandArena* arena = &command_arena;
+    if (!arena->base) {
+        arena->base = (uint8_t*)malloc(HOST_COMMAND_ARENA_BYTES);
+        if (!arena->base) {
+            return nullptr;
+        }
+        allocator->system_allocs.fetch_add(1, std::memory_order_relaxed);
+        memory_track(MEM_CPU, MEM_DRIVER, HOST_COMMAND_ARENA_BYTES);
+    }
+    if (arena->live.load(std::memory_order_acquire) == 0) {
+        arena->used = 0;
+    }
+    bytes = (bytes + 15) & ~(size_t)15;
+    if (arena->used + bytes > HOST_COMMAND_ARENA_BYTES) {
+        return nullptr;
+    }
+    uint8_t* block = arena->base + arena->used;
+    arena->used += (uint32_t)bytes;
+    arena->live.fetch_add(1, std::memory_order_relaxed);
+    return block;
+}
+
+// ---Object scope---
+
+static int pool_class(size_t bytes)
+{
+    for (int c = 0; c < HOST_POOL_CLASSES; c++) {
+        if (bytes <= ((size_t)HOST_POOL_MIN_BLOCK << c)) {
+            return c;
+        }
+    }
+    return -1;
+}
+
+static uint8_t* pool_allocate(HostAllocator* allocator, HostPool* pool)
+{
+    std::lock_guard<std::mutex> guard(pool->lock);
+    if (!pool->free) {
+        uint8_t* slab = (uint8_t*)malloc(HOST_POOL_SLAB_BYTES);
+        if (!slab) {
+            return nullptr;
+        }
+        allocator->system_allocs.fetch_add(1, std::memory_order_relaxed);
+        memory_track(MEM_CPU, MEM_DRIVER, HOST_POOL_SLAB_BYTES);
+        *(void**)slab = pool->slabs;
+        pool->slabs = slab;
+        // The first 16 bytes link the slabs
+        for (uint32_t at = 16; at + pool->block_size <= HOST_POOL_SLAB_BYTES; at += pool->block_size) {
+            *(void**)(slab + at) = pool->free;
+            pool->free = slab + at;
+        }
+    }
+    uint8_t* block = (uint8_t*)pool->free;
+    pool->free = *(void**)block;
+    return block;
+}
+
+static void pool_free(HostPool* pool, void* block)
+{
+    std::lock_guard<std::mutex> guard(pool->lock);
+    *(void**)block = pool->free;
+    pool->free = block;
+}
+
+// ---Callbacks---
+
+static void* host_allocate_block(HostAllocator* allocator, size_t size, size_t alignment, VkSystemAllocationScope scope)
+{
+    if (size > UINT32_MAX || alignment > HOST_MAX_ALIGNMENT) {
+        return nullptr;
+    }
+    size_t bytes = size + sizeof(BlockHeader);
+
+    uint8_t* block = nullptr;
+    void* owner = nullptr;
+    BlockSource source = SOURCE_MALLOC;
+    if (alignment <= sizeof(BlockHeader)) {
+        int c = pool_class(bytes);
+        if (scope == VK_SYSTEM_ALLOCATION_SCOPE_COMMAND) {
+            block = command_allocate(allocator, bytes);
+            owner = &command_arena;
+            source = SOURCE_COMMAND;
+        } else if (scope == VK_SYSTEM_ALLOCATION_SCOPE_OBJECT && c >= 0) {
+            block = pool_allocate(allocator, &allocator->pools[c]);
+            owner = &allocator->pools[c];
+            source = SOURCE_POOL;
+        }
+    }
+
+    uint8_t* memory;
+    if (block) {
+        memory = block + sizeof(BlockHeader);
+    } else {
+        owner = nullptr;
+        source = SOURCE_MALLOC;
+        if (alignment < sizeof(BlockHeader)) {
+            alignment = sizeof(BlockHeader);
+        }
+        block = (uint8_t*)malloc(bytes + alignment);
+        if (!block) {
+            return nullptr;
+        }
+        allocator->system_allocs.fetch_add(1, std::memory_order_relaxed);
+        memory = (uint8_t*)(((uintptr_t)block + sizeof(BlockHeader) + alignment - 1) & ~(uintptr_t)(alignment - 1));
+        memory_track(MEM_CPU, MEM_DRIVER, (int64_t)(size + (memory - block))); // the unused alignment tail aside
+    }
+
+    BlockHeader* header = header_of(memory);
+    header->owner = owner;
+    header->size = (uint32_t)size;
+    header->offset = (uint16_t)(memory - block);
+    header->source = source;
+    header->scope = (uint8_t)scope;
+
+    allocator->live_allocations.fetch_add(1, std::memory_order_relaxed);
+    allocator->live_bytes.fetch_add((int64_t)size, std::memory_order_relaxed);
+    return memory;
+}
+
+static void host_free_block(HostAllocator* allocator, void* memory)
+{
+    BlockHeader* header = header_of(memory);
+    uint8_t* block = (uint8_t*)memory - header->offset;
+    allocator->live_allocations.fetch_sub(1, std::memory_order_relaxed);
+    allocator->live_bytes.fetch_sub(header->size, std::memory_order_relaxed);
+
+    switch (header->source) {
+    case SOURCE_COMMAND:
+        ((CommandArena*)header->owner)->live.fetch_sub(1, std::memory_order_release);
+        break;
+    case SOURCE_POOL:
+        pool_free((HostPool*)header->owner, block);
+        break;
+    case SOURCE_MALLOC:
+        memory_track(MEM_CPU, MEM_DRIVER, -(int64_t)(header->size + header->offset));
+        free(block);
+        break;
+    }
+}
+
+static void* VKAPI_CALL host_allocation(void* user_data, size_t size, size_t alignment, VkSystemAllocationScope scope)
+{
+    HostAllocator* allocator = (HostAllocator*)user_data;
+    allocator->calls[scope].fetch_add(1, std::memory_order_relaxed);
+    return host_allocate_block(allocator, size, alignment, scope);
+}
+
+static void* VKAPI_CALL host_reallocation(void* user_data, void* original, size_t size, size_t alignment, VkSystemAllocationScope scope)
+{
+    HostAllocator* allocator = (HostAllocator*)user_data;
+    if (!original) {
+        return host_allocation(user_data, size, alignment, scope);
+    }
+    if (size == 0) {
+        host_free_block(allocator, original);
+        return nullptr;
+    }
+    allocator->calls[scope].fetch_add(1, std::memory_order_relaxed);
+    void* memory = host_allocate_block(allocator, size, alignment, scope);
+    if (memory) {
+        uint32_t old_size = header_of(original)->size;
+        memcpy(memory, original, old_size < size ? old_size : size);
+        host_free_block(allocator, original);
+    }
+    return memory;
+}
+
+static void VKAPI_CALL host_free(void* user_data, void* memory)
+{
+    if (memory) {
+        host_free_block((HostAllocator*)user_data, memory);
+    }
+}
+
+static void VKAPI_CALL host_internal_allocation(void* user_data, size_t size, VkInternalAllocationType, VkSystemAllocationScope)
+{
+    ((HostAllocator*)user_data)->internal_bytes.fetch_add((int64_t)size, std::memory_order_relaxed);
+    memory_track(MEM_CPU, MEM_DRIVER, (int64_t)size);
+}
+
+static void VKAPI_CALL host_internal_free(void* user_data, size_t size, VkInternalAllocationType, VkSystemAllocationScope)
+{
+    ((HostAllocator*)user_data)->internal_bytes.fetch_sub((int64_t)size, std::memory_order_relaxed);
+    memory_track(MEM_CPU, MEM_DRIVER, -(int64_t)size);
+}
+
+HostAllocator* HostAllocator::Create(Arena* arr)
+{
+    HostAllocator* allocator = new (arena_allocate(arr, sizeof(HostAllocator))) HostAllocator();
+    for (uint32_t c = 0; c < HOST_POOL_CLASSES; c++) {
+        allocator->pools[c].block_size = HOST_POOL_MIN_BLOCK << c;
+    }
+    allocator->callbacks.pUserData = allocator;
+    allocator->callbacks.pfnAllocation = host_allocation;
+    allocator->callbacks.pfnReallocation = host_reallocation;
+    allocator->callbacks.pfnFree = host_free;
+    allocator->callbacks.pfnInternalAllocation = host_internal_allocation;
+    allocator->callbacks.pfnInternalFree = host_internal_free;
+    return allocator;
+}
+
+void host_allocator_frame(HostAllocator* allocator)
+{
+    uint64_t calls = 0;
+    for (uint32_t s = 0; s < HOST_SCOPE_COUNT; s++) {
+        calls += allocator->calls[s].load(std::memory_order_relaxed);
+    }
+    uint64_t system_allocs = allocator->system_allocs.load(std::memory_order_relaxed);
+    allocator->frame_calls = calls - allocator->last_calls;
+    allocator->frame_system_allocs = system_allocs - allocator->last_system_allocs;
+    allocator->last_calls = calls;
+    allocator->last_system_allocs = system_allocs;
+}
+
+static const char* SCOPE_NAMES[HOST_SCOPE_COUNT] = { "command", "object", "cache", "device", "instance" };
+
+void host_allocator_print(const HostAllocator* allocator)
+{
+    printf("driver host allocations: %lld live (%.2f MB), %.2f MB internal, last frame %llu (%llu malloc)\n",
+        (long long)allocator->live_allocations.load(), allocator->live_bytes.load() / (1024.0 * 1024.0),
+        allocator->internal_bytes.load() / (1024.0 * 1024.0), (unsigned long long)allocator->frame_calls,
+        (unsigned long long)allocator->frame_system_allocs);
+    printf("    by scope:");
+    for (uint32_t s = 0; s < HOST_SCOPE_COUNT; s++) {
+        printf(" %s %llu", SCOPE_NAMES[s], (unsigned long long)allocator->calls[s].load());
+    }
+    printf(", %llu malloc\n", (unsigned long long)allocator->system_allocs.load());
+}
+
+void host_allocator_destroy(HostAllocator* allocator)
+{
+    int64_t leaked = allocator->live_allocations.load();
+    if (leaked != 0) {
+        printf("Vulkan leaked %lld host allocations (%lld bytes)\n", (long long)leaked, (long long)allocator->live_bytes.load());
+    }
+    for (uint32_t c = 0; c < HOST_POOL_CLASSES; c++) {
+        HostPool* pool = &allocator->pools[c];
+        while (pool->slabs) {
+            void* next = *(void**)pool->slabs;
+            free(pool->slabs);
+            memory_track(MEM_CPU, MEM_DRIVER, -(int64_t)HOST_POOL_SLAB_BYTES);
+            pool->slabs = next;
+        }
+        pool->free = nullptr;
+    }
+    allocator->~HostAllocator();
+}
@@ -0,0 +1,61 @@
+#ifndef HOST_ALLOCATOR_HPP
+#define HOST_ALLOCATOR_HPP
+
+#include <Arena.h>
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <vulkan/vulkan.h>
+
+// The host memory the Vulkan driver allocates for us, through the VkAllocationCallbacks every
+// create and destroy call gets from VulkanContext::allocator. Everything counts towards
+// MEM_DRIVER, and the allocations live at exit are reported as leaks.
+//
+// Small allocations don't go to malloc one by one: COMMAND scope ones only live for the call that
+// made them and come from a bump arena per thread, reset whenever everything in it has been freed
+// again. OBJECT scope ones come from free lists of fixed size blocks carved out of bigger slabs,
+// which is most of what command buffer recording and descriptor updates ask for. Anything larger,
+// more aligned or longer lived is a tracked malloc.
+
+#define HOST_POOL_CLASSES 6 // blocks of 64 bytes to 2KB, header included
+#define HOST_POOL_MIN_BLOCK 64
+#define HOST_POOL_SLAB_BYTES (64 * 1024)
+#define HOST_COMMAND_ARENA_BYTES (64 * 1024) // per thread that calls into the driver
+#define HOST_SCOPE_COUNT 5 // VkSystemAllocationScope
+
+struct HostPool {
+    std::mutex lock;
+    void* free; // blocks linked through their first bytes
+    void* slabs; // linked the same way
+    uint32_t block_size;
+};
+
+struct HostAllocator {
+    VkAllocationCallbacks callbacks;
+    HostPool pools[HOST_POOL_CLASSES];
+
+    std::atomic<uint64_t> calls[HOST_SCOPE_COUNT]; // allocations and reallocations the driver asked for
+    std::atomic<uint64_t> system_allocs; // the mallocs that took
+    std::atomic<int64_t> live_allocations;
+    std::atomic<int64_t> live_bytes; // as requested
+    std::atomic<int64_t> internal_bytes; // the driver's own, it only tells us about them
+
+    // Of the last finished frame, see host_allocator_frame
+    uint64_t frame_calls;
+    uint64_t frame_system_allocs;
+    uint64_t last_calls;
+    uint64_t last_system_allocs;
+
+    static HostAllocator* Create(Arena* arr);
+};
+
+// Turns the running counts into the last frame's, once per frame
+void host_allocator_frame(HostAllocator* allocator);
+
+void host_allocator_print(const HostAllocator* allocator);
+
+// After everything was destroyed, including the instance. Prints what the driver never gave back
+// and frees the pools, which leaked blocks may still be pointing into.
+void host_allocator_destroy(HostAllocator* allocator);
+
+#endif // HOST_ALLOCATOR_HPP
@@ -0,0 +1,206 @@
+#include "jobs.hpp"
+#include "trace.hpp"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <new>
+
+// Index of the pool thread, num_workers (the caller row) everywhere else
+static thread_local uint32_t worker_index = UINT32_MAX;
+
+static void run_job(Job job)
+{
+    job.fn(job.data);
+    if (job.counter) {
+        job.counter->pending.fetch_sub(1, std::memory_order_acq_rel);
+    }
+}
+
+static bool pop_job(JobSystem* jobs, Job* out)
+{
+    if (jobs->urgent_count > 0) {
+        *out = jobs->urgent[jobs->urgent_head];
+        jobs->urgent_head = (jobs->urgent_head + 1) % JOB_URGENT_CAPACITY;
+        jobs->urgent_count--;
+        return true;
+    }
+    if (jobs->count == 0) {
+        return false;
+    }
+    *out = jobs->queue[jobs->head];
+    jobs->head = (jobs->head + 1) % jobs->queue_capacity;
+    jobs->count--;
+    return true;
+}
+
+static void worker_main(JobSystem* jobs, uint32_t index)
+{
+    trace_name_thread("worker");
+    worker_index = index;
+    while (true) {
+        Job job;
+        {
+            std::unique_lock<std::mutex> guard(jobs->lock);
+            jobs->wake.wait(guard, [jobs] { return jobs->count > 0 || jobs->urgent_count > 0 || !jobs->running; });
+            if (!pop_job(jobs, &job)) {
+                return; // shutting down and drained
+            }
+        }
+        run_job(job);
+    }
+}
+
+JobSystem* JobSystem::Create(Arena* arr, uint32_t num_workers, uint32_t queue_capacity)
+{
+    JobSystem* jobs = new (arena_allocate(arr, sizeof(JobSystem))) JobSystem();
+
+    if (num_workers == 0) {
+        uint32_t hw = std::thread::hardware_concurrency();
+        num_workers = hw > 1 ? hw - 1 : 1;
+    }
+
+    jobs->queue = (Job*)arena_allocate(arr, queue_capacity * sizeof(Job));
+    jobs->queue_capacity = queue_capacity;
+    jobs->head = 0;
+    jobs->count = 0;
+    jobs->urgent_head = 0;
+    jobs->urgent_count = 0;
+    jobs->running = true;
+
+    jobs->num_workers = num_workers;
+    jobs->scratch = (Arena**)arena_allocate(arr, (num_workers + 1) * JOB_SCRATCH_COUNT * sizeof(Arena*));
+    memset(jobs->scratch, 0, (num_workers + 1) * JOB_SCRATCH_COUNT * sizeof(Arena*));
+    jobs->workers = (std::thread*)arena_allocate(arr, num_workers * sizeof(std::thread));
+    for (uint32_t i = 0; i < num_workers; i++) {
+        new (&jobs->workers[i]) std::thread(worker_main, jobs, i);
+    }
+
+    return jobs;
+}
+
+void job_submit(JobSystem* jobs, JobFn fn, void* data, JobCounter* counter)
+{
+    Job job = { fn, data, counter };
+    if (counter) {
+        counter->pending.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    {
+        std::lock_guard<std::mutex> guard(jobs->lock);
+        if (jobs->count < jobs->queue_capacity) {
+            jobs->queue[(jobs->head + jobs->count) % jobs->queue_capacity] = job;
+            jobs->count++;
+            jobs->wake.notify_one();
+            return;
+        }
+    }
+
+    run_job(job);
+}
+
+void job_submit_urgent(JobSystem* jobs, JobFn fn, void* data, JobCounter* counter)
+{
+    Job job = { fn, data, counter };
+    counter->pending.fetch_add(1, std::memory_order_relaxed);
+
+    {
+        std::lock_guard<std::mutex> guard(jobs->lock);
+        if (jobs->urgent_count < JOB_URGENT_CAPACITY) {
+            jobs->urgent[(jobs->urgent_head + jobs->urgent_count) % JOB_URGENT_CAPACITY] = job;
+            jobs->urgent_count++;
+            jobs->wake.notify_one();
+            return;
+        }
+    }
+
+    run_job(job);
+}
+
+// Takes the oldest urgent job of the counter out of the lane, the ones behind it move up
+static bool pop_urgent_job(JobSystem* jobs, JobCounter* counter, Job* out)
+{
+    for (uint32_t i = 0; i < jobs->urgent_count; i++) {
+        uint32_t slot = (jobs->urgent_head + i) % JOB_URGENT_CAPACITY;
+        if (jobs->urgent[slot].counter != counter) {
+            continue;
+        }
+        *out = jobs->urgent[slot];
+        for (uint32_t j = i + 1; j < jobs->urgent_count; j++) {
+            jobs->urgent[(jobs->urgent_head + j - 1) % JOB_URGENT_CAPACITY] = jobs->urgent[(jobs->urgent_head + j) % JOB_URGENT_CAPACITY];
+        }
+        jobs->urgent_count--;
+        return true;
+    }
+    return false;
+}
+
+bool job_done(JobCounter* counter)
+{
+    return counter->pending.load(std::memory_order_acquire) == 0;
+}
+
+Arena* job_scratch(JobSystem* jobs, JobScratch kind, uint32_t size_bytes, uint32_t tag)
+{
+    uint32_t row = std::min(worker_index, jobs->num_workers);
+    Arena** slot = &jobs->scratch[row * JOB_SCRATCH_COUNT + kind];
+    if (!*slot) {
+        *slot = create_arena_tagged(size_bytes, tag);
+    }
+    return *slot;
+}
+
+void job_wait(JobSystem* jobs, JobCounter* counter)
+{
+    TRACE_SCOPE("job_wait");
+    while (!job_done(counter)) {
+        Job job;
+        bool found;
+        {
+            std::lock_guard<std::mutex> guard(jobs->lock);
+            found = pop_job(jobs, &job);
+        }
+        if (found) {
+            run_job(job);
+        } else {
+            std::this_thread::yield();
+        }
+    }
+}
+
+void job_wait_urgent(JobSystem* jobs, JobCounter* counter)
+{
+    TRACE_SCOPE("job_wait_urgent");
+    while (!job_done(counter)) {
+        Job job;
+        bool found;
+        {
+            std::lock_guard<std::mutex> guard(jobs->lock);
+            found = pop_urgent_job(jobs, counter, &job);
+        }
+        if (found) {
+            run_job(job);
+        } else {
+            std::this_thread::yield();
+        }
+    }
+}
+
+void job_system_destroy(JobSystem* jobs)
+{
+    {
+        std::lock_guard<std::mutex> guard(jobs->lock);
+        jobs->running = false;
+    }
+    jobs->wake.notify_all();
+
+    for (uint32_t i = 0; i < jobs->num_workers; i++) {
+        jobs->workers[i].join();
+        jobs->workers[i].~thread();
+    }
+    for (uint32_t i = 0; i < (jobs->num_workers + 1) * JOB_SCRATCH_COUNT; i++) {
+        if (jobs->scratch[i]) {
+            arena_free(jobs->scratch[i]);
+        }
+    }
+    jobs->~JobSystem();
+}
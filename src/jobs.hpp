@@ -0,0 +1,80 @@
+#ifndef JOBS_HPP
+#define JOBS_HPP
+
+#include <Arena.h>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+
+typedef void (*JobFn)(void* data);
+
+#define JOB_URGENT_CAPACITY 64 // urgent lane ring size, see job_submit_urgent
+
+// Incremented on submit, decremented when the job finishes. Wait on it to join a batch.
+struct JobCounter {
+    std::atomic<int32_t> pending { 0 };
+};
+
+// Scratch arenas of the threads running jobs, one per kind. Each is made on a thread's first
+// job_scratch call and freed by job_system_destroy.
+enum JobScratch : uint8_t {
+    JOB_SCRATCH_MESH,
+    JOB_SCRATCH_LIGHT,
+    JOB_SCRATCH_COUNT
+};
+
+struct Job {
+    JobFn fn;
+    void* data;
+    JobCounter* counter;
+};
+
+struct JobSystem {
+    std::thread* workers;
+    uint32_t num_workers;
+
+    Job* queue; // ring buffer
+    uint32_t queue_capacity;
+    uint32_t head;
+    uint32_t count;
+
+    // taken before anything in queue, for work a frame is blocked on
+    Job urgent[JOB_URGENT_CAPACITY];
+    uint32_t urgent_head;
+    uint32_t urgent_count;
+
+    std::mutex lock;
+    std::condition_variable wake;
+    bool running;
+
+    // [num_workers + 1][JOB_SCRATCH_COUNT], the last row is the thread outside the pool that runs
+    // jobs in job_wait or inline in job_submit (one at a time, the main thread)
+    Arena** scratch;
+
+    // num_workers == 0 picks hardware_concurrency - 1 (the main thread also helps in job_wait)
+    static JobSystem* Create(Arena* arr, uint32_t num_workers = 0, uint32_t queue_capacity = 4096);
+};
+
+// Runs the job inline if the queue is full, so submission never fails
+void job_submit(JobSystem* jobs, JobFn fn, void* data, JobCounter* counter = nullptr);
+
+// Executes queued jobs on the calling thread until the counter reaches zero
+void job_wait(JobSystem* jobs, JobCounter* counter);
+
+// Workers take urgent jobs ahead of the whole queue. Runs the job inline if the lane is full.
+void job_submit_urgent(JobSystem* jobs, JobFn fn, void* data, JobCounter* counter);
+
+// Like job_wait, but the calling thread only runs urgent jobs of this counter, never an unrelated
+// (possibly long) job from the queue
+void job_wait_urgent(JobSystem* jobs, JobCounter* counter);
+
+bool job_done(JobCounter* counter);
+
+// From inside a job: the running thread's scratch arena of that kind, the job resets it when done
+Arena* job_scratch(JobSystem* jobs, JobScratch kind, uint32_t size_bytes, uint32_t tag);
+
+void job_system_destroy(JobSystem* jobs);
+
+#endif // JOBS_HPP
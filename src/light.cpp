@@ -0,0 +1,584 @@
+#include "light.hpp"
+#include "memory.hpp"
+#include "trace.hpp"
+#include <cstdio>
+#include <cstring>
+#include <new>
+
+// Index offset of the next cell in each Face direction, and which bits of the index hold each axis
+static const int32_t FACE_INDEX_STEP[FACE_COUNT] = { 1, -1, CHUNK_AREA, -CHUNK_AREA, CHUNK_SIZE, -CHUNK_SIZE };
+static const uint32_t AXIS_INDEX_SHIFT[3] = { 0, CHUNK_SHIFT * 2, CHUNK_SHIFT };
+
+LightEngine* LightEngine::Create(Arena* arr, JobSystem* jobs, uint32_t max_chunks, int32_t min_chunk_y, int32_t max_chunk_y)
+{
+    LightEngine* light = new (arena_allocate(arr, sizeof(LightEngine))) LightEngine();
+    light->jobs = jobs;
+    light->min_chunk_y = min_chunk_y;
+    light->max_chunk_y = max_chunk_y;
+
+    light->sun_remove.arena = arr;
+    light->sun_add.arena = arr;
+    light->block_remove.arena = arr;
+    light->block_add.arena = arr;
+
+    // A pool slot can be released and become ready again before its stale entry is dropped
+    light->max_pending = max_chunks * 2;
+    light->pending = (Chunk**)arena_allocate(arr, light->max_pending * sizeof(Chunk*));
+    light->local = (Chunk**)arena_allocate(arr, max_chunks * sizeof(Chunk*));
+
+    LightJob* jobs_memory = (LightJob*)arena_allocate(arr, MAX_LIGHT_JOBS * sizeof(LightJob));
+    for (uint32_t i = 0; i < MAX_LIGHT_JOBS; i++) {
+        jobs_memory[i].engine = light;
+        jobs_memory[i].next = light->free_jobs;
+        light->free_jobs = &jobs_memory[i];
+    }
+    return light;
+}
+
+// ---Queue---
+
+static void queue_push(LightQueue* queue, uint32_t chunk, uint32_t index, uint8_t value)
+{
+    LightQueueBlock* last = queue->last;
+    if (!last || last->tail == LIGHT_QUEUE_BLOCK) {
+        LightQueueBlock* block = queue->spare;
+        if (block) {
+            queue->spare = block->next;
+        } else {
+            block = (LightQueueBlock*)arena_allocate(queue->arena, sizeof(LightQueueBlock));
+        }
+        block->next = nullptr;
+        block->head = 0;
+        block->tail = 0;
+        if (last) {
+            last->next = block;
+        } else {
+            queue->first = block;
+        }
+        queue->last = block;
+        last = block;
+    }
+    last->nodes[last->tail++] = { chunk, (uint16_t)index, value, 0 };
+}
+
+static bool queue_pop(LightQueue* queue, LightNode* out)
+{
+    LightQueueBlock* first = queue->first;
+    while (first && first->head == first->tail) {
+        if (first == queue->last) {
+            first->head = 0;
+            first->tail = 0;
+            return false;
+        }
+        queue->first = first->next;
+        first->next = queue->spare;
+        queue->spare = first;
+        first = queue->first;
+    }
+    if (!first) {
+        return false;
+    }
+    *out = first->nodes[first->head++];
+    return true;
+}
+
+// ---Cells---
+
+static inline uint8_t get_light(const uint8_t* light, uint32_t index, LightChannel channel)
+{
+    return (light[index] >> channel) & LIGHT_MAX;
+}
+
+static inline void set_light(uint8_t* light, uint32_t index, LightChannel channel, uint8_t value)
+{
+    light[index] = (light[index] & ~(LIGHT_MAX << channel)) | (value << channel);
+}
+
+// Light a cell passes on to its neighbour in the given direction
+static inline uint8_t spread(uint8_t value, uint32_t face, LightChannel channel)
+{
+    if (channel == LIGHT_CHANNEL_SUN && face == FACE_NEG_Y && value == LIGHT_MAX) {
+        return LIGHT_MAX;
+    }
+    return value > 0 ? value - 1 : 0;
+}
+
+static inline bool at_face(uint32_t index, uint32_t face)
+{
+    uint32_t coord = (index >> AXIS_INDEX_SHIFT[face >> 1]) & CHUNK_MASK;
+    return coord == ((face & 1) ? 0u : (uint32_t)CHUNK_MASK);
+}
+
+static inline uint32_t pool_index(World* world, const Chunk* chunk)
+{
+    return (uint32_t)(chunk - world->pool.chunks);
+}
+
+static inline bool chunk_valid(World* world, Chunk* chunk)
+{
+    return world_get_chunk(world, chunk->pos) == chunk && chunk->state.load(std::memory_order_acquire) == CHUNK_STATE_READY;
+}
+
+static Chunk* lit_neighbor(World* world, const Chunk* chunk, uint32_t face)
+{
+    ChunkPos pos = { chunk->pos.x + FACE_NORMALS[face][0], chunk->pos.y + FACE_NORMALS[face][1], chunk->pos.z + FACE_NORMALS[face][2] };
+    Chunk* n = world_get_chunk(world, pos);
+    if (!n || n->light_state != CHUNK_LIGHT_DONE || n->state.load(std::memory_order_acquire) != CHUNK_STATE_READY) {
+        return nullptr;
+    }
+    return n;
+}
+
+// Next cell in the face direction, across the border if the chunk there is lit
+static inline bool step(World* world, Chunk* chunk, uint32_t index, uint32_t face, Chunk** out_chunk, uint32_t* out_index)
+{
+    if (!at_face(index, face)) {
+        *out_chunk = chunk;
+        *out_index = index + FACE_INDEX_STEP[face];
+        return true;
+    }
+    Chunk* n = lit_neighbor(world, chunk, face);
+    if (!n) {
+        return false;
+    }
+    *out_chunk = n;
+    *out_index = index - FACE_INDEX_STEP[face] * (CHUNK_SIZE - 1);
+    return true;
+}
+
+static inline void mark_dirty(World* world, Chunk* chunk, uint32_t index)
+{
+    int32_t x = index & CHUNK_MASK;
+    int32_t z = (index >> CHUNK_SHIFT) & CHUNK_MASK;
+    int32_t y = index >> (CHUNK_SHIFT * 2);
+    world_mark_mesh_dirty(world, chunk, x, y, z);
+}
+
+// ---Propagation across chunks (main thread)---
+
+// Spreads light from every queued cell. Cells of `unmeshed` change without marking its mesh dirty.
+static void propagate_add(World* world, LightQueue* add, LightChannel channel, const Chunk* unmeshed)
+{
+    Chunk* chunks = world->pool.chunks;
+    LightNode node;
+    while (queue_pop(add, &node)) {
+        Chunk* chunk = &chunks[node.chunk];
+        uint8_t value = get_light(chunk->light, node.index, channel);
+        if (value <= 1) {
+            continue;
+        }
+        for (uint32_t f = 0; f < FACE_COUNT; f++) {
+            Chunk* n;
+            uint32_t i;
+            if (!step(world, chunk, node.index, f, &n, &i) || block_is_opaque(n->blocks[i])) {
+                continue;
+            }
+            uint8_t v = spread(value, f, channel);
+            if (get_light(n->light, i, channel) >= v) {
+                continue;
+            }
+            set_light(n->light, i, channel, v);
+            if (n != unmeshed) {
+                mark_dirty(world, n, i);
+            }
+            queue_push(add, pool_index(world, n), i, 0);
+        }
+    }
+}
+
+// Darkens everything the removed cells lit. Cells that are lit from elsewhere go on the add
+// queue, so their light flows back in once propagate_add runs.
+static void propagate_remove(World* world, LightQueue* remove, LightQueue* add, LightChannel channel)
+{
+    Chunk* chunks = world->pool.chunks;
+    LightNode node;
+    while (queue_pop(remove, &node)) {
+        Chunk* chunk = &chunks[node.chunk];
+        for (uint32_t f = 0; f < FACE_COUNT; f++) {
+            Chunk* n;
+            uint32_t i;
+            if (!step(world, chunk, node.index, f, &n, &i)) {
+                continue;
+            }
+            uint8_t v = get_light(n->light, i, channel);
+            if (v == 0) {
+                continue;
+            }
+            bool derived = v < node.value || (v == LIGHT_MAX && spread(node.value, f, channel) == LIGHT_MAX);
+            if (!derived) {
+                queue_push(add, pool_index(world, n), i, 0);
+                continue;
+            }
+
+            uint8_t emission = channel == LIGHT_CHANNEL_BLOCK ? block_light_emission(n->blocks[i]) : 0;
+            set_light(n->light, i, channel, emission);
+            if (emission != v) {
+                mark_dirty(world, n, i);
+            }
+            queue_push(remove, pool_index(world, n), i, v);
+            if (emission > 0) {
+                queue_push(add, pool_index(world, n), i, 0);
+            }
+        }
+    }
+}
+
+void light_block_changed(LightEngine* light, World* world, Chunk* chunk, int32_t x, int32_t y, int32_t z, BlockID old_block)
+{
+    if (chunk->light_state != CHUNK_LIGHT_DONE) {
+        return; // gets lit from its blocks as they are when its job starts
+    }
+    uint32_t c = pool_index(world, chunk);
+    uint32_t index = chunk_index(x, y, z);
+    BlockID block = chunk->blocks[index];
+
+    uint8_t old_block_light = get_light(chunk->light, index, LIGHT_CHANNEL_BLOCK);
+    uint8_t emission = block_light_emission(block);
+    if (old_block_light > 0 && (old_block_light > emission || block_is_opaque(block))) {
+        set_light(chunk->light, index, LIGHT_CHANNEL_BLOCK, 0);
+        queue_push(&light->block_remove, c, index, old_block_light);
+    }
+    if (emission > 0) {
+        set_light(chunk->light, index, LIGHT_CHANNEL_BLOCK, emission);
+        queue_push(&light->block_add, c, index, 0);
+    }
+
+    uint8_t old_sun = get_light(chunk->light, index, LIGHT_CHANNEL_SUN);
+    if (block_is_opaque(block)) {
+        if (old_sun > 0) {
+            set_light(chunk->light, index, LIGHT_CHANNEL_SUN, 0);
+            queue_push(&light->sun_remove, c, index, old_sun);
+        }
+        return;
+    }
+    if (!block_is_opaque(old_block)) {
+        return; // light passed through before as well
+    }
+
+    // Opened up, let the neighbours shine in
+    for (uint32_t f = 0; f < FACE_COUNT; f++) {
+        Chunk* n;
+        uint32_t i;
+        if (step(world, chunk, index, f, &n, &i)) {
+            queue_push(&light->sun_add, pool_index(world, n), i, 0);
+            queue_push(&light->block_add, pool_index(world, n), i, 0);
+        }
+    }
+    if (chunk->pos.y >= light->max_chunk_y && y == CHUNK_MASK) {
+        set_light(chunk->light, index, LIGHT_CHANNEL_SUN, LIGHT_MAX);
+        queue_push(&light->sun_add, c, index, 0);
+    }
+}
+
+// ---Chunk jobs---
+
+// Like propagate_add, but never leaves the chunk
+static void propagate_local(Chunk* chunk, LightQueue* add, LightChannel channel)
+{
+    uint8_t* light = chunk->light;
+    const BlockID* blocks = chunk->blocks;
+    LightNode node;
+    while (queue_pop(add, &node)) {
+        uint8_t value = get_light(light, node.index, channel);
+        if (value <= 1) {
+            continue;
+        }
+        for (uint32_t f = 0; f < FACE_COUNT; f++) {
+            if (at_face(node.index, f)) {
+                continue;
+            }
+            uint32_t i = node.index + FACE_INDEX_STEP[f];
+            uint8_t v = spread(value, f, channel);
+            if (block_is_opaque(blocks[i]) || get_light(light, i, channel) >= v) {
+                continue;
+            }
+            set_light(light, i, channel, v);
+            queue_push(add, 0, i, 0);
+        }
+    }
+}
+
+static void light_job(void* data)
+{
+    TRACE_SCOPE("light");
+    LightJob* job = (LightJob*)data;
+    LightEngine* engine = job->engine;
+    Chunk* chunk = job->chunk;
+    uint8_t* light = chunk->light;
+    const BlockID* blocks = chunk->blocks;
+
+    LightQueue job_queue = {};
+    job_queue.arena = job_scratch(engine->jobs, JOB_SCRATCH_LIGHT, LIGHT_SCRATCH_BYTES, MEM_CHUNKS);
+    LightQueue* queue = &job_queue;
+    memset(light, 0, CHUNK_VOLUME);
+
+    // Full sunlight falls straight down each column until something stops it
+    uint8_t floor[CHUNK_AREA]; // per column, lowest y in full sunlight (CHUNK_SIZE if none)
+    for (uint32_t z = 0; z < CHUNK_SIZE; z++) {
+        for (uint32_t x = 0; x < CHUNK_SIZE; x++) {
+            uint32_t column = z * CHUNK_SIZE + x;
+            bool open = job->sky || (job->borders[FACE_POS_Y][column] >> LIGHT_SUN_SHIFT) == LIGHT_MAX;
+            uint32_t y = CHUNK_SIZE;
+            while (open && y > 0 && !block_is_opaque(blocks[chunk_index(x, y - 1, z)])) {
+                y--;
+                light[chunk_index(x, y, z)] = LIGHT_FULL;
+            }
+            floor[column] = (uint8_t)y;
+        }
+    }
+
+    // Only the sunlit cells next to a column that is dark at that height spread further
+    for (uint32_t z = 0; z < CHUNK_SIZE; z++) {
+        for (uint32_t x = 0; x < CHUNK_SIZE; x++) {
+            uint32_t column = z * CHUNK_SIZE + x;
+            uint32_t top = floor[column];
+            if (x > 0 && floor[column - 1] > top) {
+                top = floor[column - 1];
+            }
+            if (x < CHUNK_MASK && floor[column + 1] > top) {
+                top = floor[column + 1];
+            }
+            if (z > 0 && floor[column - CHUNK_SIZE] > top) {
+                top = floor[column - CHUNK_SIZE];
+            }
+            if (z < CHUNK_MASK && floor[column + CHUNK_SIZE] > top) {
+                top = floor[column + CHUNK_SIZE];
+            }
+            for (uint32_t y = floor[column]; y < top; y++) {
+                queue_push(queue, 0, chunk_index(x, y, z), 0);
+            }
+        }
+    }
+
+    // Light coming in through the borders
+    for (uint32_t f = 0; f < FACE_COUNT; f++) {
+        if (!(job->border_mask & (1 << f))) {
+            continue;
+        }
+        uint32_t back = f ^ 1; // direction the light travels in
+        for (uint32_t a = 0; a < CHUNK_SIZE; a++) {
+            for (uint32_t b = 0; b < CHUNK_SIZE; b++) {
+                uint32_t i = face_cell(f, a, b);
+                if (block_is_opaque(blocks[i])) {
+                    continue;
+                }
+                uint8_t outside = job->borders[f][a * CHUNK_SIZE + b];
+                uint8_t sun = spread(outside >> LIGHT_SUN_SHIFT, back, LIGHT_CHANNEL_SUN);
+                if (sun > get_light(light, i, LIGHT_CHANNEL_SUN)) {
+                    set_light(light, i, LIGHT_CHANNEL_SUN, sun);
+                    queue_push(queue, 0, i, 0);
+                }
+            }
+        }
+    }
+    propagate_local(chunk, queue, LIGHT_CHANNEL_SUN);
+
+    for (uint32_t i = 0; i < CHUNK_VOLUME; i++) {
+        uint8_t emission = block_light_emission(blocks[i]);
+        if (emission > 0) {
+            set_light(light, i, LIGHT_CHANNEL_BLOCK, emission);
+            queue_push(queue, 0, i, 0);
+        }
+    }
+    for (uint32_t f = 0; f < FACE_COUNT; f++) {
+        if (!(job->border_mask & (1 << f))) {
+            continue;
+        }
+        for (uint32_t a = 0; a < CHUNK_SIZE; a++) {
+            for (uint32_t b = 0; b < CHUNK_SIZE; b++) {
+                uint32_t i = face_cell(f, a, b);
+                uint8_t v = job->borders[f][a * CHUNK_SIZE + b] & LIGHT_MAX;
+                if (v > 1 && !block_is_opaque(blocks[i]) && v - 1 > get_light(light, i, LIGHT_CHANNEL_BLOCK)) {
+                    set_light(light, i, LIGHT_CHANNEL_BLOCK, v - 1);
+                    queue_push(queue, 0, i, 0);
+                }
+            }
+        }
+    }
+    propagate_local(chunk, queue, LIGHT_CHANNEL_BLOCK);
+    arena_reset(job_queue.arena);
+
+    std::lock_guard<std::mutex> guard(engine->done_lock);
+    job->next = engine->done;
+    engine->done = job;
+}
+
+void light_chunk_ready(LightEngine* light, Chunk* chunk)
+{
+    chunk->light_state = CHUNK_LIGHT_PENDING;
+    if (light->num_pending < light->max_pending) {
+        light->pending[light->num_pending++] = chunk;
+    } else {
+        printf("Light queue is full, chunk (%d, %d, %d) stays dark\n", chunk->pos.x, chunk->pos.y, chunk->pos.z);
+    }
+}
+
+// Sunlight comes from above, so a chunk waits until the one above it is lit. If that one isn't
+// loaded at all the chunk is lit without it, the merge brings the sunlight down once it is.
+static bool try_start_job(LightEngine* light, World* world, Chunk* chunk)
+{
+    bool sky = chunk->pos.y >= light->max_chunk_y;
+    ChunkPos above = { chunk->pos.x, chunk->pos.y + 1, chunk->pos.z };
+    if (!sky && world_get_chunk(world, above) && !lit_neighbor(world, chunk, FACE_POS_Y)) {
+        return false;
+    }
+    LightJob* job = light->free_jobs;
+    if (!job) {
+        return false;
+    }
+    light->free_jobs = job->next;
+
+    job->chunk = chunk;
+    job->sky = sky;
+    job->border_mask = 0;
+    for (uint32_t f = 0; f < FACE_COUNT; f++) {
+        const Chunk* n = lit_neighbor(world, chunk, f);
+        if (!n) {
+            continue;
+        }
+        uint32_t back = f ^ 1;
+        for (uint32_t a = 0; a < CHUNK_SIZE; a++) {
+            for (uint32_t b = 0; b < CHUNK_SIZE; b++) {
+                job->borders[f][a * CHUNK_SIZE + b] = n->light[face_cell(back, a, b)];
+            }
+        }
+        job->border_mask |= 1 << f;
+    }
+
+    chunk->light_state = CHUNK_LIGHT_QUEUED;
+    chunk->readers++; // keeps edits and eviction away while the job reads the blocks
+    job_submit(light->jobs, light_job, job, &light->counter);
+    return true;
+}
+
+static void collect_jobs(LightEngine* light, World* world)
+{
+    LightJob* done;
+    {
+        std::lock_guard<std::mutex> guard(light->done_lock);
+        done = light->done;
+        light->done = nullptr;
+    }
+    while (done) {
+        LightJob* job = done;
+        done = done->next;
+
+        Chunk* chunk = job->chunk;
+        chunk->readers--;
+        if (chunk->light_state == CHUNK_LIGHT_QUEUED && chunk_valid(world, chunk)) {
+            chunk->light_state = CHUNK_LIGHT_LOCAL;
+            light->local[light->num_local++] = chunk;
+        }
+        job->next = light->free_jobs;
+        light->free_jobs = job;
+    }
+}
+
+// Any chunk in the 3x3 columns around pos that light changes must not touch yet.
+// Edits also wait for chunks that are still being lit, their light would go stale.
+static bool columns_busy(LightEngine* light, World* world, ChunkPos pos, bool editing)
+{
+    for (int32_t dz = -1; dz <= 1; dz++) {
+        for (int32_t dx = -1; dx <= 1; dx++) {
+            for (int32_t y = light->min_chunk_y; y <= light->max_chunk_y; y++) {
+                Chunk* c = world_get_chunk(world, { pos.x + dx, y, pos.z + dz });
+                if (!c) {
+                    continue;
+                }
+                if (c->light_state == CHUNK_LIGHT_DONE && c->readers > 0) {
+                    return true;
+                }
+                if (editing && (c->readers > 0 || c->light_state == CHUNK_LIGHT_QUEUED || c->light_state == CHUNK_LIGHT_LOCAL)) {
+                    return true;
+                }
+            }
+        }
+    }
+    return false;
+}
+
+bool light_edit_blocked(LightEngine* light, World* world, ChunkPos pos)
+{
+    return columns_busy(light, world, pos, true);
+}
+
+// Light crossing the borders of a freshly lit chunk, both ways
+static void merge_chunk(LightEngine* light, World* world, Chunk* chunk)
+{
+    chunk->light_state = CHUNK_LIGHT_DONE;
+    uint32_t c = pool_index(world, chunk);
+
+    const LightChannel channels[2] = { LIGHT_CHANNEL_SUN, LIGHT_CHANNEL_BLOCK };
+    LightQueue* queues[2] = { &light->sun_add, &light->block_add };
+    for (uint32_t f = 0; f < FACE_COUNT; f++) {
+        Chunk* n = lit_neighbor(world, chunk, f);
+        if (!n) {
+            continue;
+        }
+        uint32_t back = f ^ 1;
+        uint32_t nc = pool_index(world, n);
+        for (uint32_t a = 0; a < CHUNK_SIZE; a++) {
+            for (uint32_t b = 0; b < CHUNK_SIZE; b++) {
+                uint32_t i = face_cell(f, a, b);
+                uint32_t ni = face_cell(back, a, b);
+                bool open = !block_is_opaque(chunk->blocks[i]);
+                bool n_open = !block_is_opaque(n->blocks[ni]);
+                for (uint32_t k = 0; k < 2; k++) {
+                    uint8_t v = get_light(chunk->light, i, channels[k]);
+                    uint8_t nv = get_light(n->light, ni, channels[k]);
+                    if (n_open && spread(v, f, channels[k]) > nv) {
+                        queue_push(queues[k], c, i, 0);
+                    }
+                    if (open && spread(nv, back, channels[k]) > v) {
+                        queue_push(queues[k], nc, ni, 0);
+                    }
+                }
+            }
+        }
+    }
+    propagate_add(world, &light->sun_add, LIGHT_CHANNEL_SUN, chunk);
+    propagate_add(world, &light->block_add, LIGHT_CHANNEL_BLOCK, chunk);
+}
+
+void light_update(LightEngine* light, World* world)
+{
+    // Edits were only applied where nothing else reads or lights the chunks around them
+    propagate_remove(world, &light->sun_remove, &light->sun_add, LIGHT_CHANNEL_SUN);
+    propagate_remove(world, &light->block_remove, &light->block_add, LIGHT_CHANNEL_BLOCK);
+    propagate_add(world, &light->sun_add, LIGHT_CHANNEL_SUN, nullptr);
+    propagate_add(world, &light->block_add, LIGHT_CHANNEL_BLOCK, nullptr);
+
+    collect_jobs(light, world);
+
+    uint32_t kept = 0;
+    for (uint32_t i = 0; i < light->num_local; i++) {
+        Chunk* chunk = light->local[i];
+        if (chunk->light_state != CHUNK_LIGHT_LOCAL || !chunk_valid(world, chunk)) {
+            continue;
+        }
+        if (columns_busy(light, world, chunk->pos, false)) {
+            light->local[kept++] = chunk;
+            continue;
+        }
+        merge_chunk(light, world, chunk);
+    }
+    light->num_local = kept;
+
+    kept = 0;
+    for (uint32_t i = 0; i < light->num_pending; i++) {
+        Chunk* chunk = light->pending[i];
+        if (chunk->light_state != CHUNK_LIGHT_PENDING || !chunk_valid(world, chunk)) {
+            continue;
+        }
+        if (!try_start_job(light, world, chunk)) {
+            light->pending[kept++] = chunk;
+        }
+    }
+    light->num_pending = kept;
+}
+
+void light_destroy(LightEngine* light, World* world)
+{
+    job_wait(light->jobs, &light->counter);
+    collect_jobs(light, world);
+}
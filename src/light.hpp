@@ -0,0 +1,120 @@
+#ifndef LIGHT_HPP
+#define LIGHT_HPP
+
+#include "chunk.hpp"
+#include "jobs.hpp"
+#include "mesher.hpp"
+#include "world.hpp"
+#include <Arena.h>
+#include <cstdint>
+#include <mutex>
+
+// Flood fill lighting. Every voxel has a sunlight and a block light level (Chunk::light), light
+// loses one level per step through non opaque blocks, except full sunlight going straight down.
+//
+// A chunk that becomes ready is lit by a job on its own: sunlight from the chunk above (which has
+// to be lit first) or the sky, emitters, and whatever its lit neighbours shine in through the
+// borders, from copies taken when the job starts. Back on the main thread it is merged: light is
+// pushed across the borders both ways and the chunk counts as lit.
+// Block edits update the light incrementally on the main thread, removing what the old block let
+// through (or emitted) and then spreading the light that is left back in.
+
+#define LIGHT_QUEUE_BLOCK 4096 // nodes
+#define LIGHT_SCRATCH_BYTES (8 * 1024 * 1024) // per job thread, queue blocks are reused within a job
+#define MAX_LIGHT_JOBS 32
+
+// The value is the shift of the channel in a light byte
+enum LightChannel : uint32_t {
+    LIGHT_CHANNEL_BLOCK = 0,
+    LIGHT_CHANNEL_SUN = LIGHT_SUN_SHIFT,
+};
+
+struct LightNode {
+    uint32_t chunk; // pool index
+    uint16_t index; // chunk_index
+    uint8_t value; // light before it was removed, removal queues only
+    uint8_t pad;
+};
+
+// FIFO of node blocks allocated from an arena. Emptied blocks are kept for reuse, so a queue
+// never takes more memory than the most nodes it ever held at once.
+struct LightQueueBlock {
+    LightQueueBlock* next;
+    uint32_t head;
+    uint32_t tail;
+    LightNode nodes[LIGHT_QUEUE_BLOCK];
+};
+
+struct LightQueue {
+    Arena* arena;
+    LightQueueBlock* first;
+    LightQueueBlock* last;
+    LightQueueBlock* spare;
+};
+
+struct LightJob {
+    struct LightEngine* engine;
+    Chunk* chunk;
+    bool sky; // top of the world, full sunlight comes in from above
+    uint8_t border_mask; // faces with a lit neighbour
+    uint8_t borders[FACE_COUNT][CHUNK_AREA]; // the neighbour's layer next to each face, see face_cell
+    LightJob* next; // free / done list link
+};
+
+struct LightEngine {
+    JobSystem* jobs;
+    int32_t min_chunk_y; // vertical extent of the world, in chunks
+    int32_t max_chunk_y;
+
+    // Main thread propagation
+    LightQueue sun_remove;
+    LightQueue sun_add;
+    LightQueue block_remove;
+    LightQueue block_add;
+
+    Chunk** pending; // ready, waiting for the chunk above or a job slot
+    uint32_t num_pending;
+    uint32_t max_pending;
+    Chunk** local; // lit on their own, waiting to be merged
+    uint32_t num_local;
+
+    LightJob* free_jobs;
+    JobCounter counter;
+    std::mutex done_lock;
+    LightJob* done;
+
+    static LightEngine* Create(Arena* arr, JobSystem* jobs, uint32_t max_chunks, int32_t min_chunk_y, int32_t max_chunk_y);
+};
+
+// Index of the cell at (a, b) on the given face of a chunk. Both sides of a border use the same (a, b).
+inline uint32_t face_cell(uint32_t face, uint32_t a, uint32_t b)
+{
+    uint32_t edge = (face & 1) ? 0 : CHUNK_MASK; // even faces are the positive ones
+    switch (face >> 1) {
+    case 0:
+        return chunk_index(edge, a, b); // a = y, b = z
+    case 1:
+        return chunk_index(b, edge, a); // a = z, b = x
+    default:
+        return chunk_index(b, a, edge); // a = y, b = x
+    }
+}
+
+// The world calls this when a chunk's blocks are ready, it gets lit as soon as it can
+void light_chunk_ready(LightEngine* light, Chunk* chunk);
+
+// True while an edit in the chunk at pos can't update the light yet: light can spread into the
+// 3x3 columns of chunks around it, and one of them is being meshed or lit
+bool light_edit_blocked(LightEngine* light, World* world, ChunkPos pos);
+
+// Queues the light changes of a block that was just written at local x, y, z. Only for chunks
+// light_edit_blocked allowed, propagation happens in the next light_update.
+void light_block_changed(LightEngine* light, World* world, Chunk* chunk, int32_t x, int32_t y, int32_t z, BlockID old_block);
+
+// Main thread, from world_update: propagates edits, merges finished jobs and starts new ones
+void light_update(LightEngine* light, World* world);
+
+// Waits for jobs in flight
+void light_destroy(LightEngine* light, World* world);
+
+#endif // LIGHT_HPP
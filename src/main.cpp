@@ -1,7 +1,21 @@
 #include "GLFW/glfw3.h"
+#include "block_ticks.hpp"
+#include "camera.hpp"
+#include "chunk_renderer.hpp"
+#include "cpu_raymarcher.hpp"
+#include "light.hpp"
+#include "memory.hpp"
+#include "profiler.hpp"
+#include "raymarcher.hpp"
+#include "sim.hpp"
+#include "streaming.hpp"
+#include "texture_array.hpp"
+#include "trace.hpp"
 #include "vulkan.hpp"
 #include "window.hpp"
+#include "world.hpp"
 #include <Arena.h>
+#include <algorithm>
 #include <cstdio>
 #include <cstring>
 #include <vulkan/vulkan_core.h>
@@ -11,10 +25,68 @@
 #define SCREEN_WIDTH 16 * RES_FACTOR
 #define SCREEN_HEIGHT 9 * RES_FACTOR
 
+#define WORLD_DIR "world"
+#define WORLD_SEED 1337
+#define AUTOSAVE_INTERVAL 30.0 // seconds
+
+#define LOAD_RADIUS 20 // chunks
+#define WORLD_MIN_CHUNK_Y 0
+#define WORLD_MAX_CHUNK_Y 3
+#define STREAM_MEMORY_BUDGET (768ull * 1024 * 1024)
+#define MAX_CHUNK_MESHES 3584 // one allocation each, stay well below maxMemoryAllocationCount
+#define GPU_MESH_BUDGET (1024ull * 1024 * 1024) // vertex buffers, the heap budget applies on top
+
+#define CPU_RAYMARCH_SCALE 4 // the software ray marcher traces 1 / 4 of the resolution per axis
+#define CPU_RAYMARCH_MAX_WIDTH 960
+#define CPU_RAYMARCH_MAX_HEIGHT 540
+
+#define CAMERA_SPEED 40.0f // blocks per second, x8 with control held
+#define MOUSE_SENSITIVITY 0.003f
+
+#define STATS_INTERVAL 0.5 // seconds between window title updates
+#define STATS_FRAMES 60 // averaged over
+#define STATS_CSV "frame_stats.csv"
+#define TRACE_JSON "trace.json"
+#define CAMERA_PATH "camera_path.txt" // keyframes for VoxelBench --path
+#define TEXTURE_PACK "textures.vxp" // block textures, the built in flat ones without it
+
+enum RenderMode {
+    RENDER_MESHES,
+    RENDER_RAYMARCH, // brick map on the GPU
+    RENDER_CPU_RAYMARCH,
+    RENDER_MODE_COUNT
+};
+
+static RenderMode render_mode = RENDER_MESHES;
+static bool dump_stats = false;
+static bool toggle_trace = false;
+static bool record_key = false;
+static bool print_memory = false;
+
 static void key_callback(GLFWwindow* window, int key, int scancode, int action, int mods)
 {
     if (key == GLFW_KEY_ESCAPE && action == GLFW_PRESS)
         glfwSetWindowShouldClose(window, GLFW_TRUE);
+    // R cycles between drawing meshes, ray marching the brick map and ray marching on the CPU
+    if (key == GLFW_KEY_R && action == GLFW_PRESS)
+        render_mode = (RenderMode)((render_mode + 1) % RENDER_MODE_COUNT);
+    // P writes the recent frame timings to STATS_CSV
+    if (key == GLFW_KEY_P && action == GLFW_PRESS)
+        dump_stats = true;
+    // T starts a trace, pressing it again writes it to TRACE_JSON
+    if (key == GLFW_KEY_T && action == GLFW_PRESS)
+        toggle_trace = true;
+    // K appends the camera to CAMERA_PATH
+    if (key == GLFW_KEY_K && action == GLFW_PRESS)
+        record_key = true;
+    // M prints live and peak memory per tag
+    if (key == GLFW_KEY_M && action == GLFW_PRESS)
+        print_memory = true;
+    // Z switches the depth pre-pass on and off
+    if (key == GLFW_KEY_Z && action == GLFW_PRESS) {
+        VulkanContext* ctx = (VulkanContext*)glfwGetWindowUserPointer(window);
+        ctx->depth_prepass = !ctx->depth_prepass;
+    }
 }
 
 static void framebufferResizeCallback(GLFWwindow* window, int width, int height)
@@ -23,12 +95,83 @@ static void framebufferResizeCallback(GLFWwindow* window, int width, int height)
     ctx->frame_buffer_resized = true;
 }
 
-void draw(Arena* arr, VulkanContext* ctx, Window* window)
+static uint32_t upload_chunk_mesh(void* user, ChunkPos pos, const ChunkMesh* mesh)
+{
+    return chunk_renderer_upload((ChunkRenderer*)user, pos, mesh);
+}
+
+static void release_chunk_mesh(void* user, uint32_t handle)
+{
+    chunk_renderer_release((ChunkRenderer*)user, handle);
+}
+
+static bool patch_chunk_mesh(void* user, uint32_t handle, const ChunkMesh* mesh)
+{
+    return chunk_renderer_patch((ChunkRenderer*)user, handle, mesh);
+}
+
+// WASD + space / shift to fly, hold the right mouse button to look around. Looking turns the
+// camera right away, moving goes through the sim.
+static void update_input(Window* window, Camera* camera, Simulation* sim)
 {
-    vkWaitForFences(ctx->device, 1, &ctx->in_flight_fences[ctx->current_frame], VK_TRUE, UINT64_MAX);
+    GLFWwindow* w = window->window;
+
+    static double last_x = 0.0, last_y = 0.0;
+    static bool looking = false;
+    double x, y;
+    glfwGetCursorPos(w, &x, &y);
+    if (glfwGetMouseButton(w, GLFW_MOUSE_BUTTON_RIGHT) == GLFW_PRESS) {
+        if (looking) {
+            camera_look(camera, (float)(x - last_x) * MOUSE_SENSITIVITY, -(float)(y - last_y) * MOUSE_SENSITIVITY);
+        }
+        looking = true;
+    } else {
+        looking = false;
+    }
+    last_x = x;
+    last_y = y;
+
+    SimInput input {};
+    input.move.x = (glfwGetKey(w, GLFW_KEY_D) == GLFW_PRESS) - (glfwGetKey(w, GLFW_KEY_A) == GLFW_PRESS);
+    input.move.y = (glfwGetKey(w, GLFW_KEY_SPACE) == GLFW_PRESS) - (glfwGetKey(w, GLFW_KEY_LEFT_SHIFT) == GLFW_PRESS);
+    input.move.z = (glfwGetKey(w, GLFW_KEY_W) == GLFW_PRESS) - (glfwGetKey(w, GLFW_KEY_S) == GLFW_PRESS);
+    input.speed = CAMERA_SPEED * (glfwGetKey(w, GLFW_KEY_LEFT_CONTROL) == GLFW_PRESS ? 8.0f : 1.0f);
+    input.yaw = camera->yaw;
+    input.pitch = camera->pitch;
+    sim_set_input(sim, input);
+}
+
+// Averaged frame timings and the last frame's driver allocations in the window title
+static void show_stats(Window* window, const Profiler* profiler, const Simulation* sim, const BlockTicks* ticks, const HostAllocator* host)
+{
+    FrameStats avg;
+    profiler_average(profiler, STATS_FRAMES, &avg);
+
+    char title[384];
+    int n = snprintf(title, sizeof(title), "cpu %.2f ms (world %.2f stream %.2f render %.2f raymarch %.2f submit %.2f wait %.2f) | sim tick %.2f ms | block tick %.2f ms (%u chunks)",
+        avg.cpu_ms[CPU_SCOPE_FRAME], avg.cpu_ms[CPU_SCOPE_WORLD], avg.cpu_ms[CPU_SCOPE_STREAMING], avg.cpu_ms[CPU_SCOPE_RENDERER],
+        avg.cpu_ms[CPU_SCOPE_RAYMARCH], avg.cpu_ms[CPU_SCOPE_SUBMIT], avg.cpu_ms[CPU_SCOPE_WAIT], sim->tick_us.load() / 1000.0f,
+        ticks->tick_us / 1000.0f, ticks->due_chunks);
+
+    for (uint32_t p = 0; p < GPU_PASS_COUNT && n > 0 && n < (int)sizeof(title); p++) {
+        if (avg.gpu_passes & (1 << p)) {
+            n += snprintf(title + n, sizeof(title) - n, " | gpu %s %.2f ms", profiler_pass_name((GpuPass)p), avg.gpu_ms[p]);
+        }
+    }
+    if (n > 0 && n < (int)sizeof(title)) {
+        snprintf(title + n, sizeof(title) - n, " | driver allocs %llu (%llu malloc)", (unsigned long long)host->frame_calls, (unsigned long long)host->frame_system_allocs);
+    }
+    glfwSetWindowTitle(window->window, title);
+}
 
+void draw(Arena* arr, VulkanContext* ctx, Window* window, const DrawList* draw_list)
+{
     uint32_t imageIndex;
-    VkResult res = vkAcquireNextImageKHR(ctx->device, ctx->swapchain, UINT64_MAX, ctx->image_available_semaphores[ctx->current_frame], VK_NULL_HANDLE, &imageIndex);
+    VkResult res;
+    {
+        TRACE_SCOPE("acquire image");
+        res = vkAcquireNextImageKHR(ctx->device, ctx->swapchain, UINT64_MAX, ctx->image_available_semaphores[ctx->current_frame], VK_NULL_HANDLE, &imageIndex);
+    }
     if (res == VK_ERROR_OUT_OF_DATE_KHR || res == VK_SUBOPTIMAL_KHR || ctx->frame_buffer_resized) {
         ctx->frame_buffer_resized = false;
         recreate_swapchain(arr, ctx, window);
@@ -39,8 +182,7 @@ void draw(Arena* arr, VulkanContext* ctx, Window* window)
 
     vkResetFences(ctx->device, 1, &ctx->in_flight_fences[ctx->current_frame]);
 
-    vkResetCommandBuffer(ctx->cmd_buffers[ctx->current_frame], 0);
-    record_command_buffer(ctx, ctx->cmd_buffers[ctx->current_frame], imageIndex);
+    record_command_buffer(ctx, ctx->cmd_buffers[ctx->current_frame], imageIndex, draw_list);
 
     VkSubmitInfo submitInfo {};
     submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
@@ -59,7 +201,10 @@ void draw(Arena* arr, VulkanContext* ctx, Window* window)
     submitInfo.signalSemaphoreCount = 1;
     submitInfo.pSignalSemaphores = signalSemaphores;
 
-    VK_CHECK_RESULT(vkQueueSubmit(ctx->graphics_queue, 1, &submitInfo, ctx->in_flight_fences[ctx->current_frame]));
+    {
+        TRACE_SCOPE("queue submit");
+        VK_CHECK_RESULT(vkQueueSubmit(ctx->graphics_queue, 1, &submitInfo, ctx->in_flight_fences[ctx->current_frame]));
+    }
 
     VkPresentInfoKHR presentInfo {};
     presentInfo.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
@@ -73,7 +218,10 @@ void draw(Arena* arr, VulkanContext* ctx, Window* window)
     presentInfo.pImageIndices = &imageIndex;
 
     presentInfo.pResults = nullptr; // Optional
-    vkQueuePresentKHR(ctx->present_queue, &presentInfo);
+    {
+        TRACE_SCOPE("present");
+        vkQueuePresentKHR(ctx->present_queue, &presentInfo);
+    }
 
     ctx->current_frame = (ctx->current_frame + 1) % MAX_FRAMES_IN_FLIGHT;
 }
@@ -82,23 +230,177 @@ int main()
 {
 
     Arena* GameArena = create_arena(10 MB);
+    Arena* WorldArena = create_arena_tagged(10 MB, MEM_CHUNKS); // chunk pool, light and world tables
+    Arena* TextureArena = create_arena_tagged(1 MB, MEM_TEXTURES); // grows to fit the pack
+
+    Tracer* tracer = Tracer::Create(GameArena);
+    trace_name_thread("main");
+
+    JobSystem* jobs = JobSystem::Create(GameArena);
+    IOContext* io = IOContext::Create(GameArena);
+    WorldStore* store = WorldStore::Create(GameArena, io, jobs, WORLD_DIR);
+    // Every pool slot is a full chunk, so the budget caps how many can exist at all
+    uint32_t max_chunks = STREAM_MEMORY_BUDGET / sizeof(Chunk);
+    LightEngine* light = LightEngine::Create(WorldArena, jobs, max_chunks, WORLD_MIN_CHUNK_Y, WORLD_MAX_CHUNK_Y);
+    World* world = World::Create(WorldArena, jobs, store, light, WORLD_SEED, max_chunks);
+    BlockTicks* ticks = BlockTicks::Create(WorldArena, world, jobs, max_chunks);
 
     Window* window = Window::Create(GameArena, SCREEN_WIDTH, SCREEN_HEIGHT);
 
+    memory_set_budget(MEM_GPU, MEM_MESHES, GPU_MESH_BUDGET);
     VulkanContext* ctx = VulkanContext::Create(GameArena, window);
+    Profiler* profiler = Profiler::Create(GameArena);
+    ctx->profiler = profiler;
+    ctx->jobs = jobs;
+    ChunkRenderer* renderer = ChunkRenderer::Create(GameArena, ctx, MAX_CHUNK_MESHES);
+    RaymarchRenderer* raymarcher = RaymarchRenderer::Create(GameArena, ctx, RAYMARCH_MAX_BRICKS);
+
+    TexturePack* pack = texture_pack_load(TextureArena, TEXTURE_PACK);
+    if (!pack) {
+        pack = texture_pack_default(TextureArena);
+    }
+    TextureArray* textures = TextureArray::Create(GameArena, ctx, pack);
+
+    CpuRaymarchConfig cpu_config {};
+    cpu_config.max_distance = LOAD_RADIUS * CHUNK_SIZE;
+    cpu_config.min_chunk_y = WORLD_MIN_CHUNK_Y;
+    cpu_config.max_chunk_y = WORLD_MAX_CHUNK_Y;
+    CpuRaymarcher* cpu_raymarcher = CpuRaymarcher::Create(GameArena, jobs, CPU_RAYMARCH_MAX_WIDTH, CPU_RAYMARCH_MAX_HEIGHT, cpu_config);
+
+    StreamConfig stream_config {};
+    stream_config.radius = LOAD_RADIUS;
+    stream_config.min_chunk_y = WORLD_MIN_CHUNK_Y;
+    stream_config.max_chunk_y = WORLD_MAX_CHUNK_Y;
+    stream_config.memory_budget = STREAM_MEMORY_BUDGET;
+    stream_config.max_pending_loads = 64;
+    stream_config.max_mesh_jobs = 32;
+    stream_config.max_uploads_per_frame = 32;
+    StreamManager* stream = StreamManager::Create(GameArena, world, jobs, stream_config, { renderer, upload_chunk_mesh, release_chunk_mesh, patch_chunk_mesh });
+
+    Camera camera = camera_create({ 0.0f, 100.0f, 0.0f }, (float)SCREEN_WIDTH / SCREEN_HEIGHT);
+    camera.pitch = -0.3f;
+    Simulation* sim = Simulation::Create(GameArena, { camera.position });
 
     glfwSetKeyCallback(window->window, key_callback);
 
+    double last_autosave = glfwGetTime();
+    double last_stats = glfwGetTime();
+    double last_frame = glfwGetTime();
+
     while (!glfwWindowShouldClose(window->window)) {
 
+        profiler_begin_frame(profiler);
+        profiler_begin(profiler, CPU_SCOPE_FRAME);
+
         window->update();
-        draw(GameArena, ctx, window);
+
+        double now = glfwGetTime();
+        update_input(window, &camera, sim);
+        SimState sim_state;
+        sim_interpolate(sim, trace_now(), &sim_state);
+        camera.position = sim_state.position;
+
+        if (now - last_autosave > AUTOSAVE_INTERVAL) {
+            world_begin_autosave(world);
+            last_autosave = now;
+        }
+        profiler_begin(profiler, CPU_SCOPE_WORLD);
+        world_update(world);
+        block_ticks_update(ticks, (float)(now - last_frame));
+        last_frame = now;
+        profiler_end(profiler, CPU_SCOPE_WORLD);
+
+        profiler_begin(profiler, CPU_SCOPE_WAIT);
+        begin_frame(ctx);
+        profiler_end(profiler, CPU_SCOPE_WAIT);
+
+        profiler_begin(profiler, CPU_SCOPE_STREAMING);
+        streaming_update(stream, &camera);
+        texture_array_update(textures, stream->pressure);
+        profiler_end(profiler, CPU_SCOPE_STREAMING);
+
+        profiler_begin(profiler, CPU_SCOPE_RENDERER);
+        camera.aspect = (float)ctx->sc_extent.width / (float)ctx->sc_extent.height;
+        DrawList draw_list;
+        chunk_renderer_build_draws(renderer, &camera, (float)ctx->sc_extent.height, &draw_list);
+        draw_list.textures = textures->current;
+        profiler_end(profiler, CPU_SCOPE_RENDERER);
+
+        profiler_begin(profiler, CPU_SCOPE_RAYMARCH);
+        if (render_mode == RENDER_RAYMARCH) {
+            raymarch_renderer_update(raymarcher, world, &camera);
+            raymarch_renderer_build_draw(raymarcher, &camera, &draw_list);
+        } else if (render_mode == RENDER_CPU_RAYMARCH) {
+            uint32_t width = std::min(std::max(ctx->sc_extent.width / CPU_RAYMARCH_SCALE, 1u), (uint32_t)CPU_RAYMARCH_MAX_WIDTH);
+            uint32_t height = std::min(std::max(ctx->sc_extent.height / CPU_RAYMARCH_SCALE, 1u), (uint32_t)CPU_RAYMARCH_MAX_HEIGHT);
+            cpu_raymarch(cpu_raymarcher, world, &camera, width, height);
+            window->displayBytes((const unsigned char*)cpu_raymarcher->pixels, width, height);
+        }
+        profiler_end(profiler, CPU_SCOPE_RAYMARCH);
+
+        profiler_begin(profiler, CPU_SCOPE_SUBMIT);
+        draw(GameArena, ctx, window, &draw_list);
+        profiler_end(profiler, CPU_SCOPE_SUBMIT);
+
+        profiler_end(profiler, CPU_SCOPE_FRAME);
+
+        if (now - last_stats > STATS_INTERVAL) {
+            show_stats(window, profiler, sim, ticks, ctx->host_allocator);
+            last_stats = now;
+        }
+        if (dump_stats) {
+            if (profiler_dump_csv(profiler, STATS_CSV)) {
+                printf("Frame stats written to %s\n", STATS_CSV);
+            }
+            dump_stats = false;
+        }
+        if (toggle_trace) {
+            if (trace_recording.load()) {
+                trace_stop(tracer);
+                if (trace_dump_json(tracer, TRACE_JSON)) {
+                    printf("Trace written to %s\n", TRACE_JSON);
+                }
+            } else {
+                calibrate_gpu_clock(ctx);
+                trace_start(tracer);
+            }
+            toggle_trace = false;
+        }
+        if (record_key) {
+            FILE* file = fopen(CAMERA_PATH, "a");
+            if (file) {
+                fprintf(file, "%f %f %f %f %f\n", camera.position.x, camera.position.y, camera.position.z, camera.yaw, camera.pitch);
+                fclose(file);
+            } else {
+                printf("Failed to open %s for writing\n", CAMERA_PATH);
+            }
+            record_key = false;
+        }
+        if (print_memory) {
+            memory_print();
+            host_allocator_print(ctx->host_allocator);
+            print_memory = false;
+        }
     }
 
+    sim_destroy(sim);
     vkDeviceWaitIdle(ctx->device);
 
+    streaming_destroy(stream);
+    chunk_renderer_destroy(renderer);
+    raymarch_renderer_destroy(raymarcher);
+    texture_array_destroy(textures);
+
+    world_save_all(world);
+    light_destroy(light, world);
+    world_store_destroy(store);
+    io_destroy(io);
+    job_system_destroy(jobs);
+
     cleanup_vulkan(ctx, window);
 
-    print_arena(GameArena);
+    memory_print();
+    arena_free(TextureArena);
+    arena_free(WorldArena);
     arena_free(GameArena);
 }
@@ -0,0 +1,134 @@
+#ifndef VE_MATH_HPP
+#define VE_MATH_HPP
+
+#include <cmath>
+
+struct Vec3 {
+    float x, y, z;
+};
+
+inline Vec3 operator+(Vec3 a, Vec3 b) { return { a.x + b.x, a.y + b.y, a.z + b.z }; }
+inline Vec3 operator-(Vec3 a, Vec3 b) { return { a.x - b.x, a.y - b.y, a.z - b.z }; }
+inline Vec3 operator*(Vec3 a, float s) { return { a.x * s, a.y * s, a.z * s }; }
+
+inline Vec3 lerp(Vec3 a, Vec3 b, float t) { return a + (b - a) * t; }
+
+inline float dot(Vec3 a, Vec3 b)
+{
+    return a.x * b.x + a.y * b.y + a.z * b.z;
+}
+
+inline Vec3 cross(Vec3 a, Vec3 b)
+{
+    return { a.y * b.z - a.z * b.y, a.z * b.x - a.x * b.z, a.x * b.y - a.y * b.x };
+}
+
+inline float length(Vec3 v)
+{
+    return sqrtf(dot(v, v));
+}
+
+inline Vec3 normalize(Vec3 v)
+{
+    float len = length(v);
+    return len > 0.0f ? v * (1.0f / len) : v;
+}
+
+// Column major, m[col * 4 + row], matches GLSL
+struct Mat4 {
+    float m[16];
+};
+
+inline Mat4 mat4_identity()
+{
+    Mat4 r = {};
+    r.m[0] = r.m[5] = r.m[10] = r.m[15] = 1.0f;
+    return r;
+}
+
+inline Mat4 mat4_mul(const Mat4& a, const Mat4& b)
+{
+    Mat4 r;
+    for (int c = 0; c < 4; c++) {
+        for (int row = 0; row < 4; row++) {
+            float sum = 0.0f;
+            for (int k = 0; k < 4; k++) {
+                sum += a.m[k * 4 + row] * b.m[c * 4 + k];
+            }
+            r.m[c * 4 + row] = sum;
+        }
+    }
+    return r;
+}
+
+// Right handed, depth 0..1, Y flipped for Vulkan clip space
+inline Mat4 mat4_perspective(float fov_y, float aspect, float near_z, float far_z)
+{
+    float f = 1.0f / tanf(fov_y * 0.5f);
+    Mat4 r = {};
+    r.m[0] = f / aspect;
+    r.m[5] = -f;
+    r.m[10] = far_z / (near_z - far_z);
+    r.m[11] = -1.0f;
+    r.m[14] = (near_z * far_z) / (near_z - far_z);
+    return r;
+}
+
+inline Mat4 mat4_look_dir(Vec3 eye, Vec3 forward, Vec3 up)
+{
+    Vec3 f = normalize(forward);
+    Vec3 s = normalize(cross(f, up));
+    Vec3 u = cross(s, f);
+
+    Mat4 r = mat4_identity();
+    r.m[0] = s.x;
+    r.m[4] = s.y;
+    r.m[8] = s.z;
+    r.m[1] = u.x;
+    r.m[5] = u.y;
+    r.m[9] = u.z;
+    r.m[2] = -f.x;
+    r.m[6] = -f.y;
+    r.m[10] = -f.z;
+    r.m[12] = -dot(s, eye);
+    r.m[13] = -dot(u, eye);
+    r.m[14] = dot(f, eye);
+    return r;
+}
+
+// Planes are (a, b, c, d) with a*x + b*y + c*z + d >= 0 inside
+struct Frustum {
+    float planes[6][4];
+};
+
+inline Frustum frustum_from_matrix(const Mat4& vp)
+{
+    auto row = [&vp](int r, int c) { return vp.m[c * 4 + r]; };
+
+    Frustum f;
+    for (int c = 0; c < 4; c++) {
+        f.planes[0][c] = row(3, c) + row(0, c); // left
+        f.planes[1][c] = row(3, c) - row(0, c); // right
+        f.planes[2][c] = row(3, c) + row(1, c); // bottom
+        f.planes[3][c] = row(3, c) - row(1, c); // top
+        f.planes[4][c] = row(2, c); // near (z >= 0)
+        f.planes[5][c] = row(3, c) - row(2, c); // far
+    }
+    return f;
+}
+
+inline bool frustum_test_aabb(const Frustum& f, Vec3 min, Vec3 max)
+{
+    for (int i = 0; i < 6; i++) {
+        const float* p = f.planes[i];
+        float x = p[0] > 0.0f ? max.x : min.x;
+        float y = p[1] > 0.0f ? max.y : min.y;
+        float z = p[2] > 0.0f ? max.z : min.z;
+        if (p[0] * x + p[1] * y + p[2] * z + p[3] < 0.0f) {
+            return false;
+        }
+    }
+    return true;
+}
+
+#endif // VE_MATH_HPP
@@ -0,0 +1,169 @@
+#include "memory.hpp"
+#include <cstdio>
+
+MemoryTracker memory_tracker;
+
+static const char* MEM_TAG_NAMES[MEM_TAG_COUNT] = { "other", "chunks", "meshes", "staging", "frame", "shaders", "textures", "driver" };
+static const char* MEM_DOMAIN_NAMES[MEM_DOMAIN_COUNT] = { "cpu", "gpu" };
+
+const char* memory_tag_name(MemTag tag)
+{
+    return MEM_TAG_NAMES[tag];
+}
+
+const char* memory_domain_name(MemDomain domain)
+{
+    return MEM_DOMAIN_NAMES[domain];
+}
+
+void memory_track(MemDomain domain, MemTag tag, int64_t bytes)
+{
+    MemCounter* counter = &memory_tracker.counters[domain][tag];
+    int64_t live = counter->live.fetch_add(bytes, std::memory_order_relaxed) + bytes;
+    int64_t peak = counter->peak.load(std::memory_order_relaxed);
+    while (live > peak && !counter->peak.compare_exchange_weak(peak, live, std::memory_order_relaxed)) {
+    }
+}
+
+// Racy against other threads reserving the same tag, budgets are soft by a few allocations
+static bool fits_budget(MemDomain domain, MemTag tag, uint64_t bytes)
+{
+    MemCounter* counter = &memory_tracker.counters[domain][tag];
+    uint64_t budget = counter->budget.load(std::memory_order_relaxed);
+    return budget == 0 || (uint64_t)counter->live.load(std::memory_order_relaxed) + bytes <= budget;
+}
+
+bool memory_reserve(MemDomain domain, MemTag tag, uint64_t bytes)
+{
+    if (!fits_budget(domain, tag, bytes)) {
+        memory_tracker.failed.fetch_add(bytes, std::memory_order_relaxed);
+        return false;
+    }
+    memory_track(domain, tag, (int64_t)bytes);
+    return true;
+}
+
+void memory_set_budget(MemDomain domain, MemTag tag, uint64_t bytes)
+{
+    memory_tracker.counters[domain][tag].budget.store(bytes, std::memory_order_relaxed);
+}
+
+uint64_t memory_live(MemDomain domain, MemTag tag)
+{
+    return (uint64_t)memory_tracker.counters[domain][tag].live.load(std::memory_order_relaxed);
+}
+
+uint64_t memory_peak(MemDomain domain, MemTag tag)
+{
+    return (uint64_t)memory_tracker.counters[domain][tag].peak.load(std::memory_order_relaxed);
+}
+
+// ---GPU heaps---
+
+void memory_set_heap(uint32_t heap, uint64_t size, uint64_t budget, uint64_t usage, bool device_local)
+{
+    if (heap >= MEMORY_MAX_HEAPS) {
+        return;
+    }
+    MemHeap* h = &memory_tracker.heaps[heap];
+    h->size = size;
+    h->budget = budget;
+    h->usage = usage;
+    h->allocated_at_query = usage ? h->allocated : 0; // without a usage number ours is all there is
+    h->device_local = device_local;
+    if (heap >= memory_tracker.num_heaps) {
+        memory_tracker.num_heaps = heap + 1;
+    }
+}
+
+uint64_t memory_heap_usage(uint32_t heap)
+{
+    const MemHeap* h = &memory_tracker.heaps[heap];
+    int64_t usage = (int64_t)h->usage + h->allocated - h->allocated_at_query;
+    return usage > 0 ? (uint64_t)usage : 0;
+}
+
+static uint64_t heap_limit(uint32_t heap)
+{
+    return (uint64_t)(memory_tracker.heaps[heap].budget * MEMORY_HEAP_HEADROOM);
+}
+
+bool memory_gpu_reserve(MemTag tag, uint32_t heap, uint64_t bytes)
+{
+    bool heap_fits = heap >= memory_tracker.num_heaps || memory_heap_usage(heap) + bytes <= heap_limit(heap);
+    if (!heap_fits || !fits_budget(MEM_GPU, tag, bytes)) {
+        memory_tracker.failed.fetch_add(bytes, std::memory_order_relaxed);
+        return false;
+    }
+    memory_gpu_track(tag, heap, (int64_t)bytes);
+    return true;
+}
+
+void memory_gpu_track(MemTag tag, uint32_t heap, int64_t bytes)
+{
+    memory_track(MEM_GPU, tag, bytes);
+    if (heap < MEMORY_MAX_HEAPS) {
+        memory_tracker.heaps[heap].allocated += bytes;
+    }
+}
+
+// ---Budgets---
+
+uint64_t memory_pressure()
+{
+    uint64_t over = memory_tracker.failed.exchange(0, std::memory_order_relaxed);
+    for (uint32_t d = 0; d < MEM_DOMAIN_COUNT; d++) {
+        for (uint32_t t = 0; t < MEM_TAG_COUNT; t++) {
+            uint64_t budget = memory_tracker.counters[d][t].budget.load(std::memory_order_relaxed);
+            uint64_t live = memory_live((MemDomain)d, (MemTag)t);
+            if (budget && live > budget) {
+                over += live - budget;
+            }
+        }
+    }
+    for (uint32_t h = 0; h < memory_tracker.num_heaps; h++) {
+        uint64_t usage = memory_heap_usage(h);
+        if (memory_tracker.heaps[h].budget && usage > heap_limit(h)) {
+            over += usage - heap_limit(h);
+        }
+    }
+    return over;
+}
+
+void memory_print()
+{
+    printf("%-8s %-8s %12s %12s %12s\n", "domain", "tag", "live MB", "peak MB", "budget MB");
+    for (uint32_t d = 0; d < MEM_DOMAIN_COUNT; d++) {
+        for (uint32_t t = 0; t < MEM_TAG_COUNT; t++) {
+            uint64_t peak = memory_peak((MemDomain)d, (MemTag)t);
+            if (peak == 0) {
+                continue;
+            }
+            uint64_t budget = memory_tracker.counters[d][t].budget.load(std::memory_order_relaxed);
+            printf("%-8s %-8s %12.2f %12.2f", memory_domain_name((MemDomain)d), memory_tag_name((MemTag)t),
+                memory_live((MemDomain)d, (MemTag)t) / (1024.0 * 1024.0), peak / (1024.0 * 1024.0));
+            if (budget) {
+                printf(" %12.2f\n", budget / (1024.0 * 1024.0));
+            } else {
+                printf(" %12s\n", "-");
+            }
+        }
+    }
+    for (uint32_t h = 0; h < memory_tracker.num_heaps; h++) {
+        const MemHeap* heap = &memory_tracker.heaps[h];
+        printf("heap %u%s: %.2f MB ours, %.2f / %.2f MB used of the %s, %.2f MB heap\n", h, heap->device_local ? " (device local)" : "",
+            heap->allocated / (1024.0 * 1024.0), memory_heap_usage(h) / (1024.0 * 1024.0), heap->budget / (1024.0 * 1024.0),
+            memory_tracker.heap_budgets ? "budget" : "heap size", heap->size / (1024.0 * 1024.0));
+    }
+}
+
+// ---Arenas---
+
+static void arena_hook(const Arena* arena, int64_t bytes)
+{
+    MemTag tag = arena->tag < MEM_TAG_COUNT ? (MemTag)arena->tag : MEM_OTHER;
+    memory_track(MEM_CPU, tag, bytes);
+}
+
+// Before main, so arenas made during startup are counted too
+static bool arena_hook_installed = (arena_region_hook = arena_hook, true);
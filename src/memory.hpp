@@ -0,0 +1,92 @@
+#ifndef MEMORY_HPP
+#define MEMORY_HPP
+
+#include <Arena.h>
+#include <atomic>
+#include <cstdint>
+
+// Process wide memory accounting. Every arena region, tracked malloc and GPU allocation counts
+// towards a tag, live and peak bytes per tag can be read at any time from any thread. Tags can
+// have budgets, and GPU allocations also have to fit the heap they land in: the driver's
+// VK_EXT_memory_budget numbers when it has them, the heap size otherwise. Allocations that go
+// over fail instead, and memory_pressure tells streaming how much to evict.
+// Arena regions count in full from the moment they're malloc'd, untouched pages included.
+
+#define MEMORY_MAX_HEAPS 16 // VK_MAX_MEMORY_HEAPS
+#define MEMORY_HEAP_HEADROOM 0.9 // of a heap's budget we allocate into, the driver and other processes move it
+
+// Arenas pass theirs in create_arena_tagged, plain create_arena counts as MEM_OTHER
+enum MemTag : uint32_t {
+    MEM_OTHER,
+    MEM_CHUNKS, // voxel data: chunk pool, light, brick map buffers
+    MEM_MESHES, // mesher scratch, cpu meshes waiting for upload, vertex buffers
+    MEM_STAGING, // upload and pixel staging buffers
+    MEM_FRAME, // per frame and swapchain sized resources
+    MEM_SHADERS,
+    MEM_TEXTURES, // block texture packs and arrays
+    MEM_DRIVER, // host memory the Vulkan driver allocates through our callbacks
+    MEM_TAG_COUNT
+};
+
+enum MemDomain : uint32_t {
+    MEM_CPU,
+    MEM_GPU,
+    MEM_DOMAIN_COUNT
+};
+
+struct MemCounter {
+    std::atomic<int64_t> live; // bytes
+    std::atomic<int64_t> peak;
+    std::atomic<uint64_t> budget; // 0 = unlimited
+};
+
+// Main thread only, written by the renderer
+struct MemHeap {
+    uint64_t size;
+    uint64_t budget; // VK_EXT_memory_budget, or the heap size
+    uint64_t usage; // whole process as of the last query, 0 without the extension
+    int64_t allocated; // by us, live
+    int64_t allocated_at_query;
+    bool device_local;
+};
+
+struct MemoryTracker {
+    MemCounter counters[MEM_DOMAIN_COUNT][MEM_TAG_COUNT];
+    MemHeap heaps[MEMORY_MAX_HEAPS];
+    uint32_t num_heaps;
+    bool heap_budgets; // VK_EXT_memory_budget numbers, not just heap sizes
+    std::atomic<uint64_t> failed; // bytes refused since the last memory_pressure
+};
+
+// The one instance, every arena reports into it from the start
+extern MemoryTracker memory_tracker;
+
+const char* memory_tag_name(MemTag tag);
+const char* memory_domain_name(MemDomain domain);
+
+// Unconditional, for memory that has to exist either way. Negative bytes free.
+void memory_track(MemDomain domain, MemTag tag, int64_t bytes);
+// Tracks the bytes if they fit the tag's budget, otherwise counts them as refused
+bool memory_reserve(MemDomain domain, MemTag tag, uint64_t bytes);
+
+void memory_set_budget(MemDomain domain, MemTag tag, uint64_t bytes);
+uint64_t memory_live(MemDomain domain, MemTag tag);
+uint64_t memory_peak(MemDomain domain, MemTag tag);
+
+// The renderer's view of the GPU heaps, call again whenever it requeried the budgets.
+// usage is 0 and budget the heap size without VK_EXT_memory_budget.
+void memory_set_heap(uint32_t heap, uint64_t size, uint64_t budget, uint64_t usage, bool device_local);
+// GPU allocations: the tag's budget and the heap's headroom both have to fit
+bool memory_gpu_reserve(MemTag tag, uint32_t heap, uint64_t bytes);
+// Unconditional like memory_track, also how reserved GPU memory is given back
+void memory_gpu_track(MemTag tag, uint32_t heap, int64_t bytes);
+// Process usage of the heap, ours since the last query added on top
+uint64_t memory_heap_usage(uint32_t heap);
+
+// Bytes to free to get every tag and heap back under budget, plus whatever allocations got
+// refused since the last call. Main thread, once per frame.
+uint64_t memory_pressure();
+
+void memory_print();
+
+#endif // MEMORY_HPP
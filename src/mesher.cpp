@@ -0,0 +1,619 @@
+#include "mesher.hpp"
+#include <bit>
+#include <cstdio>
+#include <cstring>
+
+// Corners of each face, counter clockwise seen from outside the block
+static constexpr uint8_t FACE_CORNERS[FACE_COUNT][4][3] = {
+    { { 1, 0, 0 }, { 1, 1, 0 }, { 1, 1, 1 }, { 1, 0, 1 } },
+    { { 0, 0, 0 }, { 0, 0, 1 }, { 0, 1, 1 }, { 0, 1, 0 } },
+    { { 0, 1, 0 }, { 0, 1, 1 }, { 1, 1, 1 }, { 1, 1, 0 } },
+    { { 0, 0, 0 }, { 1, 0, 0 }, { 1, 0, 1 }, { 0, 0, 1 } },
+    { { 0, 0, 1 }, { 1, 0, 1 }, { 1, 1, 1 }, { 0, 1, 1 } },
+    { { 0, 0, 0 }, { 0, 1, 0 }, { 1, 1, 0 }, { 1, 0, 0 } },
+};
+
+// Brightness of each light level, roughly a 0.8 falloff per step with a floor so caves aren't pitch black
+static const float LIGHT_BRIGHTNESS[LIGHT_MAX + 1] = {
+    0.06f, 0.07f, 0.08f, 0.1f, 0.12f, 0.15f, 0.18f, 0.22f, 0.27f, 0.33f, 0.4f, 0.48f, 0.58f, 0.7f, 0.84f, 1.0f
+};
+
+// ---Lookup tables---
+
+// The two axes a face spans, u and v
+static constexpr uint8_t FACE_TANGENTS[FACE_COUNT][2] = { { 1, 2 }, { 1, 2 }, { 0, 2 }, { 0, 2 }, { 0, 1 }, { 0, 1 } };
+
+// The 8 voxels around the one in front of a face, in (u, v) steps. Bit k of a ring mask is set
+// when the voxel at RING_OFFSETS[k] is opaque.
+static constexpr int8_t RING_OFFSETS[8][2] = { { -1, -1 }, { 0, -1 }, { 1, -1 }, { -1, 0 }, { 1, 0 }, { -1, 1 }, { 0, 1 }, { 1, 1 } };
+
+static constexpr uint32_t ring_bit(int32_t du, int32_t dv)
+{
+    int32_t i = (dv + 1) * 3 + (du + 1);
+    return i > 4 ? i - 1 : i; // the centre is the face's own neighbour, not part of the ring
+}
+
+// Ambient occlusion of the 4 corners of a face (2 bits each, 3 = open), for every ring mask.
+// A corner is darkened by the two edge voxels and the diagonal one touching it, and fully
+// occluded when both edges are.
+struct AoTable {
+    uint8_t corners[FACE_COUNT][256];
+};
+
+static constexpr AoTable make_ao_table()
+{
+    AoTable table {};
+    for (uint32_t f = 0; f < FACE_COUNT; f++) {
+        for (uint32_t mask = 0; mask < 256; mask++) {
+            uint8_t packed = 0;
+            for (uint32_t c = 0; c < 4; c++) {
+                int32_t du = FACE_CORNERS[f][c][FACE_TANGENTS[f][0]] ? 1 : -1;
+                int32_t dv = FACE_CORNERS[f][c][FACE_TANGENTS[f][1]] ? 1 : -1;
+                uint32_t side_u = (mask >> ring_bit(du, 0)) & 1;
+                uint32_t side_v = (mask >> ring_bit(0, dv)) & 1;
+                uint32_t corner = (mask >> ring_bit(du, dv)) & 1;
+                uint32_t ao = side_u && side_v ? 0 : 3 - (side_u + side_v + corner);
+                packed |= ao << (c * 2);
+            }
+            table.corners[f][mask] = packed;
+        }
+    }
+    return table;
+}
+
+static constexpr AoTable AO_TABLE = make_ao_table();
+static const float AO_SHADE[4] = { 0.5f, 0.68f, 0.84f, 1.0f };
+
+// Whether a face of `block` towards `neighbor` is drawn: not behind something opaque, and not
+// between two blocks of the same kind (water)
+struct VisibilityTable {
+    bool visible[BLOCK_COUNT][BLOCK_COUNT];
+};
+
+static constexpr VisibilityTable make_visibility_table()
+{
+    VisibilityTable table {};
+    for (uint32_t b = 0; b < BLOCK_COUNT; b++) {
+        for (uint32_t n = 0; n < BLOCK_COUNT; n++) {
+            bool same_kind = n == b || (block_is_water((BlockID)n) && block_is_water((BlockID)b));
+            table.visible[b][n] = !block_is_opaque((BlockID)n) && !same_kind;
+        }
+    }
+    return table;
+}
+
+static constexpr VisibilityTable FACE_VISIBLE = make_visibility_table();
+
+// ---Sources---
+
+// One resolution level of a chunk, padded with one voxel of its neighbours on every side so the
+// mesher never looks outside it. Edge and corner voxels of the padding belong to chunks that
+// aren't passed in, they stay air.
+struct MeshSource {
+    const BlockID* blocks; // (size + 2)^3, see pad_index
+    const uint8_t* light; // light level of each voxel, same layout
+    // One bit per voxel of each padded row along x (bit x + 1 for voxel x), see row_index.
+    // Lets the mesher skip whole runs of buried or empty voxels.
+    const uint64_t* opaque_rows;
+    const uint64_t* solid_rows; // anything but air
+    int32_t size; // voxels per side, padding not included
+    int32_t scale; // blocks per voxel
+    const Chunk* chunk;
+    const Chunk* const* neighbors;
+};
+
+enum MeshPass {
+    MESH_PASS_OPAQUE,
+    MESH_PASS_TRANSPARENT,
+    MESH_PASS_SKIRT,
+};
+
+static inline uint32_t grid_index(int32_t size, int32_t x, int32_t y, int32_t z)
+{
+    return (y * size + z) * size + x;
+}
+
+// Voxel coordinates from -1 to size
+static inline uint32_t pad_index(int32_t size, int32_t x, int32_t y, int32_t z)
+{
+    return grid_index(size + 2, x + 1, y + 1, z + 1);
+}
+
+static inline uint32_t row_index(int32_t size, int32_t y, int32_t z)
+{
+    return (y + 1) * (size + 2) + (z + 1);
+}
+
+// Light at block x, y, z of a chunk. Mips take the brightest block of the 2x2x2 below and behind
+// it (their centre), the blocks a mip samples its material from are often solid and dark.
+static inline uint8_t centre_light(const Chunk* chunk, int32_t x, int32_t y, int32_t z, int32_t scale)
+{
+    if (scale == 1) {
+        return light_level(chunk->light[chunk_index(x, y, z)]);
+    }
+    uint8_t level = 0;
+    for (int32_t dy = -1; dy <= 0; dy++) {
+        for (int32_t dz = -1; dz <= 0; dz++) {
+            for (int32_t dx = -1; dx <= 0; dx++) {
+                uint8_t l = light_level(chunk->light[chunk_index(x + dx, y + dy, z + dz)]);
+                level = l > level ? l : level;
+            }
+        }
+    }
+    return level;
+}
+
+// The padding layer on one face, from the neighbour's blocks next to it
+static void pad_face(const MeshSource* src, BlockID* blocks, uint8_t* light, uint32_t face)
+{
+    const Chunk* n = src->neighbors[face];
+    if (!n) {
+        return; // air, fully lit
+    }
+    int32_t size = src->size;
+    int32_t scale = src->scale;
+    int32_t half = scale / 2;
+    uint32_t axis = face >> 1;
+    uint32_t u = (axis + 1) % 3;
+    uint32_t w = (axis + 2) % 3;
+
+    int32_t voxel[3];
+    int32_t block[3];
+    voxel[axis] = (face & 1) ? -1 : size;
+    block[axis] = (face & 1) ? CHUNK_SIZE - scale + half : half;
+    for (int32_t a = 0; a < size; a++) {
+        for (int32_t b = 0; b < size; b++) {
+            voxel[u] = a;
+            voxel[w] = b;
+            block[u] = a * scale + half;
+            block[w] = b * scale + half;
+            uint32_t i = pad_index(size, voxel[0], voxel[1], voxel[2]);
+            blocks[i] = n->blocks[chunk_index(block[0], block[1], block[2])];
+            light[i] = centre_light(n, block[0], block[1], block[2], scale);
+        }
+    }
+}
+
+// Copies voxels (size^3, the chunk's own blocks or one of its mips) and the padding around them
+static void pad_source(Arena* arr, MeshSource* src, const Chunk* chunk, const Chunk* const neighbors[FACE_COUNT], const BlockID* voxels, int32_t size, int32_t scale)
+{
+    uint32_t padded = (uint32_t)(size + 2) * (size + 2) * (size + 2);
+    BlockID* blocks = (BlockID*)arena_allocate(arr, padded * sizeof(BlockID));
+    uint8_t* light = (uint8_t*)arena_allocate(arr, padded);
+    uint32_t num_rows = (uint32_t)(size + 2) * (size + 2);
+    uint64_t* opaque_rows = (uint64_t*)arena_allocate(arr, num_rows * sizeof(uint64_t));
+    uint64_t* solid_rows = (uint64_t*)arena_allocate(arr, num_rows * sizeof(uint64_t));
+    memset(blocks, 0, padded * sizeof(BlockID));
+    memset(light, LIGHT_MAX, padded);
+    *src = { blocks, light, opaque_rows, solid_rows, size, scale, chunk, neighbors };
+
+    int32_t half = scale / 2;
+    for (int32_t y = 0; y < size; y++) {
+        for (int32_t z = 0; z < size; z++) {
+            uint32_t row = pad_index(size, 0, y, z);
+            memcpy(&blocks[row], &voxels[grid_index(size, 0, y, z)], size * sizeof(BlockID));
+            if (scale == 1) {
+                const uint8_t* row_light = &chunk->light[chunk_index(0, y, z)];
+                for (int32_t x = 0; x < size; x++) {
+                    light[row + x] = light_level(row_light[x]);
+                }
+                continue;
+            }
+            for (int32_t x = 0; x < size; x++) {
+                light[row + x] = centre_light(chunk, x * scale + half, y * scale + half, z * scale + half, scale);
+            }
+        }
+    }
+    for (uint32_t f = 0; f < FACE_COUNT; f++) {
+        pad_face(src, blocks, light, f);
+    }
+
+    for (uint32_t r = 0; r < num_rows; r++) {
+        const BlockID* row = &blocks[r * (size + 2)];
+        uint64_t opaque = 0;
+        uint64_t solid = 0;
+        for (int32_t x = 0; x < size + 2; x++) {
+            opaque |= (uint64_t)block_is_opaque(row[x]) << x;
+            solid |= (uint64_t)(row[x] != BLOCK_AIR) << x;
+        }
+        opaque_rows[r] = opaque;
+        solid_rows[r] = solid;
+    }
+}
+
+// ---Meshing---
+
+// Skirts look SKIRT_DEPTH voxels up, which may be past the padding, further into the chunk above
+static inline BlockID block_above(const MeshSource* src, int32_t x, int32_t y, int32_t z)
+{
+    if (y <= src->size) {
+        return src->blocks[pad_index(src->size, x, y, z)];
+    }
+    const Chunk* above = src->neighbors[FACE_POS_Y];
+    if (!above) {
+        return BLOCK_AIR;
+    }
+    int32_t half = src->scale / 2;
+    return above->blocks[chunk_index(x * src->scale + half, (y - src->size) * src->scale + half, z * src->scale + half)];
+}
+
+static inline uint8_t light_above(const MeshSource* src, int32_t x, int32_t y, int32_t z)
+{
+    if (y <= src->size) {
+        return src->light[pad_index(src->size, x, y, z)];
+    }
+    const Chunk* above = src->neighbors[FACE_POS_Y];
+    if (!above) {
+        return LIGHT_MAX;
+    }
+    int32_t half = src->scale / 2;
+    return centre_light(above, x * src->scale + half, (y - src->size) * src->scale + half, z * src->scale + half, src->scale);
+}
+
+static bool near_surface(const MeshSource* src, int32_t x, int32_t y, int32_t z)
+{
+    for (int32_t dy = 1; dy <= SKIRT_DEPTH; dy++) {
+        if (!block_is_opaque(block_above(src, x, y + dy, z))) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Voxels [min, max) of the grid
+struct MeshBox {
+    int32_t min[3];
+    int32_t max[3];
+};
+
+static uint32_t mesh_pass(const MeshSource* src, MeshPass pass, const MeshBox& box, ChunkVertex* out)
+{
+    int32_t scale = src->scale;
+    int32_t size = src->size;
+
+    // Steps through the padded grid to the voxel in front of each face, and around that one
+    const int32_t padded = size + 2;
+    const int32_t axis_step[3] = { 1, padded * padded, padded };
+    int32_t face_step[FACE_COUNT];
+    int32_t ring_step[FACE_COUNT][8];
+    for (uint32_t f = 0; f < FACE_COUNT; f++) {
+        face_step[f] = FACE_NORMALS[f][0] * axis_step[0] + FACE_NORMALS[f][1] * axis_step[1] + FACE_NORMALS[f][2] * axis_step[2];
+        for (uint32_t k = 0; k < 8; k++) {
+            ring_step[f][k] = RING_OFFSETS[k][0] * axis_step[FACE_TANGENTS[f][0]] + RING_OFFSETS[k][1] * axis_step[FACE_TANGENTS[f][1]];
+        }
+    }
+
+    // Voxels in [box.min, box.max) along the row
+    uint64_t box_bits = ((1ull << (box.max[0] - box.min[0])) - 1) << (box.min[0] + 1);
+    uint64_t edge_bits = (1ull << 1) | (1ull << size);
+
+    uint32_t num_quads = 0;
+    for (int32_t y = box.min[1]; y < box.max[1]; y++) {
+        for (int32_t z = box.min[2]; z < box.max[2]; z++) {
+            const uint64_t* opaque = src->opaque_rows;
+            uint32_t r = row_index(size, y, z);
+            uint64_t candidates;
+            if (pass == MESH_PASS_OPAQUE) {
+                // Opaque voxels with all six neighbours opaque have nothing to draw
+                uint64_t buried = (opaque[r] >> 1) & (opaque[r] << 1) & opaque[r - 1] & opaque[r + 1] & opaque[r - (size + 2)] & opaque[r + (size + 2)];
+                candidates = opaque[r] & ~buried;
+            } else if (pass == MESH_PASS_TRANSPARENT) {
+                candidates = src->solid_rows[r] & ~opaque[r];
+            } else {
+                bool border = y == 0 || y == size - 1 || z == 0 || z == size - 1;
+                candidates = opaque[r] & (border ? ~0ull : edge_bits);
+            }
+            candidates &= box_bits;
+
+            for (; candidates; candidates &= candidates - 1) {
+                int32_t x = std::countr_zero(candidates) - 1;
+                uint32_t i = pad_index(size, x, y, z);
+                BlockID block = src->blocks[i];
+
+                for (uint32_t f = 0; f < FACE_COUNT; f++) {
+                    uint32_t front = i + face_step[f];
+                    BlockID n = src->blocks[front];
+                    uint8_t light = src->light[front];
+                    if (pass == MESH_PASS_SKIRT) {
+                        int32_t nx = x + FACE_NORMALS[f][0];
+                        int32_t ny = y + FACE_NORMALS[f][1];
+                        int32_t nz = z + FACE_NORMALS[f][2];
+                        bool inside = nx >= 0 && nx < size && ny >= 0 && ny < size && nz >= 0 && nz < size;
+                        if (inside || FACE_VISIBLE.visible[block][n] || !FACE_VISIBLE.visible[block][BLOCK_AIR] || !near_surface(src, x, y, z)) {
+                            continue;
+                        }
+                        // Skirts face a solid neighbour, they are lit like the surface above them
+                        light = 0;
+                        for (int32_t dy = 1; dy <= SKIRT_DEPTH; dy++) {
+                            uint8_t l = light_above(src, x, y + dy, z);
+                            light = l > light ? l : light;
+                        }
+                    } else if (!FACE_VISIBLE.visible[block][n]) {
+                        continue;
+                    }
+
+                    uint32_t ring = 0;
+                    for (uint32_t k = 0; k < 8; k++) {
+                        ring |= (uint32_t)block_is_opaque(src->blocks[front + ring_step[f][k]]) << k;
+                    }
+                    uint32_t ao = AO_TABLE.corners[f][ring];
+
+                    // Quads split along corners 0 and 2. Start at corner 1 instead when that
+                    // diagonal is the brighter one, so the occlusion doesn't smear along the split.
+                    uint32_t first = ((ao & 3) + ((ao >> 4) & 3)) < (((ao >> 2) & 3) + ((ao >> 6) & 3));
+
+                    // The texture has the albedo, the vertex color only the light
+                    float shade = FACE_SHADE[f] * LIGHT_BRIGHTNESS[light];
+                    uint32_t white = BLOCK_COLORS[block] | 0x00ffffff;
+                    uint32_t layer = BLOCK_FACE_TEXTURES[block][f];
+                    ChunkVertex* v = &out[num_quads * 4];
+                    for (uint32_t c = 0; c < 4; c++) {
+                        uint32_t corner = (c + first) & 3;
+                        uint32_t vx = (x + FACE_CORNERS[f][corner][0]) * scale;
+                        uint32_t vy = (y + FACE_CORNERS[f][corner][1]) * scale;
+                        uint32_t vz = (z + FACE_CORNERS[f][corner][2]) * scale;
+                        v[c].packed = pack_vertex(vx, vy, vz, f, layer);
+                        v[c].color = shade_color(white, shade * AO_SHADE[(ao >> (corner * 2)) & 3]);
+                    }
+                    num_quads++;
+                }
+            }
+        }
+    }
+    return num_quads;
+}
+
+static uint32_t mesh_body(const MeshSource* src, const MeshBox& box, ChunkVertex* out)
+{
+    uint32_t num_opaque = mesh_pass(src, MESH_PASS_OPAQUE, box, out);
+    return num_opaque + mesh_pass(src, MESH_PASS_TRANSPARENT, box, out + num_opaque * 4);
+}
+
+void downsample_voxels(const BlockID* src, int32_t src_size, BlockID* dst)
+{
+    int32_t size = src_size / 2;
+    for (int32_t y = 0; y < size; y++) {
+        for (int32_t z = 0; z < size; z++) {
+            for (int32_t x = 0; x < size; x++) {
+                BlockID upper[4];
+                uint32_t num_upper = 0;
+                BlockID lower = BLOCK_AIR;
+                uint32_t num_solid = 0;
+                for (int32_t dy = 1; dy >= 0; dy--) {
+                    for (int32_t dz = 0; dz < 2; dz++) {
+                        for (int32_t dx = 0; dx < 2; dx++) {
+                            BlockID b = src[grid_index(src_size, x * 2 + dx, y * 2 + dy, z * 2 + dz)];
+                            if (b == BLOCK_AIR) {
+                                continue;
+                            }
+                            num_solid++;
+                            if (dy == 1) {
+                                upper[num_upper++] = b;
+                            } else {
+                                lower = b;
+                            }
+                        }
+                    }
+                }
+
+                BlockID material = lower;
+                uint32_t best = 0;
+                for (uint32_t i = 0; i < num_upper; i++) {
+                    uint32_t count = 0;
+                    for (uint32_t j = 0; j < num_upper; j++) {
+                        count += upper[j] == upper[i];
+                    }
+                    if (count > best) {
+                        best = count;
+                        material = upper[i];
+                    }
+                }
+                dst[grid_index(size, x, y, z)] = num_solid >= 4 ? material : (BlockID)BLOCK_AIR;
+            }
+        }
+    }
+}
+
+uint8_t mesh_border_dependents(int32_t x, int32_t y, int32_t z)
+{
+    // Mips sample neighbours at the centre of their voxels, and skirts look a few voxels up
+    // into the chunk above
+    const int32_t max_scale = 1 << (CHUNK_LODS - 1);
+    const int32_t side = max_scale / 2;
+    const int32_t below = (SKIRT_DEPTH - 1) * max_scale + max_scale / 2;
+
+    uint8_t mask = 0;
+    mask |= (x >= CHUNK_SIZE - 1 - side) << FACE_POS_X;
+    mask |= (x <= side) << FACE_NEG_X;
+    mask |= (y >= CHUNK_SIZE - 1 - side) << FACE_POS_Y;
+    mask |= (y <= below) << FACE_NEG_Y;
+    mask |= (z >= CHUNK_SIZE - 1 - side) << FACE_POS_Z;
+    mask |= (z <= side) << FACE_NEG_Z;
+    return mask;
+}
+
+// ---Sections---
+
+// Largest single section: the body of the first mip
+#define MAX_SECTION_QUADS MAX_BOX_QUADS(CHUNK_SIZE / 2)
+
+struct MeshWriter {
+    ChunkVertex* vertices;
+    MeshSection* sections;
+    ChunkVertex* temp; // sections are meshed here first, then copied into place
+    uint32_t cursor; // next free quad, when laying out a new mesh
+    uint32_t num_faces; // padding not included
+    bool fixed_layout; // patching, sections keep their place and capacity
+};
+
+static uint32_t section_capacity(uint32_t num_quads, bool grow)
+{
+    if (grow) {
+        return num_quads * 2 + 64;
+    }
+    return num_quads + num_quads / 4;
+}
+
+static bool write_section(MeshWriter* w, uint32_t index, uint32_t num_quads, uint32_t capacity, uint32_t max_capacity)
+{
+    MeshSection* section = &w->sections[index];
+    if (w->fixed_layout) {
+        if (num_quads > section->capacity) {
+            return false;
+        }
+    } else {
+        section->first_quad = w->cursor;
+        section->capacity = capacity < max_capacity ? capacity : max_capacity;
+        w->cursor += section->capacity;
+        if (num_quads > section->capacity) {
+            // max_capacity is the worst case, this only drops faces if a bound is wrong
+            printf("Mesh section %u has %u quads, only room for %u\n", index, num_quads, section->capacity);
+            num_quads = section->capacity;
+        }
+    }
+
+    w->num_faces += num_quads;
+    ChunkVertex* dst = w->vertices + section->first_quad * 4;
+    memcpy(dst, w->temp, num_quads * 4 * sizeof(ChunkVertex));
+    memset(dst + num_quads * 4, 0, (section->capacity - num_quads) * 4 * sizeof(ChunkVertex));
+    return true;
+}
+
+static bool write_mips(Arena* arr, MeshWriter* w, const Chunk* chunk, const Chunk* const neighbors[FACE_COUNT])
+{
+    const BlockID* voxels = chunk->blocks;
+    int32_t size = CHUNK_SIZE;
+    int32_t scale = 1;
+    for (uint32_t lod = 1; lod < CHUNK_LODS; lod++) {
+        BlockID* mip = (BlockID*)arena_allocate(arr, (size / 2) * (size / 2) * (size / 2) * sizeof(BlockID));
+        downsample_voxels(voxels, size, mip);
+        voxels = mip;
+        size /= 2;
+        scale *= 2;
+
+        MeshSource src;
+        pad_source(arr, &src, chunk, neighbors, voxels, size, scale);
+
+        MeshBox all = { { 0, 0, 0 }, { size, size, size } };
+        uint32_t section = MESH_SECTION_SKIRTS + 1 + (lod - 1) * 2;
+        uint32_t max_body = MAX_BOX_QUADS(size);
+        uint32_t max_skirts = 6 * size * size;
+
+        uint32_t n = mesh_body(&src, all, w->temp);
+        if (!write_section(w, section, n, n + n / 2 + 16, max_body)) {
+            return false;
+        }
+        n = mesh_pass(&src, MESH_PASS_SKIRT, all, w->temp);
+        if (!write_section(w, section + 1, n, n + n / 2 + 16, max_skirts)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static void finish_mesh(MeshWriter* w, ChunkMesh* out)
+{
+    const MeshSection* sections = w->sections;
+    out->vertices = w->vertices;
+
+    out->lods[0].first_quad = sections[0].first_quad;
+    out->lods[0].num_quads = sections[MESH_SECTION_SKIRTS].first_quad - sections[0].first_quad;
+    out->lods[0].num_skirt_quads = sections[MESH_SECTION_SKIRTS].capacity;
+    for (uint32_t lod = 1; lod < CHUNK_LODS; lod++) {
+        const MeshSection* body = &sections[MESH_SECTION_SKIRTS + 1 + (lod - 1) * 2];
+        out->lods[lod].first_quad = body[0].first_quad;
+        out->lods[lod].num_quads = body[0].capacity;
+        out->lods[lod].num_skirt_quads = body[1].capacity;
+    }
+
+    const MeshSection* last = &sections[MESH_SECTIONS - 1];
+    out->num_quads = last->first_quad + last->capacity;
+}
+
+static MeshBox region_box(uint32_t region)
+{
+    const uint32_t per_axis = CHUNK_REGIONS_PER_AXIS;
+    int32_t x = (region % per_axis) << CHUNK_REGION_SHIFT;
+    int32_t z = ((region / per_axis) % per_axis) << CHUNK_REGION_SHIFT;
+    int32_t y = (region / (per_axis * per_axis)) << CHUNK_REGION_SHIFT;
+    const int32_t size = 1 << CHUNK_REGION_SHIFT;
+    return { { x, y, z }, { x + size, y + size, z + size } };
+}
+
+void mesh_chunk(Arena* arr, const Chunk* chunk, const Chunk* const neighbors[FACE_COUNT], uint64_t grow_regions, ChunkMesh* out)
+{
+    // Worst case allocation, untouched pages never get committed
+    MeshWriter w {};
+    w.vertices = (ChunkVertex*)arena_allocate(arr, MAX_CHUNK_MESH_QUADS * 4 * sizeof(ChunkVertex));
+    w.temp = (ChunkVertex*)arena_allocate(arr, MAX_SECTION_QUADS * 4 * sizeof(ChunkVertex));
+    w.sections = out->sections;
+
+    MeshSource src;
+    pad_source(arr, &src, chunk, neighbors, chunk->blocks, CHUNK_SIZE, 1);
+    for (uint32_t r = 0; r < CHUNK_REGIONS; r++) {
+        uint32_t n = mesh_body(&src, region_box(r), w.temp);
+        write_section(&w, r, n, section_capacity(n, grow_regions & (1ull << r)), MAX_REGION_QUADS);
+    }
+
+    MeshBox all = { { 0, 0, 0 }, { CHUNK_SIZE, CHUNK_SIZE, CHUNK_SIZE } };
+    uint32_t n = mesh_pass(&src, MESH_PASS_SKIRT, all, w.temp);
+    write_section(&w, MESH_SECTION_SKIRTS, n, n + n / 2 + 16, 6 * CHUNK_AREA);
+
+    write_mips(arr, &w, chunk, neighbors);
+    finish_mesh(&w, out);
+    if (w.num_faces == 0) {
+        out->num_quads = 0; // nothing to draw, don't keep the padding around
+    }
+    out->patch = false;
+    out->patch_skirts = false;
+    out->patch_regions = 0;
+}
+
+bool mesh_chunk_patch(Arena* arr, const Chunk* chunk, const Chunk* const neighbors[FACE_COUNT], const MeshSection layout[MESH_SECTIONS],
+    uint64_t regions, bool skirts, ChunkMesh* out)
+{
+    memcpy(out->sections, layout, sizeof(out->sections));
+    const MeshSection* last = &layout[MESH_SECTIONS - 1];
+
+    MeshWriter w {};
+    w.vertices = (ChunkVertex*)arena_allocate(arr, (last->first_quad + last->capacity) * 4 * sizeof(ChunkVertex));
+    w.temp = (ChunkVertex*)arena_allocate(arr, MAX_SECTION_QUADS * 4 * sizeof(ChunkVertex));
+    w.sections = out->sections;
+    w.fixed_layout = true;
+
+    MeshSource src;
+    pad_source(arr, &src, chunk, neighbors, chunk->blocks, CHUNK_SIZE, 1);
+    for (uint32_t r = 0; r < CHUNK_REGIONS; r++) {
+        if (!(regions & (1ull << r))) {
+            continue;
+        }
+        uint32_t n = mesh_body(&src, region_box(r), w.temp);
+        if (!write_section(&w, r, n, 0, 0)) {
+            return false;
+        }
+    }
+
+    if (skirts) {
+        MeshBox all = { { 0, 0, 0 }, { CHUNK_SIZE, CHUNK_SIZE, CHUNK_SIZE } };
+        uint32_t n = mesh_pass(&src, MESH_PASS_SKIRT, all, w.temp);
+        if (!write_section(&w, MESH_SECTION_SKIRTS, n, 0, 0)) {
+            return false;
+        }
+    }
+
+    if (!write_mips(arr, &w, chunk, neighbors)) {
+        return false;
+    }
+    finish_mesh(&w, out);
+    out->patch = true;
+    out->patch_skirts = skirts;
+    out->patch_regions = regions;
+    return true;
+}
+
+bool mesh_section_patched(const ChunkMesh* mesh, uint32_t section)
+{
+    bool region = section < CHUNK_REGIONS && (mesh->patch_regions & (1ull << section));
+    bool skirts = section == MESH_SECTION_SKIRTS && mesh->patch_skirts;
+    return (region || skirts || section > MESH_SECTION_SKIRTS) && mesh->sections[section].capacity > 0;
+}
@@ -0,0 +1,175 @@
+#ifndef MESHER_HPP
+#define MESHER_HPP
+
+#include "chunk.hpp"
+#include <Arena.h>
+#include <cstdint>
+
+enum Face : uint8_t {
+    FACE_POS_X,
+    FACE_NEG_X,
+    FACE_POS_Y,
+    FACE_NEG_Y,
+    FACE_POS_Z,
+    FACE_NEG_Z,
+    FACE_COUNT
+};
+
+inline constexpr int32_t FACE_NORMALS[FACE_COUNT][3] = {
+    { 1, 0, 0 },
+    { -1, 0, 0 },
+    { 0, 1, 0 },
+    { 0, -1, 0 },
+    { 0, 0, 1 },
+    { 0, 0, -1 },
+};
+
+// Directional light baked into each face
+inline constexpr float FACE_SHADE[FACE_COUNT] = { 0.8f, 0.8f, 1.0f, 0.5f, 0.65f, 0.65f };
+
+// RGBA8 as a little endian uint32 (0xAABBGGRR)
+inline constexpr uint32_t BLOCK_COLORS[BLOCK_COUNT] = {
+    0x00000000, // air
+    0xff808080, // stone
+    0xff2b5a86, // dirt
+    0xff3aa04a, // grass
+    0xff88c8dc, // sand
+    0xb0d08030, // water
+    0xff60d0f0, // lamp
+    0xb0d08030, // flowing water, every level
+    0xb0d08030,
+    0xb0d08030,
+    0xb0d08030,
+    0xb0d08030,
+    0xb0d08030,
+    0xb0d08030,
+};
+
+// Layers of the block texture array, see block_textures.hpp
+enum BlockTexture : uint16_t {
+    TEX_STONE,
+    TEX_DIRT,
+    TEX_GRASS_TOP,
+    TEX_GRASS_SIDE,
+    TEX_SAND,
+    TEX_WATER,
+    TEX_LAMP,
+    TEX_COUNT
+};
+
+// Texture of every block face, indexed by Face
+inline constexpr uint16_t BLOCK_FACE_TEXTURES[BLOCK_COUNT][FACE_COUNT] = {
+    { 0, 0, 0, 0, 0, 0 }, // air
+    { TEX_STONE, TEX_STONE, TEX_STONE, TEX_STONE, TEX_STONE, TEX_STONE },
+    { TEX_DIRT, TEX_DIRT, TEX_DIRT, TEX_DIRT, TEX_DIRT, TEX_DIRT },
+    { TEX_GRASS_SIDE, TEX_GRASS_SIDE, TEX_GRASS_TOP, TEX_DIRT, TEX_GRASS_SIDE, TEX_GRASS_SIDE },
+    { TEX_SAND, TEX_SAND, TEX_SAND, TEX_SAND, TEX_SAND, TEX_SAND },
+    { TEX_WATER, TEX_WATER, TEX_WATER, TEX_WATER, TEX_WATER, TEX_WATER },
+    { TEX_LAMP, TEX_LAMP, TEX_LAMP, TEX_LAMP, TEX_LAMP, TEX_LAMP },
+    { TEX_WATER, TEX_WATER, TEX_WATER, TEX_WATER, TEX_WATER, TEX_WATER }, // flowing water, every level
+    { TEX_WATER, TEX_WATER, TEX_WATER, TEX_WATER, TEX_WATER, TEX_WATER },
+    { TEX_WATER, TEX_WATER, TEX_WATER, TEX_WATER, TEX_WATER, TEX_WATER },
+    { TEX_WATER, TEX_WATER, TEX_WATER, TEX_WATER, TEX_WATER, TEX_WATER },
+    { TEX_WATER, TEX_WATER, TEX_WATER, TEX_WATER, TEX_WATER, TEX_WATER },
+    { TEX_WATER, TEX_WATER, TEX_WATER, TEX_WATER, TEX_WATER, TEX_WATER },
+    { TEX_WATER, TEX_WATER, TEX_WATER, TEX_WATER, TEX_WATER, TEX_WATER },
+};
+
+inline uint32_t shade_color(uint32_t abgr, float shade)
+{
+    uint32_t r = (uint32_t)((abgr & 0xff) * shade);
+    uint32_t g = (uint32_t)(((abgr >> 8) & 0xff) * shade);
+    uint32_t b = (uint32_t)(((abgr >> 16) & 0xff) * shade);
+    return (abgr & 0xff000000) | (b << 16) | (g << 8) | r;
+}
+
+// Positions are relative to the chunk's min corner, the draw adds the chunk origin (see
+// DrawList::origins_offset). Every lod spans the same 0 - CHUNK_SIZE, so 6 bits an axis do.
+#define VERTEX_POS_BITS 6
+#define VERTEX_FACE_SHIFT 18
+#define VERTEX_LAYER_SHIFT 21
+#define VERTEX_MAX_LAYERS (1u << (32 - VERTEX_LAYER_SHIFT))
+
+struct ChunkVertex {
+    uint32_t packed; // x | y << 6 | z << 12 | Face << 18 | texture layer << 21, the face picks the axes texture coordinates come from
+    uint32_t color; // RGBA8, face shading, light and ambient occlusion baked in, multiplies the texture
+};
+
+inline uint32_t pack_vertex(uint32_t x, uint32_t y, uint32_t z, uint32_t face, uint32_t layer)
+{
+    return x | (y << VERTEX_POS_BITS) | (z << (VERTEX_POS_BITS * 2)) | (face << VERTEX_FACE_SHIFT) | (layer << VERTEX_LAYER_SHIFT);
+}
+
+// Full resolution, then voxel mips downsampled 2x, 4x and 8x
+#define CHUNK_LODS 4
+
+// Neighbouring chunks are at most one lod apart, so a crack is never deeper than two voxels
+// of the finer one
+#define SKIRT_DEPTH 2 // voxels
+
+// Quads are 4 vertices, drawn with the shared quad index buffer (0 1 2 0 2 3).
+// Every face between two voxels, or between a voxel and the padding, is emitted at most once,
+// so a box with n voxels per side never has more than 3n^3 + 3n^2 quads.
+#define MAX_BOX_QUADS(n) (3 * (n) * (n) * (n) + 3 * (n) * (n))
+#define MAX_CHUNK_QUADS (CHUNK_VOLUME / 2 * FACE_COUNT)
+#define MAX_REGION_QUADS MAX_BOX_QUADS(8)
+// Regions may be padded up to their worst case, the rest (skirts, mips) stays well below one more chunk
+#define MAX_CHUNK_MESH_QUADS (CHUNK_REGIONS * MAX_REGION_QUADS + MAX_CHUNK_QUADS)
+
+// The mesh is split into sections that keep a fixed place in the vertex buffer, so an edit only
+// rebuilds and re-uploads the sections it touched. Full resolution is one section per region,
+// then its skirts, then body and skirts of every mip (rebuilt whole, they are small).
+#define MESH_SECTION_SKIRTS CHUNK_REGIONS
+#define MESH_SECTIONS (CHUNK_REGIONS + 1 + (CHUNK_LODS - 1) * 2)
+
+struct MeshSection {
+    uint32_t first_quad;
+    uint32_t capacity; // quads past the faces are degenerate (all zero), room to grow in place
+};
+
+// Quads of one lod: the body, then skirts.
+// Skirts are border faces near the surface that the neighbour hides. They only need drawing
+// next to a chunk drawn at another lod, where they cover the cracks between the two.
+struct MeshRange {
+    uint32_t first_quad;
+    uint32_t num_quads;
+    uint32_t num_skirt_quads;
+};
+
+struct ChunkMesh {
+    ChunkVertex* vertices;
+    uint32_t num_quads; // every section, padding included
+    MeshRange lods[CHUNK_LODS];
+    MeshSection sections[MESH_SECTIONS];
+
+    // Patches only carry the rebuilt sections: these regions, the mips, and the full
+    // resolution skirts if patch_skirts. Everything else in vertices is garbage.
+    bool patch;
+    bool patch_skirts;
+    uint64_t patch_regions;
+};
+
+// Neighbors are indexed by Face. Null neighbors count as air, so border faces get emitted, and
+// as fully lit. Faces take the light of the voxel in front of them, corners are darkened by the
+// opaque voxels around it.
+// Regions in grow_regions get extra room, they were just edited and probably will be again.
+// Vertices are allocated from arr, copy them out before resetting it.
+void mesh_chunk(Arena* arr, const Chunk* chunk, const Chunk* const neighbors[FACE_COUNT], uint64_t grow_regions, ChunkMesh* out);
+
+// Rebuilds the given regions (plus mips, plus skirts if a border changed) into an existing
+// layout. Returns false if a section outgrew its capacity, the chunk needs a full mesh_chunk.
+bool mesh_chunk_patch(Arena* arr, const Chunk* chunk, const Chunk* const neighbors[FACE_COUNT], const MeshSection layout[MESH_SECTIONS],
+    uint64_t regions, bool skirts, ChunkMesh* out);
+
+// Whether a patch carries the section, everything it carries has to be uploaded
+bool mesh_section_patched(const ChunkMesh* mesh, uint32_t section);
+
+// Faces whose neighbour chunk reads the block at local x, y, z when meshing its skirts or mips.
+// Those need a patch too when the block changes.
+uint8_t mesh_border_dependents(int32_t x, int32_t y, int32_t z);
+
+// Halves the resolution: a voxel is solid if at least half of its 8 children are, and takes the
+// most common material of its upper layer (so grass stays on top).
+void downsample_voxels(const BlockID* src, int32_t src_size, BlockID* dst);
+
+#endif // MESHER_HPP
@@ -0,0 +1,421 @@
+#include "physics.hpp"
+#include "trace.hpp"
+#include <cmath>
+#include <cstring>
+#include <new>
+
+// The chunk a query is reading, looked up again only when it crosses into another one
+struct VoxelCursor {
+    World* world;
+    ChunkPos pos;
+    const Chunk* chunk; // null when not loaded
+};
+
+static inline VoxelCursor cursor_start(World* world)
+{
+    return { world, { INT32_MAX, INT32_MAX, INT32_MAX }, nullptr };
+}
+
+static inline const Chunk* cursor_chunk(VoxelCursor* c, ChunkPos pos)
+{
+    if (pos != c->pos) {
+        Chunk* chunk = world_get_chunk(c->world, pos);
+        bool ready = chunk && chunk->state.load(std::memory_order_acquire) == CHUNK_STATE_READY;
+        c->pos = pos;
+        c->chunk = ready ? chunk : nullptr;
+    }
+    return c->chunk;
+}
+
+static inline BlockID cursor_block(VoxelCursor* c, int32_t x, int32_t y, int32_t z)
+{
+    const Chunk* chunk = cursor_chunk(c, chunk_pos_from_block(x, y, z));
+    return chunk ? chunk->blocks[chunk_index(x & CHUNK_MASK, y & CHUNK_MASK, z & CHUNK_MASK)] : BLOCK_AIR;
+}
+
+// Any solid block in lo..hi (inclusive). Walks chunk by chunk and in storage order within each.
+static bool range_has_solid(VoxelCursor* c, const int32_t lo[3], const int32_t hi[3])
+{
+    for (int32_t cy = lo[1] >> CHUNK_SHIFT; cy <= hi[1] >> CHUNK_SHIFT; cy++) {
+        for (int32_t cz = lo[2] >> CHUNK_SHIFT; cz <= hi[2] >> CHUNK_SHIFT; cz++) {
+            for (int32_t cx = lo[0] >> CHUNK_SHIFT; cx <= hi[0] >> CHUNK_SHIFT; cx++) {
+                const Chunk* chunk = cursor_chunk(c, { cx, cy, cz });
+                if (!chunk) {
+                    continue;
+                }
+                int32_t x0 = cx == lo[0] >> CHUNK_SHIFT ? lo[0] & CHUNK_MASK : 0;
+                int32_t x1 = cx == hi[0] >> CHUNK_SHIFT ? hi[0] & CHUNK_MASK : CHUNK_MASK;
+                int32_t y0 = cy == lo[1] >> CHUNK_SHIFT ? lo[1] & CHUNK_MASK : 0;
+                int32_t y1 = cy == hi[1] >> CHUNK_SHIFT ? hi[1] & CHUNK_MASK : CHUNK_MASK;
+                int32_t z0 = cz == lo[2] >> CHUNK_SHIFT ? lo[2] & CHUNK_MASK : 0;
+                int32_t z1 = cz == hi[2] >> CHUNK_SHIFT ? hi[2] & CHUNK_MASK : CHUNK_MASK;
+                for (int32_t y = y0; y <= y1; y++) {
+                    for (int32_t z = z0; z <= z1; z++) {
+                        const BlockID* row = &chunk->blocks[chunk_index(0, y, z)];
+                        for (int32_t x = x0; x <= x1; x++) {
+                            if (block_is_solid(row[x])) {
+                                return true;
+                            }
+                        }
+                    }
+                }
+            }
+        }
+    }
+    return false;
+}
+
+// ---Queries---
+
+static bool raycast(VoxelCursor* c, Vec3 origin, Vec3 dir, float max_distance, RayHit* out)
+{
+    const float o[3] = { origin.x, origin.y, origin.z };
+    const float d[3] = { dir.x, dir.y, dir.z };
+    int32_t v[3];
+    int32_t step[3];
+    float next[3]; // t of the next boundary per axis
+    float delta[3]; // t per voxel per axis
+    for (uint32_t a = 0; a < 3; a++) {
+        v[a] = (int32_t)floorf(o[a]);
+        step[a] = d[a] >= 0.0f ? 1 : -1;
+        if (fabsf(d[a]) < 1e-8f) {
+            next[a] = delta[a] = 1e30f;
+        } else {
+            float inv = 1.0f / d[a];
+            next[a] = ((float)(v[a] + (step[a] > 0)) - o[a]) * inv;
+            delta[a] = fabsf(inv);
+        }
+    }
+
+    float t = 0.0f;
+    int32_t axis = -1; // of the boundary crossed into the current voxel
+    for (uint32_t i = 0; i < PHYSICS_MAX_RAY_STEPS && t <= max_distance; i++) {
+        BlockID block = cursor_block(c, v[0], v[1], v[2]);
+        if (block_is_solid(block)) {
+            out->x = v[0];
+            out->y = v[1];
+            out->z = v[2];
+            out->inside = axis < 0;
+            // Stepping towards +x enters through the -x side
+            out->face = axis < 0 ? FACE_POS_Y : (Face)(axis * 2 + (step[axis] > 0));
+            out->block = block;
+            out->distance = t;
+            return true;
+        }
+        axis = next[0] < next[1] ? (next[0] < next[2] ? 0 : 2) : (next[1] < next[2] ? 1 : 2);
+        t = next[axis];
+        v[axis] += step[axis];
+        next[axis] += delta[axis];
+    }
+    return false;
+}
+
+static SweepResult sweep(VoxelCursor* c, const Aabb& box, Vec3 delta)
+{
+    static const uint32_t AXIS_ORDER[3] = { 1, 0, 2 }; // falling first lands boxes before they slide
+
+    float min[3] = { box.min.x, box.min.y, box.min.z };
+    float max[3] = { box.max.x, box.max.y, box.max.z };
+    const float d[3] = { delta.x, delta.y, delta.z };
+    float moved[3] = { 0.0f, 0.0f, 0.0f };
+    SweepResult result {};
+
+    for (uint32_t i = 0; i < 3; i++) {
+        uint32_t a = AXIS_ORDER[i];
+        if (d[a] == 0.0f) {
+            continue;
+        }
+
+        // The cross section the box drags through the blocks, one slice of blocks per step along a
+        int32_t lo[3];
+        int32_t hi[3];
+        for (uint32_t s = 0; s < 3; s++) {
+            lo[s] = (int32_t)floorf(min[s] + PHYSICS_EPSILON);
+            hi[s] = (int32_t)floorf(max[s] - PHYSICS_EPSILON);
+        }
+
+        float m = d[a];
+        if (d[a] > 0.0f) {
+            int32_t first = (int32_t)floorf(max[a] - PHYSICS_EPSILON) + 1;
+            int32_t last = (int32_t)floorf(max[a] + d[a] - PHYSICS_EPSILON);
+            for (int32_t b = first; b <= last; b++) {
+                lo[a] = hi[a] = b;
+                if (range_has_solid(c, lo, hi)) {
+                    m = fmaxf((float)b - max[a], 0.0f);
+                    result.blocked |= 1 << a;
+                    break;
+                }
+            }
+        } else {
+            int32_t first = (int32_t)floorf(min[a] + PHYSICS_EPSILON) - 1;
+            int32_t last = (int32_t)floorf(min[a] + d[a] + PHYSICS_EPSILON);
+            for (int32_t b = first; b >= last; b--) {
+                lo[a] = hi[a] = b;
+                if (range_has_solid(c, lo, hi)) {
+                    m = fminf((float)(b + 1) - min[a], 0.0f);
+                    result.blocked |= 1 << a;
+                    result.grounded |= a == 1;
+                    break;
+                }
+            }
+        }
+        min[a] += m;
+        max[a] += m;
+        moved[a] = m;
+    }
+
+    result.moved = { moved[0], moved[1], moved[2] };
+    return result;
+}
+
+static void block_range(const Aabb& box, int32_t lo[3], int32_t hi[3])
+{
+    lo[0] = (int32_t)floorf(box.min.x + PHYSICS_EPSILON);
+    lo[1] = (int32_t)floorf(box.min.y + PHYSICS_EPSILON);
+    lo[2] = (int32_t)floorf(box.min.z + PHYSICS_EPSILON);
+    hi[0] = (int32_t)floorf(box.max.x - PHYSICS_EPSILON);
+    hi[1] = (int32_t)floorf(box.max.y - PHYSICS_EPSILON);
+    hi[2] = (int32_t)floorf(box.max.z - PHYSICS_EPSILON);
+}
+
+bool physics_raycast(World* world, Vec3 origin, Vec3 dir, float max_distance, RayHit* out)
+{
+    VoxelCursor c = cursor_start(world);
+    return raycast(&c, origin, dir, max_distance, out);
+}
+
+SweepResult physics_sweep_aabb(World* world, const Aabb& box, Vec3 delta)
+{
+    VoxelCursor c = cursor_start(world);
+    return sweep(&c, box, delta);
+}
+
+bool physics_aabb_overlaps_solid(World* world, const Aabb& box)
+{
+    VoxelCursor c = cursor_start(world);
+    int32_t lo[3];
+    int32_t hi[3];
+    block_range(box, lo, hi);
+    return range_has_solid(&c, lo, hi);
+}
+
+bool physics_region_loaded(World* world, const Aabb& box, int32_t min_chunk_y, int32_t max_chunk_y)
+{
+    int32_t lo[3];
+    int32_t hi[3];
+    block_range(box, lo, hi);
+    int32_t y0 = lo[1] >> CHUNK_SHIFT > min_chunk_y ? lo[1] >> CHUNK_SHIFT : min_chunk_y;
+    int32_t y1 = hi[1] >> CHUNK_SHIFT < max_chunk_y ? hi[1] >> CHUNK_SHIFT : max_chunk_y;
+    for (int32_t cy = y0; cy <= y1; cy++) {
+        for (int32_t cz = lo[2] >> CHUNK_SHIFT; cz <= hi[2] >> CHUNK_SHIFT; cz++) {
+            for (int32_t cx = lo[0] >> CHUNK_SHIFT; cx <= hi[0] >> CHUNK_SHIFT; cx++) {
+                Chunk* chunk = world_get_chunk(world, { cx, cy, cz });
+                if (!chunk || chunk->state.load(std::memory_order_acquire) != CHUNK_STATE_READY) {
+                    return false;
+                }
+            }
+        }
+    }
+    return true;
+}
+
+// ---Batches---
+
+PhysicsBatcher* PhysicsBatcher::Create(Arena* arr, JobSystem* jobs)
+{
+    PhysicsBatcher* batcher = new (arena_allocate(arr, sizeof(PhysicsBatcher))) PhysicsBatcher();
+    batcher->jobs = jobs;
+    return batcher;
+}
+
+static void batch_job(void* data)
+{
+    TRACE_SCOPE("physics batch");
+    PhysicsBatcher* batcher = (PhysicsBatcher*)data;
+    VoxelCursor c = cursor_start(batcher->world);
+    uint32_t first;
+    while ((first = batcher->next.fetch_add(PHYSICS_BATCH_SLICE, std::memory_order_relaxed)) < batcher->count) {
+        uint32_t end = first + PHYSICS_BATCH_SLICE < batcher->count ? first + PHYSICS_BATCH_SLICE : batcher->count;
+        for (uint32_t i = first; i < end; i++) {
+            if (batcher->rays) {
+                RayQuery* q = &batcher->rays[i];
+                q->hit = raycast(&c, q->origin, q->dir, q->max_distance, &q->result);
+            } else {
+                SweepQuery* q = &batcher->sweeps[i];
+                q->result = sweep(&c, q->box, q->delta);
+            }
+        }
+    }
+}
+
+static void run_batch(PhysicsBatcher* batcher)
+{
+    batcher->next.store(0, std::memory_order_relaxed);
+
+    // No more pullers than slices, job_wait has the calling thread take one as well
+    uint32_t slices = (batcher->count + PHYSICS_BATCH_SLICE - 1) / PHYSICS_BATCH_SLICE;
+    uint32_t pullers = slices < batcher->jobs->num_workers + 1 ? slices : batcher->jobs->num_workers + 1;
+    for (uint32_t i = 0; i < pullers; i++) {
+        job_submit(batcher->jobs, batch_job, batcher, &batcher->counter);
+    }
+    job_wait(batcher->jobs, &batcher->counter);
+}
+
+void physics_raycast_batch(PhysicsBatcher* batcher, World* world, RayQuery* queries, uint32_t count)
+{
+    batcher->world = world;
+    batcher->rays = queries;
+    batcher->sweeps = nullptr;
+    batcher->count = count;
+    run_batch(batcher);
+}
+
+void physics_sweep_batch(PhysicsBatcher* batcher, World* world, SweepQuery* queries, uint32_t count)
+{
+    batcher->world = world;
+    batcher->rays = nullptr;
+    batcher->sweeps = queries;
+    batcher->count = count;
+    run_batch(batcher);
+}
+
+// ---Broadphase---
+
+static inline uint32_t hash_cell(uint64_t key)
+{
+    key ^= key >> 33;
+    key *= 0xff51afd7ed558ccdULL;
+    key ^= key >> 33;
+    return (uint32_t)key;
+}
+
+static inline int32_t cell_of(float v)
+{
+    return (int32_t)floorf(v) >> SPATIAL_CELL_SHIFT;
+}
+
+// Same packing as chunk_key, the cells are just smaller
+static inline uint64_t cell_key(int32_t x, int32_t y, int32_t z)
+{
+    return chunk_key({ x, y, z });
+}
+
+static uint64_t box_cell(const Aabb& box)
+{
+    Vec3 center = (box.min + box.max) * 0.5f;
+    return cell_key(cell_of(center.x), cell_of(center.y), cell_of(center.z));
+}
+
+SpatialHash* SpatialHash::Create(Arena* arr, uint32_t max_entities)
+{
+    SpatialHash* hash = (SpatialHash*)arena_allocate(arr, sizeof(SpatialHash));
+    memset(hash, 0, sizeof(SpatialHash));
+
+    uint32_t num_buckets = 16;
+    while (num_buckets < max_entities * 2) {
+        num_buckets <<= 1;
+    }
+    hash->buckets = (uint32_t*)arena_allocate(arr, num_buckets * sizeof(uint32_t));
+    hash->bucket_mask = num_buckets - 1;
+    for (uint32_t i = 0; i < num_buckets; i++) {
+        hash->buckets[i] = SPATIAL_NONE;
+    }
+
+    hash->boxes = (Aabb*)arena_allocate(arr, max_entities * sizeof(Aabb));
+    hash->cells = (uint64_t*)arena_allocate(arr, max_entities * sizeof(uint64_t));
+    hash->next = (uint32_t*)arena_allocate(arr, max_entities * sizeof(uint32_t));
+    hash->prev = (uint32_t*)arena_allocate(arr, max_entities * sizeof(uint32_t));
+    hash->max_entities = max_entities;
+    for (uint32_t i = 0; i < max_entities; i++) {
+        hash->cells[i] = SPATIAL_NO_CELL;
+    }
+    return hash;
+}
+
+static void link(SpatialHash* hash, uint32_t id, uint64_t cell)
+{
+    uint32_t* head = &hash->buckets[hash_cell(cell) & hash->bucket_mask];
+    hash->cells[id] = cell;
+    hash->prev[id] = SPATIAL_NONE;
+    hash->next[id] = *head;
+    if (*head != SPATIAL_NONE) {
+        hash->prev[*head] = id;
+    }
+    *head = id;
+}
+
+static void unlink(SpatialHash* hash, uint32_t id)
+{
+    uint32_t prev = hash->prev[id];
+    uint32_t next = hash->next[id];
+    if (prev != SPATIAL_NONE) {
+        hash->next[prev] = next;
+    } else {
+        hash->buckets[hash_cell(hash->cells[id]) & hash->bucket_mask] = next;
+    }
+    if (next != SPATIAL_NONE) {
+        hash->prev[next] = prev;
+    }
+    hash->cells[id] = SPATIAL_NO_CELL;
+}
+
+static void grow_half_size(SpatialHash* hash, const Aabb& box)
+{
+    Vec3 half = (box.max - box.min) * 0.5f;
+    hash->max_half_size.x = fmaxf(hash->max_half_size.x, half.x);
+    hash->max_half_size.y = fmaxf(hash->max_half_size.y, half.y);
+    hash->max_half_size.z = fmaxf(hash->max_half_size.z, half.z);
+}
+
+void spatial_hash_insert(SpatialHash* hash, uint32_t id, const Aabb& box)
+{
+    hash->boxes[id] = box;
+    grow_half_size(hash, box);
+    link(hash, id, box_cell(box));
+    hash->count++;
+}
+
+void spatial_hash_move(SpatialHash* hash, uint32_t id, const Aabb& box)
+{
+    hash->boxes[id] = box;
+    grow_half_size(hash, box);
+    uint64_t cell = box_cell(box);
+    if (cell != hash->cells[id]) {
+        unlink(hash, id);
+        link(hash, id, cell);
+    }
+}
+
+void spatial_hash_remove(SpatialHash* hash, uint32_t id)
+{
+    if (hash->cells[id] == SPATIAL_NO_CELL) {
+        return;
+    }
+    unlink(hash, id);
+    hash->count--;
+}
+
+uint32_t spatial_hash_query(const SpatialHash* hash, const Aabb& box, uint32_t* out, uint32_t max_out)
+{
+    // Boxes are filed under their center, so the cells to visit reach out by the largest half size
+    Vec3 lo = box.min - hash->max_half_size;
+    Vec3 hi = box.max + hash->max_half_size;
+    uint32_t found = 0;
+    for (int32_t y = cell_of(lo.y); y <= cell_of(hi.y); y++) {
+        for (int32_t z = cell_of(lo.z); z <= cell_of(hi.z); z++) {
+            for (int32_t x = cell_of(lo.x); x <= cell_of(hi.x); x++) {
+                uint64_t cell = cell_key(x, y, z);
+                // Other cells can share the bucket, checking the cell also keeps every entity to one visit
+                for (uint32_t id = hash->buckets[hash_cell(cell) & hash->bucket_mask]; id != SPATIAL_NONE; id = hash->next[id]) {
+                    if (hash->cells[id] == cell && aabb_overlaps(hash->boxes[id], box)) {
+                        if (found < max_out) {
+                            out[found] = id;
+                        }
+                        found++;
+                    }
+                }
+            }
+        }
+    }
+    return found;
+}
@@ -0,0 +1,141 @@
+#ifndef PHYSICS_HPP
+#define PHYSICS_HPP
+
+#include "jobs.hpp"
+#include "math.hpp"
+#include "mesher.hpp"
+#include "world.hpp"
+#include <Arena.h>
+#include <atomic>
+#include <cstdint>
+
+// Collision and picking queries against the voxels, read straight out of chunk storage. Every
+// query keeps the chunk it last looked at and only goes back to the chunk map when it crosses into
+// another one, so a query that stays inside a chunk (most of them) costs one lookup.
+// Queries never write anything shared and read chunks without locking: any number of threads can
+// run them at once, as long as nothing changes the world meanwhile (same as cpu_raymarch).
+// Blocks of chunks that aren't loaded count as empty, see physics_region_loaded.
+//
+// What keeps the world still: the chunk map and the blocks of ready chunks are only written by
+// the thread that runs world_update (edits, streaming, block ticks), jobs only write blocks of
+// chunks that aren't ready yet, which queries skip. So queries are safe from that thread between
+// its world_update calls, and batches block it until they're done. The server runs them right
+// after server_world_update, from the thread that ticks the world.
+
+#define PHYSICS_EPSILON 1e-4f // boxes touching a block face aren't inside it
+#define PHYSICS_MAX_RAY_STEPS 1024
+#define PHYSICS_BATCH_SLICE 64 // queries a worker takes at a time
+
+struct Aabb {
+    Vec3 min;
+    Vec3 max;
+};
+
+inline bool aabb_overlaps(const Aabb& a, const Aabb& b)
+{
+    return a.min.x < b.max.x && a.max.x > b.min.x && a.min.y < b.max.y && a.max.y > b.min.y && a.min.z < b.max.z && a.max.z > b.min.z;
+}
+
+struct RayHit {
+    int32_t x, y, z; // solid block that was hit
+    Face face; // side the ray came in through, x + FACE_NORMALS[face] is where a placed block goes
+    bool inside; // the ray started in the block, face is meaningless
+    BlockID block;
+    float distance; // along the ray to the face
+};
+
+struct SweepResult {
+    Vec3 moved; // how far the box got, each axis clipped at the first solid block
+    uint8_t blocked; // bit per axis (x = 1, y = 2, z = 4) that got clipped
+    bool grounded; // clipped moving down
+};
+
+// First solid block along the ray, dir normalized. False if none within max_distance.
+bool physics_raycast(World* world, Vec3 origin, Vec3 dir, float max_distance, RayHit* out);
+
+// Moves the box by delta one axis at a time (y, then x and z) and stops each at the first solid
+// block, so boxes slide along walls. The box should start out of solid blocks, whatever it already
+// overlaps doesn't block it.
+SweepResult physics_sweep_aabb(World* world, const Aabb& box, Vec3 delta);
+
+bool physics_aabb_overlaps_solid(World* world, const Aabb& box);
+
+// Every chunk the box touches within the world's vertical extent is loaded. Entities in or next to
+// unloaded chunks shouldn't move, they'd fall through the missing ground.
+bool physics_region_loaded(World* world, const Aabb& box, int32_t min_chunk_y, int32_t max_chunk_y);
+
+// ---Batches---
+
+struct RayQuery {
+    Vec3 origin;
+    Vec3 dir;
+    float max_distance;
+    bool hit; // results
+    RayHit result;
+};
+
+struct SweepQuery {
+    Aabb box;
+    Vec3 delta;
+    SweepResult result;
+};
+
+// Spreads batches of queries over the job system. Each worker takes PHYSICS_BATCH_SLICE queries at
+// a time and keeps its chunk between them, queries submitted in spatial order (say, walking the
+// broadphase cells) mostly hit the chunk they already have.
+struct PhysicsBatcher {
+    JobSystem* jobs;
+
+    // The batch being run
+    World* world;
+    RayQuery* rays;
+    SweepQuery* sweeps;
+    uint32_t count;
+    std::atomic<uint32_t> next;
+    JobCounter counter;
+
+    static PhysicsBatcher* Create(Arena* arr, JobSystem* jobs);
+};
+
+// Both block until every query is done, the calling thread runs queries too
+void physics_raycast_batch(PhysicsBatcher* batcher, World* world, RayQuery* queries, uint32_t count);
+void physics_sweep_batch(PhysicsBatcher* batcher, World* world, SweepQuery* queries, uint32_t count);
+
+// ---Broadphase---
+
+// Spatial hash over entity boxes. Entities live in the cell that holds the center of their box,
+// cells hash into a fixed bucket array, and each bucket is an intrusive list through per entity
+// arrays, so moving an entity within its cell costs nothing and across cells an unlink and a link.
+// Updates are single threaded, queries can run from any number of threads while none happen.
+
+#define SPATIAL_CELL_SHIFT 3 // 8 blocks
+#define SPATIAL_NONE UINT32_MAX // end of a bucket list
+#define SPATIAL_NO_CELL UINT64_MAX
+
+struct SpatialHash {
+    uint32_t* buckets; // first entity per bucket
+    uint32_t bucket_mask;
+
+    // Per entity id
+    Aabb* boxes;
+    uint64_t* cells; // packed cell coordinates, SPATIAL_NO_CELL when the id is unused
+    uint32_t* next;
+    uint32_t* prev;
+    uint32_t max_entities;
+    uint32_t count;
+
+    Vec3 max_half_size; // largest box inserted so far, queries reach this far into neighbouring cells
+
+    static SpatialHash* Create(Arena* arr, uint32_t max_entities);
+};
+
+// id < max_entities and not in the hash yet
+void spatial_hash_insert(SpatialHash* hash, uint32_t id, const Aabb& box);
+void spatial_hash_move(SpatialHash* hash, uint32_t id, const Aabb& box);
+void spatial_hash_remove(SpatialHash* hash, uint32_t id);
+
+// Ids of entities whose boxes overlap the box, up to max_out of them. Returns how many there are
+// in total, which can be more than max_out.
+uint32_t spatial_hash_query(const SpatialHash* hash, const Aabb& box, uint32_t* out, uint32_t max_out);
+
+#endif // PHYSICS_HPP
@@ -0,0 +1,151 @@
+#include "profiler.hpp"
+#include "trace.hpp"
+#include <cstdio>
+#include <cstring>
+#include <new>
+
+static const char* CPU_SCOPE_NAMES[CPU_SCOPE_COUNT] = { "frame", "world", "wait", "streaming", "renderer", "raymarch", "submit" };
+static const char* GPU_PASS_NAMES[GPU_PASS_COUNT] = { "uploads", "chunks", "raymarch", "pixels" };
+
+const char* profiler_scope_name(CpuScope scope)
+{
+    return CPU_SCOPE_NAMES[scope];
+}
+
+const char* profiler_pass_name(GpuPass pass)
+{
+    return GPU_PASS_NAMES[pass];
+}
+
+Profiler* Profiler::Create(Arena* arr)
+{
+    Profiler* profiler = new (arena_allocate(arr, sizeof(Profiler))) Profiler();
+    memset(profiler->frames, 0, sizeof(profiler->frames));
+    profiler->frame = 0;
+    return profiler;
+}
+
+void profiler_begin_frame(Profiler* profiler)
+{
+    profiler->frame++;
+    FrameStats* stats = &profiler->frames[profiler->frame % PROFILER_HISTORY];
+    memset(stats, 0, sizeof(*stats));
+    stats->frame = profiler->frame;
+}
+
+void profiler_begin(Profiler* profiler, CpuScope scope)
+{
+    profiler->scope_start[scope] = std::chrono::steady_clock::now();
+}
+
+void profiler_end(Profiler* profiler, CpuScope scope)
+{
+    std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    std::chrono::duration<float, std::milli> elapsed = now - profiler->scope_start[scope];
+    profiler->frames[profiler->frame % PROFILER_HISTORY].cpu_ms[scope] += elapsed.count();
+
+    if (trace_recording.load(std::memory_order_relaxed)) {
+        uint64_t start = std::chrono::duration_cast<std::chrono::nanoseconds>(profiler->scope_start[scope].time_since_epoch()).count();
+        uint64_t end = std::chrono::duration_cast<std::chrono::nanoseconds>(now.time_since_epoch()).count();
+        trace_event(profiler_scope_name(scope), start, end);
+    }
+}
+
+void profiler_gpu_results(Profiler* profiler, uint64_t frame, const float ms[GPU_PASS_COUNT], uint32_t passes)
+{
+    FrameStats* stats = &profiler->frames[frame % PROFILER_HISTORY];
+    if (stats->frame != frame) {
+        return;
+    }
+    memcpy(stats->gpu_ms, ms, sizeof(stats->gpu_ms));
+    stats->gpu_passes = passes;
+}
+
+const FrameStats* profiler_frame(const Profiler* profiler, uint32_t age)
+{
+    if (age == 0 || age >= PROFILER_HISTORY || age > profiler->frame) {
+        return nullptr;
+    }
+    uint64_t frame = profiler->frame - age;
+    const FrameStats* stats = &profiler->frames[frame % PROFILER_HISTORY];
+    return stats->frame == frame ? stats : nullptr;
+}
+
+void profiler_average(const Profiler* profiler, uint32_t num_frames, FrameStats* out)
+{
+    memset(out, 0, sizeof(*out));
+    out->frame = profiler->frame;
+
+    uint32_t cpu_frames = 0;
+    uint32_t gpu_frames[GPU_PASS_COUNT] = {};
+    for (uint32_t age = 1; age <= num_frames; age++) {
+        const FrameStats* stats = profiler_frame(profiler, age);
+        if (!stats) {
+            break;
+        }
+        for (uint32_t s = 0; s < CPU_SCOPE_COUNT; s++) {
+            out->cpu_ms[s] += stats->cpu_ms[s];
+        }
+        cpu_frames++;
+        for (uint32_t p = 0; p < GPU_PASS_COUNT; p++) {
+            if (stats->gpu_passes & (1 << p)) {
+                out->gpu_ms[p] += stats->gpu_ms[p];
+                gpu_frames[p]++;
+            }
+        }
+    }
+
+    for (uint32_t s = 0; s < CPU_SCOPE_COUNT && cpu_frames; s++) {
+        out->cpu_ms[s] /= cpu_frames;
+    }
+    for (uint32_t p = 0; p < GPU_PASS_COUNT; p++) {
+        if (gpu_frames[p]) {
+            out->gpu_ms[p] /= gpu_frames[p];
+            out->gpu_passes |= 1 << p;
+        }
+    }
+}
+
+bool profiler_dump_csv(const Profiler* profiler, const char* path)
+{
+    FILE* file = fopen(path, "w");
+    if (!file) {
+        printf("Failed to open %s for writing\n", path);
+        return false;
+    }
+
+    fprintf(file, "frame");
+    for (uint32_t s = 0; s < CPU_SCOPE_COUNT; s++) {
+        fprintf(file, ",cpu_%s_ms", profiler_scope_name((CpuScope)s));
+    }
+    for (uint32_t p = 0; p < GPU_PASS_COUNT; p++) {
+        fprintf(file, ",gpu_%s_ms", profiler_pass_name((GpuPass)p));
+    }
+    fprintf(file, "\n");
+
+    for (uint32_t age = PROFILER_HISTORY - 1; age >= 1; age--) {
+        const FrameStats* stats = profiler_frame(profiler, age);
+        if (!stats) {
+            continue;
+        }
+        fprintf(file, "%llu", (unsigned long long)stats->frame);
+        for (uint32_t s = 0; s < CPU_SCOPE_COUNT; s++) {
+            fprintf(file, ",%.3f", stats->cpu_ms[s]);
+        }
+        for (uint32_t p = 0; p < GPU_PASS_COUNT; p++) {
+            if (stats->gpu_passes & (1 << p)) {
+                fprintf(file, ",%.3f", stats->gpu_ms[p]);
+            } else {
+                fprintf(file, ",");
+            }
+        }
+        fprintf(file, "\n");
+    }
+
+    bool ok = !ferror(file);
+    fclose(file);
+    if (!ok) {
+        printf("Failed to write %s\n", path);
+    }
+    return ok;
+}
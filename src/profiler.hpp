@@ -0,0 +1,72 @@
+#ifndef PROFILER_HPP
+#define PROFILER_HPP
+
+#include <Arena.h>
+#include <chrono>
+#include <cstdint>
+
+// Per frame timings: CPU scopes on the main thread, and GPU passes from timestamp queries that
+// the renderer hands back once the frame is done on the GPU (a couple of frames later).
+// The last PROFILER_HISTORY frames are kept in a ring for averages and CSV dumps.
+
+#define PROFILER_HISTORY 512 // frames
+
+enum CpuScope : uint32_t {
+    CPU_SCOPE_FRAME, // the whole main loop iteration
+    CPU_SCOPE_WORLD, // world_update: edits, loads, light
+    CPU_SCOPE_WAIT, // waiting for the frame in flight to free up
+    CPU_SCOPE_STREAMING,
+    CPU_SCOPE_RENDERER, // mesh uploads and culling
+    CPU_SCOPE_RAYMARCH, // brick map updates or the CPU ray marcher
+    CPU_SCOPE_SUBMIT, // recording, submit and present
+    CPU_SCOPE_COUNT
+};
+
+enum GpuPass : uint32_t {
+    GPU_PASS_UPLOADS, // staging copies
+    GPU_PASS_CHUNKS, // clear and chunk meshes
+    GPU_PASS_RAYMARCH,
+    GPU_PASS_PIXELS, // displayBytes image copy
+    GPU_PASS_COUNT
+};
+
+struct FrameStats {
+    uint64_t frame;
+    float cpu_ms[CPU_SCOPE_COUNT];
+    float gpu_ms[GPU_PASS_COUNT];
+    uint32_t gpu_passes; // bit per GpuPass that ran and got timed
+};
+
+struct Profiler {
+    FrameStats frames[PROFILER_HISTORY]; // ring, frame % PROFILER_HISTORY
+    uint64_t frame; // the one being timed
+    std::chrono::steady_clock::time_point scope_start[CPU_SCOPE_COUNT];
+
+    static Profiler* Create(Arena* arr);
+};
+
+const char* profiler_scope_name(CpuScope scope);
+const char* profiler_pass_name(GpuPass pass);
+
+// Starts the next frame's slot in the ring
+void profiler_begin_frame(Profiler* profiler);
+
+void profiler_begin(Profiler* profiler, CpuScope scope);
+// Adds the time since profiler_begin to the scope, a scope can be entered more than once a frame.
+// Also lands on the calling thread's trace lane while tracing.
+void profiler_end(Profiler* profiler, CpuScope scope);
+
+// GPU timings of an earlier frame, dropped if it already left the ring
+void profiler_gpu_results(Profiler* profiler, uint64_t frame, const float ms[GPU_PASS_COUNT], uint32_t passes);
+
+// Finished frames, age 1 is the last one. Null if it isn't in the ring (anymore).
+const FrameStats* profiler_frame(const Profiler* profiler, uint32_t age);
+
+// Mean of the last num_frames finished frames. GPU passes average over the frames they ran in,
+// frames whose GPU results haven't come back yet are left out of those.
+void profiler_average(const Profiler* profiler, uint32_t num_frames, FrameStats* out);
+
+// One row per frame in the ring, oldest first. GPU passes that didn't run are left empty.
+bool profiler_dump_csv(const Profiler* profiler, const char* path);
+
+#endif // PROFILER_HPP
@@ -0,0 +1,115 @@
+#include "raymarcher.hpp"
+#include <cmath>
+#include <cstring>
+
+static bool brick_fits(void* user, uint64_t size, uint32_t num_copies)
+{
+    RaymarchRenderer* renderer = (RaymarchRenderer*)user;
+    return upload_fits(renderer->ctx, size, num_copies);
+}
+
+static void brick_write(void* user, BrickBuffer buffer, uint64_t offset, const void* data, uint64_t size)
+{
+    RaymarchRenderer* renderer = (RaymarchRenderer*)user;
+    upload_buffer(renderer->ctx, renderer->buffers[buffer].buffer, offset, data, size);
+}
+
+static void create_descriptor_set(RaymarchRenderer* renderer)
+{
+    VulkanContext* ctx = renderer->ctx;
+
+    VkDescriptorPoolSize pool_size {};
+    pool_size.type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    pool_size.descriptorCount = BRICK_BUFFER_COUNT;
+
+    VkDescriptorPoolCreateInfo pool_info {};
+    pool_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+    pool_info.maxSets = 1;
+    pool_info.poolSizeCount = 1;
+    pool_info.pPoolSizes = &pool_size;
+    VK_CHECK_RESULT(vkCreateDescriptorPool(ctx->device, &pool_info, ctx->allocator, &renderer->descriptor_pool));
+
+    VkDescriptorSetAllocateInfo alloc_info {};
+    alloc_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+    alloc_info.descriptorPool = renderer->descriptor_pool;
+    alloc_info.descriptorSetCount = 1;
+    alloc_info.pSetLayouts = &ctx->raymarch_set_layout;
+    VK_CHECK_RESULT(vkAllocateDescriptorSets(ctx->device, &alloc_info, &renderer->draw.descriptor_set));
+
+    VkDescriptorBufferInfo buffer_infos[BRICK_BUFFER_COUNT];
+    VkWriteDescriptorSet writes[BRICK_BUFFER_COUNT] {};
+    for (uint32_t i = 0; i < BRICK_BUFFER_COUNT; i++) {
+        buffer_infos[i] = { renderer->buffers[i].buffer, 0, VK_WHOLE_SIZE };
+        writes[i].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+        writes[i].dstSet = renderer->draw.descriptor_set;
+        writes[i].dstBinding = i;
+        writes[i].descriptorCount = 1;
+        writes[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        writes[i].pBufferInfo = &buffer_infos[i];
+    }
+    vkUpdateDescriptorSets(ctx->device, BRICK_BUFFER_COUNT, writes, 0, nullptr);
+}
+
+RaymarchRenderer* RaymarchRenderer::Create(Arena* arr, VulkanContext* ctx, uint32_t max_bricks)
+{
+    RaymarchRenderer* renderer = (RaymarchRenderer*)arena_allocate(arr, sizeof(RaymarchRenderer));
+    memset(renderer, 0, sizeof(*renderer));
+    renderer->ctx = ctx;
+    renderer->map = BrickMap::Create(arr, max_bricks, { renderer, brick_fits, brick_write });
+
+    for (uint32_t i = 0; i < BRICK_BUFFER_COUNT; i++) {
+        VkDeviceSize size = brickmap_buffer_size((BrickBuffer)i, max_bricks);
+        bool ok = create_gpu_buffer(ctx, size, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+            VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, MEM_CHUNKS, &renderer->buffers[i]);
+        assert(ok);
+    }
+    create_descriptor_set(renderer);
+
+    // Nodes and voxels are only read through the grid, which starts out empty
+    bool ok = upload_buffer(ctx, renderer->buffers[BRICK_BUFFER_GRID].buffer, 0, renderer->map->grid,
+        brickmap_buffer_size(BRICK_BUFFER_GRID, max_bricks));
+    assert(ok);
+
+    return renderer;
+}
+
+void raymarch_renderer_update(RaymarchRenderer* renderer, World* world, const Camera* camera)
+{
+    brickmap_update(renderer->map, world, camera_chunk(camera));
+}
+
+void raymarch_renderer_build_draw(RaymarchRenderer* renderer, const Camera* camera, DrawList* out)
+{
+    RaymarchParams* params = &renderer->draw.params;
+    float half_height = tanf(camera->fov_y * 0.5f);
+    Vec3 forward = camera_forward(camera);
+    Vec3 right = camera_right(camera);
+    Vec3 up = cross(right, forward);
+
+    Vec3 vectors[4] = { camera->position, forward, right * (half_height * camera->aspect), up * half_height };
+    float* dst[4] = { params->position, params->forward, params->right, params->up };
+    for (uint32_t i = 0; i < 4; i++) {
+        dst[i][0] = vectors[i].x;
+        dst[i][1] = vectors[i].y;
+        dst[i][2] = vectors[i].z;
+        dst[i][3] = 0.0f;
+    }
+
+    ChunkPos origin = renderer->map->origin;
+    params->origin[0] = origin.x;
+    params->origin[1] = origin.y;
+    params->origin[2] = origin.z;
+    params->origin[3] = 0;
+
+    out->raymarch = &renderer->draw;
+}
+
+void raymarch_renderer_destroy(RaymarchRenderer* renderer)
+{
+    VulkanContext* ctx = renderer->ctx;
+    for (uint32_t i = 0; i < BRICK_BUFFER_COUNT; i++) {
+        cancel_uploads(ctx, renderer->buffers[i].buffer);
+        destroy_gpu_buffer(ctx, &renderer->buffers[i]);
+    }
+    vkDestroyDescriptorPool(ctx->device, renderer->descriptor_pool, ctx->allocator);
+}
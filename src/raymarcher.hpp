@@ -0,0 +1,36 @@
+#ifndef RAYMARCHER_HPP
+#define RAYMARCHER_HPP
+
+#include "brickmap.hpp"
+#include "camera.hpp"
+#include "vulkan.hpp"
+#include "world.hpp"
+#include <Arena.h>
+#include <cstdint>
+
+// Renders the world by marching rays through a brick map instead of drawing meshes.
+// Costs one storage buffer slot per chunk in the window plus 512 bytes per mixed brick.
+
+#define RAYMARCH_MAX_BRICKS (128 * 1024) // 64MB of voxels
+
+struct RaymarchRenderer {
+    VulkanContext* ctx;
+    BrickMap* map;
+
+    GpuBuffer buffers[BRICK_BUFFER_COUNT];
+    VkDescriptorPool descriptor_pool;
+    RaymarchDraw draw;
+
+    static RaymarchRenderer* Create(Arena* arr, VulkanContext* ctx, uint32_t max_bricks);
+};
+
+// Brings the brick map up to date with the chunks around the camera, call once per frame
+// after begin_frame
+void raymarch_renderer_update(RaymarchRenderer* renderer, World* world, const Camera* camera);
+
+// Points out->raymarch at a full screen ray march of the brick map
+void raymarch_renderer_build_draw(RaymarchRenderer* renderer, const Camera* camera, DrawList* out);
+
+void raymarch_renderer_destroy(RaymarchRenderer* renderer);
+
+#endif // RAYMARCHER_HPP
@@ -0,0 +1,745 @@
+#include "replication.hpp"
+#include "trace.hpp"
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#define KNOWN_EMPTY UINT64_MAX
+#define CHUNK_HEADER_BYTES 32 // type, position and size in front of a chunk payload, at most
+
+// ---Varints---
+
+struct Writer {
+    uint8_t* data;
+    uint32_t size;
+    uint32_t capacity;
+    bool overflow;
+};
+
+struct Reader {
+    const uint8_t* data;
+    uint32_t size;
+    uint32_t at;
+    bool failed;
+};
+
+static inline uint32_t zigzag(int32_t v)
+{
+    return ((uint32_t)v << 1) ^ (uint32_t)(v >> 31);
+}
+
+static inline int32_t unzigzag(uint32_t v)
+{
+    return (int32_t)(v >> 1) ^ -(int32_t)(v & 1);
+}
+
+static void put_varint(Writer* w, uint32_t v)
+{
+    do {
+        if (w->size == w->capacity) {
+            w->overflow = true;
+            return;
+        }
+        uint8_t byte = v & 0x7f;
+        v >>= 7;
+        w->data[w->size++] = byte | (v ? 0x80 : 0);
+    } while (v);
+}
+
+static void put_bytes(Writer* w, const uint8_t* data, uint32_t size)
+{
+    if (w->capacity - w->size < size) {
+        w->overflow = true;
+        return;
+    }
+    memcpy(w->data + w->size, data, size);
+    w->size += size;
+}
+
+static void put_pos(Writer* w, ChunkPos pos)
+{
+    put_varint(w, zigzag(pos.x));
+    put_varint(w, zigzag(pos.y));
+    put_varint(w, zigzag(pos.z));
+}
+
+static uint32_t get_varint(Reader* r)
+{
+    uint32_t v = 0;
+    for (uint32_t shift = 0; shift < 35; shift += 7) {
+        if (r->at == r->size) {
+            break;
+        }
+        uint8_t byte = r->data[r->at++];
+        v |= (uint32_t)(byte & 0x7f) << shift;
+        if (!(byte & 0x80)) {
+            return v;
+        }
+    }
+    r->failed = true;
+    return 0;
+}
+
+static ChunkPos get_pos(Reader* r)
+{
+    ChunkPos pos;
+    pos.x = unzigzag(get_varint(r));
+    pos.y = unzigzag(get_varint(r));
+    pos.z = unzigzag(get_varint(r));
+    return pos;
+}
+
+// ---Known chunks---
+
+static void known_init(Arena* arr, KnownChunks* known, uint32_t max_entries)
+{
+    uint32_t capacity = 16;
+    while (capacity < max_entries * 2) {
+        capacity <<= 1;
+    }
+    known->keys = (uint64_t*)arena_allocate(arr, capacity * sizeof(*known->keys));
+    known->revisions = (uint32_t*)arena_allocate(arr, capacity * sizeof(*known->revisions));
+    known->capacity = capacity;
+    memset(known->keys, 0xff, capacity * sizeof(*known->keys));
+    known->count = 0;
+}
+
+static void known_clear(KnownChunks* known)
+{
+    memset(known->keys, 0xff, known->capacity * sizeof(*known->keys));
+    known->count = 0;
+}
+
+static uint32_t known_find(const KnownChunks* known, uint64_t key)
+{
+    uint32_t mask = known->capacity - 1;
+    uint32_t slot = chunk_key_hash(key) & mask;
+    while (known->keys[slot] != key && known->keys[slot] != KNOWN_EMPTY) {
+        slot = (slot + 1) & mask;
+    }
+    return slot;
+}
+
+// The client's revision, false if it doesn't have the chunk
+static bool known_get(const KnownChunks* known, uint64_t key, uint32_t* revision)
+{
+    uint32_t slot = known_find(known, key);
+    if (known->keys[slot] == KNOWN_EMPTY) {
+        return false;
+    }
+    *revision = known->revisions[slot];
+    return true;
+}
+
+// Views are clamped so there is always room
+static void known_set(KnownChunks* known, uint64_t key, uint32_t revision)
+{
+    uint32_t slot = known_find(known, key);
+    if (known->keys[slot] == KNOWN_EMPTY) {
+        known->keys[slot] = key;
+        known->count++;
+    }
+    known->revisions[slot] = revision;
+}
+
+// Backward shift like chunk_map_remove
+static void known_remove_slot(KnownChunks* known, uint32_t slot)
+{
+    uint32_t mask = known->capacity - 1;
+    known->count--;
+    uint32_t hole = slot;
+    uint32_t next = (hole + 1) & mask;
+    while (known->keys[next] != KNOWN_EMPTY) {
+        uint32_t home = chunk_key_hash(known->keys[next]) & mask;
+        if (((next - home) & mask) >= ((next - hole) & mask)) {
+            known->keys[hole] = known->keys[next];
+            known->revisions[hole] = known->revisions[next];
+            hole = next;
+        }
+        next = (next + 1) & mask;
+    }
+    known->keys[hole] = KNOWN_EMPTY;
+}
+
+static inline ChunkPos key_pos(uint64_t key)
+{
+    const int64_t bias = 1 << 20;
+    const uint64_t mask = (1 << 21) - 1;
+    return { (int32_t)((int64_t)((key >> 42) & mask) - bias), (int32_t)((int64_t)((key >> 21) & mask) - bias), (int32_t)((int64_t)(key & mask) - bias) };
+}
+
+// ---Server---
+
+ReplicaServer* ReplicaServer::Create(Arena* arr, World* world, ReplicaTransport transport, const ReplicaConfig& config)
+{
+    ReplicaServer* server = (ReplicaServer*)arena_allocate(arr, sizeof(ReplicaServer));
+    memset(server, 0, sizeof(*server));
+    server->world = world;
+    server->transport = transport;
+    server->config = config;
+
+    uint32_t side = config.max_radius * 2 + 1;
+    server->max_candidates = side * side * (config.max_chunk_y - config.min_chunk_y + 1);
+    server->candidates = (ReplicaCandidate*)arena_allocate(arr, server->max_candidates * sizeof(ReplicaCandidate));
+
+    server->connections = (ReplicaConnection*)arena_allocate(arr, config.max_connections * sizeof(ReplicaConnection));
+    memset(server->connections, 0, config.max_connections * sizeof(ReplicaConnection));
+    for (uint32_t c = 0; c < config.max_connections; c++) {
+        known_init(arr, &server->connections[c].known, server->max_candidates);
+    }
+
+    server->groups = (DeltaGroup*)arena_allocate(arr, REPLICA_EDIT_LOG * sizeof(DeltaGroup));
+    server->selected = (uint32_t*)arena_allocate(arr, REPLICA_EDIT_LOG * sizeof(uint32_t));
+    // Per edit a 3 byte gap and a 3 byte block at most, per group 5 varints
+    server->deltas = (uint8_t*)arena_allocate(arr, REPLICA_EDIT_LOG * (6 + 25));
+    server->message = (uint8_t*)arena_allocate(arr, REPLICA_MAX_MESSAGE_BYTES);
+    server->scratch = (uint8_t*)arena_allocate(arr, CHUNK_CODEC_SCRATCH_BYTES);
+
+    world_enable_edit_log(world, arr, REPLICA_EDIT_LOG);
+    return server;
+}
+
+bool replica_connect(ReplicaServer* server, uint32_t connection, uint64_t bandwidth)
+{
+    if (connection >= server->config.max_connections || server->connections[connection].active) {
+        return false;
+    }
+    ReplicaConnection* conn = &server->connections[connection];
+    KnownChunks known = conn->known;
+    memset(conn, 0, sizeof(*conn));
+    conn->known = known;
+    known_clear(&conn->known);
+    conn->active = true;
+    conn->bandwidth = bandwidth;
+    conn->tokens = bandwidth * REPLICA_BURST_SECONDS;
+    conn->connected_tick = server->tick;
+    return true;
+}
+
+void replica_disconnect(ReplicaServer* server, uint32_t connection)
+{
+    if (connection < server->config.max_connections) {
+        server->connections[connection].active = false;
+    }
+}
+
+static bool send_message(ReplicaServer* server, uint32_t connection, const uint8_t* data, uint32_t size)
+{
+    return server->transport.send(server->transport.user, connection, data, size);
+}
+
+// False if the connection sent something it shouldn't have
+static bool handle_client_message(ReplicaServer* server, ReplicaConnection* conn, const uint8_t* data, uint32_t size)
+{
+    Reader r = { data, size, 1, false };
+    switch (data[0]) {
+    case REPLICA_MSG_VIEW: {
+        ChunkPos center = get_pos(&r);
+        int32_t radius = std::min((int32_t)get_varint(&r), server->config.max_radius);
+        if (r.failed) {
+            return false;
+        }
+        if (!conn->has_view || center != conn->center || radius != conn->radius) {
+            conn->rescan = true;
+        }
+        conn->has_view = true;
+        conn->center = center;
+        conn->radius = radius;
+        return true;
+    }
+    case REPLICA_MSG_EDIT: {
+        int32_t x = unzigzag(get_varint(&r));
+        int32_t y = unzigzag(get_varint(&r));
+        int32_t z = unzigzag(get_varint(&r));
+        uint32_t block = get_varint(&r);
+        if (r.failed || block >= BLOCK_COUNT) {
+            return false;
+        }
+        // Only inside what the client can see
+        ChunkPos pos = chunk_pos_from_block(x, y, z);
+        if (conn->has_view && std::abs(pos.x - conn->center.x) <= conn->radius && std::abs(pos.z - conn->center.z) <= conn->radius) {
+            world_queue_edit(server->world, x, y, z, (BlockID)block);
+        }
+        return true;
+    }
+    default:
+        return false;
+    }
+}
+
+// Groups the edit log by chunk, each group's writes sorted by block with only the last write to
+// a block kept, and encodes every group once
+static void build_deltas(ReplicaServer* server)
+{
+    World* world = server->world;
+    AppliedEdit* log = world->edit_log;
+    uint32_t count = world->num_logged;
+    std::sort(log, log + count, [](const AppliedEdit& a, const AppliedEdit& b) {
+        uint64_t ka = chunk_key(a.pos);
+        uint64_t kb = chunk_key(b.pos);
+        if (ka != kb) {
+            return ka < kb;
+        }
+        return a.index != b.index ? a.index < b.index : a.revision < b.revision;
+    });
+
+    Writer w = { server->deltas, 0, REPLICA_EDIT_LOG * (6 + 25), false };
+    server->num_groups = 0;
+    uint32_t i = 0;
+    while (i < count) {
+        uint64_t key = chunk_key(log[i].pos);
+        uint32_t end = i + 1;
+        uint32_t first_revision = log[i].revision;
+        uint32_t last_revision = log[i].revision;
+        uint32_t blocks = 1;
+        while (end < count && chunk_key(log[end].pos) == key) {
+            first_revision = std::min(first_revision, log[end].revision);
+            last_revision = std::max(last_revision, log[end].revision);
+            blocks += log[end].index != log[end - 1].index;
+            end++;
+        }
+
+        DeltaGroup* group = &server->groups[server->num_groups++];
+        group->key = key;
+        group->revision = last_revision;
+        // Writes missing from the log leave a gap no client can bridge
+        group->base_revision = last_revision - (end - i) == first_revision - 1 ? first_revision - 1 : UINT32_MAX;
+        group->offset = w.size;
+
+        put_pos(&w, log[i].pos);
+        put_varint(&w, blocks);
+        uint32_t previous = 0;
+        for (; i < end; i++) {
+            if (i + 1 < end && log[i + 1].index == log[i].index) {
+                continue;
+            }
+            put_varint(&w, log[i].index - previous);
+            put_varint(&w, log[i].block);
+            previous = log[i].index;
+        }
+        group->size = w.size - group->offset;
+    }
+}
+
+static bool flush_edits(ReplicaServer* server, uint32_t connection, uint32_t first, uint32_t count)
+{
+    ReplicaConnection* conn = &server->connections[connection];
+    Writer w = { server->message, 0, REPLICA_MAX_MESSAGE_BYTES, false };
+    put_varint(&w, REPLICA_MSG_EDITS);
+    put_varint(&w, count);
+    uint32_t edits = 0;
+    for (uint32_t s = first; s < first + count; s++) {
+        const DeltaGroup* group = &server->groups[server->selected[s]];
+        put_bytes(&w, server->deltas + group->offset, group->size);
+    }
+    if (w.overflow || !send_message(server, connection, w.data, w.size)) {
+        conn->rescan = true; // the known revisions stay behind, the chunks go again whole
+        return false;
+    }
+    for (uint32_t s = first; s < first + count; s++) {
+        const DeltaGroup* group = &server->groups[server->selected[s]];
+        known_set(&conn->known, group->key, group->revision);
+        Reader r = { server->deltas + group->offset, group->size, 0, false };
+        get_pos(&r);
+        edits += get_varint(&r);
+    }
+    conn->edits_sent += edits;
+    conn->edit_bytes += w.size;
+    conn->tokens -= w.size;
+    return true;
+}
+
+static void send_deltas(ReplicaServer* server, uint32_t connection)
+{
+    ReplicaConnection* conn = &server->connections[connection];
+    uint32_t num_selected = 0;
+    for (uint32_t g = 0; g < server->num_groups; g++) {
+        const DeltaGroup* group = &server->groups[g];
+        uint32_t revision;
+        if (!known_get(&conn->known, group->key, &revision) || revision == group->revision) {
+            continue;
+        }
+        if (revision != group->base_revision) {
+            conn->rescan = true; // fell behind, the scan sends it whole
+            continue;
+        }
+        server->selected[num_selected++] = g;
+    }
+
+    // As few messages as fit
+    uint32_t first = 0;
+    uint32_t bytes = 0;
+    for (uint32_t s = 0; s < num_selected; s++) {
+        uint32_t size = server->groups[server->selected[s]].size;
+        if (s > first && bytes + size + 16 > REPLICA_MAX_MESSAGE_BYTES) {
+            if (!flush_edits(server, connection, first, s - first)) {
+                return;
+            }
+            first = s;
+            bytes = 0;
+        }
+        bytes += size;
+    }
+    if (num_selected > first) {
+        flush_edits(server, connection, first, num_selected - first);
+    }
+}
+
+static bool in_view(const ReplicaServer* server, const ReplicaConnection* conn, ChunkPos pos)
+{
+    return std::abs(pos.x - conn->center.x) <= conn->radius && std::abs(pos.z - conn->center.z) <= conn->radius
+        && pos.y >= server->config.min_chunk_y && pos.y <= server->config.max_chunk_y;
+}
+
+static Chunk* ready_chunk(World* world, ChunkPos pos)
+{
+    Chunk* chunk = world_get_chunk(world, pos);
+    if (!chunk || chunk->state.load(std::memory_order_acquire) != CHUNK_STATE_READY) {
+        return nullptr;
+    }
+    return chunk;
+}
+
+// Unloads what left the view or the world. Slots are walked down so the entries a removal
+// shifts back have been looked at already, wrapping ones are caught by the next scan.
+static bool send_unloads(ReplicaServer* server, uint32_t connection)
+{
+    ReplicaConnection* conn = &server->connections[connection];
+    KnownChunks* known = &conn->known;
+    for (uint32_t slot = known->capacity; slot-- > 0;) {
+        uint64_t key = known->keys[slot];
+        if (key == KNOWN_EMPTY) {
+            continue;
+        }
+        ChunkPos pos = key_pos(key);
+        if (in_view(server, conn, pos) && ready_chunk(server->world, pos)) {
+            continue;
+        }
+        uint8_t data[32];
+        Writer w = { data, 0, sizeof(data), false };
+        put_varint(&w, REPLICA_MSG_UNLOAD);
+        put_pos(&w, pos);
+        if (!send_message(server, connection, w.data, w.size)) {
+            return false;
+        }
+        known_remove_slot(known, slot);
+        conn->rescan = true;
+    }
+    return true;
+}
+
+static bool send_chunk(ReplicaServer* server, uint32_t connection, Chunk* chunk)
+{
+    ReplicaConnection* conn = &server->connections[connection];
+    uint8_t* payload = server->message + CHUNK_HEADER_BYTES;
+    uint32_t size = chunk_encode(chunk->blocks, payload, REPLICA_MAX_MESSAGE_BYTES - CHUNK_HEADER_BYTES, server->scratch);
+    if (size == 0) {
+        printf("Failed to encode chunk (%d, %d, %d) for replication\n", chunk->pos.x, chunk->pos.y, chunk->pos.z);
+        return false;
+    }
+
+    // The header goes right in front of the payload
+    uint8_t header[CHUNK_HEADER_BYTES];
+    Writer w = { header, 0, sizeof(header), false };
+    put_varint(&w, REPLICA_MSG_CHUNK);
+    put_pos(&w, chunk->pos);
+    put_varint(&w, size);
+    uint8_t* message = payload - w.size;
+    memcpy(message, header, w.size);
+    if (!send_message(server, connection, message, w.size + size)) {
+        return false;
+    }
+
+    uint64_t key = chunk_key(chunk->pos);
+    uint32_t revision;
+    if (known_get(&conn->known, key, &revision)) {
+        conn->resends++;
+    }
+    known_set(&conn->known, key, chunk->revision);
+    conn->chunks_sent++;
+    conn->chunk_bytes += w.size + size;
+    conn->tokens -= w.size + size;
+    return true;
+}
+
+static void send_chunks(ReplicaServer* server, uint32_t connection)
+{
+    TRACE_SCOPE("replica scan");
+    ReplicaConnection* conn = &server->connections[connection];
+    World* world = server->world;
+    conn->rescan = false;
+    conn->scanned_events = world->chunk_events;
+
+    if (!send_unloads(server, connection)) {
+        conn->rescan = true;
+        return;
+    }
+
+    uint32_t num_candidates = 0;
+    bool loading = false;
+    for (int32_t y = server->config.min_chunk_y; y <= server->config.max_chunk_y; y++) {
+        for (int32_t dz = -conn->radius; dz <= conn->radius; dz++) {
+            for (int32_t dx = -conn->radius; dx <= conn->radius; dx++) {
+                ChunkPos pos = { conn->center.x + dx, y, conn->center.z + dz };
+                Chunk* chunk = ready_chunk(world, pos);
+                loading |= !chunk;
+                uint32_t revision;
+                if (!chunk || (known_get(&conn->known, chunk_key(pos), &revision) && revision == chunk->revision)) {
+                    continue;
+                }
+                int32_t dy = y - conn->center.y;
+                server->candidates[num_candidates++] = { chunk, dx * dx + dy * dy + dz * dz };
+            }
+        }
+    }
+    if (num_candidates == 0) {
+        if (conn->joined_tick == 0 && !loading) {
+            conn->joined_tick = server->tick;
+        }
+        return;
+    }
+
+    std::sort(server->candidates, server->candidates + num_candidates, [](const ReplicaCandidate& a, const ReplicaCandidate& b) {
+        return a.distance < b.distance;
+    });
+    uint32_t sent = 0;
+    while (sent < num_candidates && conn->tokens > 0.0 && send_chunk(server, connection, server->candidates[sent].chunk)) {
+        sent++;
+    }
+    conn->rescan = sent < num_candidates;
+}
+
+void replica_server_update(ReplicaServer* server, float dt)
+{
+    TRACE_SCOPE("replication");
+    World* world = server->world;
+    server->tick++;
+
+    for (uint32_t c = 0; c < server->config.max_connections; c++) {
+        ReplicaConnection* conn = &server->connections[c];
+        if (!conn->active) {
+            continue;
+        }
+        uint32_t size;
+        while (conn->active && (size = server->transport.receive(server->transport.user, c, server->message, REPLICA_MAX_MESSAGE_BYTES)) > 0) {
+            if (!handle_client_message(server, conn, server->message, size)) {
+                printf("Malformed message on connection %u, disconnecting\n", c);
+                conn->active = false;
+            }
+        }
+        conn->tokens = std::min(conn->tokens + conn->bandwidth * (double)dt, conn->bandwidth * REPLICA_BURST_SECONDS);
+    }
+
+    if (world->num_logged > 0) {
+        build_deltas(server);
+    }
+    for (uint32_t c = 0; c < server->config.max_connections; c++) {
+        ReplicaConnection* conn = &server->connections[c];
+        if (!conn->active || !conn->has_view) {
+            continue;
+        }
+        if (world->edit_log_overflow) {
+            conn->rescan = true; // revisions tell what went missing
+        }
+        if (server->num_groups > 0) {
+            send_deltas(server, c);
+        }
+        if (conn->rescan || conn->scanned_events != world->chunk_events) {
+            send_chunks(server, c);
+        }
+    }
+    server->num_groups = 0;
+    world_clear_edit_log(world);
+}
+
+// ---Client---
+
+ReplicaClient* ReplicaClient::Create(Arena* arr, ReplicaTransport transport, uint32_t connection, ReplicaClientHooks hooks)
+{
+    ReplicaClient* client = (ReplicaClient*)arena_allocate(arr, sizeof(ReplicaClient));
+    memset(client, 0, sizeof(*client));
+    client->transport = transport;
+    client->connection = connection;
+    client->hooks = hooks;
+    client->message = (uint8_t*)arena_allocate(arr, REPLICA_MAX_MESSAGE_BYTES);
+    client->scratch = (uint8_t*)arena_allocate(arr, CHUNK_CODEC_SCRATCH_BYTES);
+    client->blocks = (BlockID*)arena_allocate(arr, CHUNK_VOLUME * sizeof(BlockID));
+    return client;
+}
+
+static bool client_send(ReplicaClient* client, const Writer& w)
+{
+    return client->transport.send(client->transport.user, client->connection, w.data, w.size);
+}
+
+bool replica_client_send_view(ReplicaClient* client, ChunkPos center, int32_t radius)
+{
+    uint8_t data[32];
+    Writer w = { data, 0, sizeof(data), false };
+    put_varint(&w, REPLICA_MSG_VIEW);
+    put_pos(&w, center);
+    put_varint(&w, (uint32_t)std::max(radius, 0));
+    return client_send(client, w);
+}
+
+bool replica_client_send_edit(ReplicaClient* client, int32_t x, int32_t y, int32_t z, BlockID block)
+{
+    uint8_t data[32];
+    Writer w = { data, 0, sizeof(data), false };
+    put_varint(&w, REPLICA_MSG_EDIT);
+    put_varint(&w, zigzag(x));
+    put_varint(&w, zigzag(y));
+    put_varint(&w, zigzag(z));
+    put_varint(&w, block);
+    return client_send(client, w);
+}
+
+static bool handle_server_message(ReplicaClient* client, const uint8_t* data, uint32_t size)
+{
+    Reader r = { data, size, 0, false };
+    uint32_t type = get_varint(&r);
+    switch (type) {
+    case REPLICA_MSG_CHUNK: {
+        ChunkPos pos = get_pos(&r);
+        uint32_t payload = get_varint(&r);
+        if (r.failed || payload != size - r.at || !chunk_decode(data + r.at, payload, client->blocks, client->scratch)) {
+            return false;
+        }
+        client->chunks_received++;
+        if (client->hooks.chunk) {
+            client->hooks.chunk(client->hooks.user, pos, client->blocks);
+        }
+        return true;
+    }
+    case REPLICA_MSG_EDITS: {
+        uint32_t groups = get_varint(&r);
+        for (uint32_t g = 0; g < groups && !r.failed; g++) {
+            ChunkPos pos = get_pos(&r);
+            uint32_t count = get_varint(&r);
+            uint32_t index = 0;
+            for (uint32_t e = 0; e < count && !r.failed; e++) {
+                index += get_varint(&r);
+                uint32_t block = get_varint(&r);
+                if (r.failed || index >= CHUNK_VOLUME || block > UINT16_MAX) {
+                    return false;
+                }
+                client->edits_received++;
+                if (client->hooks.edit) {
+                    client->hooks.edit(client->hooks.user, pos, index, (BlockID)block);
+                }
+            }
+        }
+        return !r.failed;
+    }
+    case REPLICA_MSG_UNLOAD: {
+        ChunkPos pos = get_pos(&r);
+        if (r.failed) {
+            return false;
+        }
+        if (client->hooks.unload) {
+            client->hooks.unload(client->hooks.user, pos);
+        }
+        return true;
+    }
+    default:
+        return false;
+    }
+}
+
+bool replica_client_update(ReplicaClient* client)
+{
+    uint32_t size;
+    while ((size = client->transport.receive(client->transport.user, client->connection, client->message, REPLICA_MAX_MESSAGE_BYTES)) > 0) {
+        client->bytes_received += size;
+        if (!handle_server_message(client, client->message, size)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// ---Loopback---
+
+LoopbackTransport* LoopbackTransport::Create(Arena* arr, uint32_t max_connections)
+{
+    LoopbackTransport* loopback = (LoopbackTransport*)arena_allocate(arr, sizeof(LoopbackTransport));
+    memset(loopback, 0, sizeof(*loopback));
+    loopback->max_connections = max_connections;
+    loopback->queues = (LoopbackQueue*)arena_allocate(arr, max_connections * 2 * sizeof(LoopbackQueue));
+    for (uint32_t q = 0; q < max_connections * 2; q++) {
+        loopback->queues[q] = { (uint8_t*)arena_allocate(arr, LOOPBACK_QUEUE_BYTES), 0, 0 };
+    }
+    for (uint32_t side = 0; side < 2; side++) {
+        loopback->ends[side] = { loopback, side };
+    }
+    return loopback;
+}
+
+static void ring_write(LoopbackQueue* queue, const uint8_t* data, uint32_t size)
+{
+    uint32_t at = (queue->head + queue->used) % LOOPBACK_QUEUE_BYTES;
+    uint32_t first = std::min(size, LOOPBACK_QUEUE_BYTES - at);
+    memcpy(queue->data + at, data, first);
+    memcpy(queue->data, data + first, size - first);
+    queue->used += size;
+}
+
+static void ring_read(LoopbackQueue* queue, uint8_t* out, uint32_t size)
+{
+    uint32_t first = std::min(size, LOOPBACK_QUEUE_BYTES - queue->head);
+    memcpy(out, queue->data + queue->head, first);
+    memcpy(out + first, queue->data, size - first);
+    queue->head = (queue->head + size) % LOOPBACK_QUEUE_BYTES;
+    queue->used -= size;
+}
+
+static bool loopback_send(void* user, uint32_t connection, const uint8_t* data, uint32_t size)
+{
+    LoopbackEnd* end = (LoopbackEnd*)user;
+    LoopbackTransport* loopback = end->loopback;
+    if (connection >= loopback->max_connections) {
+        return false;
+    }
+    LoopbackQueue* queue = &loopback->queues[connection * 2 + (end->side ^ 1)];
+    if (LOOPBACK_QUEUE_BYTES - queue->used < sizeof(uint32_t) + size) {
+        return false;
+    }
+    ring_write(queue, (const uint8_t*)&size, sizeof(size));
+    ring_write(queue, data, size);
+    loopback->bytes[end->side] += size;
+    return true;
+}
+
+static uint32_t loopback_receive(void* user, uint32_t connection, uint8_t* out, uint32_t capacity)
+{
+    LoopbackEnd* end = (LoopbackEnd*)user;
+    LoopbackTransport* loopback = end->loopback;
+    if (connection >= loopback->max_connections) {
+        return 0;
+    }
+    LoopbackQueue* queue = &loopback->queues[connection * 2 + end->side];
+    if (queue->used == 0) {
+        return 0;
+    }
+    uint32_t size;
+    ring_read(queue, (uint8_t*)&size, sizeof(size));
+    if (size > capacity) {
+        printf("Loopback message of %u bytes doesn't fit %u, dropped\n", size, capacity);
+        queue->head = (queue->head + size) % LOOPBACK_QUEUE_BYTES;
+        queue->used -= size;
+        return 0;
+    }
+    ring_read(queue, out, size);
+    return size;
+}
+
+ReplicaTransport loopback_server_transport(LoopbackTransport* loopback)
+{
+    return { &loopback->ends[0], loopback_send, loopback_receive };
+}
+
+ReplicaTransport loopback_client_transport(LoopbackTransport* loopback)
+{
+    return { &loopback->ends[1], loopback_send, loopback_receive };
+}
@@ -0,0 +1,201 @@
+#ifndef REPLICATION_HPP
+#define REPLICATION_HPP
+
+#include "chunk.hpp"
+#include "chunk_codec.hpp"
+#include "world.hpp"
+#include <Arena.h>
+#include <cstdint>
+
+// Chunk replication from a server world to its clients. Every connection has a view (a chunk
+// and a radius) and the server keeps the chunks inside it in sync on the client:
+//
+// - Missing or stale chunks go out whole, palette encoded and compressed (chunk_encode), nearest
+//   first, for as long as the connection's bandwidth budget allows. Budgets are token buckets
+//   refilled every update, so joining clients stream in at a steady rate instead of in bursts.
+// - Block writes go out as deltas: once per update, every chunk a client has that changed gets
+//   its writes batched into one message, positions as varint gaps between sorted block indices.
+//   Deltas always go out and are charged to the budget, they're small and latency matters more.
+//   A client that missed a write (log overflow, chunk reloaded) gets the whole chunk again.
+// - Chunks that leave the view or the server world are unloaded on the client.
+//
+// Messages go through a ReplicaTransport, reliable and ordered, with an in-process loopback below.
+//
+// Wire format, every integer a LEB128 varint, signed ones zigzag encoded first:
+//   chunk   REPLICA_MSG_CHUNK  x y z size payload
+//   edits   REPLICA_MSG_EDITS  count { x y z n { index_gap block }*n }*count
+//   unload  REPLICA_MSG_UNLOAD x y z
+//   view    REPLICA_MSG_VIEW   x y z radius               (client to server)
+//   edit    REPLICA_MSG_EDIT   x y z block                (client to server, block coordinates)
+
+#define REPLICA_MAX_MESSAGE_BYTES (CHUNK_PAYLOAD_MAX_BYTES + 64)
+#define REPLICA_EDIT_LOG 16384 // block writes per update the world keeps for deltas
+#define REPLICA_BURST_SECONDS 0.5 // of bandwidth a connection can bank
+#define REPLICA_DEFAULT_BANDWIDTH (512 * 1024) // bytes per second
+
+enum ReplicaMessageType : uint8_t {
+    REPLICA_MSG_CHUNK,
+    REPLICA_MSG_EDITS,
+    REPLICA_MSG_UNLOAD,
+    REPLICA_MSG_VIEW,
+    REPLICA_MSG_EDIT,
+};
+
+// Reliable and ordered, per connection. Either end can be anything from a socket to a queue.
+struct ReplicaTransport {
+    void* user;
+    // Takes the whole message or nothing, false when the connection's queue is full (try again)
+    bool (*send)(void* user, uint32_t connection, const uint8_t* data, uint32_t size);
+    // Size of the next message copied to out, 0 if there is none
+    uint32_t (*receive)(void* user, uint32_t connection, uint8_t* out, uint32_t capacity);
+};
+
+// ---Server---
+
+struct ReplicaConfig {
+    uint32_t max_connections;
+    int32_t max_radius; // chunks, views are clamped to it
+    int32_t min_chunk_y; // vertical extent of the world, views cover all of it
+    int32_t max_chunk_y;
+};
+
+// Chunks a client has, by chunk_key, with the revision it has
+struct KnownChunks {
+    uint64_t* keys;
+    uint32_t* revisions;
+    uint32_t capacity; // power of two
+    uint32_t count;
+};
+
+struct ReplicaCandidate {
+    Chunk* chunk;
+    int32_t distance; // squared, in chunks
+};
+
+struct ReplicaConnection {
+    bool active;
+    bool has_view; // nothing is sent before the first view message
+    ChunkPos center;
+    int32_t radius;
+
+    KnownChunks known;
+
+    uint64_t bandwidth; // bytes per second
+    double tokens; // bytes that can go out, negative after deltas overdrew it
+
+    bool rescan; // look for missing chunks on the next update
+    uint64_t scanned_events; // world->chunk_events as of the last scan
+
+    uint64_t connected_tick;
+    uint64_t joined_tick; // the first time the whole view was loaded and in sync, 0 before
+
+    // For stats
+    uint64_t chunks_sent;
+    uint64_t chunk_bytes;
+    uint64_t edits_sent;
+    uint64_t edit_bytes;
+    uint64_t resends; // chunks sent again because a delta couldn't be
+};
+
+// This update's block writes to one chunk, encoded once for every connection that has it
+struct DeltaGroup {
+    uint64_t key;
+    uint32_t base_revision; // a client has to be at this one for the delta to apply
+    uint32_t revision; // after it
+    uint32_t offset; // into ReplicaServer::deltas, "x y z n { index_gap block }*n"
+    uint32_t size;
+};
+
+struct ReplicaServer {
+    World* world;
+    ReplicaTransport transport;
+    ReplicaConfig config;
+
+    ReplicaConnection* connections;
+
+    ReplicaCandidate* candidates;
+    uint32_t max_candidates;
+
+    DeltaGroup* groups; // REPLICA_EDIT_LOG
+    uint32_t* selected; // groups going to one connection
+    uint8_t* deltas;
+    uint32_t num_groups;
+
+    uint8_t* message; // REPLICA_MAX_MESSAGE_BYTES
+    uint8_t* scratch; // CHUNK_CODEC_SCRATCH_BYTES
+    uint64_t tick;
+
+    // Turns on the world's edit log, the server is the one that clears it
+    static ReplicaServer* Create(Arena* arr, World* world, ReplicaTransport transport, const ReplicaConfig& config);
+};
+
+bool replica_connect(ReplicaServer* server, uint32_t connection, uint64_t bandwidth = REPLICA_DEFAULT_BANDWIDTH);
+void replica_disconnect(ReplicaServer* server, uint32_t connection);
+
+// Main thread, once per tick after world_update and streaming. dt in seconds since the last one.
+void replica_server_update(ReplicaServer* server, float dt);
+
+// ---Client---
+
+// What the client does with what arrives, blocks are only valid during the call
+struct ReplicaClientHooks {
+    void* user;
+    void (*chunk)(void* user, ChunkPos pos, const BlockID* blocks);
+    void (*edit)(void* user, ChunkPos pos, uint32_t index, BlockID block);
+    void (*unload)(void* user, ChunkPos pos);
+};
+
+struct ReplicaClient {
+    ReplicaTransport transport;
+    uint32_t connection;
+    ReplicaClientHooks hooks;
+
+    uint8_t* message; // REPLICA_MAX_MESSAGE_BYTES
+    uint8_t* scratch; // CHUNK_CODEC_SCRATCH_BYTES
+    BlockID* blocks; // CHUNK_VOLUME
+
+    uint64_t bytes_received;
+    uint64_t chunks_received;
+    uint64_t edits_received;
+
+    static ReplicaClient* Create(Arena* arr, ReplicaTransport transport, uint32_t connection, ReplicaClientHooks hooks);
+};
+
+bool replica_client_send_view(ReplicaClient* client, ChunkPos center, int32_t radius);
+bool replica_client_send_edit(ReplicaClient* client, int32_t x, int32_t y, int32_t z, BlockID block);
+
+// Handles everything that arrived. False on a malformed message, the connection is unusable then.
+bool replica_client_update(ReplicaClient* client);
+
+// ---Loopback---
+
+// Both ends of max_connections connections in one process, a byte ring per direction. For
+// testing, and for bots sharing the server's process.
+#define LOOPBACK_QUEUE_BYTES (256 * 1024) // per direction and connection, fits a few whole chunks
+
+struct LoopbackQueue {
+    uint8_t* data;
+    uint32_t head; // read position
+    uint32_t used;
+};
+
+struct LoopbackTransport;
+
+struct LoopbackEnd {
+    LoopbackTransport* loopback;
+    uint32_t side; // 0 = server, 1 = client
+};
+
+struct LoopbackTransport {
+    LoopbackQueue* queues; // [connection * 2 + side receiving]
+    uint32_t max_connections;
+    LoopbackEnd ends[2];
+    uint64_t bytes[2]; // sent by each side, ever
+
+    static LoopbackTransport* Create(Arena* arr, uint32_t max_connections);
+};
+
+ReplicaTransport loopback_server_transport(LoopbackTransport* loopback);
+ReplicaTransport loopback_client_transport(LoopbackTransport* loopback);
+
+#endif // REPLICATION_HPP
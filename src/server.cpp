@@ -0,0 +1,90 @@
+#include "server.hpp"
+#include "memory.hpp"
+#include "trace.hpp"
+#include <cstdio>
+#include <new>
+
+ServerWorld* ServerWorld::Create(JobSystem* jobs, IOContext* io, const ServerWorldConfig& config)
+{
+    Arena* arena = create_arena_tagged(SERVER_ARENA_BYTES, MEM_CHUNKS);
+    ServerWorld* instance = new (arena_allocate(arena, sizeof(ServerWorld))) ServerWorld();
+    instance->arena = arena;
+    instance->config = config;
+
+    if (config.dir) {
+        instance->store = WorldStore::Create(arena, io, jobs, config.dir, SERVER_STORE_TASKS, SERVER_STORE_REGIONS);
+    }
+    // Every pool slot is a full chunk, so the budget caps how many can exist at all
+    uint32_t max_chunks = (uint32_t)(config.memory_budget / sizeof(Chunk));
+    instance->light = LightEngine::Create(arena, jobs, max_chunks, config.min_chunk_y, config.max_chunk_y);
+    instance->world = World::Create(arena, jobs, instance->store, instance->light, config.seed, max_chunks);
+    instance->ticks = BlockTicks::Create(arena, instance->world, jobs, max_chunks);
+
+    StreamConfig stream_config {};
+    stream_config.radius = config.radius;
+    stream_config.min_chunk_y = config.min_chunk_y;
+    stream_config.max_chunk_y = config.max_chunk_y;
+    stream_config.memory_budget = config.memory_budget;
+    stream_config.max_pending_loads = SERVER_PENDING_LOADS;
+    instance->stream = StreamManager::Create(arena, instance->world, jobs, stream_config, {});
+
+    instance->focus = camera_create(config.spawn, 1.0f);
+    instance->physics = PhysicsBatcher::Create(arena, jobs);
+
+    if (config.max_connections > 0) {
+        ReplicaConfig replica_config {};
+        replica_config.max_connections = config.max_connections;
+        replica_config.max_radius = config.radius;
+        replica_config.min_chunk_y = config.min_chunk_y;
+        replica_config.max_chunk_y = config.max_chunk_y;
+        instance->replica = ReplicaServer::Create(arena, instance->world, config.transport, replica_config);
+    }
+    return instance;
+}
+
+void server_world_update(ServerWorld* instance)
+{
+    TRACE_SCOPE("server world");
+    uint64_t start = trace_now();
+
+    const ServerWorldConfig* config = &instance->config;
+    if (config->autosave_ticks > 0 && instance->tick > 0 && (instance->tick + config->autosave_offset) % config->autosave_ticks == 0) {
+        world_begin_autosave(instance->world);
+    }
+    float dt = instance->last_update ? (float)((start - instance->last_update) * 1e-9) : 0.0f;
+    instance->last_update = start;
+    world_update(instance->world);
+    streaming_update(instance->stream, &instance->focus);
+    block_ticks_update(instance->ticks, dt);
+    if (instance->replica) {
+        replica_server_update(instance->replica, dt);
+    }
+    instance->tick++;
+
+    instance->tick_us = (uint32_t)((trace_now() - start) / 1000);
+    if (instance->tick_us > instance->peak_tick_us) {
+        instance->peak_tick_us = instance->tick_us;
+    }
+}
+
+uint64_t server_world_arena_bytes(const ServerWorld* instance)
+{
+    uint64_t bytes = 0;
+    for (Region* region = instance->arena->start; region; region = region->next) {
+        bytes += sizeof(Region) + region->capacity * sizeof(uintptr_t);
+    }
+    return bytes;
+}
+
+void server_world_destroy(ServerWorld* instance)
+{
+    streaming_destroy(instance->stream);
+    world_save_all(instance->world);
+    light_destroy(instance->light, instance->world);
+    if (instance->store) {
+        world_store_destroy(instance->store);
+    }
+    Arena* arena = instance->arena;
+    instance->~ServerWorld();
+    arena_free(arena);
+}
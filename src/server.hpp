@@ -0,0 +1,72 @@
+#ifndef SERVER_HPP
+#define SERVER_HPP
+
+#include "block_ticks.hpp"
+#include "camera.hpp"
+#include "jobs.hpp"
+#include "light.hpp"
+#include "physics.hpp"
+#include "replication.hpp"
+#include "streaming.hpp"
+#include "world.hpp"
+#include "world_io.hpp"
+#include "world_store.hpp"
+#include <Arena.h>
+#include <cstdint>
+
+// One world hosted by the headless server: its own arena, store, light and chunk streaming, with
+// the job system and IO shared by every world in the process. Nothing is meshed. The arena holds
+// everything the instance allocates and the chunk pool is sized from its memory budget, so a
+// world can never take more than it was given, and its pages are only touched as chunks load.
+
+#define SERVER_STORE_TASKS 8 // per world, each holds a chunk snapshot and encode buffers
+#define SERVER_STORE_REGIONS 16 // open region files per world
+#define SERVER_ARENA_BYTES (1 MB) // first region, the chunk pool gets one of its own
+#define SERVER_PENDING_LOADS 16
+
+struct ServerWorldConfig {
+    const char* dir; // null = nothing is persisted
+    uint64_t seed;
+    uint64_t memory_budget; // voxel data, bytes
+    int32_t radius; // chunks kept loaded around the spawn
+    int32_t min_chunk_y;
+    int32_t max_chunk_y;
+    Vec3 spawn;
+    uint32_t autosave_ticks; // 0 = only on destroy
+    uint32_t autosave_offset; // ticks, staggers the worlds' autosaves
+    uint32_t max_connections; // clients replicated to, 0 = none
+    ReplicaTransport transport;
+};
+
+struct ServerWorld {
+    Arena* arena;
+    ServerWorldConfig config;
+
+    WorldStore* store; // null without a dir
+    LightEngine* light;
+    World* world;
+    BlockTicks* ticks;
+    StreamManager* stream;
+    Camera focus; // what the stream loads around
+    ReplicaServer* replica; // null without connections
+    PhysicsBatcher* physics; // queries against the world, between server_world_update calls on the thread running them
+
+    uint64_t tick;
+    uint64_t last_update; // trace_now
+    uint32_t tick_us; // last server_world_update
+    uint32_t peak_tick_us;
+
+    // Lives in an arena of its own, freed by server_world_destroy
+    static ServerWorld* Create(JobSystem* jobs, IOContext* io, const ServerWorldConfig& config);
+};
+
+// Main thread, once per server tick
+void server_world_update(ServerWorld* instance);
+
+// Every region of the instance's arena, untouched pages included
+uint64_t server_world_arena_bytes(const ServerWorld* instance);
+
+// Saves everything and waits for it to land, then frees the instance
+void server_world_destroy(ServerWorld* instance);
+
+#endif // SERVER_HPP
@@ -6,6 +6,8 @@
 #include <fstream>
 #include <vulkan/vulkan_core.h>
 
+#define SHADER_CODE_BYTES (64 * 1024)
+
 static char* read_file(Arena* arr, const char* path, size_t* size)
 {
     std::ifstream file(path, std::ios::ate | std::ios::binary);
@@ -24,11 +26,12 @@ static char* read_file(Arena* arr, const char* path, size_t* size)
     return out;
 }
 
-VkShaderModule create_shader_module(Arena* arr, VulkanContext* ctx, const char* path)
+VkShaderModule create_shader_module(VulkanContext* ctx, const char* path)
 {
     size_t size = 0;
-    ArenaMark m = arena_scratch(arr);
-    char* binary = read_file(arr, path, &size);
+    // Arena of its own so the SPIR-V counts as MEM_SHADERS, grows for bigger modules
+    Arena* code = create_arena_tagged(SHADER_CODE_BYTES, MEM_SHADERS);
+    char* binary = read_file(code, path, &size);
 
     VkShaderModuleCreateInfo c_info;
     c_info.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
@@ -38,8 +41,8 @@ VkShaderModule create_shader_module(Arena* arr, VulkanContext* ctx, const char*
     c_info.pNext = nullptr;
 
     VkShaderModule module;
-    VK_CHECK_RESULT(vkCreateShaderModule(ctx->device, &c_info, nullptr, &module));
+    VK_CHECK_RESULT(vkCreateShaderModule(ctx->device, &c_info, ctx->allocator, &module));
 
-    arena_pop_scratch(arr, m);
+    arena_free(code);
     return module;
 }
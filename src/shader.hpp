@@ -6,6 +6,6 @@
 
 struct VulkanContext;
 
-VkShaderModule create_shader_module(Arena* arr, VulkanContext* ctx, const char* path);
+VkShaderModule create_shader_module(VulkanContext* ctx, const char* path);
 
 #endif // VE_SHADER
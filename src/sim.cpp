@@ -0,0 +1,124 @@
+#include "sim.hpp"
+#include "camera.hpp"
+#include "trace.hpp"
+#include <chrono>
+#include <new>
+
+// ---Sim thread---
+
+static void sim_tick(Simulation* sim, const SimInput& input)
+{
+    TRACE_SCOPE("sim tick");
+    Camera camera {};
+    camera.position = sim->state.position;
+    camera.yaw = input.yaw;
+    camera.pitch = input.pitch;
+    camera_move(&camera, input.move, input.speed, sim->dt);
+    sim->state.position = camera.position;
+}
+
+static void publish(Simulation* sim, const SimState& prev)
+{
+    SimSnapshot* snapshot = &sim->slots[sim->back];
+    snapshot->tick = sim->tick;
+    snapshot->time = trace_now();
+    snapshot->prev = prev;
+    snapshot->state = sim->state;
+
+    // Release hands the slot over, acquire takes back whichever one the renderer let go of
+    uint32_t old = sim->middle.exchange(sim->back | SIM_SNAPSHOT_FRESH, std::memory_order_acq_rel);
+    sim->back = old & ~SIM_SNAPSHOT_FRESH;
+}
+
+static void sim_main(Simulation* sim)
+{
+    trace_name_thread("sim");
+
+    using Clock = std::chrono::steady_clock;
+    Clock::duration tick_length = std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(sim->dt));
+    Clock::time_point next = Clock::now() + tick_length;
+
+    while (sim->running.load(std::memory_order_relaxed)) {
+        std::this_thread::sleep_until(next); // returns right away while catching up
+
+        Clock::time_point start = Clock::now();
+        SimInput input;
+        {
+            std::lock_guard<std::mutex> guard(sim->input_lock);
+            input = sim->input;
+        }
+        SimState prev = sim->state;
+        sim_tick(sim, input);
+        sim->tick++;
+        publish(sim, prev);
+
+        Clock::time_point end = Clock::now();
+        sim->tick_us.store((uint32_t)std::chrono::duration_cast<std::chrono::microseconds>(end - start).count(), std::memory_order_relaxed);
+
+        next += tick_length;
+        if (end - next > tick_length * SIM_MAX_CATCHUP_TICKS) {
+            uint64_t behind = (end - next) / tick_length;
+            next += tick_length * behind;
+            sim->dropped_ticks.fetch_add(behind, std::memory_order_relaxed);
+        }
+    }
+}
+
+// ---Main thread---
+
+Simulation* Simulation::Create(Arena* arr, const SimState& initial, uint32_t tick_hz)
+{
+    Simulation* sim = new (arena_allocate(arr, sizeof(Simulation))) Simulation();
+    sim->dt = 1.0f / tick_hz;
+    sim->tick = 0;
+    sim->state = initial;
+    sim->input = {};
+
+    uint64_t now = trace_now();
+    for (uint32_t i = 0; i < 3; i++) {
+        sim->slots[i] = { 0, now, initial, initial };
+    }
+    sim->back = 0;
+    sim->middle.store(1, std::memory_order_relaxed);
+    sim->front = 2;
+
+    sim->running.store(true, std::memory_order_relaxed);
+    sim->tick_us.store(0, std::memory_order_relaxed);
+    sim->dropped_ticks.store(0, std::memory_order_relaxed);
+    sim->thread = std::thread(sim_main, sim);
+    return sim;
+}
+
+void sim_set_input(Simulation* sim, const SimInput& input)
+{
+    std::lock_guard<std::mutex> guard(sim->input_lock);
+    sim->input = input;
+}
+
+// ---Render thread---
+
+const SimSnapshot* sim_latest(Simulation* sim)
+{
+    if (sim->middle.load(std::memory_order_relaxed) & SIM_SNAPSHOT_FRESH) {
+        uint32_t old = sim->middle.exchange(sim->front, std::memory_order_acq_rel);
+        sim->front = old & ~SIM_SNAPSHOT_FRESH;
+    }
+    return &sim->slots[sim->front];
+}
+
+void sim_interpolate(Simulation* sim, uint64_t now, SimState* out)
+{
+    const SimSnapshot* snapshot = sim_latest(sim);
+    float alpha = 0.0f;
+    if (now > snapshot->time) {
+        alpha = (float)((double)(now - snapshot->time) / (sim->dt * 1e9));
+        alpha = alpha > 1.0f ? 1.0f : alpha;
+    }
+    out->position = lerp(snapshot->prev.position, snapshot->state.position, alpha);
+}
+
+void sim_destroy(Simulation* sim)
+{
+    sim->running.store(false, std::memory_order_relaxed);
+    sim->thread.join();
+}
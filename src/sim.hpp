@@ -0,0 +1,80 @@
+#ifndef SIM_HPP
+#define SIM_HPP
+
+#include "math.hpp"
+#include <Arena.h>
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+
+// Gameplay runs on a thread of its own at a fixed tick, independent of the frame rate. Every
+// tick ends by publishing an immutable snapshot through a triple buffer: the sim writes into its
+// back slot and swaps it with the middle one, the renderer swaps the middle one into its front
+// slot whenever a fresh one is there. Neither side ever waits on the other, a slow tick just means
+// the renderer keeps interpolating towards the last snapshot it got.
+//
+// Snapshots carry the state before and after their tick, so the renderer can always interpolate
+// across exactly one tick, however many it missed. That shows the world up to one tick late.
+
+#define SIM_TICK_HZ 30
+#define SIM_MAX_CATCHUP_TICKS 5 // after a stall, further missed ticks are dropped instead of run in a burst
+
+// Written by the main thread from the window, read at the start of every tick
+struct SimInput {
+    Vec3 move; // right, up, forward, see camera_move
+    float speed; // blocks per second
+    float yaw; // look direction, mouse look stays on the render thread so it has no tick of latency
+    float pitch;
+};
+
+struct SimState {
+    Vec3 position; // player eye
+};
+
+struct SimSnapshot {
+    uint64_t tick;
+    uint64_t time; // trace_now when it was published
+    SimState prev; // before this tick
+    SimState state;
+};
+
+#define SIM_SNAPSHOT_FRESH 4 // set on middle when the sim swapped in a slot the renderer hasn't taken
+
+struct Simulation {
+    float dt; // seconds per tick
+    uint64_t tick;
+
+    SimState state; // sim thread only
+
+    std::mutex input_lock;
+    SimInput input;
+
+    SimSnapshot slots[3];
+    uint32_t back; // sim thread
+    std::atomic<uint32_t> middle; // slot index | SIM_SNAPSHOT_FRESH
+    uint32_t front; // render thread
+
+    std::atomic<bool> running;
+    std::atomic<uint32_t> tick_us; // duration of the last tick, for stats
+    std::atomic<uint64_t> dropped_ticks; // skipped after stalls
+    std::thread thread;
+
+    // Starts ticking right away from the given state
+    static Simulation* Create(Arena* arr, const SimState& initial, uint32_t tick_hz = SIM_TICK_HZ);
+};
+
+// Main thread, any time. Takes effect from the next tick.
+void sim_set_input(Simulation* sim, const SimInput& input);
+
+// Render thread. Swaps in the newest snapshot if there is one, the returned pointer stays valid
+// until the next call.
+const SimSnapshot* sim_latest(Simulation* sim);
+
+// Render thread. State at `now` (trace_now), between the latest snapshot's prev and state.
+void sim_interpolate(Simulation* sim, uint64_t now, SimState* out);
+
+// Stops and joins the thread
+void sim_destroy(Simulation* sim);
+
+#endif // SIM_HPP
@@ -0,0 +1,505 @@
+#include "streaming.hpp"
+#include "memory.hpp"
+#include "trace.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+
+#define STREAM_REBUILD_FRAMES 8 // re-sort for view direction even when the camera stays in its chunk
+#define STREAM_FACING_WEIGHT 1.5f // chunks behind the camera count as up to 4x further away
+#define MESH_SCRATCH_BYTES (24 * 1024 * 1024) // worst case mesh + mips, only touched pages are committed
+
+StreamManager* StreamManager::Create(Arena* arr, World* world, JobSystem* jobs, const StreamConfig& config, StreamHooks hooks)
+{
+    StreamManager* stream = new (arena_allocate(arr, sizeof(StreamManager))) StreamManager();
+
+    stream->world = world;
+    stream->jobs = jobs;
+    stream->hooks = hooks;
+    stream->config = config;
+
+    uint32_t num_entries = world->pool.capacity;
+    stream->entries = (StreamEntry*)arena_allocate(arr, num_entries * sizeof(StreamEntry));
+    for (uint32_t i = 0; i < num_entries; i++) {
+        new (&stream->entries[i]) StreamEntry();
+        stream->entries[i].stream = stream;
+        stream->entries[i].mesh_handle = MESH_HANDLE_NONE;
+    }
+
+    uint32_t side = config.radius * 2 + 1;
+    stream->max_candidates = side * side * (config.max_chunk_y - config.min_chunk_y + 1);
+    stream->candidates = (StreamCandidate*)arena_allocate(arr, stream->max_candidates * sizeof(StreamCandidate));
+
+    stream->center = { INT32_MAX, INT32_MAX, INT32_MAX };
+    return stream;
+}
+
+static inline StreamEntry* entry_of(StreamManager* stream, const Chunk* chunk)
+{
+    return &stream->entries[chunk - stream->world->pool.chunks];
+}
+
+static inline uint32_t mesh_size(const ChunkMesh* mesh)
+{
+    return mesh->num_quads * 4 * sizeof(ChunkVertex);
+}
+
+uint64_t streaming_memory_used(StreamManager* stream)
+{
+    ChunkPool* pool = &stream->world->pool;
+    return (uint64_t)(pool->capacity - pool->num_free) * sizeof(Chunk) + stream->mesh_bytes;
+}
+
+// ---LRU---
+
+static void lru_remove(StreamManager* stream, StreamEntry* entry)
+{
+    if (entry->lru_prev) {
+        entry->lru_prev->lru_next = entry->lru_next;
+    } else {
+        stream->lru_head = entry->lru_next;
+    }
+    if (entry->lru_next) {
+        entry->lru_next->lru_prev = entry->lru_prev;
+    } else {
+        stream->lru_tail = entry->lru_prev;
+    }
+    entry->lru_prev = nullptr;
+    entry->lru_next = nullptr;
+}
+
+static void lru_push_front(StreamManager* stream, StreamEntry* entry)
+{
+    entry->lru_prev = nullptr;
+    entry->lru_next = stream->lru_head;
+    if (stream->lru_head) {
+        stream->lru_head->lru_prev = entry;
+    } else {
+        stream->lru_tail = entry;
+    }
+    stream->lru_head = entry;
+}
+
+static void lru_touch(StreamManager* stream, StreamEntry* entry)
+{
+    if (stream->lru_head != entry) {
+        lru_remove(stream, entry);
+        lru_push_front(stream, entry);
+    }
+}
+
+// ---Residency---
+
+static void drop_gpu_mesh(StreamManager* stream, StreamEntry* entry)
+{
+    if (entry->mesh_handle != MESH_HANDLE_NONE) {
+        stream->hooks.release(stream->hooks.user, entry->mesh_handle);
+        entry->mesh_handle = MESH_HANDLE_NONE;
+    }
+    stream->mesh_bytes -= entry->mesh_bytes;
+    entry->mesh_bytes = 0;
+}
+
+static void free_cpu_mesh(StreamEntry* entry)
+{
+    memory_track(MEM_CPU, MEM_MESHES, -(int64_t)mesh_size(&entry->cpu_mesh));
+    free(entry->cpu_mesh.vertices);
+    entry->cpu_mesh = {};
+}
+
+static void drop_cpu_mesh(StreamManager* stream, StreamEntry* entry)
+{
+    stream->mesh_bytes -= mesh_size(&entry->cpu_mesh);
+    free_cpu_mesh(entry);
+}
+
+static void track_chunk(StreamManager* stream, Chunk* chunk)
+{
+    StreamEntry* entry = entry_of(stream, chunk);
+    entry->chunk = chunk;
+    entry->stage = STREAM_LOADING;
+    entry->wanted = true;
+    entry->remesh = false;
+    entry->mesh_neighbors = 0;
+    lru_push_front(stream, entry);
+    stream->pending_loads++;
+}
+
+static bool evict(StreamManager* stream, StreamEntry* entry)
+{
+    if (entry->chunk->readers > 0 || entry->stage == STREAM_MESHING) {
+        return false;
+    }
+    if (!world_unload_chunk(stream->world, entry->chunk)) {
+        return false; // modified and the store can't take the save yet
+    }
+
+    drop_gpu_mesh(stream, entry);
+    if (entry->stage == STREAM_MESHED) {
+        drop_cpu_mesh(stream, entry);
+    }
+    if (entry->stage == STREAM_LOADING) {
+        stream->pending_loads--;
+    }
+    lru_remove(stream, entry);
+    entry->stage = STREAM_NONE;
+    entry->chunk = nullptr;
+    return true;
+}
+
+// Evicts least recently used chunks outside the load radius until a pool slot is free and
+// `bytes` more fit in the budget. Chunks inside the radius are never evicted, a budget that is
+// too small for the radius just stops new loads.
+static bool make_room(StreamManager* stream, uint64_t bytes)
+{
+    ChunkPool* pool = &stream->world->pool;
+    StreamEntry* entry = stream->lru_tail;
+    while (pool->num_free == 0 || streaming_memory_used(stream) + bytes > stream->config.memory_budget) {
+        if (!entry) {
+            return false;
+        }
+        StreamEntry* prev = entry->lru_prev;
+        if (!entry->wanted) {
+            evict(stream, entry);
+        }
+        entry = prev;
+    }
+    return true;
+}
+
+// Memory outside the stream's own budget ran over (GPU heaps, tag budgets, refused uploads).
+// Drops the meshes of chunks outside the radius, least recently used first, until about
+// `bytes` are freed. GPU meshes stop counting as soon as they're released, the memory itself is
+// freed a few frames later by the deletion queue.
+static void shed(StreamManager* stream, uint64_t bytes)
+{
+    uint64_t freed = 0;
+    StreamEntry* entry = stream->lru_tail;
+    while (entry && !entry->wanted && freed < bytes) {
+        StreamEntry* prev = entry->lru_prev;
+        uint64_t held = entry->mesh_bytes + (entry->stage == STREAM_MESHED ? mesh_size(&entry->cpu_mesh) : 0);
+        if (held > 0 && evict(stream, entry)) {
+            freed += held;
+        }
+        entry = prev;
+    }
+}
+
+// ---Meshing---
+
+static void mesh_job(void* data)
+{
+    TRACE_SCOPE("mesh");
+    StreamEntry* entry = (StreamEntry*)data;
+    StreamManager* stream = entry->stream;
+
+    entry->cpu_mesh = {};
+    if (!entry->mesh_cancelled.load(std::memory_order_acquire)) {
+        Arena* mesh_scratch = job_scratch(stream->jobs, JOB_SCRATCH_MESH, MESH_SCRATCH_BYTES, MEM_MESHES);
+        ChunkMesh mesh {};
+        if (entry->patching) {
+            entry->patching = mesh_chunk_patch(mesh_scratch, entry->chunk, entry->neighbors, entry->layout,
+                entry->patch_regions, entry->patch_skirts, &mesh);
+        }
+        if (!entry->patching) {
+            // New mesh, or a region outgrew its section. Give the edited regions room to grow.
+            mesh_chunk(mesh_scratch, entry->chunk, entry->neighbors, entry->patch_regions, &mesh);
+        }
+        if (mesh.num_quads > 0) {
+            entry->cpu_mesh = mesh;
+            entry->cpu_mesh.vertices = (ChunkVertex*)malloc(mesh_size(&mesh));
+            memcpy(entry->cpu_mesh.vertices, mesh.vertices, mesh_size(&mesh));
+            memory_track(MEM_CPU, MEM_MESHES, mesh_size(&mesh));
+        }
+        arena_reset(mesh_scratch);
+    }
+
+    std::lock_guard<std::mutex> guard(stream->done_lock);
+    entry->done_next = stream->done;
+    stream->done = entry;
+}
+
+static void release_readers(StreamEntry* entry)
+{
+    entry->chunk->readers--;
+    for (uint32_t f = 0; f < FACE_COUNT; f++) {
+        if (entry->neighbors[f]) {
+            ((Chunk*)entry->neighbors[f])->readers--;
+        }
+    }
+}
+
+static void collect_meshes(StreamManager* stream)
+{
+    StreamEntry* done;
+    {
+        std::lock_guard<std::mutex> guard(stream->done_lock);
+        done = stream->done;
+        stream->done = nullptr;
+    }
+    while (done) {
+        StreamEntry* entry = done;
+        done = done->done_next;
+
+        release_readers(entry);
+        stream->mesh_jobs--;
+
+        if (entry->mesh_cancelled.load(std::memory_order_relaxed)) {
+            free_cpu_mesh(entry);
+            entry->stage = entry->mesh_handle != MESH_HANDLE_NONE ? STREAM_RESIDENT : STREAM_READY;
+            entry->remesh = true;
+            continue;
+        }
+        stream->mesh_bytes += mesh_size(&entry->cpu_mesh);
+        entry->stage = STREAM_MESHED;
+    }
+}
+
+static bool schedule_mesh(StreamManager* stream, StreamEntry* entry)
+{
+    // Neighbours still loading or being lit are waited for. Missing ones count as air and trigger a remesh
+    // once they show up, see notify_neighbors.
+    ChunkPos pos = entry->chunk->pos;
+    const Chunk* neighbors[FACE_COUNT];
+    uint8_t mask = 0;
+    for (uint32_t f = 0; f < FACE_COUNT; f++) {
+        ChunkPos npos = { pos.x + FACE_NORMALS[f][0], pos.y + FACE_NORMALS[f][1], pos.z + FACE_NORMALS[f][2] };
+        Chunk* n = world_get_chunk(stream->world, npos);
+        neighbors[f] = nullptr;
+        if (!n) {
+            continue;
+        }
+        if (n->state.load(std::memory_order_acquire) != CHUNK_STATE_READY || n->light_state != CHUNK_LIGHT_DONE) {
+            return false;
+        }
+        neighbors[f] = n;
+        mask |= 1 << f;
+    }
+
+    // Edits to these chunks wait until the job is done with them
+    Chunk* chunk = entry->chunk;
+    chunk->readers++;
+    for (uint32_t f = 0; f < FACE_COUNT; f++) {
+        entry->neighbors[f] = neighbors[f];
+        if (neighbors[f]) {
+            ((Chunk*)neighbors[f])->readers++;
+        }
+    }
+
+    // Edits only touching regions of a resident mesh rebuild just those regions.
+    // A new neighbour changes the whole border, that takes a full mesh.
+    entry->patching = entry->mesh_handle != MESH_HANDLE_NONE && !entry->remesh && stream->hooks.patch;
+    entry->patch_regions = chunk->dirty_regions;
+    entry->patch_skirts = chunk->dirty_borders != 0;
+    chunk->dirty_regions = 0;
+    chunk->dirty_borders = 0;
+
+    entry->mesh_neighbors = mask;
+    entry->remesh = false;
+    entry->mesh_cancelled.store(false, std::memory_order_relaxed);
+    entry->stage = STREAM_MESHING;
+    stream->mesh_jobs++;
+    job_submit(stream->jobs, mesh_job, entry, &stream->mesh_counter);
+    return true;
+}
+
+static void notify_neighbors(StreamManager* stream, Chunk* chunk)
+{
+    for (uint32_t f = 0; f < FACE_COUNT; f++) {
+        ChunkPos npos = { chunk->pos.x + FACE_NORMALS[f][0], chunk->pos.y + FACE_NORMALS[f][1], chunk->pos.z + FACE_NORMALS[f][2] };
+        Chunk* n = world_get_chunk(stream->world, npos);
+        if (!n) {
+            continue;
+        }
+        StreamEntry* entry = entry_of(stream, n);
+        uint32_t back = f ^ 1; // the face of n that points at chunk
+        if (entry->stage >= STREAM_MESHING && !(entry->mesh_neighbors & (1 << back))) {
+            entry->remesh = true;
+        }
+    }
+}
+
+// ---Update---
+
+static inline bool in_range(StreamManager* stream, ChunkPos pos)
+{
+    if (pos.y < stream->config.min_chunk_y || pos.y > stream->config.max_chunk_y) {
+        return false;
+    }
+    int32_t dx = pos.x - stream->center.x;
+    int32_t dz = pos.z - stream->center.z;
+    return dx * dx + dz * dz <= stream->config.radius * stream->config.radius;
+}
+
+static void rebuild_candidates(StreamManager* stream, const Camera* camera)
+{
+    for (StreamEntry* entry = stream->lru_head; entry; entry = entry->lru_next) {
+        entry->wanted = false;
+    }
+
+    Vec3 forward = camera_forward(camera);
+    int32_t r = stream->config.radius;
+    stream->num_candidates = 0;
+    for (int32_t y = stream->config.min_chunk_y; y <= stream->config.max_chunk_y; y++) {
+        for (int32_t dz = -r; dz <= r; dz++) {
+            for (int32_t dx = -r; dx <= r; dx++) {
+                ChunkPos pos = { stream->center.x + dx, y, stream->center.z + dz };
+                if (!in_range(stream, pos)) {
+                    continue;
+                }
+                Vec3 centre = { (pos.x + 0.5f) * CHUNK_SIZE, (pos.y + 0.5f) * CHUNK_SIZE, (pos.z + 0.5f) * CHUNK_SIZE };
+                Vec3 to = centre - camera->position;
+                float dist2 = dot(to, to);
+                float facing = dist2 > 0.0f ? dot(to, forward) / sqrtf(dist2) : 1.0f;
+
+                StreamCandidate* c = &stream->candidates[stream->num_candidates++];
+                c->pos = pos;
+                c->priority = dist2 * (1.0f + STREAM_FACING_WEIGHT * (1.0f - facing));
+            }
+        }
+    }
+    std::sort(stream->candidates, stream->candidates + stream->num_candidates,
+        [](const StreamCandidate& a, const StreamCandidate& b) { return a.priority < b.priority; });
+
+    // Far to near, so the closest chunks end up at the head of the LRU
+    for (uint32_t i = stream->num_candidates; i-- > 0;) {
+        Chunk* chunk = world_get_chunk(stream->world, stream->candidates[i].pos);
+        if (chunk) {
+            StreamEntry* entry = entry_of(stream, chunk);
+            entry->wanted = true;
+            lru_touch(stream, entry);
+        }
+    }
+
+    // Everything that left the range now sits at the tail. Cancel its pending work, loaded
+    // chunks stay cached until the budget needs them.
+    StreamEntry* entry = stream->lru_tail;
+    while (entry && !entry->wanted) {
+        StreamEntry* prev = entry->lru_prev;
+        if (entry->stage == STREAM_LOADING) {
+            evict(stream, entry);
+        } else if (entry->stage == STREAM_MESHING) {
+            entry->mesh_cancelled.store(true, std::memory_order_relaxed);
+        }
+        entry = prev;
+    }
+
+    if (stream->world->store) {
+        world_store_set_focus(stream->world->store, stream->center);
+    }
+    stream->last_rebuild = stream->frame;
+}
+
+static void upload_mesh(StreamManager* stream, StreamEntry* entry, uint32_t handle)
+{
+    drop_gpu_mesh(stream, entry);
+    entry->mesh_handle = handle;
+    entry->mesh_bytes = handle != MESH_HANDLE_NONE ? mesh_size(&entry->cpu_mesh) : 0;
+    stream->mesh_bytes += entry->mesh_bytes;
+    memcpy(entry->layout, entry->cpu_mesh.sections, sizeof(entry->layout));
+    drop_cpu_mesh(stream, entry);
+    entry->stage = STREAM_RESIDENT;
+}
+
+void streaming_update(StreamManager* stream, const Camera* camera)
+{
+    stream->frame++;
+    collect_meshes(stream);
+
+    ChunkPos center = camera_chunk(camera);
+    if (center != stream->center || stream->frame - stream->last_rebuild >= STREAM_REBUILD_FRAMES) {
+        stream->center = center;
+        rebuild_candidates(stream, camera);
+    }
+
+    // Whatever can't be shed stops new chunks from loading and meshing until it clears
+    stream->pressure = memory_pressure();
+    if (stream->pressure > 0) {
+        shed(stream, stream->pressure);
+    }
+
+    const StreamConfig& config = stream->config;
+    uint32_t uploads = 0;
+    bool uploads_full = false;
+    for (uint32_t i = 0; i < stream->num_candidates; i++) {
+        const StreamCandidate& c = stream->candidates[i];
+        Chunk* chunk = world_get_chunk(stream->world, c.pos);
+        if (!chunk) {
+            if (stream->pressure > 0 || stream->pending_loads >= config.max_pending_loads || !make_room(stream, sizeof(Chunk))) {
+                continue;
+            }
+            chunk = world_request_chunk(stream->world, c.pos, c.priority);
+            if (chunk) {
+                track_chunk(stream, chunk);
+            }
+            continue;
+        }
+
+        StreamEntry* entry = entry_of(stream, chunk);
+        if (entry->stage == STREAM_NONE) {
+            track_chunk(stream, chunk);
+        }
+        if (entry->stage == STREAM_LOADING) {
+            if (chunk->state.load(std::memory_order_acquire) != CHUNK_STATE_READY || chunk->light_state != CHUNK_LIGHT_DONE) {
+                continue;
+            }
+            entry->stage = STREAM_READY;
+            stream->pending_loads--;
+            stream->chunks_loaded++;
+            notify_neighbors(stream, chunk);
+        }
+
+        if (!stream->hooks.upload) {
+            continue;
+        }
+
+        bool edited = chunk->dirty_regions || chunk->dirty_borders;
+        bool needs_mesh = (entry->stage == STREAM_READY && stream->pressure == 0) || (entry->stage == STREAM_RESIDENT && (entry->remesh || edited));
+        if (needs_mesh && stream->mesh_jobs < config.max_mesh_jobs && make_room(stream, 0)) {
+            schedule_mesh(stream, entry);
+        }
+
+        if (entry->stage == STREAM_MESHED && entry->patching && !uploads_full) {
+            if (!stream->hooks.patch(stream->hooks.user, entry->mesh_handle, &entry->cpu_mesh)) {
+                uploads_full = true;
+                continue;
+            }
+            drop_cpu_mesh(stream, entry);
+            entry->stage = STREAM_RESIDENT;
+        }
+
+        if (entry->stage == STREAM_MESHED && !uploads_full && uploads < config.max_uploads_per_frame) {
+            uint32_t handle = MESH_HANDLE_NONE;
+            if (entry->cpu_mesh.num_quads > 0) {
+                handle = stream->hooks.upload(stream->hooks.user, chunk->pos, &entry->cpu_mesh);
+                if (handle == MESH_HANDLE_NONE) {
+                    uploads_full = true;
+                    continue;
+                }
+                uploads++;
+            }
+            upload_mesh(stream, entry, handle);
+        }
+    }
+
+    // Meshes grow the footprint without any new loads, keep it in budget
+    make_room(stream, 0);
+}
+
+void streaming_destroy(StreamManager* stream)
+{
+    for (StreamEntry* entry = stream->lru_head; entry; entry = entry->lru_next) {
+        entry->mesh_cancelled.store(true, std::memory_order_relaxed);
+    }
+    job_wait(stream->jobs, &stream->mesh_counter);
+    collect_meshes(stream);
+
+    for (StreamEntry* entry = stream->lru_head; entry; entry = entry->lru_next) {
+        drop_gpu_mesh(stream, entry);
+        if (entry->stage == STREAM_MESHED) {
+            drop_cpu_mesh(stream, entry);
+        }
+    }
+}
@@ -0,0 +1,123 @@
+#ifndef STREAMING_HPP
+#define STREAMING_HPP
+
+#include "camera.hpp"
+#include "chunk.hpp"
+#include "jobs.hpp"
+#include "mesher.hpp"
+#include "world.hpp"
+#include <Arena.h>
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+
+// Keeps every chunk inside a radius around the camera loaded, meshed and uploaded.
+// Work is ordered by distance and view direction, chunks that fall out of range have their
+// pending work cancelled, and everything resident sits in an LRU list that is evicted from
+// the tail whenever voxels + meshes go over the memory budget. Budgets the stream doesn't track
+// itself (GPU heaps, memory tags) shed meshes the same way, see memory_pressure.
+
+#define MESH_HANDLE_NONE UINT32_MAX
+
+// Renderer side of the pipeline. Without hooks nothing gets meshed (headless).
+struct StreamHooks {
+    void* user;
+    // Returns a handle, or MESH_HANDLE_NONE if the mesh can't be taken this frame (try again)
+    uint32_t (*upload)(void* user, ChunkPos pos, const ChunkMesh* mesh);
+    void (*release)(void* user, uint32_t handle);
+    // Optional. Rewrites the sections of a resident mesh that a patch rebuilt, false if it can't
+    // be taken this frame (try again). Without it every edit uploads a whole new mesh.
+    bool (*patch)(void* user, uint32_t handle, const ChunkMesh* mesh);
+};
+
+struct StreamConfig {
+    int32_t radius; // horizontal, in chunks
+    int32_t min_chunk_y; // vertical extent of the world, in chunks
+    int32_t max_chunk_y;
+    uint64_t memory_budget; // voxel data + meshes, bytes
+    uint32_t max_pending_loads; // loads / generation in flight
+    uint32_t max_mesh_jobs;
+    uint32_t max_uploads_per_frame;
+};
+
+enum StreamStage : uint8_t {
+    STREAM_NONE,
+    STREAM_LOADING, // voxels loading or generating, or waiting for their light
+    STREAM_READY, // voxels and light ready, no (or a stale) mesh
+    STREAM_MESHING,
+    STREAM_MESHED, // cpu mesh waiting for upload
+    STREAM_RESIDENT,
+};
+
+struct StreamEntry {
+    Chunk* chunk;
+    struct StreamManager* stream;
+    StreamStage stage;
+    bool wanted; // inside the load radius as of the last rebuild
+    bool remesh; // a neighbour showed up after the last mesh was built
+    uint8_t mesh_neighbors; // faces that had a neighbour when meshed
+
+    uint32_t mesh_handle;
+    uint32_t mesh_bytes;
+    MeshSection layout[MESH_SECTIONS]; // of the resident mesh, patches keep it
+
+    // mesh job state
+    std::atomic<bool> mesh_cancelled;
+    const Chunk* neighbors[FACE_COUNT];
+    bool patching; // rebuilding patch_regions of the resident mesh, cleared if it had to remesh
+    bool patch_skirts;
+    uint64_t patch_regions;
+    ChunkMesh cpu_mesh; // malloc'd, owned while STREAM_MESHED
+    StreamEntry* done_next;
+
+    StreamEntry* lru_prev; // towards most recently used
+    StreamEntry* lru_next;
+};
+
+struct StreamCandidate {
+    ChunkPos pos;
+    float priority; // lower goes first
+};
+
+struct StreamManager {
+    World* world;
+    JobSystem* jobs;
+    StreamHooks hooks;
+    StreamConfig config;
+
+    StreamEntry* entries; // indexed like world->pool.chunks
+
+    StreamCandidate* candidates;
+    uint32_t num_candidates;
+    uint32_t max_candidates;
+
+    StreamEntry* lru_head;
+    StreamEntry* lru_tail;
+
+    ChunkPos center;
+    Vec3 forward;
+    uint64_t frame;
+    uint64_t last_rebuild;
+
+    uint32_t pending_loads;
+    uint32_t mesh_jobs;
+    uint64_t mesh_bytes;
+    uint64_t chunks_loaded; // ever made it to STREAM_READY, for stats
+    uint64_t pressure; // memory_pressure this frame
+
+    JobCounter mesh_counter;
+    std::mutex done_lock;
+    StreamEntry* done;
+
+    static StreamManager* Create(Arena* arr, World* world, JobSystem* jobs, const StreamConfig& config, StreamHooks hooks);
+};
+
+// Main thread, once per frame after world_update
+void streaming_update(StreamManager* stream, const Camera* camera);
+
+uint64_t streaming_memory_used(StreamManager* stream);
+
+// Waits for in flight mesh jobs and releases every mesh
+void streaming_destroy(StreamManager* stream);
+
+#endif // STREAMING_HPP
@@ -0,0 +1,275 @@
+#include "texture_array.hpp"
+#include <cstring>
+
+// ---Images---
+
+static bool create_image(TextureArray* textures, uint32_t first_mip, bool budgeted, TextureImage* texture)
+{
+    VulkanContext* ctx = textures->ctx;
+    const TexturePack* pack = textures->pack;
+    *texture = {};
+    texture->first_mip = first_mip;
+    texture->levels = pack->mips - first_mip;
+    GpuImage* out = &texture->gpu;
+    out->tag = MEM_TEXTURES;
+
+    VkImageCreateInfo image_info {};
+    image_info.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+    image_info.imageType = VK_IMAGE_TYPE_2D;
+    image_info.format = VK_FORMAT_R8G8B8A8_UNORM;
+    image_info.extent = { texture_mip_size(pack, first_mip), texture_mip_size(pack, first_mip), 1 };
+    image_info.mipLevels = texture->levels;
+    image_info.arrayLayers = pack->layers;
+    image_info.samples = VK_SAMPLE_COUNT_1_BIT;
+    image_info.tiling = VK_IMAGE_TILING_OPTIMAL;
+    image_info.usage = VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+    image_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    image_info.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    VK_CHECK_RESULT(vkCreateImage(ctx->device, &image_info, ctx->allocator, &out->image));
+
+    VkMemoryRequirements requirements;
+    vkGetImageMemoryRequirements(ctx->device, out->image, &requirements);
+
+    VkMemoryAllocateInfo alloc_info {};
+    alloc_info.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+    alloc_info.allocationSize = requirements.size;
+    alloc_info.memoryTypeIndex = find_memory_type(ctx, requirements.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+    if (alloc_info.memoryTypeIndex == UINT32_MAX) {
+        vkDestroyImage(ctx->device, out->image, ctx->allocator);
+        *texture = {};
+        return false;
+    }
+
+    // The resident mips have to exist either way, the full image only if there's room
+    out->heap = ctx->memory_properties.memoryTypes[alloc_info.memoryTypeIndex].heapIndex;
+    if (budgeted && !memory_gpu_reserve(MEM_TEXTURES, out->heap, requirements.size)) {
+        vkDestroyImage(ctx->device, out->image, ctx->allocator);
+        *texture = {};
+        return false;
+    } else if (!budgeted) {
+        memory_gpu_track(MEM_TEXTURES, out->heap, (int64_t)requirements.size);
+    }
+    if (vkAllocateMemory(ctx->device, &alloc_info, ctx->allocator, &out->memory) != VK_SUCCESS) {
+        memory_gpu_track(MEM_TEXTURES, out->heap, -(int64_t)requirements.size);
+        memory_tracker.failed.fetch_add(requirements.size, std::memory_order_relaxed);
+        vkDestroyImage(ctx->device, out->image, ctx->allocator);
+        *texture = {};
+        return false;
+    }
+    out->allocation_size = requirements.size;
+    VK_CHECK_RESULT(vkBindImageMemory(ctx->device, out->image, out->memory, 0));
+
+    VkImageViewCreateInfo view_info {};
+    view_info.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+    view_info.image = out->image;
+    view_info.viewType = VK_IMAGE_VIEW_TYPE_2D_ARRAY;
+    view_info.format = VK_FORMAT_R8G8B8A8_UNORM;
+    view_info.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    view_info.subresourceRange.baseMipLevel = 0;
+    view_info.subresourceRange.levelCount = texture->levels;
+    view_info.subresourceRange.baseArrayLayer = 0;
+    view_info.subresourceRange.layerCount = pack->layers;
+    VK_CHECK_RESULT(vkCreateImageView(ctx->device, &view_info, ctx->allocator, &out->view));
+    return true;
+}
+
+static void write_set(TextureArray* textures, VkDescriptorSet set, const TextureImage* image)
+{
+    VkDescriptorImageInfo image_info {};
+    image_info.sampler = textures->sampler;
+    image_info.imageView = image->gpu.view;
+    image_info.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+
+    VkWriteDescriptorSet write {};
+    write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    write.dstSet = set;
+    write.dstBinding = 0;
+    write.descriptorCount = 1;
+    write.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    write.pImageInfo = &image_info;
+    vkUpdateDescriptorSets(textures->ctx->device, 1, &write, 0, nullptr);
+}
+
+static VkImageSubresourceRange whole_image(const TextureArray* textures, const TextureImage* image)
+{
+    return { VK_IMAGE_ASPECT_COLOR_BIT, 0, image->levels, 0, textures->pack->layers };
+}
+
+// Rows [row, row + num_rows) of layers [layer, layer + num_layers) of a pack mip. Full rows of
+// several layers only when they're whole, they aren't contiguous otherwise.
+static bool upload_rows(TextureArray* textures, TextureImage* image, uint32_t mip, uint32_t layer, uint32_t num_layers, uint32_t row,
+    uint32_t num_rows, uint32_t flags)
+{
+    uint32_t size = texture_mip_size(textures->pack, mip);
+    VkBufferImageCopy region {};
+    region.imageSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, mip - image->first_mip, layer, num_layers };
+    region.imageOffset = { 0, (int32_t)row, 0 };
+    region.imageExtent = { size, num_rows, 1 };
+    const uint8_t* data = texture_pack_pixels(textures->pack, mip, layer) + (uint64_t)row * size * 4;
+    VkDeviceSize bytes = (VkDeviceSize)size * 4 * num_rows * num_layers;
+    return upload_image(textures->ctx, image->gpu.image, region, whole_image(textures, image), flags, data, bytes);
+}
+
+// ---Streaming---
+
+// Queues up to TEXTURE_STREAM_BYTES of the full image, whole mips while they fit and row bands
+// of single layers after. True once the last copy is queued.
+static bool stream_full(TextureArray* textures)
+{
+    const TexturePack* pack = textures->pack;
+    TextureImage* full = &textures->full;
+    VkDeviceSize budget = TEXTURE_STREAM_BYTES;
+
+    while (textures->next_mip < pack->mips) {
+        uint32_t mip = textures->next_mip;
+        uint32_t size = texture_mip_size(pack, mip);
+        VkDeviceSize row_bytes = (VkDeviceSize)size * 4;
+        bool first = mip == 0 && textures->next_layer == 0 && textures->next_row == 0;
+        uint32_t flags = first ? IMAGE_UPLOAD_FIRST : 0;
+
+        uint32_t num_layers = 1;
+        uint32_t num_rows = (uint32_t)(budget / row_bytes);
+        if (textures->next_layer == 0 && textures->next_row == 0 && texture_mip_bytes(pack, mip) <= budget) {
+            num_layers = pack->layers;
+            num_rows = size;
+        }
+        num_rows = num_rows < size - textures->next_row ? num_rows : size - textures->next_row;
+        if (num_rows == 0) {
+            return false;
+        }
+
+        bool last = mip == pack->mips - 1 && textures->next_layer + num_layers == pack->layers && textures->next_row + num_rows == size;
+        flags |= last ? IMAGE_UPLOAD_LAST : 0;
+        if (!upload_rows(textures, full, mip, textures->next_layer, num_layers, textures->next_row, num_rows, flags)) {
+            return false;
+        }
+        budget -= row_bytes * num_rows * num_layers;
+
+        textures->next_row += num_rows;
+        if (textures->next_row == size) {
+            textures->next_row = 0;
+            textures->next_layer += num_layers;
+        }
+        if (textures->next_layer == pack->layers) {
+            textures->next_layer = 0;
+            textures->next_mip++;
+        }
+    }
+    return true;
+}
+
+// The draws stop using it right away, the frames in flight are done with it by the time the
+// deletion queue frees it
+static void drop_full(TextureArray* textures)
+{
+    defer_destroy_image(textures->ctx, &textures->full.gpu);
+    textures->full = {};
+    textures->stage = TEXTURE_LOW;
+    textures->current = textures->low_set;
+    textures->retry_frame = textures->frame + TEXTURE_RETRY_FRAMES;
+}
+
+void texture_array_update(TextureArray* textures, uint64_t pressure)
+{
+    textures->frame++;
+
+    if (textures->stage != TEXTURE_LOW && pressure > 0) {
+        drop_full(textures);
+        return;
+    }
+
+    bool wants_full = textures->pack->size > TEXTURE_RESIDENT_SIZE && pressure == 0 && textures->frame >= textures->retry_frame;
+    if (textures->stage == TEXTURE_LOW && wants_full) {
+        if (!create_image(textures, 0, true, &textures->full)) {
+            textures->retry_frame = textures->frame + TEXTURE_RETRY_FRAMES;
+            return;
+        }
+        // Not bound since the last drop, the frames in flight are long done with it
+        write_set(textures, textures->full_set, &textures->full);
+        textures->stage = TEXTURE_STREAMING;
+        textures->next_mip = 0;
+        textures->next_layer = 0;
+        textures->next_row = 0;
+    }
+
+    // The copies are recorded ahead of this frame's draws, it can already sample the image
+    if (textures->stage == TEXTURE_STREAMING && stream_full(textures)) {
+        textures->stage = TEXTURE_FULL;
+        textures->current = textures->full_set;
+    }
+}
+
+// ---Setup---
+
+TextureArray* TextureArray::Create(Arena* arr, VulkanContext* ctx, const TexturePack* pack)
+{
+    TextureArray* textures = (TextureArray*)arena_allocate(arr, sizeof(TextureArray));
+    memset(textures, 0, sizeof(*textures));
+    textures->ctx = ctx;
+    textures->pack = pack;
+
+    // Sharp up close, smooth in the distance
+    VkSamplerCreateInfo sampler_info {};
+    sampler_info.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+    sampler_info.magFilter = VK_FILTER_NEAREST;
+    sampler_info.minFilter = VK_FILTER_LINEAR;
+    sampler_info.mipmapMode = VK_SAMPLER_MIPMAP_MODE_LINEAR;
+    sampler_info.addressModeU = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+    sampler_info.addressModeV = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+    sampler_info.addressModeW = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+    sampler_info.minLod = 0.0f;
+    sampler_info.maxLod = VK_LOD_CLAMP_NONE;
+    VK_CHECK_RESULT(vkCreateSampler(ctx->device, &sampler_info, ctx->allocator, &textures->sampler));
+
+    VkDescriptorPoolSize pool_size {};
+    pool_size.type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    pool_size.descriptorCount = 2;
+
+    VkDescriptorPoolCreateInfo pool_info {};
+    pool_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+    pool_info.maxSets = 2;
+    pool_info.poolSizeCount = 1;
+    pool_info.pPoolSizes = &pool_size;
+    VK_CHECK_RESULT(vkCreateDescriptorPool(ctx->device, &pool_info, ctx->allocator, &textures->descriptor_pool));
+
+    VkDescriptorSetLayout layouts[2] = { ctx->texture_set_layout, ctx->texture_set_layout };
+    VkDescriptorSet sets[2];
+    VkDescriptorSetAllocateInfo alloc_info {};
+    alloc_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+    alloc_info.descriptorPool = textures->descriptor_pool;
+    alloc_info.descriptorSetCount = 2;
+    alloc_info.pSetLayouts = layouts;
+    VK_CHECK_RESULT(vkAllocateDescriptorSets(ctx->device, &alloc_info, sets));
+    textures->low_set = sets[0];
+    textures->full_set = sets[1];
+
+    uint32_t first_mip = 0;
+    while (texture_mip_size(pack, first_mip) > TEXTURE_RESIDENT_SIZE) {
+        first_mip++;
+    }
+    bool ok = create_image(textures, first_mip, false, &textures->low);
+    assert(ok);
+    for (uint32_t mip = first_mip; mip < pack->mips; mip++) {
+        uint32_t flags = (mip == first_mip ? IMAGE_UPLOAD_FIRST : 0) | (mip == pack->mips - 1 ? IMAGE_UPLOAD_LAST : 0);
+        ok = upload_rows(textures, &textures->low, mip, 0, pack->layers, 0, texture_mip_size(pack, mip), flags);
+        assert(ok);
+    }
+    write_set(textures, textures->low_set, &textures->low);
+
+    textures->stage = TEXTURE_LOW;
+    textures->current = textures->low_set;
+    return textures;
+}
+
+void texture_array_destroy(TextureArray* textures)
+{
+    VulkanContext* ctx = textures->ctx;
+    cancel_image_uploads(ctx, textures->full.gpu.image);
+    cancel_image_uploads(ctx, textures->low.gpu.image);
+    if (textures->full.gpu.image) {
+        destroy_gpu_image(ctx, &textures->full.gpu);
+    }
+    destroy_gpu_image(ctx, &textures->low.gpu);
+    vkDestroyDescriptorPool(ctx->device, textures->descriptor_pool, ctx->allocator);
+    vkDestroySampler(ctx->device, textures->sampler, ctx->allocator);
+}
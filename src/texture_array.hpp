@@ -0,0 +1,66 @@
+#ifndef TEXTURE_ARRAY_HPP
+#define TEXTURE_ARRAY_HPP
+
+#include "block_textures.hpp"
+#include "vulkan.hpp"
+#include <Arena.h>
+#include <cstdint>
+
+// The block texture pack on the GPU, one 2D array image sampled by every chunk draw through a
+// single descriptor set, with each vertex carrying its layer.
+//
+// The small mips (TEXTURE_RESIDENT_SIZE and below) are uploaded at startup and always stay.
+// Packs with bigger textures stream the rest in: a second image with the full chain is
+// allocated when memory allows and filled a few MB per frame, and the draws switch over to it
+// once the last copy is queued. Under memory pressure it goes away again and the draws fall
+// back to the small mips, so a high resolution pack never costs more VRAM than there is room for.
+
+#define TEXTURE_RESIDENT_SIZE 32 // px, mips this size and smaller are always resident
+#define TEXTURE_STREAM_BYTES (4 * 1024 * 1024) // per frame, shares the staging buffer with meshes
+#define TEXTURE_RETRY_FRAMES 600 // after dropping the full image or failing to allocate it
+
+struct TextureImage {
+    GpuImage gpu;
+    uint32_t first_mip; // of the pack, at level 0
+    uint32_t levels;
+};
+
+enum TextureStage : uint8_t {
+    TEXTURE_LOW, // only the resident mips
+    TEXTURE_STREAMING, // full is being filled
+    TEXTURE_FULL,
+};
+
+struct TextureArray {
+    VulkanContext* ctx;
+    const TexturePack* pack;
+    VkSampler sampler;
+    VkDescriptorPool descriptor_pool;
+
+    TextureImage low;
+    VkDescriptorSet low_set;
+    TextureImage full;
+    VkDescriptorSet full_set;
+
+    TextureStage stage;
+    uint32_t next_mip; // next copy into full
+    uint32_t next_layer;
+    uint32_t next_row;
+
+    uint64_t frame;
+    uint64_t retry_frame; // full isn't allocated again before this one
+
+    VkDescriptorSet current; // what the draws bind this frame
+
+    // The pack has to outlive it
+    static TextureArray* Create(Arena* arr, VulkanContext* ctx, const TexturePack* pack);
+};
+
+// Streams or drops the full image. Once per frame after begin_frame, pressure as measured
+// by memory_pressure this frame.
+void texture_array_update(TextureArray* textures, uint64_t pressure);
+
+// Frames in flight have to be done
+void texture_array_destroy(TextureArray* textures);
+
+#endif // TEXTURE_ARRAY_HPP
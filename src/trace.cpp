@@ -0,0 +1,163 @@
+#include "trace.hpp"
+#include <cstdio>
+#include <cstring>
+#include <new>
+
+std::atomic<bool> trace_recording { false };
+
+static Tracer* active_tracer = nullptr;
+static thread_local TraceLane* thread_lane = nullptr;
+static thread_local bool thread_lane_failed = false;
+static thread_local const char* thread_name = nullptr;
+
+static void lane_init(Tracer* tracer, TraceLane* lane, const char* name)
+{
+    lane->events = (TraceEvent*)arena_allocate(tracer->arr, TRACE_LANE_EVENTS * sizeof(TraceEvent));
+    lane->written.store(0, std::memory_order_relaxed);
+    snprintf(lane->name, sizeof(lane->name), "%s", name);
+}
+
+Tracer* Tracer::Create(Arena* arr)
+{
+    Tracer* tracer = new (arena_allocate(arr, sizeof(Tracer))) Tracer();
+    tracer->num_lanes.store(0, std::memory_order_relaxed);
+    tracer->start = 0;
+    tracer->arr = arr;
+    lane_init(tracer, &tracer->gpu_lane, "GPU");
+    active_tracer = tracer;
+    return tracer;
+}
+
+static TraceLane* get_thread_lane()
+{
+    if (thread_lane || thread_lane_failed || !active_tracer) {
+        return thread_lane;
+    }
+
+    Tracer* tracer = active_tracer;
+    std::lock_guard<std::mutex> guard(tracer->lane_lock);
+    uint32_t index = tracer->num_lanes.load(std::memory_order_relaxed);
+    if (index == TRACE_MAX_LANES) {
+        printf("Out of trace lanes, a thread won't be traced\n");
+        thread_lane_failed = true;
+        return nullptr;
+    }
+
+    TraceLane* lane = &tracer->lanes[index];
+    char name[TRACE_NAME_LENGTH];
+    snprintf(name, sizeof(name), "%s %u", thread_name ? thread_name : "thread", index);
+    lane_init(tracer, lane, name);
+    tracer->num_lanes.store(index + 1, std::memory_order_release);
+    thread_lane = lane;
+    return lane;
+}
+
+static void lane_push(TraceLane* lane, const char* name, uint64_t start, uint64_t end)
+{
+    uint64_t n = lane->written.load(std::memory_order_relaxed);
+    TraceEvent* event = &lane->events[n % TRACE_LANE_EVENTS];
+    event->name = name;
+    event->start = start;
+    event->end = end;
+    lane->written.store(n + 1, std::memory_order_release);
+}
+
+void trace_name_thread(const char* name)
+{
+    thread_name = name;
+    if (thread_lane) {
+        snprintf(thread_lane->name, sizeof(thread_lane->name), "%s", name);
+    }
+}
+
+void trace_event(const char* name, uint64_t start, uint64_t end)
+{
+    TraceLane* lane = get_thread_lane();
+    if (lane) {
+        lane_push(lane, name, start, end);
+    }
+}
+
+void trace_gpu_event(const char* name, uint64_t start, uint64_t end)
+{
+    if (active_tracer) {
+        lane_push(&active_tracer->gpu_lane, name, start, end);
+    }
+}
+
+void trace_start(Tracer* tracer)
+{
+    tracer->start = trace_now();
+    trace_recording.store(true, std::memory_order_relaxed);
+}
+
+void trace_stop(Tracer* tracer)
+{
+    trace_recording.store(false, std::memory_order_relaxed);
+}
+
+// Copies the lane's ring, then drops what the owner may have overwritten while it was copied
+static uint32_t snapshot_lane(TraceLane* lane, TraceEvent* out)
+{
+    uint64_t written = lane->written.load(std::memory_order_acquire);
+    uint64_t first = written > TRACE_LANE_EVENTS ? written - TRACE_LANE_EVENTS : 0;
+    for (uint64_t i = first; i < written; i++) {
+        out[i - first] = lane->events[i % TRACE_LANE_EVENTS];
+    }
+
+    uint64_t now_written = lane->written.load(std::memory_order_acquire);
+    uint64_t valid = now_written > TRACE_LANE_EVENTS ? now_written - TRACE_LANE_EVENTS : 0;
+    if (valid >= written) {
+        return 0;
+    }
+    uint64_t skip = valid > first ? valid - first : 0;
+    memmove(out, out + skip, (written - first - skip) * sizeof(TraceEvent));
+    return (uint32_t)(written - first - skip);
+}
+
+static void write_lane(FILE* file, Tracer* tracer, TraceLane* lane, uint32_t tid, TraceEvent* scratch, bool* first)
+{
+    fprintf(file, "%s\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":\"%s\"}}", *first ? "" : ",", tid, lane->name);
+    *first = false;
+
+    uint32_t count = snapshot_lane(lane, scratch);
+    for (uint32_t i = 0; i < count; i++) {
+        const TraceEvent* event = &scratch[i];
+        if (event->start < tracer->start) {
+            continue;
+        }
+        double ts = (double)(event->start - tracer->start) / 1000.0;
+        double dur = (double)(event->end - event->start) / 1000.0;
+        fprintf(file, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f}", event->name, tid, ts, dur);
+    }
+}
+
+bool trace_dump_json(Tracer* tracer, const char* path)
+{
+    FILE* file = fopen(path, "w");
+    if (!file) {
+        printf("Failed to open %s for writing\n", path);
+        return false;
+    }
+
+    Arena* scratch = create_arena(TRACE_LANE_EVENTS * sizeof(TraceEvent));
+    TraceEvent* events = (TraceEvent*)arena_allocate(scratch, TRACE_LANE_EVENTS * sizeof(TraceEvent));
+
+    fprintf(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[");
+    bool first = true;
+    uint32_t num_lanes = tracer->num_lanes.load(std::memory_order_acquire);
+    for (uint32_t i = 0; i < num_lanes; i++) {
+        write_lane(file, tracer, &tracer->lanes[i], i, events, &first);
+    }
+    write_lane(file, tracer, &tracer->gpu_lane, TRACE_MAX_LANES, events, &first);
+    fprintf(file, "\n]}\n");
+
+    arena_free(scratch);
+
+    bool ok = !ferror(file);
+    fclose(file);
+    if (!ok) {
+        printf("Failed to write %s\n", path);
+    }
+    return ok;
+}
@@ -0,0 +1,93 @@
+#ifndef TRACE_HPP
+#define TRACE_HPP
+
+#include <Arena.h>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+
+// Timeline tracing. Every thread that traces gets its own lane, a ring of finished scopes that
+// only it writes, so recording is a couple of stores and no locks. GPU pass ranges go on a lane
+// of their own, converted to the CPU clock by the renderer. trace_dump_json writes whatever the
+// rings still hold since trace_start in the Chrome trace format (chrome://tracing, Perfetto).
+// Define TRACE_DISABLED to compile the macros out.
+
+#define TRACE_MAX_LANES 64
+#define TRACE_LANE_EVENTS 65536 // per lane, oldest events are overwritten
+#define TRACE_NAME_LENGTH 32
+
+// Names must outlive the trace, use string literals
+struct TraceEvent {
+    const char* name;
+    uint64_t start; // ns, trace_now
+    uint64_t end;
+};
+
+struct TraceLane {
+    TraceEvent* events; // ring, written % TRACE_LANE_EVENTS
+    std::atomic<uint64_t> written; // only the owning thread stores
+    char name[TRACE_NAME_LENGTH];
+};
+
+struct Tracer {
+    TraceLane lanes[TRACE_MAX_LANES];
+    std::atomic<uint32_t> num_lanes;
+    TraceLane gpu_lane; // written by the thread that reads the timestamp queries
+
+    uint64_t start; // trace_start time, older events aren't dumped
+
+    Arena* arr; // lane rings, allocated when a thread first traces
+    std::mutex lane_lock;
+
+    // Becomes the process' tracer, the macros write into it
+    static Tracer* Create(Arena* arr);
+};
+
+extern std::atomic<bool> trace_recording;
+
+inline uint64_t trace_now()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Lane name of the calling thread, takes effect whether or not it traced already
+void trace_name_thread(const char* name);
+
+// Records a finished scope on the calling thread's lane. Dropped when the lanes ran out.
+void trace_event(const char* name, uint64_t start, uint64_t end);
+// Same on the GPU lane, times already on the trace_now clock
+void trace_gpu_event(const char* name, uint64_t start, uint64_t end);
+
+void trace_start(Tracer* tracer);
+void trace_stop(Tracer* tracer);
+
+// Safe while threads keep tracing, events that get overwritten during the dump are left out
+bool trace_dump_json(Tracer* tracer, const char* path);
+
+struct TraceScope {
+    const char* name;
+    uint64_t start;
+
+    TraceScope(const char* name)
+        : name(name)
+        , start(trace_recording.load(std::memory_order_relaxed) ? trace_now() : 0)
+    {
+    }
+    ~TraceScope()
+    {
+        if (start) {
+            trace_event(name, start, trace_now());
+        }
+    }
+};
+
+#ifdef TRACE_DISABLED
+#define TRACE_SCOPE(name)
+#else
+#define TRACE_CONCAT_(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_(a, b)
+#define TRACE_SCOPE(name) TraceScope TRACE_CONCAT(trace_scope_, __LINE__)(name)
+#endif
+
+#endif // TRACE_HPP
@@ -1,7 +1,12 @@
 #include "Arena.h"
+#include "brickmap.hpp"
+#include "mesher.hpp"
 #include "shader.hpp"
+#include "trace.hpp"
 #include <algorithm>
 #include <climits>
+#include <cmath>
+#include <cstddef>
 #include <set>
 #define GLFW_INCLUDE_VULKAN
 #include <GLFW/glfw3.h>
@@ -158,7 +163,7 @@ static void create_instance(Arena* arr, VulkanContext* ctx)
         instance_info.pNext = nullptr;
     }
 
-    VK_CHECK_RESULT(vkCreateInstance(&instance_info, nullptr, &ctx->instance));
+    VK_CHECK_RESULT(vkCreateInstance(&instance_info, ctx->allocator, &ctx->instance));
 
     arena_pop_scratch(arr, m);
 }
@@ -170,7 +175,7 @@ static void setup_debug_messenger(VulkanContext* ctx)
     VkDebugUtilsMessengerCreateInfoEXT createInfo {};
     populateDebugMessengerCreateInfo(createInfo);
 
-    VK_CHECK_RESULT(CreateDebugUtilsMessengerEXT(ctx->instance, &createInfo, nullptr, &ctx->debug_messenger));
+    VK_CHECK_RESULT(CreateDebugUtilsMessengerEXT(ctx->instance, &createInfo, ctx->allocator, &ctx->debug_messenger));
 }
 
 struct QueueFamilyIndices {
@@ -230,6 +235,22 @@ bool checkDeviceExtensionSupport(VkPhysicalDevice dev)
     return requiredExtensions.empty();
 }
 
+static bool has_device_extension(VkPhysicalDevice dev, const char* name)
+{
+    uint32_t extension_count = 0;
+    vkEnumerateDeviceExtensionProperties(dev, nullptr, &extension_count, nullptr);
+
+    VkExtensionProperties props[extension_count];
+    vkEnumerateDeviceExtensionProperties(dev, nullptr, &extension_count, props);
+
+    for (uint32_t i = 0; i < extension_count; i++) {
+        if (strcmp(props[i].extensionName, name) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
 struct SwapChainSupportDetails {
     VkSurfaceCapabilitiesKHR capabilities;
 
@@ -327,13 +348,39 @@ static void create_logical_device(VulkanContext* ctx)
     VkDeviceCreateInfo createInfo {};
     createInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
 
+    // Dynamic rendering where the device has Vulkan 1.3, the render pass otherwise
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(ctx->physical_device, &properties);
+    VkPhysicalDeviceDynamicRenderingFeatures dynamicRendering {};
+    dynamicRendering.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DYNAMIC_RENDERING_FEATURES;
+    if (properties.apiVersion >= VK_API_VERSION_1_3) {
+        VkPhysicalDeviceFeatures2 features {};
+        features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+        features.pNext = &dynamicRendering;
+        vkGetPhysicalDeviceFeatures2(ctx->physical_device, &features);
+    }
+    ctx->dynamic_rendering = dynamicRendering.dynamicRendering;
+    if (ctx->dynamic_rendering) {
+        createInfo.pNext = &dynamicRendering;
+    }
+
     createInfo.pQueueCreateInfos = queue_infos;
     createInfo.queueCreateInfoCount = uniqueQueueFamilies.size();
 
     createInfo.pEnabledFeatures = &deviceFeatures;
 
-    createInfo.ppEnabledExtensionNames = DeviceExtensions;
-    createInfo.enabledExtensionCount = NumDeviceExtensions;
+    // Optional ones go after the required ones
+    const char* extensions[NumDeviceExtensions + 1];
+    uint32_t num_extensions = 0;
+    for (int e = 0; e < NumDeviceExtensions; e++) {
+        extensions[num_extensions++] = DeviceExtensions[e];
+    }
+    ctx->memory_budget = has_device_extension(ctx->physical_device, VK_EXT_MEMORY_BUDGET_EXTENSION_NAME);
+    if (ctx->memory_budget) {
+        extensions[num_extensions++] = VK_EXT_MEMORY_BUDGET_EXTENSION_NAME;
+    }
+    createInfo.ppEnabledExtensionNames = extensions;
+    createInfo.enabledExtensionCount = num_extensions;
 
     if (enableValidationLayers) {
         createInfo.enabledLayerCount = NumValidationLayers;
@@ -342,7 +389,7 @@ static void create_logical_device(VulkanContext* ctx)
         createInfo.enabledLayerCount = 0;
     }
 
-    VK_CHECK_RESULT(vkCreateDevice(ctx->physical_device, &createInfo, nullptr, &ctx->device));
+    VK_CHECK_RESULT(vkCreateDevice(ctx->physical_device, &createInfo, ctx->allocator, &ctx->device));
 
     // Queues
     vkGetDeviceQueue(ctx->device, indices.graphics, 0, &ctx->graphics_queue);
@@ -351,7 +398,7 @@ static void create_logical_device(VulkanContext* ctx)
 
 static void create_surface(VulkanContext* ctx, Window* window)
 {
-    VK_CHECK_RESULT(glfwCreateWindowSurface(ctx->instance, window->window, nullptr, &ctx->surface));
+    VK_CHECK_RESULT(glfwCreateWindowSurface(ctx->instance, window->window, ctx->allocator, &ctx->surface));
 }
 
 static VkSurfaceFormatKHR choose_swapchain_surface_format(VkSurfaceFormatKHR* formats, uint32_t size,
@@ -402,7 +449,8 @@ static void create_swapchain(Arena* arr, VulkanContext* ctx, Window* window)
     SwapChainSupportDetails support = query_swapchain_support(arr, ctx, ctx->physical_device);
 
     VkSurfaceFormatKHR surfaceFormat = choose_swapchain_surface_format(support.formats, support.num_formats);
-    VkPresentModeKHR presentMode = choose_swap_present_mode(support.present_modes, support.num_present_modes);
+    // Mailbox doesn't hold rendering to the refresh rate, FIFO where it's missing
+    VkPresentModeKHR presentMode = choose_swap_present_mode(support.present_modes, support.num_present_modes, VK_PRESENT_MODE_MAILBOX_KHR);
     VkExtent2D extent = choose_swap_extent(window, support.capabilities);
 
     uint32_t imageCount = support.capabilities.minImageCount + 1; // ensure that we always have enough to swap buffers
@@ -421,8 +469,11 @@ static void create_swapchain(Arena* arr, VulkanContext* ctx, Window* window)
     createInfo.imageExtent = extent;
     createInfo.imageArrayLayers = 1;
     createInfo.imageUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT;
-    // Maybe use this if you want to render to a texture first (Should be configurable)
-    // createInfo.imageUsage = VK_IMAGE_USAGE_TRANSFER_DST_BIT
+    // Lets Window::displayBytes copy its images in
+    ctx->sc_transfer_dst = support.capabilities.supportedUsageFlags & VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+    if (ctx->sc_transfer_dst) {
+        createInfo.imageUsage |= VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+    }
 
     QueueFamilyIndices indices = findQueueFamilies(ctx, ctx->physical_device);
     uint32_t queueFamilyIndices[] = { indices.graphics, indices.present };
@@ -443,7 +494,7 @@ static void create_swapchain(Arena* arr, VulkanContext* ctx, Window* window)
     createInfo.clipped = VK_TRUE;
     createInfo.oldSwapchain = VK_NULL_HANDLE;
 
-    vkCreateSwapchainKHR(ctx->device, &createInfo, nullptr, &ctx->swapchain);
+    vkCreateSwapchainKHR(ctx->device, &createInfo, ctx->allocator, &ctx->swapchain);
     arena_pop_scratch(arr, m);
 
     // Images
@@ -475,14 +526,656 @@ static void create_image_views(VulkanContext* ctx)
         createInfo.subresourceRange.baseArrayLayer = 0;
         createInfo.subresourceRange.layerCount = 1;
 
-        VK_CHECK_RESULT(vkCreateImageView(ctx->device, &createInfo, nullptr, &ctx->sc_image_views[i]));
+        VK_CHECK_RESULT(vkCreateImageView(ctx->device, &createInfo, ctx->allocator, &ctx->sc_image_views[i]));
+    }
+}
+
+// ===========================================
+// -----------------BUFFERS-------------------
+// ===========================================
+
+void query_memory_budget(VulkanContext* ctx)
+{
+    VkPhysicalDeviceMemoryBudgetPropertiesEXT budget {};
+    budget.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_BUDGET_PROPERTIES_EXT;
+
+    VkPhysicalDeviceMemoryProperties2 props {};
+    props.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_PROPERTIES_2;
+    props.pNext = ctx->memory_budget ? &budget : nullptr;
+    vkGetPhysicalDeviceMemoryProperties2(ctx->physical_device, &props);
+    ctx->memory_properties = props.memoryProperties;
+    ctx->memory_budget_frames = 0;
+
+    memory_tracker.heap_budgets = ctx->memory_budget;
+    for (uint32_t h = 0; h < props.memoryProperties.memoryHeapCount; h++) {
+        const VkMemoryHeap* heap = &props.memoryProperties.memoryHeaps[h];
+        bool device_local = heap->flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT;
+        if (ctx->memory_budget) {
+            memory_set_heap(h, heap->size, budget.heapBudget[h], budget.heapUsage[h], device_local);
+        } else {
+            memory_set_heap(h, heap->size, heap->size, 0, device_local);
+        }
+    }
+}
+
+uint32_t find_memory_type(VulkanContext* ctx, uint32_t type_bits, VkMemoryPropertyFlags properties)
+{
+    const VkPhysicalDeviceMemoryProperties* mem_props = &ctx->memory_properties;
+
+    for (uint32_t i = 0; i < mem_props->memoryTypeCount; i++) {
+        if ((type_bits & (1 << i)) && (mem_props->memoryTypes[i].propertyFlags & properties) == properties) {
+            return i;
+        }
+    }
+    printf("No suitable memory type found\n");
+    return UINT32_MAX;
+}
+
+bool create_gpu_buffer(VulkanContext* ctx, VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties, MemTag tag, GpuBuffer* out)
+{
+    *out = {};
+
+    VkBufferCreateInfo bufferInfo {};
+    bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+    bufferInfo.size = size;
+    bufferInfo.usage = usage;
+    bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    VK_CHECK_RESULT(vkCreateBuffer(ctx->device, &bufferInfo, ctx->allocator, &out->buffer));
+
+    VkMemoryRequirements requirements;
+    vkGetBufferMemoryRequirements(ctx->device, out->buffer, &requirements);
+
+    VkMemoryAllocateInfo allocInfo {};
+    allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+    allocInfo.allocationSize = requirements.size;
+    allocInfo.memoryTypeIndex = find_memory_type(ctx, requirements.memoryTypeBits, properties);
+
+    if (allocInfo.memoryTypeIndex == UINT32_MAX) {
+        vkDestroyBuffer(ctx->device, out->buffer, ctx->allocator);
+        *out = {};
+        return false;
+    }
+
+    // Running out of budget or device memory is recoverable (streaming evicts and the caller retries),
+    // so no VK_CHECK_RESULT
+    uint32_t heap = ctx->memory_properties.memoryTypes[allocInfo.memoryTypeIndex].heapIndex;
+    if (!memory_gpu_reserve(tag, heap, requirements.size)) {
+        vkDestroyBuffer(ctx->device, out->buffer, ctx->allocator);
+        *out = {};
+        return false;
+    }
+    if (vkAllocateMemory(ctx->device, &allocInfo, ctx->allocator, &out->memory) != VK_SUCCESS) {
+        memory_gpu_track(tag, heap, -(int64_t)requirements.size);
+        memory_tracker.failed.fetch_add(requirements.size, std::memory_order_relaxed);
+        vkDestroyBuffer(ctx->device, out->buffer, ctx->allocator);
+        *out = {};
+        return false;
+    }
+    out->allocation_size = requirements.size;
+    out->tag = tag;
+    out->heap = heap;
+    VK_CHECK_RESULT(vkBindBufferMemory(ctx->device, out->buffer, out->memory, 0));
+
+    if (properties & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) {
+        VK_CHECK_RESULT(vkMapMemory(ctx->device, out->memory, 0, size, 0, &out->mapped));
+    }
+    out->size = size;
+    return true;
+}
+
+void destroy_gpu_buffer(VulkanContext* ctx, GpuBuffer* buffer)
+{
+    if (buffer->mapped) {
+        vkUnmapMemory(ctx->device, buffer->memory);
+    }
+    vkDestroyBuffer(ctx->device, buffer->buffer, ctx->allocator);
+    vkFreeMemory(ctx->device, buffer->memory, ctx->allocator);
+    if (buffer->allocation_size) {
+        memory_gpu_track(buffer->tag, buffer->heap, -(int64_t)buffer->allocation_size);
+    }
+    *buffer = {};
+}
+
+void destroy_gpu_image(VulkanContext* ctx, GpuImage* image)
+{
+    vkDestroyImageView(ctx->device, image->view, ctx->allocator);
+    vkDestroyImage(ctx->device, image->image, ctx->allocator);
+    vkFreeMemory(ctx->device, image->memory, ctx->allocator);
+    if (image->allocation_size) {
+        memory_gpu_track(image->tag, image->heap, -(int64_t)image->allocation_size);
+    }
+    *image = {};
+}
+
+static void create_deletion_queues(VulkanContext* ctx)
+{
+    for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+        ctx->deletions[i].arena = create_arena_tagged(DELETION_ARENA_BYTES, MEM_FRAME);
+    }
+}
+
+static Deletion* push_deletion(VulkanContext* ctx, DeletionKind kind)
+{
+    DeletionQueue* queue = &ctx->deletions[ctx->current_frame];
+    Deletion* deletion = (Deletion*)arena_allocate(queue->arena, sizeof(Deletion));
+    memset(deletion, 0, sizeof(*deletion));
+    deletion->kind = kind;
+    deletion->next = queue->first;
+    queue->first = deletion;
+    queue->count++;
+    return deletion;
+}
+
+void defer_destroy_buffer(VulkanContext* ctx, GpuBuffer* buffer)
+{
+    cancel_uploads(ctx, buffer->buffer);
+    if (buffer->allocation_size) {
+        memory_gpu_track(buffer->tag, buffer->heap, -(int64_t)buffer->allocation_size);
+    }
+    Deletion* deletion = push_deletion(ctx, DELETE_BUFFER);
+    deletion->buffer = *buffer;
+    deletion->buffer.allocation_size = 0; // already given back
+    *buffer = {};
+}
+
+void defer_destroy_image(VulkanContext* ctx, GpuImage* image)
+{
+    cancel_image_uploads(ctx, image->image);
+    if (image->allocation_size) {
+        memory_gpu_track(image->tag, image->heap, -(int64_t)image->allocation_size);
+    }
+    Deletion* deletion = push_deletion(ctx, DELETE_IMAGE);
+    deletion->image = *image;
+    deletion->image.allocation_size = 0;
+    *image = {};
+}
+
+// Everything the frame retired, its fence has to have signalled since
+static void flush_deletions(VulkanContext* ctx, uint32_t frame)
+{
+    DeletionQueue* queue = &ctx->deletions[frame];
+    if (queue->count == 0) {
+        return;
+    }
+    TRACE_SCOPE("flush deletions");
+    for (Deletion* deletion = queue->first; deletion; deletion = deletion->next) {
+        if (deletion->kind == DELETE_BUFFER) {
+            destroy_gpu_buffer(ctx, &deletion->buffer);
+        } else {
+            destroy_gpu_image(ctx, &deletion->image);
+        }
+    }
+    arena_reset(queue->arena);
+    queue->first = nullptr;
+    queue->count = 0;
+}
+
+static void create_upload_resources(VulkanContext* ctx)
+{
+    for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+        bool ok = create_gpu_buffer(ctx, UPLOAD_STAGING_BYTES, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+            VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, MEM_STAGING, &ctx->staging[i]);
+        assert(ok);
+    }
+}
+
+bool upload_fits(VulkanContext* ctx, VkDeviceSize size, uint32_t num_copies)
+{
+    // Worst case alignment padding in front of every copy
+    VkDeviceSize offset = ctx->staging_used + num_copies * 15;
+    return offset + size <= UPLOAD_STAGING_BYTES && ctx->num_uploads + num_copies <= MAX_UPLOAD_COPIES;
+}
+
+bool upload_buffer(VulkanContext* ctx, VkBuffer dst, VkDeviceSize dst_offset, const void* data, VkDeviceSize size)
+{
+    VkDeviceSize offset = (ctx->staging_used + 15) & ~(VkDeviceSize)15;
+    if (offset + size > UPLOAD_STAGING_BYTES || ctx->num_uploads == MAX_UPLOAD_COPIES) {
+        return false;
+    }
+
+    GpuBuffer* staging = &ctx->staging[ctx->current_frame];
+    memcpy((uint8_t*)staging->mapped + offset, data, size);
+    ctx->staging_used = offset + size;
+
+    BufferUpload* upload = &ctx->uploads[ctx->num_uploads++];
+    upload->dst = dst;
+    upload->region.srcOffset = offset;
+    upload->region.dstOffset = dst_offset;
+    upload->region.size = size;
+    return true;
+}
+
+void cancel_uploads(VulkanContext* ctx, VkBuffer dst)
+{
+    uint32_t n = 0;
+    for (uint32_t i = 0; i < ctx->num_uploads; i++) {
+        if (ctx->uploads[i].dst != dst) {
+            ctx->uploads[n++] = ctx->uploads[i];
+        }
+    }
+    ctx->num_uploads = n;
+}
+
+bool upload_image(VulkanContext* ctx, VkImage dst, const VkBufferImageCopy& region, const VkImageSubresourceRange& range, uint32_t flags,
+    const void* data, VkDeviceSize size)
+{
+    VkDeviceSize offset = (ctx->staging_used + 15) & ~(VkDeviceSize)15;
+    if (offset + size > UPLOAD_STAGING_BYTES || ctx->num_image_uploads == MAX_IMAGE_UPLOADS) {
+        return false;
+    }
+
+    GpuBuffer* staging = &ctx->staging[ctx->current_frame];
+    memcpy((uint8_t*)staging->mapped + offset, data, size);
+    ctx->staging_used = offset + size;
+
+    ImageUpload* upload = &ctx->image_uploads[ctx->num_image_uploads++];
+    upload->dst = dst;
+    upload->region = region;
+    upload->region.bufferOffset = offset;
+    upload->range = range;
+    upload->flags = flags;
+    return true;
+}
+
+void cancel_image_uploads(VulkanContext* ctx, VkImage dst)
+{
+    uint32_t n = 0;
+    for (uint32_t i = 0; i < ctx->num_image_uploads; i++) {
+        if (ctx->image_uploads[i].dst != dst) {
+            ctx->image_uploads[n++] = ctx->image_uploads[i];
+        }
+    }
+    ctx->num_image_uploads = n;
+}
+
+static void image_upload_barrier(VkCommandBuffer cmd_buffer, const ImageUpload* upload, bool first)
+{
+    VkImageMemoryBarrier barrier {};
+    barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+    barrier.oldLayout = first ? VK_IMAGE_LAYOUT_UNDEFINED : VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+    barrier.newLayout = first ? VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL : VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.image = upload->dst;
+    barrier.subresourceRange = upload->range;
+    barrier.srcAccessMask = first ? 0 : VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.dstAccessMask = first ? VK_ACCESS_TRANSFER_WRITE_BIT : VK_ACCESS_SHADER_READ_BIT;
+    VkPipelineStageFlags src_stage = first ? VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT : VK_PIPELINE_STAGE_TRANSFER_BIT;
+    VkPipelineStageFlags dst_stage = first ? VK_PIPELINE_STAGE_TRANSFER_BIT : VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
+    vkCmdPipelineBarrier(cmd_buffer, src_stage, dst_stage, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+}
+
+static void record_uploads(VulkanContext* ctx, VkCommandBuffer cmd_buffer)
+{
+    ctx->uploads_recorded = true;
+    if (ctx->num_uploads == 0 && ctx->num_image_uploads == 0) {
+        return;
+    }
+
+    // Meshes and brick maps are patched in place, earlier frames may still be reading what
+    // gets overwritten
+    VkMemoryBarrier before {};
+    before.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    vkCmdPipelineBarrier(cmd_buffer, VK_PIPELINE_STAGE_VERTEX_INPUT_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 1, &before, 0, nullptr, 0, nullptr);
+
+    VkBuffer staging = ctx->staging[ctx->current_frame].buffer;
+    for (uint32_t i = 0; i < ctx->num_uploads; i++) {
+        vkCmdCopyBuffer(cmd_buffer, staging, ctx->uploads[i].dst, 1, &ctx->uploads[i].region);
+    }
+    for (uint32_t i = 0; i < ctx->num_image_uploads; i++) {
+        const ImageUpload* upload = &ctx->image_uploads[i];
+        if (upload->flags & IMAGE_UPLOAD_FIRST) {
+            image_upload_barrier(cmd_buffer, upload, true);
+        }
+        vkCmdCopyBufferToImage(cmd_buffer, staging, upload->dst, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &upload->region);
+        if (upload->flags & IMAGE_UPLOAD_LAST) {
+            image_upload_barrier(cmd_buffer, upload, false);
+        }
+    }
+
+    VkMemoryBarrier barrier {};
+    barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT | VK_ACCESS_INDEX_READ_BIT | VK_ACCESS_SHADER_READ_BIT;
+    vkCmdPipelineBarrier(cmd_buffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_VERTEX_INPUT_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+}
+
+static void create_frame_rings(VulkanContext* ctx)
+{
+    VkDescriptorPoolSize pool_size {};
+    pool_size.type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    pool_size.descriptorCount = MAX_FRAMES_IN_FLIGHT;
+
+    VkDescriptorPoolCreateInfo pool_info {};
+    pool_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+    pool_info.maxSets = MAX_FRAMES_IN_FLIGHT;
+    pool_info.poolSizeCount = 1;
+    pool_info.pPoolSizes = &pool_size;
+    VK_CHECK_RESULT(vkCreateDescriptorPool(ctx->device, &pool_info, ctx->allocator, &ctx->frame_descriptor_pool));
+
+    VkDescriptorSetLayout layouts[MAX_FRAMES_IN_FLIGHT];
+    for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+        layouts[i] = ctx->frame_set_layout;
+    }
+    VkDescriptorSetAllocateInfo alloc_info {};
+    alloc_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+    alloc_info.descriptorPool = ctx->frame_descriptor_pool;
+    alloc_info.descriptorSetCount = MAX_FRAMES_IN_FLIGHT;
+    alloc_info.pSetLayouts = layouts;
+    VK_CHECK_RESULT(vkAllocateDescriptorSets(ctx->device, &alloc_info, ctx->frame_sets));
+
+    for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+        bool ok = create_gpu_buffer(ctx, FRAME_RING_BYTES, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+            VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, MEM_FRAME, &ctx->frame_rings[i]);
+        assert(ok);
+
+        VkDescriptorBufferInfo buffer_info = { ctx->frame_rings[i].buffer, 0, VK_WHOLE_SIZE };
+        VkWriteDescriptorSet write {};
+        write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+        write.dstSet = ctx->frame_sets[i];
+        write.dstBinding = 0;
+        write.descriptorCount = 1;
+        write.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        write.pBufferInfo = &buffer_info;
+        vkUpdateDescriptorSets(ctx->device, 1, &write, 0, nullptr);
+    }
+}
+
+void* frame_ring_allocate(VulkanContext* ctx, VkDeviceSize size, VkDeviceSize* offset)
+{
+    VkDeviceSize start = (ctx->frame_ring_used + 15) & ~(VkDeviceSize)15;
+    if (start + size > FRAME_RING_BYTES) {
+        return nullptr;
+    }
+    ctx->frame_ring_used = start + size;
+    *offset = start;
+    return (uint8_t*)ctx->frame_rings[ctx->current_frame].mapped + start;
+}
+
+static void create_quad_indices(VulkanContext* ctx)
+{
+    VkDeviceSize size = MAX_CHUNK_MESH_QUADS * 6 * sizeof(uint32_t);
+    bool ok = create_gpu_buffer(ctx, size, VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, MEM_MESHES, &ctx->quad_indices);
+    assert(ok);
+
+    // Written straight into the staging buffer, nothing else has been uploaded yet
+    uint32_t* indices = (uint32_t*)ctx->staging[ctx->current_frame].mapped;
+    for (uint32_t q = 0; q < MAX_CHUNK_MESH_QUADS; q++) {
+        uint32_t v = q * 4;
+        uint32_t* i = &indices[q * 6];
+        i[0] = v;
+        i[1] = v + 1;
+        i[2] = v + 2;
+        i[3] = v;
+        i[4] = v + 2;
+        i[5] = v + 3;
     }
+    ctx->staging_used = size;
+
+    BufferUpload* upload = &ctx->uploads[ctx->num_uploads++];
+    upload->dst = ctx->quad_indices.buffer;
+    upload->region = { 0, 0, size };
+}
+
+static void create_timestamp_pools(VulkanContext* ctx)
+{
+    QueueFamilyIndices indices = findQueueFamilies(ctx, ctx->physical_device);
+    uint32_t family_count = 0;
+    vkGetPhysicalDeviceQueueFamilyProperties(ctx->physical_device, &family_count, nullptr);
+    VkQueueFamilyProperties families[family_count];
+    vkGetPhysicalDeviceQueueFamilyProperties(ctx->physical_device, &family_count, families);
+
+    VkPhysicalDeviceProperties props;
+    vkGetPhysicalDeviceProperties(ctx->physical_device, &props);
+
+    uint32_t valid_bits = families[indices.graphics].timestampValidBits;
+    if (valid_bits == 0 || props.limits.timestampPeriod == 0.0f) {
+        printf("The graphics queue has no timestamps, GPU passes won't be timed\n");
+        return;
+    }
+    ctx->timestamp_period = props.limits.timestampPeriod;
+    ctx->timestamp_mask = valid_bits >= 64 ? UINT64_MAX : (1ull << valid_bits) - 1;
+
+    VkQueryPoolCreateInfo poolInfo {};
+    poolInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+    poolInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+    poolInfo.queryCount = GPU_PASS_COUNT * 2;
+    for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+        VK_CHECK_RESULT(vkCreateQueryPool(ctx->device, &poolInfo, ctx->allocator, &ctx->timestamp_pools[i]));
+    }
+    ctx->timestamps = true;
+    calibrate_gpu_clock(ctx);
+}
+
+static uint64_t gpu_to_trace_time(VulkanContext* ctx, uint64_t ticks)
+{
+    return (uint64_t)((int64_t)((double)(ticks & ctx->timestamp_mask) * ctx->timestamp_period) + ctx->gpu_clock_offset);
+}
+
+void calibrate_gpu_clock(VulkanContext* ctx)
+{
+    if (!ctx->timestamps) {
+        return;
+    }
+
+    VkQueryPoolCreateInfo poolInfo {};
+    poolInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+    poolInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+    poolInfo.queryCount = 1;
+    VkQueryPool pool;
+    VK_CHECK_RESULT(vkCreateQueryPool(ctx->device, &poolInfo, ctx->allocator, &pool));
+
+    VkCommandBufferAllocateInfo allocInfo {};
+    allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+    allocInfo.commandPool = ctx->cmd_pool;
+    allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+    allocInfo.commandBufferCount = 1;
+    VkCommandBuffer cmd_buffer;
+    VK_CHECK_RESULT(vkAllocateCommandBuffers(ctx->device, &allocInfo, &cmd_buffer));
+
+    VkCommandBufferBeginInfo beginInfo {};
+    beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+    VK_CHECK_RESULT(vkBeginCommandBuffer(cmd_buffer, &beginInfo));
+    vkCmdResetQueryPool(cmd_buffer, pool, 0, 1);
+    vkCmdWriteTimestamp(cmd_buffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, pool, 0);
+    VK_CHECK_RESULT(vkEndCommandBuffer(cmd_buffer));
+
+    VkFenceCreateInfo fenceInfo {};
+    fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+    VkFence fence;
+    VK_CHECK_RESULT(vkCreateFence(ctx->device, &fenceInfo, ctx->allocator, &fence));
+
+    VkSubmitInfo submitInfo {};
+    submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    submitInfo.commandBufferCount = 1;
+    submitInfo.pCommandBuffers = &cmd_buffer;
+
+    // An idle queue runs the timestamp right away, so it lands between the two CPU reads
+    vkQueueWaitIdle(ctx->graphics_queue);
+    uint64_t cpu_before = trace_now();
+    VK_CHECK_RESULT(vkQueueSubmit(ctx->graphics_queue, 1, &submitInfo, fence));
+    vkWaitForFences(ctx->device, 1, &fence, VK_TRUE, UINT64_MAX);
+    uint64_t cpu_after = trace_now();
+
+    uint64_t ticks = 0;
+    VK_CHECK_RESULT(vkGetQueryPoolResults(ctx->device, pool, 0, 1, sizeof(ticks), &ticks, sizeof(ticks), VK_QUERY_RESULT_64_BIT));
+    uint64_t cpu = cpu_before + (cpu_after - cpu_before) / 2;
+    ctx->gpu_clock_offset = (int64_t)cpu - (int64_t)((double)(ticks & ctx->timestamp_mask) * ctx->timestamp_period);
+
+    vkDestroyFence(ctx->device, fence, ctx->allocator);
+    vkFreeCommandBuffers(ctx->device, ctx->cmd_pool, 1, &cmd_buffer);
+    vkDestroyQueryPool(ctx->device, pool, ctx->allocator);
+}
+
+static bool timing(VulkanContext* ctx)
+{
+    return ctx->timestamps && ctx->profiler;
+}
+
+static void write_timestamp(VulkanContext* ctx, VkCommandBuffer cmd_buffer, GpuPass pass, bool end)
+{
+    if (!timing(ctx)) {
+        return;
+    }
+    // Top of pipe for the start, so the pass' wait on earlier work is counted as part of it
+    VkPipelineStageFlagBits stage = end ? VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT : VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
+    vkCmdWriteTimestamp(cmd_buffer, stage, ctx->timestamp_pools[ctx->current_frame], pass * 2 + end);
+    if (end) {
+        ctx->timestamp_passes[ctx->current_frame] |= 1 << pass;
+    }
+}
+
+// The frame's fence has signalled, so its queries are done. Still asks without waiting and
+// checks availability, a query that isn't there just leaves its pass out.
+static void read_timestamps(VulkanContext* ctx)
+{
+    uint32_t passes = ctx->timestamp_passes[ctx->current_frame];
+    ctx->timestamp_passes[ctx->current_frame] = 0;
+    if (!timing(ctx) || passes == 0) {
+        return;
+    }
+
+    uint64_t results[GPU_PASS_COUNT * 2][2]; // value, availability
+    VkResult res = vkGetQueryPoolResults(ctx->device, ctx->timestamp_pools[ctx->current_frame], 0, GPU_PASS_COUNT * 2, sizeof(results), results,
+        sizeof(results[0]), VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WITH_AVAILABILITY_BIT);
+    if (res != VK_SUCCESS && res != VK_NOT_READY) {
+        return;
+    }
+
+    float ms[GPU_PASS_COUNT] = {};
+    uint32_t timed = 0;
+    for (uint32_t p = 0; p < GPU_PASS_COUNT; p++) {
+        uint64_t* begin = results[p * 2];
+        uint64_t* end = results[p * 2 + 1];
+        if (!(passes & (1 << p)) || !begin[1] || !end[1]) {
+            continue;
+        }
+        uint64_t ticks = (end[0] - begin[0]) & ctx->timestamp_mask;
+        ms[p] = (float)((double)ticks * ctx->timestamp_period * 1e-6);
+        timed |= 1 << p;
+
+        if (trace_recording.load(std::memory_order_relaxed)) {
+            uint64_t start = gpu_to_trace_time(ctx, begin[0]);
+            trace_gpu_event(profiler_pass_name((GpuPass)p), start, start + (uint64_t)((double)ticks * ctx->timestamp_period));
+        }
+    }
+    profiler_gpu_results(ctx->profiler, ctx->timestamp_frames[ctx->current_frame], ms, timed);
+}
+
+void begin_frame(VulkanContext* ctx)
+{
+    {
+        TRACE_SCOPE("wait frame fence");
+        vkWaitForFences(ctx->device, 1, &ctx->in_flight_fences[ctx->current_frame], VK_TRUE, UINT64_MAX);
+    }
+    read_timestamps(ctx);
+    flush_deletions(ctx, ctx->current_frame);
+    host_allocator_frame(ctx->host_allocator);
+
+    // Nothing recorded for this frame is pending anymore
+    VK_CHECK_RESULT(vkResetCommandPool(ctx->device, ctx->frame_pools[ctx->current_frame], 0));
+    for (size_t b = 0; b < MAX_RECORD_BATCHES; b++) {
+        VK_CHECK_RESULT(vkResetCommandPool(ctx->device, ctx->batch_pools[ctx->current_frame][b], 0));
+    }
+
+    ctx->frame_ring_used = 0;
+
+    if (++ctx->memory_budget_frames >= MEMORY_BUDGET_INTERVAL) {
+        query_memory_budget(ctx);
+    }
+
+    // The last frame that used this staging buffer is done, start filling it again.
+    // If the previous frame was skipped its copies were never recorded, keep them.
+    if (ctx->uploads_recorded) {
+        ctx->uploads_recorded = false;
+        ctx->staging_used = 0;
+        ctx->num_uploads = 0;
+        ctx->num_image_uploads = 0;
+    }
+}
+
+void wait_frames_in_flight(VulkanContext* ctx)
+{
+    TRACE_SCOPE("wait frames in flight");
+    vkWaitForFences(ctx->device, MAX_FRAMES_IN_FLIGHT, ctx->in_flight_fences, VK_TRUE, UINT64_MAX);
+}
+
+// ===========================================
+// ===========================================
+
+static VkFormat find_depth_format(VulkanContext* ctx)
+{
+    VkFormat candidates[] = { VK_FORMAT_D32_SFLOAT, VK_FORMAT_X8_D24_UNORM_PACK32, VK_FORMAT_D16_UNORM };
+    for (VkFormat format : candidates) {
+        VkFormatProperties props;
+        vkGetPhysicalDeviceFormatProperties(ctx->physical_device, format, &props);
+        if (props.optimalTilingFeatures & VK_FORMAT_FEATURE_DEPTH_STENCIL_ATTACHMENT_BIT) {
+            return format;
+        }
+    }
+    return VK_FORMAT_D16_UNORM; // required to be supported
+}
+
+static void create_depth_resources(VulkanContext* ctx)
+{
+    VkImageCreateInfo imageInfo {};
+    imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+    imageInfo.imageType = VK_IMAGE_TYPE_2D;
+    imageInfo.format = ctx->depth_format;
+    imageInfo.extent = { ctx->sc_extent.width, ctx->sc_extent.height, 1 };
+    imageInfo.mipLevels = 1;
+    imageInfo.arrayLayers = 1;
+    imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+    imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+    imageInfo.usage = VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT;
+    imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    VK_CHECK_RESULT(vkCreateImage(ctx->device, &imageInfo, ctx->allocator, &ctx->depth_image));
+
+    VkMemoryRequirements requirements;
+    vkGetImageMemoryRequirements(ctx->device, ctx->depth_image, &requirements);
+
+    VkMemoryAllocateInfo allocInfo {};
+    allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+    allocInfo.allocationSize = requirements.size;
+    allocInfo.memoryTypeIndex = find_memory_type(ctx, requirements.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+    VK_CHECK_RESULT(vkAllocateMemory(ctx->device, &allocInfo, ctx->allocator, &ctx->depth_memory));
+    VK_CHECK_RESULT(vkBindImageMemory(ctx->device, ctx->depth_image, ctx->depth_memory, 0));
+    // Can't render without it, counted but not held to a budget
+    ctx->depth_size = requirements.size;
+    ctx->depth_heap = ctx->memory_properties.memoryTypes[allocInfo.memoryTypeIndex].heapIndex;
+    memory_gpu_track(MEM_FRAME, ctx->depth_heap, (int64_t)ctx->depth_size);
+
+    VkImageViewCreateInfo viewInfo {};
+    viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+    viewInfo.image = ctx->depth_image;
+    viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+    viewInfo.format = ctx->depth_format;
+    viewInfo.subresourceRange.aspectMask = VK_IMAGE_ASPECT_DEPTH_BIT;
+    viewInfo.subresourceRange.baseMipLevel = 0;
+    viewInfo.subresourceRange.levelCount = 1;
+    viewInfo.subresourceRange.baseArrayLayer = 0;
+    viewInfo.subresourceRange.layerCount = 1;
+    VK_CHECK_RESULT(vkCreateImageView(ctx->device, &viewInfo, ctx->allocator, &ctx->depth_view));
+}
+
+// Attachment formats for pipelines under dynamic rendering, in place of the render pass
+static VkPipelineRenderingCreateInfo pipeline_rendering_info(VulkanContext* ctx)
+{
+    VkPipelineRenderingCreateInfo info {};
+    info.sType = VK_STRUCTURE_TYPE_PIPELINE_RENDERING_CREATE_INFO;
+    info.colorAttachmentCount = 1;
+    info.pColorAttachmentFormats = &ctx->sc_image_format;
+    info.depthAttachmentFormat = ctx->depth_format;
+    return info;
 }
 
 static void create_graphics_pipeline(Arena* arr, VulkanContext* ctx)
 {
-    VkShaderModule vertex_module = create_shader_module(arr, ctx, "shaders/triangle.vert.spv");
-    VkShaderModule frag_module = create_shader_module(arr, ctx, "shaders/triangle.frag.spv");
+    VkShaderModule vertex_module = create_shader_module(ctx, "shaders/chunk.vert.spv");
+    VkShaderModule frag_module = create_shader_module(ctx, "shaders/chunk.frag.spv");
 
     VkPipelineShaderStageCreateInfo vert_stage_info {};
     vert_stage_info.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
@@ -509,12 +1202,27 @@ static void create_graphics_pipeline(Arena* arr, VulkanContext* ctx)
     dynamic_state_info.dynamicStateCount = num_dynamic_states;
     dynamic_state_info.pDynamicStates = dynamic_states;
 
+    VkVertexInputBindingDescription vertex_binding {};
+    vertex_binding.binding = 0;
+    vertex_binding.stride = sizeof(ChunkVertex);
+    vertex_binding.inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
+
+    VkVertexInputAttributeDescription vertex_attributes[2] {};
+    vertex_attributes[0].location = 0;
+    vertex_attributes[0].binding = 0;
+    vertex_attributes[0].format = VK_FORMAT_R32_UINT;
+    vertex_attributes[0].offset = offsetof(ChunkVertex, packed);
+    vertex_attributes[1].location = 1;
+    vertex_attributes[1].binding = 0;
+    vertex_attributes[1].format = VK_FORMAT_R8G8B8A8_UNORM;
+    vertex_attributes[1].offset = offsetof(ChunkVertex, color);
+
     VkPipelineVertexInputStateCreateInfo v_input_info {};
     v_input_info.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
-    v_input_info.vertexBindingDescriptionCount = 0;
-    v_input_info.pVertexBindingDescriptions = nullptr;
-    v_input_info.vertexAttributeDescriptionCount = 0;
-    v_input_info.pVertexAttributeDescriptions = nullptr;
+    v_input_info.vertexBindingDescriptionCount = 1;
+    v_input_info.pVertexBindingDescriptions = &vertex_binding;
+    v_input_info.vertexAttributeDescriptionCount = 2;
+    v_input_info.pVertexAttributeDescriptions = vertex_attributes;
 
     VkPipelineInputAssemblyStateCreateInfo input_assemply_info {};
     input_assemply_info.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
@@ -545,7 +1253,7 @@ static void create_graphics_pipeline(Arena* arr, VulkanContext* ctx)
     rasterizer.polygonMode = VK_POLYGON_MODE_FILL;
     rasterizer.lineWidth = 1.0f;
     rasterizer.cullMode = VK_CULL_MODE_BACK_BIT;
-    rasterizer.frontFace = VK_FRONT_FACE_CLOCKWISE;
+    rasterizer.frontFace = VK_FRONT_FACE_COUNTER_CLOCKWISE; // the projection flips y, so this is CCW on screen
 
     rasterizer.depthBiasEnable = VK_FALSE;
     rasterizer.depthBiasConstantFactor = 0.0f;
@@ -561,6 +1269,14 @@ static void create_graphics_pipeline(Arena* arr, VulkanContext* ctx)
     multisampling.alphaToCoverageEnable = VK_FALSE;
     multisampling.alphaToOneEnable = VK_FALSE;
 
+    VkPipelineDepthStencilStateCreateInfo depth_stencil {};
+    depth_stencil.sType = VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO;
+    depth_stencil.depthTestEnable = VK_TRUE;
+    depth_stencil.depthWriteEnable = VK_TRUE;
+    depth_stencil.depthCompareOp = VK_COMPARE_OP_LESS;
+    depth_stencil.depthBoundsTestEnable = VK_FALSE;
+    depth_stencil.stencilTestEnable = VK_FALSE;
+
     VkPipelineColorBlendAttachmentState colorBlendAttachment {};
     colorBlendAttachment.colorWriteMask = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT | VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT;
     colorBlendAttachment.blendEnable = VK_FALSE;
@@ -582,13 +1298,41 @@ static void create_graphics_pipeline(Arena* arr, VulkanContext* ctx)
     colorBlending.blendConstants[2] = 0.0f;
     colorBlending.blendConstants[3] = 0.0f;
 
+    // The block texture array, one set for every draw
+    VkDescriptorSetLayoutBinding texture_binding {};
+    texture_binding.binding = 0;
+    texture_binding.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    texture_binding.descriptorCount = 1;
+    texture_binding.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+
+    VkDescriptorSetLayoutCreateInfo set_layout_info {};
+    set_layout_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+    set_layout_info.bindingCount = 1;
+    set_layout_info.pBindings = &texture_binding;
+    VK_CHECK_RESULT(vkCreateDescriptorSetLayout(ctx->device, &set_layout_info, ctx->allocator, &ctx->texture_set_layout));
+
+    // Chunk origins from the frame ring, read by both vertex shaders
+    VkDescriptorSetLayoutBinding ring_binding {};
+    ring_binding.binding = 0;
+    ring_binding.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    ring_binding.descriptorCount = 1;
+    ring_binding.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+    set_layout_info.pBindings = &ring_binding;
+    VK_CHECK_RESULT(vkCreateDescriptorSetLayout(ctx->device, &set_layout_info, ctx->allocator, &ctx->frame_set_layout));
+
+    VkDescriptorSetLayout set_layouts[2] = { ctx->texture_set_layout, ctx->frame_set_layout };
     VkPipelineLayoutCreateInfo pipelineLayoutInfo {};
     pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
-    pipelineLayoutInfo.setLayoutCount = 0;
-    pipelineLayoutInfo.pSetLayouts = nullptr;
-    pipelineLayoutInfo.pushConstantRangeCount = 0;
-    pipelineLayoutInfo.pPushConstantRanges = nullptr;
-    VK_CHECK_RESULT(vkCreatePipelineLayout(ctx->device, &pipelineLayoutInfo, nullptr, &ctx->pipeline_layout));
+    pipelineLayoutInfo.setLayoutCount = 2;
+    pipelineLayoutInfo.pSetLayouts = set_layouts;
+    VkPushConstantRange push_constants {};
+    push_constants.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+    push_constants.offset = 0;
+    push_constants.size = sizeof(Mat4); // view projection
+
+    pipelineLayoutInfo.pushConstantRangeCount = 1;
+    pipelineLayoutInfo.pPushConstantRanges = &push_constants;
+    VK_CHECK_RESULT(vkCreatePipelineLayout(ctx->device, &pipelineLayoutInfo, ctx->allocator, &ctx->pipeline_layout));
 
     VkGraphicsPipelineCreateInfo pipelineInfo {};
     pipelineInfo.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
@@ -600,10 +1344,12 @@ static void create_graphics_pipeline(Arena* arr, VulkanContext* ctx)
     pipelineInfo.pViewportState = &viewport_state;
     pipelineInfo.pRasterizationState = &rasterizer;
     pipelineInfo.pMultisampleState = &multisampling;
-    pipelineInfo.pDepthStencilState = nullptr; // Optional
+    pipelineInfo.pDepthStencilState = &depth_stencil;
     pipelineInfo.pColorBlendState = &colorBlending;
     pipelineInfo.pDynamicState = &dynamic_state_info;
 
+    VkPipelineRenderingCreateInfo rendering_info = pipeline_rendering_info(ctx);
+    pipelineInfo.pNext = ctx->dynamic_rendering ? &rendering_info : nullptr;
     pipelineInfo.layout = ctx->pipeline_layout;
     pipelineInfo.renderPass = ctx->render_pass;
     pipelineInfo.subpass = 0;
@@ -611,14 +1357,148 @@ static void create_graphics_pipeline(Arena* arr, VulkanContext* ctx)
     pipelineInfo.basePipelineHandle = VK_NULL_HANDLE; // Optional
     pipelineInfo.basePipelineIndex = -1; // Optional
 
-    VK_CHECK_RESULT(vkCreateGraphicsPipelines(ctx->device, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &ctx->graphics_pipeline));
+    VK_CHECK_RESULT(vkCreateGraphicsPipelines(ctx->device, VK_NULL_HANDLE, 1, &pipelineInfo, ctx->allocator, &ctx->graphics_pipeline));
+
+    // After the pre-pass every visible fragment is already in the depth buffer, shading only
+    // the ones that match it runs the fragment shader once per pixel
+    depth_stencil.depthCompareOp = VK_COMPARE_OP_EQUAL;
+    depth_stencil.depthWriteEnable = VK_FALSE;
+    VK_CHECK_RESULT(vkCreateGraphicsPipelines(ctx->device, VK_NULL_HANDLE, 1, &pipelineInfo, ctx->allocator, &ctx->equal_pipeline));
+
+    // Pre-pass: positions only, no fragment shader and no color writes
+    VkShaderModule depth_module = create_shader_module(ctx, "shaders/chunk_depth.vert.spv");
+    VkPipelineShaderStageCreateInfo depth_stage_info = vert_stage_info;
+    depth_stage_info.module = depth_module;
+    v_input_info.vertexAttributeDescriptionCount = 1;
+    colorBlendAttachment.colorWriteMask = 0;
+    depth_stencil.depthCompareOp = VK_COMPARE_OP_LESS;
+    depth_stencil.depthWriteEnable = VK_TRUE;
+    pipelineInfo.stageCount = 1;
+    pipelineInfo.pStages = &depth_stage_info;
+    VK_CHECK_RESULT(vkCreateGraphicsPipelines(ctx->device, VK_NULL_HANDLE, 1, &pipelineInfo, ctx->allocator, &ctx->depth_pipeline));
+
+    vkDestroyShaderModule(ctx->device, depth_module, ctx->allocator);
+    vkDestroyShaderModule(ctx->device, frag_module, ctx->allocator);
+    vkDestroyShaderModule(ctx->device, vertex_module, ctx->allocator);
+}
+
+// Full screen triangle, raymarch.frag walks the brick map buffers bound at set 0
+static void create_raymarch_pipeline(Arena* arr, VulkanContext* ctx)
+{
+    VkDescriptorSetLayoutBinding bindings[BRICK_BUFFER_COUNT] {};
+    for (uint32_t i = 0; i < BRICK_BUFFER_COUNT; i++) {
+        bindings[i].binding = i;
+        bindings[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        bindings[i].descriptorCount = 1;
+        bindings[i].stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+    }
+
+    VkDescriptorSetLayoutCreateInfo set_layout_info {};
+    set_layout_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+    set_layout_info.bindingCount = BRICK_BUFFER_COUNT;
+    set_layout_info.pBindings = bindings;
+    VK_CHECK_RESULT(vkCreateDescriptorSetLayout(ctx->device, &set_layout_info, ctx->allocator, &ctx->raymarch_set_layout));
+
+    VkPushConstantRange push_constants {};
+    push_constants.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+    push_constants.offset = 0;
+    push_constants.size = sizeof(RaymarchParams);
+
+    VkPipelineLayoutCreateInfo layout_info {};
+    layout_info.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+    layout_info.setLayoutCount = 1;
+    layout_info.pSetLayouts = &ctx->raymarch_set_layout;
+    layout_info.pushConstantRangeCount = 1;
+    layout_info.pPushConstantRanges = &push_constants;
+    VK_CHECK_RESULT(vkCreatePipelineLayout(ctx->device, &layout_info, ctx->allocator, &ctx->raymarch_pipeline_layout));
+
+    VkShaderModule vertex_module = create_shader_module(ctx, "shaders/raymarch.vert.spv");
+    VkShaderModule frag_module = create_shader_module(ctx, "shaders/raymarch.frag.spv");
+
+    VkPipelineShaderStageCreateInfo stages[2] {};
+    stages[0].sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+    stages[0].stage = VK_SHADER_STAGE_VERTEX_BIT;
+    stages[0].module = vertex_module;
+    stages[0].pName = "main";
+    stages[1].sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+    stages[1].stage = VK_SHADER_STAGE_FRAGMENT_BIT;
+    stages[1].module = frag_module;
+    stages[1].pName = "main";
+
+    VkDynamicState dynamic_states[] = { VK_DYNAMIC_STATE_VIEWPORT, VK_DYNAMIC_STATE_SCISSOR };
+    VkPipelineDynamicStateCreateInfo dynamic_state_info {};
+    dynamic_state_info.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
+    dynamic_state_info.dynamicStateCount = 2;
+    dynamic_state_info.pDynamicStates = dynamic_states;
+
+    VkPipelineVertexInputStateCreateInfo v_input_info {};
+    v_input_info.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
+
+    VkPipelineInputAssemblyStateCreateInfo input_assembly_info {};
+    input_assembly_info.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
+    input_assembly_info.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
 
-    vkDestroyShaderModule(ctx->device, frag_module, nullptr);
-    vkDestroyShaderModule(ctx->device, vertex_module, nullptr);
+    VkPipelineViewportStateCreateInfo viewport_state {};
+    viewport_state.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
+    viewport_state.viewportCount = 1;
+    viewport_state.scissorCount = 1;
+
+    VkPipelineRasterizationStateCreateInfo rasterizer {};
+    rasterizer.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
+    rasterizer.polygonMode = VK_POLYGON_MODE_FILL;
+    rasterizer.lineWidth = 1.0f;
+    rasterizer.cullMode = VK_CULL_MODE_NONE;
+    rasterizer.frontFace = VK_FRONT_FACE_COUNTER_CLOCKWISE;
+
+    VkPipelineMultisampleStateCreateInfo multisampling {};
+    multisampling.sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO;
+    multisampling.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
+    multisampling.minSampleShading = 1.0f;
+
+    // Every pixel is written, depth is neither needed nor kept
+    VkPipelineDepthStencilStateCreateInfo depth_stencil {};
+    depth_stencil.sType = VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO;
+    depth_stencil.depthTestEnable = VK_FALSE;
+    depth_stencil.depthWriteEnable = VK_FALSE;
+
+    VkPipelineColorBlendAttachmentState color_blend_attachment {};
+    color_blend_attachment.colorWriteMask = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT | VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT;
+    color_blend_attachment.blendEnable = VK_FALSE;
+
+    VkPipelineColorBlendStateCreateInfo color_blending {};
+    color_blending.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
+    color_blending.attachmentCount = 1;
+    color_blending.pAttachments = &color_blend_attachment;
+
+    VkGraphicsPipelineCreateInfo pipeline_info {};
+    pipeline_info.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
+    pipeline_info.stageCount = 2;
+    pipeline_info.pStages = stages;
+    pipeline_info.pVertexInputState = &v_input_info;
+    pipeline_info.pInputAssemblyState = &input_assembly_info;
+    pipeline_info.pViewportState = &viewport_state;
+    pipeline_info.pRasterizationState = &rasterizer;
+    pipeline_info.pMultisampleState = &multisampling;
+    pipeline_info.pDepthStencilState = &depth_stencil;
+    pipeline_info.pColorBlendState = &color_blending;
+    pipeline_info.pDynamicState = &dynamic_state_info;
+    VkPipelineRenderingCreateInfo rendering_info = pipeline_rendering_info(ctx);
+    pipeline_info.pNext = ctx->dynamic_rendering ? &rendering_info : nullptr;
+    pipeline_info.layout = ctx->raymarch_pipeline_layout;
+    pipeline_info.renderPass = ctx->render_pass;
+    pipeline_info.subpass = 0;
+    VK_CHECK_RESULT(vkCreateGraphicsPipelines(ctx->device, VK_NULL_HANDLE, 1, &pipeline_info, ctx->allocator, &ctx->raymarch_pipeline));
+
+    vkDestroyShaderModule(ctx->device, frag_module, ctx->allocator);
+    vkDestroyShaderModule(ctx->device, vertex_module, ctx->allocator);
 }
 
 static void create_renderpass(VulkanContext* ctx)
 {
+    if (ctx->dynamic_rendering) {
+        return; // attachments are given when recording
+    }
+
     VkAttachmentDescription colorAttachment {};
     colorAttachment.format = ctx->sc_image_format;
     colorAttachment.samples = VK_SAMPLE_COUNT_1_BIT;
@@ -633,40 +1513,74 @@ static void create_renderpass(VulkanContext* ctx)
     colorAttachmentRef.attachment = 0;
     colorAttachmentRef.layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
 
+    VkAttachmentDescription depthAttachment {};
+    depthAttachment.format = ctx->depth_format;
+    depthAttachment.samples = VK_SAMPLE_COUNT_1_BIT;
+    depthAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+    depthAttachment.storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+    depthAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+    depthAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+    depthAttachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    depthAttachment.finalLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+
+    VkAttachmentReference depthAttachmentRef {};
+    depthAttachmentRef.attachment = 1;
+    depthAttachmentRef.layout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+
     VkSubpassDescription subpass {};
     subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
 
     subpass.colorAttachmentCount = 1;
     subpass.pColorAttachments = &colorAttachmentRef;
+    subpass.pDepthStencilAttachment = &depthAttachmentRef;
+
+    // The depth image is shared by every frame in flight, so the previous frame's depth writes
+    // have to finish before this frame clears it
+    VkSubpassDependency dependency {};
+    dependency.srcSubpass = VK_SUBPASS_EXTERNAL;
+    dependency.dstSubpass = 0;
+    dependency.srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+    dependency.srcAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+    dependency.dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT;
+    dependency.dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+
+    VkAttachmentDescription attachments[] = { colorAttachment, depthAttachment };
 
     VkRenderPassCreateInfo renderPassInfo {};
     renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
-    renderPassInfo.attachmentCount = 1;
-    renderPassInfo.pAttachments = &colorAttachment;
+    renderPassInfo.attachmentCount = 2;
+    renderPassInfo.pAttachments = attachments;
     renderPassInfo.subpassCount = 1;
     renderPassInfo.pSubpasses = &subpass;
+    renderPassInfo.dependencyCount = 1;
+    renderPassInfo.pDependencies = &dependency;
 
-    VK_CHECK_RESULT(vkCreateRenderPass(ctx->device, &renderPassInfo, nullptr, &ctx->render_pass));
+    VK_CHECK_RESULT(vkCreateRenderPass(ctx->device, &renderPassInfo, ctx->allocator, &ctx->render_pass));
 }
 
 static void create_framebuffers(VulkanContext* ctx)
 {
+    if (ctx->dynamic_rendering) {
+        return;
+    }
+
     ctx->sc_framebuffers.resize(ctx->sc_image_views.size());
     for (size_t i = 0; i < ctx->sc_image_views.size(); i++) {
         VkImageView attachments[] = {
-            ctx->sc_image_views[i]
+            ctx->sc_image_views[i],
+            ctx->depth_view
         };
 
         VkFramebufferCreateInfo framebufferInfo {};
         framebufferInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
         framebufferInfo.renderPass = ctx->render_pass;
-        framebufferInfo.attachmentCount = 1;
+        framebufferInfo.attachmentCount = 2;
         framebufferInfo.pAttachments = attachments;
         framebufferInfo.width = ctx->sc_extent.width;
         framebufferInfo.height = ctx->sc_extent.height;
         framebufferInfo.layers = 1;
 
-        VK_CHECK_RESULT(vkCreateFramebuffer(ctx->device, &framebufferInfo, nullptr, &ctx->sc_framebuffers[i]))
+        VK_CHECK_RESULT(vkCreateFramebuffer(ctx->device, &framebufferInfo, ctx->allocator, &ctx->sc_framebuffers[i]))
     }
 }
 static void create_command_pool(VulkanContext* ctx)
@@ -675,50 +1589,131 @@ static void create_command_pool(VulkanContext* ctx)
 
     VkCommandPoolCreateInfo poolInfo {};
     poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
-    poolInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+    poolInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
     poolInfo.queueFamilyIndex = queueFamilyIndices.graphics;
-    VK_CHECK_RESULT(vkCreateCommandPool(ctx->device, &poolInfo, nullptr, &ctx->cmd_pool));
+    VK_CHECK_RESULT(vkCreateCommandPool(ctx->device, &poolInfo, ctx->allocator, &ctx->cmd_pool));
+
+    // Buffers in the frame pools are only ever reset along with their pool
+    for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+        VK_CHECK_RESULT(vkCreateCommandPool(ctx->device, &poolInfo, ctx->allocator, &ctx->frame_pools[i]));
+        for (size_t b = 0; b < MAX_RECORD_BATCHES; b++) {
+            VK_CHECK_RESULT(vkCreateCommandPool(ctx->device, &poolInfo, ctx->allocator, &ctx->batch_pools[i][b]));
+        }
+    }
 }
 
 static void create_command_buffers(VulkanContext* ctx)
 {
     VkCommandBufferAllocateInfo allocInfo {};
     allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
-    allocInfo.commandPool = ctx->cmd_pool;
-    allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
-    allocInfo.commandBufferCount = MAX_FRAMES_IN_FLIGHT;
+    allocInfo.commandBufferCount = 1;
 
-    VK_CHECK_RESULT(vkAllocateCommandBuffers(ctx->device, &allocInfo, ctx->cmd_buffers))
+    for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+        allocInfo.commandPool = ctx->frame_pools[i];
+        allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+        VK_CHECK_RESULT(vkAllocateCommandBuffers(ctx->device, &allocInfo, &ctx->cmd_buffers[i]))
+
+        allocInfo.level = VK_COMMAND_BUFFER_LEVEL_SECONDARY;
+        for (size_t b = 0; b < MAX_RECORD_BATCHES; b++) {
+            allocInfo.commandPool = ctx->batch_pools[i][b];
+            VK_CHECK_RESULT(vkAllocateCommandBuffers(ctx->device, &allocInfo, &ctx->batch_buffers[i][b]))
+            VK_CHECK_RESULT(vkAllocateCommandBuffers(ctx->device, &allocInfo, &ctx->batch_depth_buffers[i][b]))
+        }
+    }
 }
 
-void record_command_buffer(VulkanContext* ctx, VkCommandBuffer cmd_buffer, uint32_t image_index)
+static uint8_t srgb_encode(uint8_t linear)
 {
-    VkCommandBufferBeginInfo beginInfo {};
-    beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-    beginInfo.flags = 0;
-    beginInfo.pInheritanceInfo = nullptr;
-    VK_CHECK_RESULT(vkBeginCommandBuffer(cmd_buffer, &beginInfo));
+    static uint8_t table[256];
+    static bool ready = false;
+    if (!ready) {
+        for (uint32_t i = 0; i < 256; i++) {
+            float l = (float)i / 255.0f;
+            float e = l <= 0.0031308f ? l * 12.92f : 1.055f * powf(l, 1.0f / 2.4f) - 0.055f;
+            table[i] = (uint8_t)(e * 255.0f + 0.5f);
+        }
+        ready = true;
+    }
+    return table[linear];
+}
 
-    VkRenderPassBeginInfo renderPassInfo {};
-    renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
-    renderPassInfo.renderPass = ctx->render_pass;
-    renderPassInfo.framebuffer = ctx->sc_framebuffers[image_index];
+// Window::display hook. Scales the image to the swapchain and converts it to its format, the
+// copy gets recorded with the next frame. Call after begin_frame.
+static bool display_pixels(void* user, const unsigned char* bytes, int width, int height)
+{
+    VulkanContext* ctx = (VulkanContext*)user;
+    if (!ctx->sc_transfer_dst || width <= 0 || height <= 0) {
+        return false;
+    }
 
-    renderPassInfo.renderArea.offset = { 0, 0 };
-    renderPassInfo.renderArea.extent = ctx->sc_extent;
+    VkExtent2D extent = ctx->sc_extent;
+    VkDeviceSize size = (VkDeviceSize)extent.width * extent.height * 4;
+    GpuBuffer* staging = &ctx->pixel_staging[ctx->current_frame];
+    if (staging->size < size) {
+        destroy_gpu_buffer(ctx, staging);
+        if (!create_gpu_buffer(ctx, size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+                VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, MEM_STAGING, staging)) {
+            return false;
+        }
+    }
 
-    VkClearValue clearColor = { { { 0.0f, 0.0f, 0.0f, 1.0f } } };
-    renderPassInfo.clearValueCount = 1;
-    renderPassInfo.pClearValues = &clearColor;
+    bool bgra = ctx->sc_image_format == VK_FORMAT_B8G8R8A8_SRGB || ctx->sc_image_format == VK_FORMAT_B8G8R8A8_UNORM;
+    bool srgb = ctx->sc_image_format == VK_FORMAT_B8G8R8A8_SRGB || ctx->sc_image_format == VK_FORMAT_R8G8B8A8_SRGB;
+    uint8_t* dst = (uint8_t*)staging->mapped;
+    for (uint32_t y = 0; y < extent.height; y++) {
+        const uint8_t* row = bytes + (size_t)(y * height / extent.height) * width * 4;
+        for (uint32_t x = 0; x < extent.width; x++) {
+            const uint8_t* src = row + (size_t)(x * width / extent.width) * 4;
+            uint8_t r = srgb ? srgb_encode(src[0]) : src[0];
+            uint8_t g = srgb ? srgb_encode(src[1]) : src[1];
+            uint8_t b = srgb ? srgb_encode(src[2]) : src[2];
+            dst[0] = bgra ? b : r;
+            dst[1] = g;
+            dst[2] = bgra ? r : b;
+            dst[3] = src[3];
+            dst += 4;
+        }
+    }
+
+    ctx->pixels_extent = extent;
+    ctx->pixels_pending = true;
+    return true;
+}
 
-    vkCmdBeginRenderPass(cmd_buffer, &renderPassInfo, VK_SUBPASS_CONTENTS_INLINE);
-    vkCmdBindPipeline(cmd_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, ctx->graphics_pipeline);
+static void record_pixel_copy(VulkanContext* ctx, VkCommandBuffer cmd_buffer, uint32_t image_index)
+{
+    VkImageMemoryBarrier barrier {};
+    barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+    barrier.srcAccessMask = 0;
+    barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.image = ctx->sc_images[image_index];
+    barrier.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 };
+    // Chains with the acquire semaphore wait, which is at the color output stage
+    vkCmdPipelineBarrier(cmd_buffer, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+
+    VkBufferImageCopy region {};
+    region.imageSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1 };
+    region.imageExtent = { ctx->pixels_extent.width, ctx->pixels_extent.height, 1 };
+    vkCmdCopyBufferToImage(cmd_buffer, ctx->pixel_staging[ctx->current_frame].buffer, barrier.image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region);
+
+    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.dstAccessMask = 0;
+    barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+    barrier.newLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+    vkCmdPipelineBarrier(cmd_buffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+}
 
+static void set_viewport(VulkanContext* ctx, VkCommandBuffer cmd_buffer)
+{
     VkViewport viewport {};
     viewport.x = 0.0f;
     viewport.y = 0.0f;
     viewport.width = (float)ctx->sc_extent.width;
-    viewport.height = (float)ctx->sc_extent.width;
+    viewport.height = (float)ctx->sc_extent.height;
     viewport.minDepth = 0.0f;
     viewport.maxDepth = 1.0f;
     vkCmdSetViewport(cmd_buffer, 0, 1, &viewport);
@@ -727,10 +1722,263 @@ void record_command_buffer(VulkanContext* ctx, VkCommandBuffer cmd_buffer, uint3
     scissor.offset = { 0, 0 };
     scissor.extent = ctx->sc_extent;
     vkCmdSetScissor(cmd_buffer, 0, 1, &scissor);
+}
 
-    vkCmdDraw(cmd_buffer, 3, 1, 0, 0);
+static void record_chunk_draws(VulkanContext* ctx, VkCommandBuffer cmd_buffer, VkPipeline pipeline, const DrawList* draw_list, uint32_t first, uint32_t count)
+{
+    vkCmdBindPipeline(cmd_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline);
+    vkCmdPushConstants(cmd_buffer, ctx->pipeline_layout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(Mat4), &draw_list->view_proj);
+    vkCmdBindIndexBuffer(cmd_buffer, ctx->quad_indices.buffer, 0, VK_INDEX_TYPE_UINT32);
+    VkDescriptorSet sets[2] = { draw_list->textures, ctx->frame_sets[ctx->current_frame] };
+    vkCmdBindDescriptorSets(cmd_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, ctx->pipeline_layout, 0, 2, sets, 0, nullptr);
+    for (uint32_t i = first; i < first + count; i++) {
+        const ChunkDraw* draw = &draw_list->draws[i];
+        VkDeviceSize offset = 0;
+        vkCmdBindVertexBuffers(cmd_buffer, 0, 1, &draw->vertex_buffer, &offset);
+        // The instance index picks the draw's origin out of the ring
+        vkCmdDrawIndexed(cmd_buffer, draw->num_quads * 6, 1, 0, draw->first_quad * 4, draw_list->first_origin + i);
+    }
+}
+
+// One batch per thread at most, and only once there are enough draws to pay for the secondary buffers
+static uint32_t record_batch_count(VulkanContext* ctx, uint32_t num_draws)
+{
+    if (!ctx->jobs) {
+        return 1;
+    }
+    uint32_t batches = num_draws / RECORD_MIN_DRAWS;
+    batches = std::min(batches, ctx->jobs->num_workers + 1);
+    return std::min(batches, (uint32_t)MAX_RECORD_BATCHES);
+}
+
+static void begin_secondary(VulkanContext* ctx, VkCommandBuffer cmd_buffer, uint32_t image_index)
+{
+    VkCommandBufferInheritanceRenderingInfo renderingInfo {};
+    renderingInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_RENDERING_INFO;
+    renderingInfo.colorAttachmentCount = 1;
+    renderingInfo.pColorAttachmentFormats = &ctx->sc_image_format;
+    renderingInfo.depthAttachmentFormat = ctx->depth_format;
+    renderingInfo.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
+
+    VkCommandBufferInheritanceInfo inheritanceInfo {};
+    inheritanceInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO;
+    if (ctx->dynamic_rendering) {
+        inheritanceInfo.pNext = &renderingInfo;
+    } else {
+        inheritanceInfo.renderPass = ctx->render_pass;
+        inheritanceInfo.subpass = 0;
+        inheritanceInfo.framebuffer = ctx->sc_framebuffers[image_index];
+    }
+
+    VkCommandBufferBeginInfo beginInfo {};
+    beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT | VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT;
+    beginInfo.pInheritanceInfo = &inheritanceInfo;
+    VK_CHECK_RESULT(vkBeginCommandBuffer(cmd_buffer, &beginInfo));
+
+    // Secondary buffers inherit none of the primary's state
+    set_viewport(ctx, cmd_buffer);
+}
 
-    vkCmdEndRenderPass(cmd_buffer);
+static void record_batch_job(void* data)
+{
+    TRACE_SCOPE("record chunk batch");
+    RecordBatch* batch = (RecordBatch*)data;
+    VulkanContext* ctx = batch->ctx;
+
+    if (batch->depth_buffer) {
+        begin_secondary(ctx, batch->depth_buffer, batch->image_index);
+        record_chunk_draws(ctx, batch->depth_buffer, ctx->depth_pipeline, batch->draw_list, batch->first_draw, batch->num_draws);
+        VK_CHECK_RESULT(vkEndCommandBuffer(batch->depth_buffer));
+    }
+
+    begin_secondary(ctx, batch->cmd_buffer, batch->image_index);
+    VkPipeline pipeline = batch->depth_buffer ? ctx->equal_pipeline : ctx->graphics_pipeline;
+    record_chunk_draws(ctx, batch->cmd_buffer, pipeline, batch->draw_list, batch->first_draw, batch->num_draws);
+    VK_CHECK_RESULT(vkEndCommandBuffer(batch->cmd_buffer));
+}
+
+// Splits the chunk draws into even batches, records them in the job system's urgent lane (the
+// calling thread takes some too, and nothing else) and executes them in draw list order. With the pre-pass every batch's depth
+// buffer goes first, so the whole depth buffer is done before anything is shaded.
+static void record_parallel(VulkanContext* ctx, VkCommandBuffer cmd_buffer, uint32_t image_index, const DrawList* draw_list, uint32_t batches)
+{
+    uint32_t per_batch = (draw_list->num_draws + batches - 1) / batches;
+    VkCommandBuffer depth_buffers[MAX_RECORD_BATCHES];
+    VkCommandBuffer color_buffers[MAX_RECORD_BATCHES];
+    uint32_t count = 0;
+    for (uint32_t b = 0; b < batches && b * per_batch < draw_list->num_draws; b++) {
+        RecordBatch* batch = &ctx->record_batches[b];
+        batch->ctx = ctx;
+        batch->cmd_buffer = ctx->batch_buffers[ctx->current_frame][b];
+        batch->depth_buffer = ctx->depth_prepass ? ctx->batch_depth_buffers[ctx->current_frame][b] : VK_NULL_HANDLE;
+        batch->draw_list = draw_list;
+        batch->first_draw = b * per_batch;
+        batch->num_draws = std::min(per_batch, draw_list->num_draws - batch->first_draw);
+        batch->image_index = image_index;
+        depth_buffers[count] = batch->depth_buffer;
+        color_buffers[count] = batch->cmd_buffer;
+        count++;
+        job_submit_urgent(ctx->jobs, record_batch_job, batch, &ctx->record_counter);
+    }
+    job_wait_urgent(ctx->jobs, &ctx->record_counter);
+    if (ctx->depth_prepass) {
+        vkCmdExecuteCommands(cmd_buffer, count, depth_buffers);
+    }
+    vkCmdExecuteCommands(cmd_buffer, count, color_buffers);
+}
+
+// Clears the swapchain image and depth, secondaries = the draws come in secondary command buffers
+static void begin_rendering(VulkanContext* ctx, VkCommandBuffer cmd_buffer, uint32_t image_index, bool secondaries)
+{
+    VkClearValue clearValues[2] {};
+    clearValues[0].color = { { 0.53f, 0.72f, 0.92f, 1.0f } };
+    clearValues[1].depthStencil = { 1.0f, 0 };
+
+    if (!ctx->dynamic_rendering) {
+        VkRenderPassBeginInfo renderPassInfo {};
+        renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+        renderPassInfo.renderPass = ctx->render_pass;
+        renderPassInfo.framebuffer = ctx->sc_framebuffers[image_index];
+        renderPassInfo.renderArea.offset = { 0, 0 };
+        renderPassInfo.renderArea.extent = ctx->sc_extent;
+        renderPassInfo.clearValueCount = 2;
+        renderPassInfo.pClearValues = clearValues;
+        vkCmdBeginRenderPass(cmd_buffer, &renderPassInfo, secondaries ? VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS : VK_SUBPASS_CONTENTS_INLINE);
+        return;
+    }
+
+    // What the render pass' layout transitions and external dependency did. The color barrier
+    // chains with the acquire semaphore wait, the depth image is shared by every frame in flight
+    // so the previous frame's depth writes have to finish before it gets cleared.
+    VkImageMemoryBarrier barriers[2] {};
+    barriers[0].sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+    barriers[0].srcAccessMask = 0;
+    barriers[0].dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+    barriers[0].oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    barriers[0].newLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+    barriers[0].srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barriers[0].dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barriers[0].image = ctx->sc_images[image_index];
+    barriers[0].subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 };
+    barriers[1] = barriers[0];
+    barriers[1].srcAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+    barriers[1].dstAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+    barriers[1].newLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+    barriers[1].image = ctx->depth_image;
+    barriers[1].subresourceRange = { VK_IMAGE_ASPECT_DEPTH_BIT, 0, 1, 0, 1 };
+    vkCmdPipelineBarrier(cmd_buffer, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT,
+        VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT, 0, 0, nullptr, 0, nullptr, 2, barriers);
+
+    VkRenderingAttachmentInfo colorAttachment {};
+    colorAttachment.sType = VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO;
+    colorAttachment.imageView = ctx->sc_image_views[image_index];
+    colorAttachment.imageLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+    colorAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+    colorAttachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+    colorAttachment.clearValue = clearValues[0];
+
+    VkRenderingAttachmentInfo depthAttachment {};
+    depthAttachment.sType = VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO;
+    depthAttachment.imageView = ctx->depth_view;
+    depthAttachment.imageLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+    depthAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+    depthAttachment.storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+    depthAttachment.clearValue = clearValues[1];
+
+    VkRenderingInfo renderingInfo {};
+    renderingInfo.sType = VK_STRUCTURE_TYPE_RENDERING_INFO;
+    renderingInfo.flags = secondaries ? VK_RENDERING_CONTENTS_SECONDARY_COMMAND_BUFFERS_BIT : 0;
+    renderingInfo.renderArea.offset = { 0, 0 };
+    renderingInfo.renderArea.extent = ctx->sc_extent;
+    renderingInfo.layerCount = 1;
+    renderingInfo.colorAttachmentCount = 1;
+    renderingInfo.pColorAttachments = &colorAttachment;
+    renderingInfo.pDepthAttachment = &depthAttachment;
+    vkCmdBeginRendering(cmd_buffer, &renderingInfo);
+}
+
+static void end_rendering(VulkanContext* ctx, VkCommandBuffer cmd_buffer, uint32_t image_index)
+{
+    if (!ctx->dynamic_rendering) {
+        vkCmdEndRenderPass(cmd_buffer);
+        return;
+    }
+    vkCmdEndRendering(cmd_buffer);
+
+    VkImageMemoryBarrier barrier {};
+    barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+    barrier.srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+    barrier.dstAccessMask = 0;
+    barrier.oldLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+    barrier.newLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.image = ctx->sc_images[image_index];
+    barrier.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 };
+    vkCmdPipelineBarrier(cmd_buffer, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+}
+
+void record_command_buffer(VulkanContext* ctx, VkCommandBuffer cmd_buffer, uint32_t image_index, const DrawList* draw_list)
+{
+    TRACE_SCOPE("record_command_buffer");
+    VkCommandBufferBeginInfo beginInfo {};
+    beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+    beginInfo.pInheritanceInfo = nullptr;
+    VK_CHECK_RESULT(vkBeginCommandBuffer(cmd_buffer, &beginInfo));
+
+    ctx->timestamp_passes[ctx->current_frame] = 0;
+    if (timing(ctx)) {
+        vkCmdResetQueryPool(cmd_buffer, ctx->timestamp_pools[ctx->current_frame], 0, GPU_PASS_COUNT * 2);
+        ctx->timestamp_frames[ctx->current_frame] = ctx->profiler->frame;
+    }
+
+    if (ctx->num_uploads > 0 || ctx->num_image_uploads > 0) {
+        write_timestamp(ctx, cmd_buffer, GPU_PASS_UPLOADS, false);
+        record_uploads(ctx, cmd_buffer);
+        write_timestamp(ctx, cmd_buffer, GPU_PASS_UPLOADS, true);
+    } else {
+        record_uploads(ctx, cmd_buffer);
+    }
+
+    // A displayed image replaces the frame, unless the swapchain changed size since it was scaled
+    bool pixels = ctx->pixels_pending && ctx->pixels_extent.width == ctx->sc_extent.width && ctx->pixels_extent.height == ctx->sc_extent.height;
+    ctx->pixels_pending = false;
+    if (pixels) {
+        write_timestamp(ctx, cmd_buffer, GPU_PASS_PIXELS, false);
+        record_pixel_copy(ctx, cmd_buffer, image_index);
+        write_timestamp(ctx, cmd_buffer, GPU_PASS_PIXELS, true);
+        VK_CHECK_RESULT(vkEndCommandBuffer(cmd_buffer));
+        return;
+    }
+
+    GpuPass pass = draw_list->raymarch ? GPU_PASS_RAYMARCH : GPU_PASS_CHUNKS;
+    uint32_t batches = draw_list->raymarch ? 1 : record_batch_count(ctx, draw_list->num_draws);
+    write_timestamp(ctx, cmd_buffer, pass, false);
+    begin_rendering(ctx, cmd_buffer, image_index, batches > 1);
+
+    if (batches > 1) {
+        record_parallel(ctx, cmd_buffer, image_index, draw_list, batches);
+    } else if (draw_list->raymarch) {
+        const RaymarchDraw* raymarch = draw_list->raymarch;
+        set_viewport(ctx, cmd_buffer);
+        vkCmdBindPipeline(cmd_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, ctx->raymarch_pipeline);
+        vkCmdBindDescriptorSets(cmd_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, ctx->raymarch_pipeline_layout, 0, 1, &raymarch->descriptor_set, 0, nullptr);
+        vkCmdPushConstants(cmd_buffer, ctx->raymarch_pipeline_layout, VK_SHADER_STAGE_FRAGMENT_BIT, 0, sizeof(RaymarchParams), &raymarch->params);
+        vkCmdDraw(cmd_buffer, 3, 1, 0, 0);
+    } else {
+        set_viewport(ctx, cmd_buffer);
+        if (ctx->depth_prepass) {
+            record_chunk_draws(ctx, cmd_buffer, ctx->depth_pipeline, draw_list, 0, draw_list->num_draws);
+            record_chunk_draws(ctx, cmd_buffer, ctx->equal_pipeline, draw_list, 0, draw_list->num_draws);
+        } else {
+            record_chunk_draws(ctx, cmd_buffer, ctx->graphics_pipeline, draw_list, 0, draw_list->num_draws);
+        }
+    }
+
+    end_rendering(ctx, cmd_buffer, image_index);
+    write_timestamp(ctx, cmd_buffer, pass, true);
 
     VK_CHECK_RESULT(vkEndCommandBuffer(cmd_buffer));
 }
@@ -746,22 +1994,27 @@ static void create_sync_objects(VulkanContext* ctx)
 
     for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
 
-        VK_CHECK_RESULT(vkCreateSemaphore(ctx->device, &semaphoreInfo, nullptr, &ctx->image_available_semaphores[i]))
-        VK_CHECK_RESULT(vkCreateSemaphore(ctx->device, &semaphoreInfo, nullptr, &ctx->render_finished_semaphores[i]))
-        VK_CHECK_RESULT(vkCreateFence(ctx->device, &fenceInfo, nullptr, &ctx->in_flight_fences[i]))
+        VK_CHECK_RESULT(vkCreateSemaphore(ctx->device, &semaphoreInfo, ctx->allocator, &ctx->image_available_semaphores[i]))
+        VK_CHECK_RESULT(vkCreateSemaphore(ctx->device, &semaphoreInfo, ctx->allocator, &ctx->render_finished_semaphores[i]))
+        VK_CHECK_RESULT(vkCreateFence(ctx->device, &fenceInfo, ctx->allocator, &ctx->in_flight_fences[i]))
     }
 }
 
 static void cleanup_swapchain(VulkanContext* ctx)
 {
+    vkDestroyImageView(ctx->device, ctx->depth_view, ctx->allocator);
+    vkDestroyImage(ctx->device, ctx->depth_image, ctx->allocator);
+    vkFreeMemory(ctx->device, ctx->depth_memory, ctx->allocator);
+    memory_gpu_track(MEM_FRAME, ctx->depth_heap, -(int64_t)ctx->depth_size);
+
     for (size_t i = 0; i < ctx->sc_framebuffers.size(); i++) {
-        vkDestroyFramebuffer(ctx->device, ctx->sc_framebuffers[i], nullptr);
+        vkDestroyFramebuffer(ctx->device, ctx->sc_framebuffers[i], ctx->allocator);
     }
 
     for (size_t i = 0; i < ctx->sc_image_views.size(); i++) {
-        vkDestroyImageView(ctx->device, ctx->sc_image_views[i], nullptr);
+        vkDestroyImageView(ctx->device, ctx->sc_image_views[i], ctx->allocator);
     }
-    vkDestroySwapchainKHR(ctx->device, ctx->swapchain, nullptr);
+    vkDestroySwapchainKHR(ctx->device, ctx->swapchain, ctx->allocator);
 }
 
 void recreate_swapchain(Arena* arr, VulkanContext* ctx, Window* window)
@@ -780,6 +2033,7 @@ void recreate_swapchain(Arena* arr, VulkanContext* ctx, Window* window)
 
     create_swapchain(arr, ctx, window);
     create_image_views(ctx);
+    create_depth_resources(ctx);
     create_framebuffers(ctx);
 }
 
@@ -787,20 +2041,34 @@ void init_vulkan(Arena* arr, VulkanContext* ctx, Window* window)
 {
 
     glfwSetWindowUserPointer(window->window, ctx);
+    window->display_user = ctx;
+    window->display = display_pixels;
 
+    ctx->host_allocator = HostAllocator::Create(arr);
+    ctx->allocator = &ctx->host_allocator->callbacks;
     create_instance(arr, ctx);
     setup_debug_messenger(ctx);
     create_surface(ctx, window);
     pick_physical_device(ctx);
     create_logical_device(ctx);
+    query_memory_budget(ctx);
     create_swapchain(arr, ctx, window);
     create_image_views(ctx);
+    ctx->depth_format = find_depth_format(ctx);
+    create_depth_resources(ctx);
     create_renderpass(ctx);
     create_graphics_pipeline(arr, ctx);
+    ctx->depth_prepass = true;
+    create_raymarch_pipeline(arr, ctx);
     create_framebuffers(ctx);
     create_command_pool(ctx);
     create_command_buffers(ctx);
     create_sync_objects(ctx);
+    create_upload_resources(ctx);
+    create_frame_rings(ctx);
+    create_deletion_queues(ctx);
+    create_quad_indices(ctx);
+    create_timestamp_pools(ctx);
 }
 
 void cleanup_vulkan(VulkanContext* ctx, Window* window)
@@ -809,23 +2077,56 @@ void cleanup_vulkan(VulkanContext* ctx, Window* window)
 
     for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
 
-        vkDestroySemaphore(ctx->device, ctx->image_available_semaphores[i], nullptr);
-        vkDestroySemaphore(ctx->device, ctx->render_finished_semaphores[i], nullptr);
-        vkDestroyFence(ctx->device, ctx->in_flight_fences[i], nullptr);
+        vkDestroySemaphore(ctx->device, ctx->image_available_semaphores[i], ctx->allocator);
+        vkDestroySemaphore(ctx->device, ctx->render_finished_semaphores[i], ctx->allocator);
+        vkDestroyFence(ctx->device, ctx->in_flight_fences[i], ctx->allocator);
+    }
+    vkDestroyCommandPool(ctx->device, ctx->cmd_pool, ctx->allocator);
+    for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+        vkDestroyCommandPool(ctx->device, ctx->frame_pools[i], ctx->allocator);
+        for (size_t b = 0; b < MAX_RECORD_BATCHES; b++) {
+            vkDestroyCommandPool(ctx->device, ctx->batch_pools[i][b], ctx->allocator);
+        }
+    }
+    if (ctx->timestamps) {
+        for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+            vkDestroyQueryPool(ctx->device, ctx->timestamp_pools[i], ctx->allocator);
+        }
     }
-    vkDestroyCommandPool(ctx->device, ctx->cmd_pool, nullptr);
 
-    vkDestroyPipeline(ctx->device, ctx->graphics_pipeline, nullptr);
+    // Everything retired since the last frames in flight finished, the caller waited for idle
+    for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+        flush_deletions(ctx, i);
+        arena_free(ctx->deletions[i].arena);
+    }
 
-    vkDestroyPipelineLayout(ctx->device, ctx->pipeline_layout, nullptr);
-    vkDestroyRenderPass(ctx->device, ctx->render_pass, nullptr);
+    destroy_gpu_buffer(ctx, &ctx->quad_indices);
+    for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+        destroy_gpu_buffer(ctx, &ctx->staging[i]);
+        destroy_gpu_buffer(ctx, &ctx->frame_rings[i]);
+        destroy_gpu_buffer(ctx, &ctx->pixel_staging[i]);
+    }
 
-    vkDestroySurfaceKHR(ctx->instance, ctx->surface, nullptr);
-    vkDestroyDevice(ctx->device, nullptr);
+    vkDestroyPipeline(ctx->device, ctx->graphics_pipeline, ctx->allocator);
+    vkDestroyPipeline(ctx->device, ctx->equal_pipeline, ctx->allocator);
+    vkDestroyPipeline(ctx->device, ctx->depth_pipeline, ctx->allocator);
+    vkDestroyPipeline(ctx->device, ctx->raymarch_pipeline, ctx->allocator);
+    vkDestroyPipelineLayout(ctx->device, ctx->raymarch_pipeline_layout, ctx->allocator);
+    vkDestroyDescriptorSetLayout(ctx->device, ctx->raymarch_set_layout, ctx->allocator);
+
+    vkDestroyPipelineLayout(ctx->device, ctx->pipeline_layout, ctx->allocator);
+    vkDestroyDescriptorSetLayout(ctx->device, ctx->texture_set_layout, ctx->allocator);
+    vkDestroyDescriptorSetLayout(ctx->device, ctx->frame_set_layout, ctx->allocator);
+    vkDestroyDescriptorPool(ctx->device, ctx->frame_descriptor_pool, ctx->allocator);
+    vkDestroyRenderPass(ctx->device, ctx->render_pass, ctx->allocator);
+
+    vkDestroySurfaceKHR(ctx->instance, ctx->surface, ctx->allocator);
+    vkDestroyDevice(ctx->device, ctx->allocator);
     if (enableValidationLayers) {
-        DestroyDebugUtilsMessengerEXT(ctx->instance, ctx->debug_messenger, nullptr);
+        DestroyDebugUtilsMessengerEXT(ctx->instance, ctx->debug_messenger, ctx->allocator);
     }
-    vkDestroyInstance(ctx->instance, nullptr);
+    vkDestroyInstance(ctx->instance, ctx->allocator);
+    host_allocator_destroy(ctx->host_allocator);
 
     ctx->sc_images.clear(); // explicitely free the memory, since the vector destructor will not be called
     ctx->sc_image_views.clear();
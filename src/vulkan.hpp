@@ -2,6 +2,11 @@
 #define VULKAN_HPP_
 
 #include "Arena.h"
+#include "host_allocator.hpp"
+#include "math.hpp"
+#include "memory.hpp"
+#include "jobs.hpp"
+#include "profiler.hpp"
 #include "window.hpp"
 #include <cassert>
 #include <cstdint>
@@ -26,22 +31,180 @@ const int MAX_FRAMES_IN_FLIGHT = 2; // Should be configurable
         }                                                                                                                                  \
     }
 
+#define UPLOAD_STAGING_BYTES (16 * 1024 * 1024) // per frame in flight
+#define MAX_UPLOAD_COPIES 4096
+#define MAX_IMAGE_UPLOADS 256
+#define FRAME_RING_BYTES (1024 * 1024) // per frame in flight, draw data written fresh every frame
+#define DELETION_ARENA_BYTES (64 * 1024) // per frame in flight, grows when a frame retires more
+#define MEMORY_BUDGET_INTERVAL 30 // frames between VK_EXT_memory_budget queries
+#define MAX_RECORD_BATCHES 16 // secondary command buffers the chunk draws can be split into
+#define RECORD_MIN_DRAWS 256 // per batch, fewer draws than that are recorded inline
+
+struct GpuBuffer {
+    VkBuffer buffer;
+    VkDeviceMemory memory;
+    VkDeviceSize size;
+    void* mapped; // only for host visible buffers
+    VkDeviceSize allocation_size; // what counts towards the tag and heap
+    MemTag tag;
+    uint32_t heap;
+};
+
+struct GpuImage {
+    VkImage image;
+    VkDeviceMemory memory;
+    VkImageView view;
+    VkDeviceSize allocation_size;
+    MemTag tag;
+    uint32_t heap;
+};
+
+// Resources retired during a frame, freed once the GPU is past it
+enum DeletionKind : uint8_t {
+    DELETE_BUFFER,
+    DELETE_IMAGE,
+};
+
+struct Deletion {
+    DeletionKind kind;
+    GpuBuffer buffer;
+    GpuImage image;
+    Deletion* next;
+};
+
+struct DeletionQueue {
+    Arena* arena; // the entries, reset in one go once they're freed
+    Deletion* first;
+    uint32_t count;
+};
+
+struct BufferUpload {
+    VkBuffer dst;
+    VkBufferCopy region;
+};
+
+#define IMAGE_UPLOAD_FIRST 1 // moves the whole image to TRANSFER_DST_OPTIMAL first, discarding its contents
+#define IMAGE_UPLOAD_LAST 2 // moves the whole image to SHADER_READ_ONLY_OPTIMAL after
+
+struct ImageUpload {
+    VkImage dst;
+    VkBufferImageCopy region;
+    VkImageSubresourceRange range; // the whole image, for the layout transitions
+    uint32_t flags;
+};
+
+struct ChunkDraw {
+    VkBuffer vertex_buffer;
+    uint32_t first_quad;
+    uint32_t num_quads;
+};
+
+// Push constants of raymarch.frag
+struct RaymarchParams {
+    float position[4]; // camera
+    float forward[4];
+    float right[4]; // scaled to the edge of the screen
+    float up[4];
+    int32_t origin[4]; // chunk at the min corner of the brick map window
+};
+
+struct RaymarchDraw {
+    VkDescriptorSet descriptor_set; // the brick map buffers
+    RaymarchParams params;
+};
+
+struct DrawList {
+    Mat4 view_proj;
+    const ChunkDraw* draws;
+    uint32_t num_draws;
+    uint32_t first_origin; // vec4 index into this frame's ring, the chunk origin of every draw in order
+
+    VkDescriptorSet textures; // block texture array, bound once for all the chunk draws
+    const RaymarchDraw* raymarch; // when set, replaces the chunk draws
+};
+
 struct VulkanContext;
 
+// A slice of the chunk draws, recorded into a secondary command buffer on the job system
+struct RecordBatch {
+    VulkanContext* ctx;
+    VkCommandBuffer cmd_buffer;
+    VkCommandBuffer depth_buffer; // pre-pass of the same draws, null without one
+    const DrawList* draw_list;
+    uint32_t first_draw;
+    uint32_t num_draws;
+    uint32_t image_index;
+};
+
 void init_vulkan(Arena* arr, VulkanContext* ctx, Window* window);
 void cleanup_vulkan(VulkanContext* ctx, Window* window);
 
-void record_command_buffer(VulkanContext* ctx, VkCommandBuffer cmd_buffer, uint32_t image_index);
+// Waits until the current frame's resources are free again and resets its command pools, call
+// before touching anything per frame
+void begin_frame(VulkanContext* ctx);
+// Blocks until every submitted frame has finished
+void wait_frames_in_flight(VulkanContext* ctx);
+
+// Large draw lists are split into batches recorded in parallel on ctx->jobs, blocks until they're done
+void record_command_buffer(VulkanContext* ctx, VkCommandBuffer cmd_buffer, uint32_t image_index, const DrawList* draw_list);
 void recreate_swapchain(Arena* arr, VulkanContext* ctx, Window* window);
 
+// Lines the GPU timestamp clock up with trace_now, so GPU passes land on the trace timeline.
+// Waits for the queue to idle, done once at init and again whenever a trace starts.
+void calibrate_gpu_clock(VulkanContext* ctx);
+
+// Refreshes the heap budgets memory tracking allocates against, begin_frame does it every
+// MEMORY_BUDGET_INTERVAL frames
+void query_memory_budget(VulkanContext* ctx);
+
+uint32_t find_memory_type(VulkanContext* ctx, uint32_t type_bits, VkMemoryPropertyFlags properties);
+// False if the tag's budget or the heap can't take it (see memory.hpp) or the allocation fails
+bool create_gpu_buffer(VulkanContext* ctx, VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties, MemTag tag, GpuBuffer* out);
+void destroy_gpu_buffer(VulkanContext* ctx, GpuBuffer* buffer);
+void destroy_gpu_image(VulkanContext* ctx, GpuImage* image);
+
+// Frees the resource once every frame recorded so far has finished on the GPU: the frame's
+// fence is waited on by begin_frame MAX_FRAMES_IN_FLIGHT frames later anyway, so retiring never
+// stalls. Uploads into it that weren't recorded yet are dropped, and its memory stops counting
+// towards its tag and heap right away so streaming doesn't evict twice for it. Clears *buffer.
+void defer_destroy_buffer(VulkanContext* ctx, GpuBuffer* buffer);
+void defer_destroy_image(VulkanContext* ctx, GpuImage* image);
+
+// Copies data into this frame's staging buffer, the copy into dst is recorded at the start of the
+// next frame. Returns false when the staging buffer is full, try again next frame.
+bool upload_buffer(VulkanContext* ctx, VkBuffer dst, VkDeviceSize dst_offset, const void* data, VkDeviceSize size);
+// True if upload_buffer would take num_copies copies totalling size bytes this frame
+bool upload_fits(VulkanContext* ctx, VkDeviceSize size, uint32_t num_copies);
+// Drops copies into dst that haven't been recorded yet, for buffers that get destroyed
+void cancel_uploads(VulkanContext* ctx, VkBuffer dst);
+// Bump allocates 16 byte aligned from this frame's ring, which the chunk shaders see as a storage
+// buffer at set 1. Written by the CPU and read by the GPU in place, nothing is copied. Valid until
+// begin_frame comes back around to this frame, null when the ring is full.
+void* frame_ring_allocate(VulkanContext* ctx, VkDeviceSize size, VkDeviceSize* offset);
+// Same as upload_buffer for a region of an image, bufferOffset is filled in. Images are only
+// sampled once complete: the first upload into one carries IMAGE_UPLOAD_FIRST, the last
+// IMAGE_UPLOAD_LAST, and nothing may read it in between.
+bool upload_image(VulkanContext* ctx, VkImage dst, const VkBufferImageCopy& region, const VkImageSubresourceRange& range, uint32_t flags,
+    const void* data, VkDeviceSize size);
+void cancel_image_uploads(VulkanContext* ctx, VkImage dst);
+
 struct VulkanContext {
 
+    // Every create and destroy call passes allocator, so the driver's host memory is tracked
+    // and pooled, see host_allocator.hpp
+    HostAllocator* host_allocator;
+    const VkAllocationCallbacks* allocator;
+
     VkInstance instance;
     VkDebugUtilsMessengerEXT debug_messenger;
 
     VkPhysicalDevice physical_device = VK_NULL_HANDLE;
     VkDevice device;
 
+    VkPhysicalDeviceMemoryProperties memory_properties;
+    bool memory_budget; // VK_EXT_memory_budget enabled
+    uint32_t memory_budget_frames; // since the last query
+
     VkQueue graphics_queue;
     VkQueue present_queue;
 
@@ -49,20 +212,54 @@ struct VulkanContext {
 
     VkSwapchainKHR swapchain;
 
+    VkDescriptorSetLayout texture_set_layout; // set 0 of the chunk pipelines, see texture_array.hpp
+    VkDescriptorSetLayout frame_set_layout; // set 1, the frame ring
     VkPipelineLayout pipeline_layout;
-    VkRenderPass render_pass;
+    // Vulkan 1.3 devices render without render pass and framebuffer objects, attachments are
+    // given at record time and swapchain recreation only rebuilds the images and views
+    bool dynamic_rendering;
+    VkRenderPass render_pass; // fallback, null with dynamic rendering
+
+    VkPipeline graphics_pipeline; // chunk meshes, depth tested and written
+    // Depth pre-pass: depth_pipeline lays down depth from positions only, then equal_pipeline
+    // shades the fragments that ended up in front
+    bool depth_prepass;
+    VkPipeline depth_pipeline;
+    VkPipeline equal_pipeline;
+
+    VkDescriptorSetLayout raymarch_set_layout;
+    VkPipelineLayout raymarch_pipeline_layout;
+    VkPipeline raymarch_pipeline;
 
-    VkPipeline graphics_pipeline;
+    VkFormat depth_format;
+    VkImage depth_image;
+    VkDeviceMemory depth_memory;
+    VkDeviceSize depth_size;
+    uint32_t depth_heap;
+    VkImageView depth_view;
 
     std::vector<VkImage> sc_images; // using vector for easier swapchain recreation (Should be fine as it shouldn't be recreated much)
     std::vector<VkImageView> sc_image_views;
-    std::vector<VkFramebuffer> sc_framebuffers;
+    std::vector<VkFramebuffer> sc_framebuffers; // empty with dynamic rendering
 
     VkFormat sc_image_format;
     VkExtent2D sc_extent;
 
-    VkCommandPool cmd_pool;
+    VkCommandPool cmd_pool; // one off work outside the frame, like clock calibration
+
+    // Every frame in flight has its own pools, reset wholesale by begin_frame once its fence has
+    // signalled. The primary buffer gets a pool of its own and so does every batch of chunk
+    // draws, each recorded into a secondary buffer by one job, so no pool is ever used by two
+    // threads at once.
+    VkCommandPool frame_pools[MAX_FRAMES_IN_FLIGHT];
     VkCommandBuffer cmd_buffers[MAX_FRAMES_IN_FLIGHT];
+    VkCommandPool batch_pools[MAX_FRAMES_IN_FLIGHT][MAX_RECORD_BATCHES];
+    VkCommandBuffer batch_buffers[MAX_FRAMES_IN_FLIGHT][MAX_RECORD_BATCHES];
+    VkCommandBuffer batch_depth_buffers[MAX_FRAMES_IN_FLIGHT][MAX_RECORD_BATCHES];
+
+    JobSystem* jobs; // records the batches, null = everything is recorded inline
+    RecordBatch record_batches[MAX_RECORD_BATCHES];
+    JobCounter record_counter;
 
     VkSemaphore image_available_semaphores[MAX_FRAMES_IN_FLIGHT];
     VkSemaphore render_finished_semaphores[MAX_FRAMES_IN_FLIGHT];
@@ -70,6 +267,43 @@ struct VulkanContext {
 
     uint32_t current_frame = 0;
 
+    GpuBuffer staging[MAX_FRAMES_IN_FLIGHT];
+    VkDeviceSize staging_used;
+    BufferUpload uploads[MAX_UPLOAD_COPIES];
+    uint32_t num_uploads;
+    ImageUpload image_uploads[MAX_IMAGE_UPLOADS];
+    uint32_t num_image_uploads;
+    bool uploads_recorded;
+
+    // Host visible and mapped for good, one per frame in flight and reset by begin_frame
+    GpuBuffer frame_rings[MAX_FRAMES_IN_FLIGHT];
+    VkDeviceSize frame_ring_used;
+    VkDescriptorPool frame_descriptor_pool;
+    VkDescriptorSet frame_sets[MAX_FRAMES_IN_FLIGHT];
+
+    // Retired resources by the frame in flight that retired them, freed by begin_frame once that
+    // frame's fence has signalled again
+    DeletionQueue deletions[MAX_FRAMES_IN_FLIGHT];
+
+    GpuBuffer quad_indices; // 0 1 2 0 2 3 for every quad, shared by all chunk meshes
+
+    // Window::displayBytes images, copied straight into the swapchain image instead of drawing
+    bool sc_transfer_dst; // the swapchain images can be copied into
+    GpuBuffer pixel_staging[MAX_FRAMES_IN_FLIGHT];
+    VkExtent2D pixels_extent; // what pixel_staging was filled for
+    bool pixels_pending;
+
+    // Begin / end timestamp pair per GpuPass and frame in flight, read back once the frame's fence
+    // has signalled so it never stalls. Unset profiler or no timestamp support = nothing is timed.
+    Profiler* profiler;
+    bool timestamps;
+    float timestamp_period; // ns per tick
+    uint64_t timestamp_mask; // timestampValidBits of the graphics queue
+    VkQueryPool timestamp_pools[MAX_FRAMES_IN_FLIGHT];
+    uint64_t timestamp_frames[MAX_FRAMES_IN_FLIGHT]; // profiler frame that was recorded
+    uint32_t timestamp_passes[MAX_FRAMES_IN_FLIGHT]; // bit per GpuPass written, 0 = nothing to read
+    int64_t gpu_clock_offset; // ns, trace_now - timestamp * timestamp_period
+
     bool frame_buffer_resized = false;
 
     static VulkanContext* Create(Arena* arr, Window* window)
@@ -20,7 +20,7 @@ Window* Window::Create(Arena* arr, uint32_t width, uint32_t height)
     }
 
     glfwWindowHint(GLFW_CLIENT_API, GLFW_NO_API);
-    window->window = glfwCreateWindow(width, height, "RaycastingEngine", NULL, NULL);
+    window->window = glfwCreateWindow(width, height, "VoxelEngine", NULL, NULL);
     if (!window->window) {
         glfwTerminate();
         printf("Failed to init Window");
@@ -43,7 +43,12 @@ void Window::destroy()
     glfwTerminate();
 }
 
-void Window::displayBytes(unsigned char* bytes, int width, int height)
+void Window::displayBytes(const unsigned char* bytes, int width, int height)
 {
-    // glDrawPixels(width, height, GL_RGBA, GL_UNSIGNED_BYTE, bytes);
+    if (!display) {
+        return;
+    }
+    if (!display(display_user, bytes, width, height)) {
+        printf("Failed to display %dx%d image\n", width, height);
+    }
 }
@@ -10,11 +10,16 @@ struct Window {
     int width = 0;
     int height = 0;
 
+    // Presents displayBytes images, installed by the renderer. Unset = displayBytes does nothing.
+    void* display_user;
+    bool (*display)(void* user, const unsigned char* bytes, int width, int height);
+
     static Window* Create(Arena* arr, uint32_t width, uint32_t height);
 
     void update();
     void destroy();
-    void displayBytes(unsigned char* bytes, int width, int height);
+    // RGBA8 rows top to bottom, scaled to the window by the next frame
+    void displayBytes(const unsigned char* bytes, int width, int height);
 };
 
 #endif // WINDOW_HPP
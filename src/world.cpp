@@ -0,0 +1,471 @@
+#include "world.hpp"
+#include "block_ticks.hpp"
+#include "light.hpp"
+#include "mesher.hpp"
+#include "trace.hpp"
+#include "worldgen.hpp"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <new>
+#include <thread>
+
+World* World::Create(Arena* arr, JobSystem* jobs, WorldStore* store, LightEngine* light, uint64_t seed, uint32_t max_chunks)
+{
+    World* world = new (arena_allocate(arr, sizeof(World))) World();
+
+    world->seed = seed;
+    world->jobs = jobs;
+    world->store = store;
+    world->light = light;
+
+    chunk_pool_init(arr, &world->pool, max_chunks);
+    chunk_map_init(arr, &world->chunks, max_chunks);
+    world->gen_jobs = (GenJob*)arena_allocate(arr, max_chunks * sizeof(GenJob));
+    world->edits = (BlockEdit*)arena_allocate(arr, MAX_QUEUED_EDITS * sizeof(BlockEdit));
+
+    return world;
+}
+
+Chunk* world_get_chunk(World* world, ChunkPos pos)
+{
+    return chunk_map_get(&world->chunks, chunk_key(pos));
+}
+
+static void gen_job(void* data)
+{
+    TRACE_SCOPE("generate");
+    GenJob* job = (GenJob*)data;
+    World* world = job->world;
+    if (!job->chunk->cancelled.load(std::memory_order_acquire)) {
+        generate_chunk(world->seed, job->chunk);
+    }
+
+    std::lock_guard<std::mutex> guard(world->gen_lock);
+    job->next = world->gen_done;
+    world->gen_done = job;
+}
+
+static void start_generation(World* world, Chunk* chunk)
+{
+    GenJob* job = &world->gen_jobs[chunk - world->pool.chunks];
+    job->world = world;
+    job->chunk = chunk;
+    chunk->state.store(CHUNK_STATE_GENERATING, std::memory_order_relaxed);
+    job_submit(world->jobs, gen_job, job);
+}
+
+Chunk* world_request_chunk(World* world, ChunkPos pos, float priority)
+{
+    Chunk* chunk = world_get_chunk(world, pos);
+    if (chunk) {
+        return chunk;
+    }
+
+    chunk = chunk_pool_acquire(&world->pool);
+    if (!chunk) {
+        return nullptr;
+    }
+    chunk->pos = pos;
+
+    if (world->store) {
+        chunk->state.store(CHUNK_STATE_LOADING, std::memory_order_relaxed);
+        if (!world_store_load(world->store, chunk, priority)) {
+            chunk_pool_release(&world->pool, chunk);
+            return nullptr;
+        }
+    } else {
+        start_generation(world, chunk);
+    }
+
+    chunk_map_insert(&world->chunks, chunk_key(pos), chunk);
+    return chunk;
+}
+
+void world_release_chunk(World* world, Chunk* chunk)
+{
+    world->chunk_events++;
+    if (world->ticks) {
+        block_ticks_chunk_released(world->ticks, chunk);
+    }
+    if (world_get_chunk(world, chunk->pos) == chunk) {
+        chunk_map_remove(&world->chunks, chunk_key(chunk->pos));
+    }
+
+    uint32_t state = chunk->state.load(std::memory_order_acquire);
+    if (state == CHUNK_STATE_LOADING || state == CHUNK_STATE_GENERATING) {
+        chunk->cancelled.store(true, std::memory_order_release);
+        return;
+    }
+    chunk_pool_release(&world->pool, chunk);
+}
+
+BlockID world_get_block(World* world, int32_t x, int32_t y, int32_t z)
+{
+    Chunk* chunk = world_get_chunk(world, chunk_pos_from_block(x, y, z));
+    if (!chunk || chunk->state.load(std::memory_order_acquire) != CHUNK_STATE_READY) {
+        return BLOCK_AIR;
+    }
+    return chunk->blocks[chunk_index(x & CHUNK_MASK, y & CHUNK_MASK, z & CHUNK_MASK)];
+}
+
+// Faces read the voxel in front of them and the ring around that one (ambient occlusion), so
+// that is every region the 3x3x3 blocks around it fall in, in this chunk and the ones it
+// borders. Plus the skirts and mips of neighbouring chunks that sample it.
+void world_mark_mesh_dirty(World* world, Chunk* chunk, int32_t x, int32_t y, int32_t z)
+{
+    Chunk* neighbors[FACE_COUNT];
+    for (uint32_t f = 0; f < FACE_COUNT; f++) {
+        ChunkPos npos = { chunk->pos.x + FACE_NORMALS[f][0], chunk->pos.y + FACE_NORMALS[f][1], chunk->pos.z + FACE_NORMALS[f][2] };
+        neighbors[f] = world_get_chunk(world, npos);
+    }
+
+    for (int32_t dy = -1; dy <= 1; dy++) {
+        for (int32_t dz = -1; dz <= 1; dz++) {
+            for (int32_t dx = -1; dx <= 1; dx++) {
+                int32_t nx = x + dx;
+                int32_t ny = y + dy;
+                int32_t nz = z + dz;
+                bool out_x = nx < 0 || nx >= CHUNK_SIZE;
+                bool out_y = ny < 0 || ny >= CHUNK_SIZE;
+                bool out_z = nz < 0 || nz >= CHUNK_SIZE;
+                if (out_x + out_y + out_z == 0) {
+                    chunk->dirty_regions |= 1ull << chunk_region_index(nx, ny, nz);
+                    continue;
+                }
+                if (out_x + out_y + out_z > 1) {
+                    continue; // diagonal chunks don't see this one
+                }
+                uint32_t f = out_x ? (nx < 0 ? FACE_NEG_X : FACE_POS_X) : out_y ? (ny < 0 ? FACE_NEG_Y : FACE_POS_Y) : (nz < 0 ? FACE_NEG_Z : FACE_POS_Z);
+                chunk->dirty_borders |= 1 << f;
+                if (neighbors[f]) {
+                    neighbors[f]->dirty_borders |= 1 << (f ^ 1);
+                    neighbors[f]->dirty_regions |= 1ull << chunk_region_index(nx & CHUNK_MASK, ny & CHUNK_MASK, nz & CHUNK_MASK);
+                }
+            }
+        }
+    }
+
+    uint8_t dependents = mesh_border_dependents(x, y, z);
+    for (uint32_t f = 0; f < FACE_COUNT; f++) {
+        if ((dependents & (1 << f)) && neighbors[f]) {
+            neighbors[f]->dirty_borders |= 1 << (f ^ 1);
+        }
+    }
+}
+
+// Writes a block of a chunk edits are allowed on and queues what changes because of it
+static void write_block(World* world, Chunk* chunk, int32_t x, int32_t y, int32_t z, BlockID block)
+{
+    BlockID* slot = &chunk->blocks[chunk_index(x, y, z)];
+    BlockID old = *slot;
+    *slot = block;
+    chunk->flags |= CHUNK_FLAG_MODIFIED;
+    chunk->revision++;
+    if (world->edit_log) {
+        if (world->num_logged < world->max_logged) {
+            world->edit_log[world->num_logged++] = { chunk->pos, chunk->revision, chunk_index(x, y, z), block };
+        } else {
+            world->edit_log_overflow = true;
+        }
+    }
+    world_mark_mesh_dirty(world, chunk, x, y, z);
+    if (world->light) {
+        light_block_changed(world->light, world, chunk, x, y, z, old);
+    }
+    if (world->ticks) {
+        block_ticks_block_changed(world->ticks, chunk, x, y, z);
+    }
+}
+
+bool world_set_block(World* world, int32_t x, int32_t y, int32_t z, BlockID block)
+{
+    Chunk* chunk = world_get_chunk(world, chunk_pos_from_block(x, y, z));
+    if (!chunk || chunk->state.load(std::memory_order_acquire) != CHUNK_STATE_READY) {
+        return false;
+    }
+    write_block(world, chunk, x & CHUNK_MASK, y & CHUNK_MASK, z & CHUNK_MASK, block);
+    return true;
+}
+
+void world_enable_edit_log(World* world, Arena* arr, uint32_t max_edits)
+{
+    world->edit_log = (AppliedEdit*)arena_allocate(arr, max_edits * sizeof(AppliedEdit));
+    world->max_logged = max_edits;
+    world_clear_edit_log(world);
+}
+
+void world_clear_edit_log(World* world)
+{
+    world->num_logged = 0;
+    world->edit_log_overflow = false;
+}
+
+bool world_queue_edit(World* world, int32_t x, int32_t y, int32_t z, BlockID block)
+{
+    if (world->num_edits == MAX_QUEUED_EDITS) {
+        return false;
+    }
+    world->edits[world->num_edits++] = { x, y, z, block, world->next_edit_order++ };
+    return true;
+}
+
+static void apply_edits(World* world)
+{
+    if (world->num_edits == 0) {
+        return;
+    }
+
+    // Chunk by chunk, then block by block in queue order
+    std::sort(world->edits, world->edits + world->num_edits, [](const BlockEdit& a, const BlockEdit& b) {
+        uint64_t ka = chunk_key(chunk_pos_from_block(a.x, a.y, a.z));
+        uint64_t kb = chunk_key(chunk_pos_from_block(b.x, b.y, b.z));
+        if (ka != kb) {
+            return ka < kb;
+        }
+        uint32_t ia = chunk_index(a.x & CHUNK_MASK, a.y & CHUNK_MASK, a.z & CHUNK_MASK);
+        uint32_t ib = chunk_index(b.x & CHUNK_MASK, b.y & CHUNK_MASK, b.z & CHUNK_MASK);
+        if (ia != ib) {
+            return ia < ib;
+        }
+        return a.order < b.order;
+    });
+
+    uint32_t kept = 0;
+    uint32_t i = 0;
+    while (i < world->num_edits) {
+        ChunkPos pos = chunk_pos_from_block(world->edits[i].x, world->edits[i].y, world->edits[i].z);
+        uint32_t end = i + 1;
+        while (end < world->num_edits && chunk_pos_from_block(world->edits[end].x, world->edits[end].y, world->edits[end].z) == pos) {
+            end++;
+        }
+
+        Chunk* chunk = world_get_chunk(world, pos);
+        if (!chunk || chunk->state.load(std::memory_order_acquire) != CHUNK_STATE_READY) {
+            i = end;
+            continue;
+        }
+        if (chunk->readers > 0 || (world->light && light_edit_blocked(world->light, world, pos))) {
+            while (i < end) {
+                world->edits[kept++] = world->edits[i++];
+            }
+            continue;
+        }
+
+        for (; i < end; i++) {
+            const BlockEdit& edit = world->edits[i];
+            bool last = i + 1 == end || world->edits[i + 1].x != edit.x || world->edits[i + 1].y != edit.y || world->edits[i + 1].z != edit.z;
+            if (!last) {
+                continue;
+            }
+            int32_t x = edit.x & CHUNK_MASK;
+            int32_t y = edit.y & CHUNK_MASK;
+            int32_t z = edit.z & CHUNK_MASK;
+            if (chunk->blocks[chunk_index(x, y, z)] != edit.block) {
+                write_block(world, chunk, x, y, z, edit.block);
+            }
+        }
+    }
+
+    world->num_edits = kept;
+    if (kept == 0) {
+        world->next_edit_order = 0;
+    }
+}
+
+// Blocks are in, the chunk still needs its light before it counts as ready for meshing
+static void chunk_ready(World* world, Chunk* chunk)
+{
+    world->chunk_events++;
+    chunk->state.store(CHUNK_STATE_READY, std::memory_order_release);
+    if (world->light) {
+        light_chunk_ready(world->light, chunk);
+    } else {
+        memset(chunk->light, LIGHT_FULL, CHUNK_VOLUME);
+        chunk->light_state = CHUNK_LIGHT_DONE;
+    }
+}
+
+static bool save_chunk(World* world, Chunk* chunk);
+
+static void handle_store_result(World* world, const StoreResult& res)
+{
+    if (res.task == STORE_TASK_LOAD) {
+        Chunk* chunk = res.chunk;
+        if (chunk->cancelled.load(std::memory_order_acquire)) {
+            chunk_pool_release(&world->pool, chunk);
+            return;
+        }
+        switch (res.type) {
+        case STORE_LOADED:
+            chunk_ready(world, chunk);
+            break;
+        case STORE_FAILED:
+            printf("Failed to load chunk (%d, %d, %d), regenerating\n", res.pos.x, res.pos.y, res.pos.z);
+            start_generation(world, chunk);
+            break;
+        default:
+            start_generation(world, chunk);
+            break;
+        }
+        return;
+    }
+
+    Chunk* chunk = world_get_chunk(world, res.pos);
+    if (!chunk) {
+        return;
+    }
+    chunk->flags &= ~CHUNK_FLAG_SAVING;
+    if (res.type == STORE_FAILED) {
+        printf("Failed to save chunk (%d, %d, %d)\n", res.pos.x, res.pos.y, res.pos.z);
+        chunk->flags |= CHUNK_FLAG_MODIFIED;
+    } else if (chunk->flags & CHUNK_FLAG_MODIFIED) {
+        save_chunk(world, chunk); // edited while the snapshot was written, a busy store leaves it to the next autosave
+    }
+}
+
+static bool save_chunk(World* world, Chunk* chunk)
+{
+    if (!(chunk->flags & CHUNK_FLAG_MODIFIED) || (chunk->flags & CHUNK_FLAG_SAVING)) {
+        return true;
+    }
+    if (chunk->state.load(std::memory_order_acquire) != CHUNK_STATE_READY) {
+        return true;
+    }
+    if (!world_store_save(world->store, chunk)) {
+        return false;
+    }
+    chunk->flags &= ~CHUNK_FLAG_MODIFIED;
+    chunk->flags |= CHUNK_FLAG_SAVING;
+    return true;
+}
+
+static void continue_autosave(World* world)
+{
+    uint32_t queued = 0;
+    ChunkMap* map = &world->chunks;
+    while (world->autosave_cursor < map->capacity && queued < AUTOSAVE_CHUNKS_PER_FRAME) {
+        uint32_t slot = world->autosave_cursor;
+        if (chunk_map_slot_used(map, slot)) {
+            Chunk* chunk = map->values[slot];
+            bool needs_save = chunk->flags & CHUNK_FLAG_MODIFIED;
+            if (!save_chunk(world, chunk)) {
+                return; // store is busy, resume here next frame
+            }
+            queued += needs_save;
+        }
+        world->autosave_cursor++;
+    }
+    if (world->autosave_cursor >= map->capacity) {
+        world->autosave_active = false;
+    }
+}
+
+void world_begin_autosave(World* world)
+{
+    if (!world->store || world->autosave_active) {
+        return;
+    }
+    world->autosave_active = true;
+    world->autosave_cursor = 0;
+}
+
+static void collect_generated(World* world)
+{
+    GenJob* done;
+    {
+        std::lock_guard<std::mutex> guard(world->gen_lock);
+        done = world->gen_done;
+        world->gen_done = nullptr;
+    }
+    while (done) {
+        GenJob* next = done->next;
+        Chunk* chunk = done->chunk;
+        if (chunk->cancelled.load(std::memory_order_acquire)) {
+            chunk_pool_release(&world->pool, chunk);
+        } else {
+            chunk_ready(world, chunk);
+        }
+        done = next;
+    }
+}
+
+void world_update(World* world)
+{
+    collect_generated(world);
+    apply_edits(world);
+
+    if (world->store) {
+        world_store_update(world->store);
+
+        StoreResult results[64];
+        uint32_t n;
+        while ((n = world_store_poll(world->store, results, 64)) > 0) {
+            for (uint32_t i = 0; i < n; i++) {
+                handle_store_result(world, results[i]);
+            }
+        }
+
+        if (world->autosave_active) {
+            continue_autosave(world);
+        }
+    }
+
+    if (world->light) {
+        light_update(world->light, world);
+    }
+}
+
+bool world_unload_chunk(World* world, Chunk* chunk)
+{
+    if (!world->store) {
+        world_release_chunk(world, chunk);
+        return true;
+    }
+    // The chunk has to outlive its save: edits made meanwhile are saved again once it lands,
+    // and a failed save flags it modified again
+    if ((chunk->flags & CHUNK_FLAG_SAVING) || !save_chunk(world, chunk)) {
+        return false;
+    }
+    if (chunk->flags & CHUNK_FLAG_SAVING) {
+        return false; // just queued, released on a later try
+    }
+    world_release_chunk(world, chunk);
+    return true;
+}
+
+static uint32_t count_unsaved(World* world)
+{
+    uint32_t count = 0;
+    ChunkMap* map = &world->chunks;
+    for (uint32_t slot = 0; slot < map->capacity; slot++) {
+        if (!chunk_map_slot_used(map, slot)) {
+            continue;
+        }
+        const Chunk* chunk = map->values[slot];
+        bool ready = chunk->state.load(std::memory_order_acquire) == CHUNK_STATE_READY;
+        count += ready && (chunk->flags & (CHUNK_FLAG_MODIFIED | CHUNK_FLAG_SAVING));
+    }
+    return count;
+}
+
+void world_save_all(World* world)
+{
+    if (!world->store) {
+        return;
+    }
+
+    // A pass skips chunks whose last save is still in flight and a save can fail, so passes
+    // repeat until every chunk is on disk
+    for (uint32_t pass = 0; pass < SAVE_ALL_MAX_PASSES; pass++) {
+        world_begin_autosave(world);
+        while (world->autosave_active || !world_store_idle(world->store)) {
+            world_update(world);
+            std::this_thread::yield();
+        }
+        if (count_unsaved(world) == 0) {
+            return;
+        }
+    }
+    printf("Gave up saving %u chunks\n", count_unsaved(world));
+}
@@ -0,0 +1,112 @@
+#ifndef WORLD_HPP
+#define WORLD_HPP
+
+#include "chunk.hpp"
+#include "jobs.hpp"
+#include "world_store.hpp"
+#include <Arena.h>
+#include <cstdint>
+#include <mutex>
+
+#define AUTOSAVE_CHUNKS_PER_FRAME 8
+#define SAVE_ALL_MAX_PASSES 8 // world_save_all gives up on chunks whose saves keep failing
+#define MAX_QUEUED_EDITS 65536
+
+struct GenJob {
+    struct World* world;
+    Chunk* chunk;
+    GenJob* next; // done list link
+};
+
+struct BlockEdit {
+    int32_t x, y, z;
+    BlockID block;
+    uint32_t order; // queue order, the last edit to a block wins
+};
+
+// A block change that landed, as replication sees it
+struct AppliedEdit {
+    ChunkPos pos;
+    uint32_t revision; // of the chunk, after this edit
+    uint32_t index; // chunk_index
+    BlockID block;
+};
+
+struct LightEngine;
+struct BlockTicks;
+
+struct World {
+    uint64_t seed;
+    ChunkPool pool;
+    ChunkMap chunks;
+
+    JobSystem* jobs;
+    WorldStore* store; // null = nothing is persisted
+    LightEngine* light; // null = everything is fully lit
+    BlockTicks* ticks; // null = blocks never update on their own, see BlockTicks::Create
+
+    GenJob* gen_jobs; // one slot per pool chunk
+    std::mutex gen_lock;
+    GenJob* gen_done; // finished generation, handed back to the main thread
+
+    BlockEdit* edits;
+    uint32_t num_edits;
+    uint32_t next_edit_order;
+
+    bool autosave_active;
+    uint32_t autosave_cursor; // chunk map slot the current autosave pass is at
+
+    // Every block write in order, once world_enable_edit_log was called. The one reader clears it.
+    AppliedEdit* edit_log;
+    uint32_t num_logged;
+    uint32_t max_logged;
+    bool edit_log_overflow; // writes were left out since the last clear
+
+    uint64_t chunk_events; // chunks that became ready or were released, ever
+
+    static World* Create(Arena* arr, JobSystem* jobs, WorldStore* store, LightEngine* light, uint64_t seed, uint32_t max_chunks);
+};
+
+Chunk* world_get_chunk(World* world, ChunkPos pos);
+
+// Allocates the chunk and starts loading it from disk (or generating it when it was never saved).
+// Returns null if the pool is full or the store is busy, try again next frame.
+Chunk* world_request_chunk(World* world, ChunkPos pos, float priority);
+
+// Removes the chunk from the world. If a load or generation job still owns it, the job is
+// cancelled and the memory goes back to the pool once it finishes.
+void world_release_chunk(World* world, Chunk* chunk);
+
+// Saves the chunk if it was modified, then releases it once no save of it is in flight.
+// False until then or while the store is busy, try again later.
+bool world_unload_chunk(World* world, Chunk* chunk);
+
+BlockID world_get_block(World* world, int32_t x, int32_t y, int32_t z);
+
+// Flags every part of the mesh that shows the block at local x, y, z, after it or its light changed
+void world_mark_mesh_dirty(World* world, Chunk* chunk, int32_t x, int32_t y, int32_t z);
+
+// Writes immediately. Only safe while no mesh or light job reads the chunk or lights the chunks
+// around it, gameplay goes through world_queue_edit.
+bool world_set_block(World* world, int32_t x, int32_t y, int32_t z, BlockID block);
+
+// Queues a block change for the next world_update. Edits are grouped per chunk, repeated
+// writes to one block collapse into the last, and chunks a mesh job is reading (or that light
+// can't be updated around yet) keep theirs until it is done. Edits to chunks that aren't loaded
+// are dropped. False if the queue is full.
+bool world_queue_edit(World* world, int32_t x, int32_t y, int32_t z, BlockID block);
+
+// Starts logging block writes into world->edit_log, max_edits between clears
+void world_enable_edit_log(World* world, Arena* arr, uint32_t max_edits);
+void world_clear_edit_log(World* world);
+
+// Applies queued edits, handles finished loads / generation / saves and keeps an autosave pass moving. Never blocks.
+void world_update(World* world);
+
+// Starts a pass that snapshots every modified chunk, AUTOSAVE_CHUNKS_PER_FRAME at a time
+void world_begin_autosave(World* world);
+
+// Blocking, saves everything and waits for the IO to land. Used on shutdown.
+void world_save_all(World* world);
+
+#endif // WORLD_HPP
@@ -0,0 +1,588 @@
+#include "world_io.hpp"
+#include "trace.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <new>
+#include <unistd.h>
+
+#if defined(__linux__)
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#endif
+
+#define IO_NUM_THREADS 2
+
+// ===========================================
+// -----------------IO_URING------------------
+// ===========================================
+
+#if defined(__linux__) && defined(__NR_io_uring_setup)
+#define HAS_URING 1
+
+// Raw syscall interface so we don't depend on liburing
+struct IOUring {
+    int fd;
+    uint32_t to_submit;
+
+    unsigned* sq_head;
+    unsigned* sq_tail;
+    unsigned* sq_mask;
+    unsigned* sq_array;
+    struct io_uring_sqe* sqes;
+
+    unsigned* cq_head;
+    unsigned* cq_tail;
+    unsigned* cq_mask;
+    struct io_uring_cqe* cqes;
+
+    void* sq_ptr;
+    size_t sq_size;
+    void* cq_ptr;
+    size_t cq_size;
+    size_t sqes_size;
+};
+
+static bool uring_init(IOUring* ring, uint32_t entries)
+{
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+
+    int fd = (int)syscall(__NR_io_uring_setup, entries, &params);
+    if (fd < 0) {
+        return false;
+    }
+
+    ring->fd = fd;
+    ring->to_submit = 0;
+    ring->sq_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    ring->cq_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    bool single_mmap = params.features & IORING_FEAT_SINGLE_MMAP;
+    if (single_mmap) {
+        ring->sq_size = std::max(ring->sq_size, ring->cq_size);
+        ring->cq_size = ring->sq_size;
+    }
+
+    ring->sq_ptr = mmap(nullptr, ring->sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    if (ring->sq_ptr == MAP_FAILED) {
+        close(fd);
+        return false;
+    }
+    if (single_mmap) {
+        ring->cq_ptr = ring->sq_ptr;
+    } else {
+        ring->cq_ptr = mmap(nullptr, ring->cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+        if (ring->cq_ptr == MAP_FAILED) {
+            munmap(ring->sq_ptr, ring->sq_size);
+            close(fd);
+            return false;
+        }
+    }
+
+    ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = (struct io_uring_sqe*)mmap(nullptr, ring->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+    if (ring->sqes == MAP_FAILED) {
+        if (!single_mmap) {
+            munmap(ring->cq_ptr, ring->cq_size);
+        }
+        munmap(ring->sq_ptr, ring->sq_size);
+        close(fd);
+        return false;
+    }
+
+    char* sq = (char*)ring->sq_ptr;
+    ring->sq_head = (unsigned*)(sq + params.sq_off.head);
+    ring->sq_tail = (unsigned*)(sq + params.sq_off.tail);
+    ring->sq_mask = (unsigned*)(sq + params.sq_off.ring_mask);
+    ring->sq_array = (unsigned*)(sq + params.sq_off.array);
+
+    char* cq = (char*)ring->cq_ptr;
+    ring->cq_head = (unsigned*)(cq + params.cq_off.head);
+    ring->cq_tail = (unsigned*)(cq + params.cq_off.tail);
+    ring->cq_mask = (unsigned*)(cq + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe*)(cq + params.cq_off.cqes);
+
+    return true;
+}
+
+static void uring_free(IOUring* ring)
+{
+    munmap(ring->sqes, ring->sqes_size);
+    if (ring->cq_ptr != ring->sq_ptr) {
+        munmap(ring->cq_ptr, ring->cq_size);
+    }
+    munmap(ring->sq_ptr, ring->sq_size);
+    close(ring->fd);
+}
+
+static void uring_queue(IOUring* ring, IOBatch* batch)
+{
+    unsigned tail = *ring->sq_tail;
+    unsigned index = tail & *ring->sq_mask;
+    struct io_uring_sqe* sqe = &ring->sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+
+    const IORequest& first = batch->requests[0];
+    sqe->fd = first.fd;
+    if (first.op == IO_OP_SYNC) {
+        sqe->opcode = IORING_OP_FSYNC;
+        sqe->fsync_flags = IORING_FSYNC_DATASYNC;
+    } else {
+        sqe->opcode = first.op == IO_OP_READ ? IORING_OP_READV : IORING_OP_WRITEV;
+        sqe->off = first.offset + batch->result;
+        sqe->addr = (uint64_t)(uintptr_t)(batch->iov + batch->first_iov);
+        sqe->len = batch->num_requests - batch->first_iov;
+    }
+    sqe->user_data = (uint64_t)(uintptr_t)batch;
+
+    ring->sq_array[index] = index;
+    __atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+    ring->to_submit++;
+}
+
+// Moves the batch past n more transferred bytes and queues the rest again, like the loop in
+// run_batch_blocking. Done after the kernel is finished with the iovecs.
+static void uring_requeue(IOUring* ring, IOBatch* batch, uint32_t n)
+{
+    batch->result += (int32_t)n;
+    while (batch->first_iov < batch->num_requests && n >= batch->iov[batch->first_iov].iov_len) {
+        n -= (uint32_t)batch->iov[batch->first_iov].iov_len;
+        batch->first_iov++;
+    }
+    struct iovec* cur = &batch->iov[batch->first_iov];
+    cur->iov_base = (char*)cur->iov_base + n;
+    cur->iov_len -= n;
+    uring_queue(ring, batch);
+}
+
+static void uring_enter(IOUring* ring, bool get_events)
+{
+    if (ring->to_submit == 0 && !get_events) {
+        return;
+    }
+    // min_complete = 0, never blocks
+    int ret = (int)syscall(__NR_io_uring_enter, ring->fd, ring->to_submit, 0, get_events ? IORING_ENTER_GETEVENTS : 0, nullptr, 0);
+    if (ret > 0) {
+        ring->to_submit -= std::min((uint32_t)ret, ring->to_submit);
+    } else if (ret < 0 && errno != EAGAIN && errno != EBUSY && errno != EINTR) {
+        printf("io_uring_enter failed: %s\n", strerror(errno));
+    }
+}
+#else
+struct IOUring {
+};
+#endif
+
+// ===========================================
+// ---------------THREAD POOL-----------------
+// ===========================================
+
+static int32_t run_batch_blocking(IOBatch* batch)
+{
+    const IORequest& first = batch->requests[0];
+    if (first.op == IO_OP_SYNC) {
+        while (fdatasync(first.fd) < 0) {
+            if (errno != EINTR) {
+                return -errno;
+            }
+        }
+        return 0;
+    }
+
+    struct iovec iov[IO_MAX_IOV];
+    memcpy(iov, batch->iov, batch->num_requests * sizeof(*iov));
+    struct iovec* cur = iov;
+    int num_iov = batch->num_requests;
+
+    uint64_t offset = first.offset;
+    int32_t total = 0;
+
+    while (num_iov > 0) {
+        ssize_t n = first.op == IO_OP_READ ? preadv(first.fd, cur, num_iov, offset) : pwritev(first.fd, cur, num_iov, offset);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return total > 0 ? total : -errno;
+        }
+        if (n == 0) {
+            break; // EOF on read
+        }
+        total += (int32_t)n;
+        offset += n;
+
+        // advance past the fully transferred iovecs
+        while (num_iov > 0 && (size_t)n >= cur->iov_len) {
+            n -= cur->iov_len;
+            cur++;
+            num_iov--;
+        }
+        if (num_iov > 0) {
+            cur->iov_base = (char*)cur->iov_base + n;
+            cur->iov_len -= n;
+        }
+    }
+    return total;
+}
+
+static void io_thread_main(IOContext* io)
+{
+    trace_name_thread("io");
+    while (true) {
+        IOBatch* batch;
+        {
+            std::unique_lock<std::mutex> guard(io->thread_lock);
+            io->thread_wake.wait(guard, [io] { return io->thread_queue || !io->running; });
+            if (!io->thread_queue) {
+                return;
+            }
+            batch = io->thread_queue;
+            io->thread_queue = batch->next;
+            if (!io->thread_queue) {
+                io->thread_queue_tail = nullptr;
+            }
+        }
+
+        {
+            TRACE_SCOPE("io batch");
+            batch->result = run_batch_blocking(batch);
+        }
+
+        std::lock_guard<std::mutex> guard(io->thread_lock);
+        batch->next = io->thread_done;
+        io->thread_done = batch;
+    }
+}
+
+// ===========================================
+// -----------------CONTEXT-------------------
+// ===========================================
+
+IOContext* IOContext::Create(Arena* arr, uint32_t queue_depth, uint32_t max_pending, bool allow_uring)
+{
+    IOContext* io = new (arena_allocate(arr, sizeof(IOContext))) IOContext();
+
+    io->queue_depth = queue_depth;
+    io->batches = (IOBatch*)arena_allocate(arr, queue_depth * sizeof(IOBatch));
+    io->free_batches = nullptr;
+    for (uint32_t i = 0; i < queue_depth; i++) {
+        io->batches[i].next = io->free_batches;
+        io->free_batches = &io->batches[i];
+    }
+
+    io->pending_capacity = max_pending;
+    io->pending = (IORequest*)arena_allocate(arr, max_pending * sizeof(IORequest));
+
+    io->completion_capacity = max_pending + queue_depth * IO_MAX_IOV;
+    io->completions = (IOCompletion*)arena_allocate(arr, io->completion_capacity * sizeof(IOCompletion));
+
+    io->backend = IO_BACKEND_THREADS;
+#ifdef HAS_URING
+    if (allow_uring) {
+        IOUring* ring = (IOUring*)arena_allocate(arr, sizeof(IOUring));
+        if (uring_init(ring, queue_depth)) {
+            io->uring = ring;
+            io->backend = IO_BACKEND_URING;
+        }
+    }
+#endif
+
+    if (io->backend == IO_BACKEND_THREADS) {
+        io->running = true;
+        io->num_threads = IO_NUM_THREADS;
+        io->threads = (std::thread*)arena_allocate(arr, io->num_threads * sizeof(std::thread));
+        for (uint32_t i = 0; i < io->num_threads; i++) {
+            new (&io->threads[i]) std::thread(io_thread_main, io);
+        }
+    }
+
+    printf("World IO backend: %s\n", io->backend == IO_BACKEND_URING ? "io_uring" : "threads");
+    return io;
+}
+
+bool io_submit(IOContext* io, const IORequest& req)
+{
+    std::lock_guard<std::mutex> guard(io->pending_lock);
+    if (io->num_pending == io->pending_capacity) {
+        return false;
+    }
+    io->pending[io->num_pending++] = req;
+    return true;
+}
+
+void io_reprioritize(IOContext* io, IOPriorityFn fn, void* user)
+{
+    std::lock_guard<std::mutex> guard(io->pending_lock);
+    for (uint32_t i = 0; i < io->num_pending; i++) {
+        if (io->pending[i].op == IO_OP_READ) {
+            io->pending[i].priority = fn(io->pending[i], user);
+        }
+    }
+}
+
+// Returns false when the completion queue has no room for the batch yet
+static bool finish_batch(IOContext* io, IOBatch* batch, int32_t result)
+{
+    if (io->num_completions + batch->num_requests > io->completion_capacity) {
+        return false;
+    }
+
+    int32_t remaining = result;
+    for (uint32_t i = 0; i < batch->num_requests; i++) {
+        const IORequest& req = batch->requests[i];
+        IOCompletion c;
+        c.op = req.op;
+        c.buffer = req.buffer;
+        c.user_data = req.user_data;
+        if (result < 0) {
+            c.result = result;
+        } else {
+            c.result = std::min(remaining, (int32_t)req.size);
+            remaining -= c.result;
+        }
+        uint32_t slot = (io->completion_head + io->num_completions) % io->completion_capacity;
+        io->completions[slot] = c;
+        io->num_completions++;
+    }
+
+    io->in_flight--;
+    batch->next = io->free_batches;
+    io->free_batches = batch;
+    return true;
+}
+
+static void reap(IOContext* io)
+{
+#ifdef HAS_URING
+    if (io->backend == IO_BACKEND_URING) {
+        IOUring* ring = io->uring;
+        uring_enter(ring, io->in_flight > 0);
+
+        unsigned head = *ring->cq_head;
+        unsigned tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+        while (head != tail) {
+            struct io_uring_cqe* cqe = &ring->cqes[head & *ring->cq_mask];
+            IOBatch* batch = (IOBatch*)(uintptr_t)cqe->user_data;
+            int32_t res = cqe->res;
+            if (res > 0 && (uint32_t)(batch->result + res) < batch->bytes) {
+                uring_requeue(ring, batch, (uint32_t)res); // short transfer, the rest goes again
+                head++;
+                continue;
+            }
+            // An error after some progress reports the progress, EOF ends a read short
+            int32_t result = res < 0 ? (batch->result > 0 ? batch->result : res) : batch->result + res;
+            if (!finish_batch(io, batch, result)) {
+                break; // leave it in the ring until io_poll makes room
+            }
+            head++;
+        }
+        __atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+        return;
+    }
+#endif
+
+    IOBatch* done;
+    {
+        std::lock_guard<std::mutex> guard(io->thread_lock);
+        done = io->thread_done;
+        io->thread_done = nullptr;
+    }
+    while (done) {
+        IOBatch* next = done->next;
+        if (!finish_batch(io, done, done->result)) {
+            // put the rest back for the next update
+            std::lock_guard<std::mutex> guard(io->thread_lock);
+            IOBatch* last = done;
+            while (last->next) {
+                last = last->next;
+            }
+            last->next = io->thread_done;
+            io->thread_done = done;
+            break;
+        }
+        done = next;
+    }
+}
+
+struct BatchRange {
+    uint32_t start;
+    uint32_t count;
+    float priority;
+};
+
+// Takes up to max_batches batches out of the pending queue. Best priority requests are
+// picked first, then sorted by file offset so neighbours can be merged into one op.
+static uint32_t build_batches(IOContext* io, uint32_t max_batches, IOBatch** out)
+{
+    uint32_t n = io->num_pending;
+    if (n == 0 || max_batches == 0) {
+        return 0;
+    }
+
+    IORequest* queue = io->pending;
+
+    // Writes age toward the front every update, so a steady stream of reads can't starve autosave
+    for (uint32_t i = 0; i < n; i++) {
+        if (queue[i].op == IO_OP_WRITE) {
+            queue[i].priority *= 0.5f;
+        }
+    }
+
+    auto by_priority = [](const IORequest& a, const IORequest& b) { return a.priority < b.priority; };
+    auto by_location = [](const IORequest& a, const IORequest& b) {
+        if (a.fd != b.fd) {
+            return a.fd < b.fd;
+        }
+        if (a.op != b.op) {
+            return a.op < b.op;
+        }
+        return a.offset < b.offset;
+    };
+
+    uint32_t num_candidates = std::min(n, max_batches * IO_MAX_IOV);
+    if (num_candidates < n) {
+        std::nth_element(queue, queue + num_candidates, queue + n, by_priority);
+    }
+    std::sort(queue, queue + num_candidates, by_location);
+
+    BatchRange ranges[IO_MAX_DISPATCH * IO_MAX_IOV];
+    uint32_t num_ranges = 0;
+    for (uint32_t i = 0; i < num_candidates; i++) {
+        const IORequest& req = queue[i];
+        if (num_ranges > 0) {
+            BatchRange& r = ranges[num_ranges - 1];
+            const IORequest& prev = queue[r.start + r.count - 1];
+            uint64_t bytes = prev.offset + prev.size - queue[r.start].offset;
+            bool adjacent = prev.fd == req.fd && prev.op == req.op && req.op != IO_OP_SYNC && prev.offset + prev.size == req.offset;
+            if (adjacent && r.count < IO_MAX_IOV && bytes + req.size <= IO_MAX_MERGE_BYTES) {
+                r.count++;
+                r.priority = std::min(r.priority, req.priority);
+                continue;
+            }
+        }
+        ranges[num_ranges++] = { i, 1, req.priority };
+    }
+
+    std::sort(ranges, ranges + num_ranges, [](const BatchRange& a, const BatchRange& b) { return a.priority < b.priority; });
+
+    uint32_t num_batches = std::min(num_ranges, max_batches);
+    bool taken[IO_MAX_DISPATCH * IO_MAX_IOV] = {};
+
+    for (uint32_t b = 0; b < num_batches; b++) {
+        IOBatch* batch = io->free_batches;
+        io->free_batches = batch->next;
+
+        const BatchRange& r = ranges[b];
+        batch->num_requests = r.count;
+        batch->bytes = 0;
+        batch->result = 0;
+        batch->first_iov = 0;
+        batch->next = nullptr;
+        for (uint32_t i = 0; i < r.count; i++) {
+            batch->bytes += queue[r.start + i].size;
+            batch->requests[i] = queue[r.start + i];
+            batch->iov[i].iov_base = queue[r.start + i].buffer;
+            batch->iov[i].iov_len = queue[r.start + i].size;
+            taken[r.start + i] = true;
+        }
+        out[b] = batch;
+    }
+
+    // compact whatever was not dispatched back to the front
+    uint32_t write = 0;
+    for (uint32_t i = 0; i < n; i++) {
+        if (i < num_candidates && taken[i]) {
+            continue;
+        }
+        queue[write++] = queue[i];
+    }
+    io->num_pending = write;
+
+    return num_batches;
+}
+
+static void dispatch(IOContext* io, IOBatch* batch)
+{
+    io->in_flight++;
+
+#ifdef HAS_URING
+    if (io->backend == IO_BACKEND_URING) {
+        uring_queue(io->uring, batch);
+        return;
+    }
+#endif
+
+    std::lock_guard<std::mutex> guard(io->thread_lock);
+    batch->next = nullptr;
+    if (io->thread_queue_tail) {
+        io->thread_queue_tail->next = batch;
+    } else {
+        io->thread_queue = batch;
+    }
+    io->thread_queue_tail = batch;
+    io->thread_wake.notify_one();
+}
+
+void io_update(IOContext* io)
+{
+    reap(io);
+
+    uint32_t budget = std::min(io->queue_depth - io->in_flight, (uint32_t)IO_MAX_DISPATCH);
+    if (budget > 0) {
+        IOBatch* batches[IO_MAX_DISPATCH];
+        uint32_t num_batches;
+        {
+            std::lock_guard<std::mutex> guard(io->pending_lock);
+            num_batches = build_batches(io, budget, batches);
+        }
+        for (uint32_t i = 0; i < num_batches; i++) {
+            dispatch(io, batches[i]);
+        }
+    }
+
+#ifdef HAS_URING
+    if (io->backend == IO_BACKEND_URING) {
+        uring_enter(io->uring, false);
+    }
+#endif
+}
+
+uint32_t io_poll(IOContext* io, IOCompletion* out, uint32_t max)
+{
+    uint32_t n = std::min(max, io->num_completions);
+    for (uint32_t i = 0; i < n; i++) {
+        out[i] = io->completions[io->completion_head];
+        io->completion_head = (io->completion_head + 1) % io->completion_capacity;
+    }
+    io->num_completions -= n;
+    return n;
+}
+
+bool io_idle(IOContext* io)
+{
+    std::lock_guard<std::mutex> guard(io->pending_lock);
+    return io->num_pending == 0 && io->in_flight == 0 && io->num_completions == 0;
+}
+
+void io_destroy(IOContext* io)
+{
+#ifdef HAS_URING
+    if (io->backend == IO_BACKEND_URING) {
+        uring_free(io->uring);
+    }
+#endif
+    if (io->backend == IO_BACKEND_THREADS) {
+        {
+            std::lock_guard<std::mutex> guard(io->thread_lock);
+            io->running = false;
+        }
+        io->thread_wake.notify_all();
+        for (uint32_t i = 0; i < io->num_threads; i++) {
+            io->threads[i].join();
+            io->threads[i].~thread();
+        }
+    }
+    io->~IOContext();
+}
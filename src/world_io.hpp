@@ -0,0 +1,119 @@
+#ifndef WORLD_IO_HPP
+#define WORLD_IO_HPP
+
+#include <Arena.h>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <sys/uio.h>
+#include <thread>
+
+// Asynchronous sector I/O. Requests are queued from any thread, dispatched in priority order
+// by io_update (main loop), merged when they touch adjacent sectors of the same file, and
+// completed through a queue the main loop drains with io_poll.
+//
+// Backend is io_uring when the kernel supports it, otherwise a small pool of threads doing
+// blocking preadv/pwritev/fdatasync.
+
+#define IO_SECTOR_SIZE 4096
+#define IO_MAX_IOV 16 // max requests merged into one vectored op
+#define IO_MAX_MERGE_BYTES (1 MB)
+#define IO_MAX_DISPATCH 64 // batches started per io_update, bounds its scratch on the stack
+
+// Reads use the distance to the camera (lower goes first), writes start behind every read and age forward
+#define IO_PRIORITY_WRITE 1.0e9f
+
+enum IOOp : uint8_t {
+    IO_OP_READ,
+    IO_OP_WRITE,
+    IO_OP_SYNC, // fdatasync of fd, offset/size/buffer unused, never merged
+};
+
+enum IOBackend : uint8_t {
+    IO_BACKEND_URING,
+    IO_BACKEND_THREADS,
+};
+
+struct IORequest {
+    IOOp op;
+    int fd;
+    uint64_t offset; // bytes, sector aligned
+    uint32_t size; // bytes
+    void* buffer;
+    float priority;
+    uint64_t user_data;
+};
+
+struct IOCompletion {
+    IOOp op;
+    int32_t result; // bytes transferred, or -errno
+    void* buffer;
+    uint64_t user_data;
+};
+
+// One vectored operation, made of up to IO_MAX_IOV merged requests
+struct IOBatch {
+    IORequest requests[IO_MAX_IOV];
+    struct iovec iov[IO_MAX_IOV];
+    uint32_t num_requests;
+    uint32_t bytes; // all requests
+    int32_t result; // io_uring: bytes transferred so far, a short op is resubmitted from there
+    uint32_t first_iov; // io_uring: first iovec not transferred in full
+    IOBatch* next; // free list / thread queue link
+};
+
+struct IOUring;
+
+struct IOContext {
+    IOBackend backend;
+    IOUring* uring;
+
+    uint32_t queue_depth; // max batches in flight
+    uint32_t in_flight;
+
+    IOBatch* batches;
+    IOBatch* free_batches;
+
+    // pending requests, guarded by pending_lock (submitted from job threads)
+    std::mutex pending_lock;
+    IORequest* pending;
+    uint32_t num_pending;
+    uint32_t pending_capacity;
+
+    // completed requests waiting for io_poll. Only touched by the main thread
+    IOCompletion* completions;
+    uint32_t completion_head;
+    uint32_t num_completions;
+    uint32_t completion_capacity;
+
+    // thread fallback
+    std::thread* threads;
+    uint32_t num_threads;
+    std::mutex thread_lock;
+    std::condition_variable thread_wake;
+    IOBatch* thread_queue; // FIFO, in the order io_update dispatched them (best priority first)
+    IOBatch* thread_queue_tail;
+    IOBatch* thread_done;
+    bool running;
+
+    static IOContext* Create(Arena* arr, uint32_t queue_depth = 64, uint32_t max_pending = 4096, bool allow_uring = true);
+};
+
+// Thread safe. Returns false if the pending queue is full
+bool io_submit(IOContext* io, const IORequest& req);
+
+// Main thread only: dispatches pending requests and collects finished ones
+void io_update(IOContext* io);
+
+// Main thread only: pops up to max completions, returns how many were written
+uint32_t io_poll(IOContext* io, IOCompletion* out, uint32_t max);
+
+// Recomputes the priority of every queued read (e.g. when the camera moves)
+typedef float (*IOPriorityFn)(const IORequest& req, void* user);
+void io_reprioritize(IOContext* io, IOPriorityFn fn, void* user);
+
+bool io_idle(IOContext* io);
+
+void io_destroy(IOContext* io);
+
+#endif // WORLD_IO_HPP
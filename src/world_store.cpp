@@ -0,0 +1,686 @@
+#include "world_store.hpp"
+#include "trace.hpp"
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <new>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// user_data for header IO is the region pointer tagged with the low bit, tasks are untagged
+#define HEADER_TAG 1
+
+static inline ChunkPos region_of(ChunkPos p)
+{
+    return { p.x >> REGION_SHIFT, p.y >> REGION_SHIFT, p.z >> REGION_SHIFT };
+}
+
+static inline uint32_t region_local_index(ChunkPos p)
+{
+    return ((p.y & REGION_MASK) << (REGION_SHIFT * 2)) | ((p.z & REGION_MASK) << REGION_SHIFT) | (p.x & REGION_MASK);
+}
+
+static inline uint32_t sectors_for(uint32_t bytes)
+{
+    return (bytes + IO_SECTOR_SIZE - 1) / IO_SECTOR_SIZE;
+}
+
+float world_store_priority(ChunkPos focus, ChunkPos pos)
+{
+    float dx = (float)(pos.x - focus.x);
+    float dy = (float)(pos.y - focus.y);
+    float dz = (float)(pos.z - focus.z);
+    return dx * dx + dy * dy + dz * dz;
+}
+
+WorldStore* WorldStore::Create(Arena* arr, IOContext* io, JobSystem* jobs, const char* dir, uint32_t max_tasks, uint32_t max_regions)
+{
+    WorldStore* store = new (arena_allocate(arr, sizeof(WorldStore))) WorldStore();
+    store->io = io;
+    store->jobs = jobs;
+    snprintf(store->dir, sizeof(store->dir), "%s", dir);
+
+    if (mkdir(dir, 0755) != 0 && errno != EEXIST) {
+        printf("Failed to create world directory %s: %s\n", dir, strerror(errno));
+    }
+
+    store->max_regions = max_regions;
+    store->regions = (RegionFile*)arena_allocate(arr, max_regions * sizeof(RegionFile));
+    for (uint32_t i = 0; i < max_regions; i++) {
+        RegionFile* region = new (&store->regions[i]) RegionFile();
+        region->store = store;
+        region->state = REGION_UNUSED;
+        region->fd = -1;
+    }
+
+    store->num_tasks = max_tasks;
+    store->tasks = (StoreTask*)arena_allocate(arr, max_tasks * sizeof(StoreTask));
+    store->free_tasks = nullptr;
+    for (uint32_t i = 0; i < max_tasks; i++) {
+        StoreTask* task = &store->tasks[i];
+        memset(task, 0, sizeof(*task));
+        task->store = store;
+        task->snapshot = (BlockID*)arena_allocate(arr, CHUNK_VOLUME * sizeof(BlockID));
+        task->buffer = (uint8_t*)arena_allocate(arr, CHUNK_PAYLOAD_SECTORS * IO_SECTOR_SIZE);
+        task->scratch = (uint8_t*)arena_allocate(arr, CHUNK_CODEC_SCRATCH_BYTES);
+        task->next = store->free_tasks;
+        store->free_tasks = task;
+    }
+
+    return store;
+}
+
+// ===========================================
+// -----------------REGIONS-------------------
+// ===========================================
+
+static void region_close(RegionFile* region)
+{
+    if (region->fd >= 0) {
+        close(region->fd);
+    }
+    region->fd = -1;
+    region->state = REGION_UNUSED;
+}
+
+static void mark_sectors(RegionFile* region, uint32_t first, uint32_t count, bool used)
+{
+    for (uint32_t s = first; s < first + count && s < REGION_MAX_SECTORS; s++) {
+        if (used) {
+            region->used_sectors[s / 64] |= 1ull << (s % 64);
+        } else {
+            region->used_sectors[s / 64] &= ~(1ull << (s % 64));
+        }
+    }
+}
+
+// First fit. Caller holds region->lock
+static uint32_t allocate_sectors(RegionFile* region, uint32_t count)
+{
+    uint32_t run = 0;
+    for (uint32_t s = REGION_HEADER_SECTORS; s < REGION_MAX_SECTORS; s++) {
+        bool used = region->used_sectors[s / 64] & (1ull << (s % 64));
+        run = used ? 0 : run + 1;
+        if (run == count) {
+            uint32_t first = s + 1 - count;
+            mark_sectors(region, first, count, true);
+            return first;
+        }
+    }
+    return 0;
+}
+
+static inline bool same_extent(RegionEntry a, RegionEntry b)
+{
+    return a.sector == b.sector && a.size == b.size;
+}
+
+// Frees the sectors of a chunk's extent unless a header still points at them. Caller holds region->lock
+static void release_extent(RegionFile* region, uint32_t index, RegionEntry e)
+{
+    if (e.size == 0 || same_extent(e, region->header[index]) || same_extent(e, region->on_disk[index]) || same_extent(e, region->in_flight[index])) {
+        return;
+    }
+    mark_sectors(region, e.sector, sectors_for(e.size), false);
+}
+
+static void parse_header(RegionFile* region, int32_t bytes_read)
+{
+    std::lock_guard<std::mutex> guard(region->lock);
+    memset(region->used_sectors, 0, sizeof(region->used_sectors));
+    mark_sectors(region, 0, REGION_HEADER_SECTORS, true);
+
+    if (bytes_read < (int32_t)sizeof(region->header)) {
+        // new (or truncated) file, start empty
+        memset(region->header, 0, sizeof(region->header));
+        memset(region->on_disk, 0, sizeof(region->on_disk));
+        memset(region->in_flight, 0, sizeof(region->in_flight));
+        return;
+    }
+
+    memcpy(region->header, region->header_io, sizeof(region->header));
+    for (uint32_t i = 0; i < REGION_CHUNKS; i++) {
+        RegionEntry& e = region->header[i];
+        if (e.size == 0) {
+            continue;
+        }
+        uint32_t count = sectors_for(e.size);
+        if (e.size > CHUNK_PAYLOAD_MAX_BYTES || e.sector < REGION_HEADER_SECTORS || e.sector + count > REGION_MAX_SECTORS) {
+            printf("Region (%d, %d, %d): dropping corrupt entry %u\n", region->pos.x, region->pos.y, region->pos.z, i);
+            e = {};
+            continue;
+        }
+        mark_sectors(region, e.sector, count, true);
+    }
+    memcpy(region->on_disk, region->header, sizeof(region->header));
+    memcpy(region->in_flight, region->header, sizeof(region->header));
+}
+
+// Returns -1 when the file doesn't exist and create is false, -2 on any other failure
+static int open_region_file(WorldStore* store, ChunkPos rpos, bool create)
+{
+    char path[512];
+    snprintf(path, sizeof(path), "%s/r.%d.%d.%d.vxr", store->dir, rpos.x, rpos.y, rpos.z);
+    int fd = open(path, create ? O_RDWR | O_CREAT : O_RDWR, 0644);
+    if (fd < 0 && (create || errno != ENOENT)) {
+        printf("Failed to open region %s: %s\n", path, strerror(errno));
+        return -2;
+    }
+    return fd;
+}
+
+// Loads don't create the file: a region that was never saved is READY with an empty header and
+// no fd, every load in it comes back STORE_MISSING. The first save creates the file.
+static RegionFile* acquire_region(WorldStore* store, ChunkPos chunk, bool create)
+{
+    ChunkPos rpos = region_of(chunk);
+    uint64_t key = chunk_key(rpos);
+
+    RegionFile* victim = nullptr;
+    for (uint32_t i = 0; i < store->max_regions; i++) {
+        RegionFile* region = &store->regions[i];
+        if (region->state != REGION_UNUSED && region->key == key) {
+            if (region->fd < 0 && create) {
+                int fd = open_region_file(store, rpos, true);
+                if (fd < 0) {
+                    return nullptr;
+                }
+                region->fd = fd;
+            }
+            region->last_used = store->frame;
+            return region;
+        }
+        if (region->state == REGION_UNUSED) {
+            if (!victim || victim->state != REGION_UNUSED) {
+                victim = region;
+            }
+            continue;
+        }
+        bool closable = region->refs == 0 && region->state != REGION_LOADING_HEADER && !region->header_writing && !region->header_dirty;
+        if (closable && (!victim || (victim->state != REGION_UNUSED && region->last_used < victim->last_used))) {
+            victim = region;
+        }
+    }
+
+    if (!victim) {
+        return nullptr; // every region is busy
+    }
+    region_close(victim);
+
+    int fd = open_region_file(store, rpos, create);
+    if (fd == -2) {
+        return nullptr;
+    }
+
+    victim->pos = rpos;
+    victim->key = key;
+    victim->fd = fd;
+    victim->state = REGION_LOADING_HEADER;
+    victim->writes_in_flight = 0;
+    victim->header_dirty = false;
+    victim->header_writing = false;
+    victim->refs = 0;
+    victim->last_used = store->frame;
+    victim->waiting = nullptr;
+
+    if (fd < 0) {
+        parse_header(victim, 0);
+        victim->state = REGION_READY;
+        return victim;
+    }
+
+    IORequest req = {};
+    req.op = IO_OP_READ;
+    req.fd = fd;
+    req.offset = 0;
+    req.size = sizeof(victim->header_io);
+    req.buffer = victim->header_io;
+    req.priority = 0.0f;
+    req.user_data = (uint64_t)(uintptr_t)victim | HEADER_TAG;
+    if (!io_submit(store->io, req)) {
+        region_close(victim);
+        return nullptr;
+    }
+
+    return victim;
+}
+
+static bool submit_header_io(WorldStore* store, RegionFile* region, IOOp op)
+{
+    IORequest req = {};
+    req.op = op;
+    req.fd = region->fd;
+    if (op == IO_OP_WRITE) {
+        req.offset = 0;
+        req.size = sizeof(region->header_io);
+        req.buffer = region->header_io;
+    }
+    req.priority = IO_PRIORITY_WRITE;
+    req.user_data = (uint64_t)(uintptr_t)region | HEADER_TAG;
+    return io_submit(store->io, req);
+}
+
+// The header write is over. Once it is durable the sectors the old header pointed at can go, if
+// it failed before reaching the file the ones it would have pointed at can. A failure after that
+// leaves the file pointing at either, both stay reserved until the region is closed.
+static void finish_header_write(RegionFile* region, bool landed)
+{
+    region->header_writing = false;
+    std::lock_guard<std::mutex> guard(region->lock);
+    if (!landed && region->header_step != HEADER_SYNC_PAYLOADS) {
+        region->header_dirty = true;
+        return;
+    }
+    for (uint32_t i = 0; i < REGION_CHUNKS; i++) {
+        RegionEntry old = region->on_disk[i];
+        RegionEntry written = region->in_flight[i];
+        if (same_extent(old, written)) {
+            continue;
+        }
+        if (landed) {
+            region->on_disk[i] = written;
+            release_extent(region, i, old);
+        } else {
+            region->in_flight[i] = old;
+            release_extent(region, i, written);
+            region->header_dirty = true;
+        }
+    }
+}
+
+// Headers go out once every payload write they point at has landed. Checked in the same critical
+// section as the snapshot, an encode job could otherwise add an entry for a payload still in flight.
+// The write itself starts after the payloads are synced, see handle_header_completion.
+static void write_header(WorldStore* store, RegionFile* region)
+{
+    {
+        std::lock_guard<std::mutex> guard(region->lock);
+        if (!region->header_dirty || region->writes_in_flight > 0) {
+            return;
+        }
+        memcpy(region->header_io, region->header, sizeof(region->header));
+        memcpy(region->in_flight, region->header, sizeof(region->header));
+        region->header_dirty = false;
+    }
+    region->header_writing = true;
+    region->header_step = HEADER_SYNC_PAYLOADS;
+
+    if (!submit_header_io(store, region, IO_OP_SYNC)) {
+        finish_header_write(region, false); // try again next update
+    }
+}
+
+// ===========================================
+// ------------------TASKS--------------------
+// ===========================================
+
+static StoreTask* acquire_task(WorldStore* store)
+{
+    StoreTask* task = store->free_tasks;
+    if (task) {
+        store->free_tasks = task->next;
+        task->next = nullptr;
+        store->active_tasks++;
+    }
+    return task;
+}
+
+static void finish_task(WorldStore* store, StoreTask* task, StoreResultType result)
+{
+    task->result = result;
+    task->next = nullptr;
+    if (store->finished_tail) {
+        store->finished_tail->next = task;
+    } else {
+        store->finished = task;
+    }
+    store->finished_tail = task;
+}
+
+// Called from worker jobs
+static void push_done(StoreTask* task, StoreResultType result)
+{
+    WorldStore* store = task->store;
+    task->result = result;
+    std::lock_guard<std::mutex> guard(store->done_lock);
+    task->next = store->done;
+    store->done = task;
+}
+
+static void decode_job(void* data)
+{
+    TRACE_SCOPE("decode");
+    StoreTask* task = (StoreTask*)data;
+    if (task->dest->cancelled.load(std::memory_order_acquire)) {
+        push_done(task, STORE_FAILED); // nobody wants it anymore
+        return;
+    }
+    bool ok = chunk_decode(task->buffer, task->size, task->dest->blocks, task->scratch);
+    push_done(task, ok ? STORE_LOADED : STORE_FAILED);
+}
+
+static void encode_job(void* data)
+{
+    TRACE_SCOPE("encode");
+    StoreTask* task = (StoreTask*)data;
+    WorldStore* store = task->store;
+    RegionFile* region = task->region;
+
+    uint32_t size = chunk_encode(task->snapshot, task->buffer, CHUNK_PAYLOAD_SECTORS * IO_SECTOR_SIZE, task->scratch);
+    if (size == 0) {
+        push_done(task, STORE_FAILED);
+        return;
+    }
+    uint32_t count = sectors_for(size);
+    memset(task->buffer + size, 0, count * IO_SECTOR_SIZE - size);
+
+    uint32_t sector;
+    {
+        std::lock_guard<std::mutex> guard(region->lock);
+        uint32_t index = region_local_index(task->pos);
+        sector = allocate_sectors(region, count); // never the old sectors, they're still marked
+        if (sector == 0) {
+            printf("Region (%d, %d, %d) is out of sectors\n", region->pos.x, region->pos.y, region->pos.z);
+            push_done(task, STORE_FAILED);
+            return;
+        }
+        RegionEntry old = region->header[index];
+        region->header[index] = { sector, size };
+        release_extent(region, index, old);
+        region->writes_in_flight++;
+    }
+
+    task->size = size;
+
+    IORequest req = {};
+    req.op = IO_OP_WRITE;
+    req.fd = region->fd;
+    req.offset = (uint64_t)sector * IO_SECTOR_SIZE;
+    req.size = count * IO_SECTOR_SIZE;
+    req.buffer = task->buffer;
+    req.priority = IO_PRIORITY_WRITE;
+    req.user_data = (uint64_t)(uintptr_t)task;
+    if (!io_submit(store->io, req)) {
+        std::lock_guard<std::mutex> guard(region->lock);
+        region->writes_in_flight--;
+        push_done(task, STORE_FAILED);
+    }
+}
+
+static void start_task(WorldStore* store, StoreTask* task)
+{
+    RegionFile* region = task->region;
+
+    if (region->state == REGION_FAILED) {
+        finish_task(store, task, STORE_FAILED);
+        return;
+    }
+
+    if (task->type == STORE_TASK_SAVE) {
+        job_submit(store->jobs, encode_job, task);
+        return;
+    }
+
+    RegionEntry entry;
+    {
+        std::lock_guard<std::mutex> guard(region->lock);
+        entry = region->header[region_local_index(task->pos)];
+    }
+    if (entry.size == 0) {
+        finish_task(store, task, STORE_MISSING);
+        return;
+    }
+
+    task->size = entry.size;
+
+    IORequest req = {};
+    req.op = IO_OP_READ;
+    req.fd = region->fd;
+    req.offset = (uint64_t)entry.sector * IO_SECTOR_SIZE;
+    req.size = sectors_for(entry.size) * IO_SECTOR_SIZE;
+    req.buffer = task->buffer;
+    req.priority = task->priority;
+    req.user_data = (uint64_t)(uintptr_t)task;
+    if (!io_submit(store->io, req)) {
+        finish_task(store, task, STORE_FAILED);
+    }
+}
+
+static bool begin_task(WorldStore* store, StoreTask* task)
+{
+    RegionFile* region = acquire_region(store, task->pos, task->type == STORE_TASK_SAVE);
+    if (!region) {
+        task->next = store->free_tasks;
+        store->free_tasks = task;
+        store->active_tasks--;
+        return false;
+    }
+
+    task->region = region;
+    region->refs++;
+
+    if (region->state == REGION_LOADING_HEADER) {
+        task->next = region->waiting;
+        region->waiting = task;
+    } else {
+        start_task(store, task);
+    }
+    return true;
+}
+
+bool world_store_load(WorldStore* store, Chunk* dest, float priority)
+{
+    // A save of the same chunk may still be landing, wait for it rather than read stale sectors
+    for (uint32_t i = 0; i < store->num_tasks; i++) {
+        StoreTask* other = &store->tasks[i];
+        if (other->region && other->type == STORE_TASK_SAVE && other->pos == dest->pos) {
+            return false;
+        }
+    }
+
+    StoreTask* task = acquire_task(store);
+    if (!task) {
+        return false;
+    }
+    task->type = STORE_TASK_LOAD;
+    task->pos = dest->pos;
+    task->dest = dest;
+    task->priority = priority;
+    return begin_task(store, task);
+}
+
+bool world_store_save(WorldStore* store, Chunk* chunk)
+{
+    StoreTask* task = acquire_task(store);
+    if (!task) {
+        return false;
+    }
+    task->type = STORE_TASK_SAVE;
+    task->pos = chunk->pos;
+    task->dest = nullptr;
+    task->priority = IO_PRIORITY_WRITE;
+    memcpy(task->snapshot, chunk->blocks, sizeof(chunk->blocks));
+    return begin_task(store, task);
+}
+
+static float reprioritize_fn(const IORequest& req, void* user)
+{
+    if (req.user_data & HEADER_TAG) {
+        return 0.0f;
+    }
+    // The IO may be shared, every read goes by its own store's focus
+    StoreTask* task = (StoreTask*)(uintptr_t)req.user_data;
+    return world_store_priority(task->store->focus, task->pos);
+}
+
+void world_store_set_focus(WorldStore* store, ChunkPos focus)
+{
+    if (focus == store->focus) {
+        return;
+    }
+    store->focus = focus;
+    io_reprioritize(store->io, reprioritize_fn, nullptr);
+}
+
+// ===========================================
+// -----------------UPDATE--------------------
+// ===========================================
+
+static void handle_header_completion(WorldStore* store, RegionFile* region, const IOCompletion& c)
+{
+    if (c.op != IO_OP_READ) {
+        bool ok = c.op == IO_OP_SYNC ? c.result == 0 : c.result >= (int32_t)sizeof(region->header_io);
+        if (!ok) {
+            printf("Failed to %s region header (%d, %d, %d)\n", c.op == IO_OP_SYNC ? "sync" : "write", region->pos.x, region->pos.y, region->pos.z);
+            finish_header_write(region, false);
+            return;
+        }
+        if (region->header_step == HEADER_SYNC_HEADER) {
+            finish_header_write(region, true);
+            return;
+        }
+        HeaderStep next = region->header_step == HEADER_SYNC_PAYLOADS ? HEADER_WRITE : HEADER_SYNC_HEADER;
+        if (!submit_header_io(store, region, next == HEADER_WRITE ? IO_OP_WRITE : IO_OP_SYNC)) {
+            finish_header_write(region, false);
+            return;
+        }
+        region->header_step = next;
+        return;
+    }
+
+    if (c.result < 0) {
+        printf("Failed to read region header (%d, %d, %d): %s\n", region->pos.x, region->pos.y, region->pos.z, strerror(-c.result));
+        region->state = REGION_FAILED;
+    } else {
+        parse_header(region, c.result);
+        region->state = REGION_READY;
+    }
+
+    StoreTask* task = region->waiting;
+    region->waiting = nullptr;
+    while (task) {
+        StoreTask* next = task->next;
+        start_task(store, task);
+        task = next;
+    }
+}
+
+static void handle_task_completion(WorldStore* store, StoreTask* task, const IOCompletion& c)
+{
+    if (task->type == STORE_TASK_LOAD) {
+        if (c.result < (int32_t)task->size) {
+            finish_task(store, task, STORE_FAILED);
+            return;
+        }
+        job_submit(store->jobs, decode_job, task);
+        return;
+    }
+
+    RegionFile* region = task->region;
+    bool failed = c.result < (int32_t)task->size;
+    {
+        std::lock_guard<std::mutex> guard(region->lock);
+        region->writes_in_flight--;
+        if (failed) {
+            // Back to the last header written, the chunk is saved again later. No other save of
+            // it is in flight, so the entry is still the one this task wrote.
+            uint32_t index = region_local_index(task->pos);
+            RegionEntry written = region->header[index];
+            region->header[index] = region->in_flight[index];
+            release_extent(region, index, written);
+        } else {
+            region->header_dirty = true;
+        }
+    }
+    finish_task(store, task, failed ? STORE_FAILED : STORE_SAVED);
+}
+
+void world_store_update(WorldStore* store)
+{
+    store->frame++;
+
+    io_update(store->io);
+
+    IOCompletion completions[64];
+    uint32_t n;
+    while ((n = io_poll(store->io, completions, 64)) > 0) {
+        for (uint32_t i = 0; i < n; i++) {
+            const IOCompletion& c = completions[i];
+            if (c.user_data & HEADER_TAG) {
+                RegionFile* region = (RegionFile*)(uintptr_t)(c.user_data & ~(uint64_t)HEADER_TAG);
+                handle_header_completion(region->store, region, c);
+            } else {
+                StoreTask* task = (StoreTask*)(uintptr_t)c.user_data;
+                handle_task_completion(task->store, task, c);
+            }
+        }
+    }
+
+    StoreTask* done;
+    {
+        std::lock_guard<std::mutex> guard(store->done_lock);
+        done = store->done;
+        store->done = nullptr;
+    }
+    while (done) {
+        StoreTask* next = done->next;
+        finish_task(store, done, done->result);
+        done = next;
+    }
+
+    for (uint32_t i = 0; i < store->max_regions; i++) {
+        RegionFile* region = &store->regions[i];
+        if (region->state == REGION_READY && !region->header_writing) {
+            write_header(store, region);
+        }
+    }
+}
+
+uint32_t world_store_poll(WorldStore* store, StoreResult* out, uint32_t max)
+{
+    uint32_t n = 0;
+    while (n < max && store->finished) {
+        StoreTask* task = store->finished;
+        store->finished = task->next;
+        if (!store->finished) {
+            store->finished_tail = nullptr;
+        }
+
+        out[n].type = task->result;
+        out[n].task = task->type;
+        out[n].pos = task->pos;
+        out[n].chunk = task->dest;
+        n++;
+
+        task->region->refs--;
+        task->region = nullptr;
+        task->next = store->free_tasks;
+        store->free_tasks = task;
+        store->active_tasks--;
+    }
+    return n;
+}
+
+bool world_store_idle(WorldStore* store)
+{
+    if (store->active_tasks > 0 || !io_idle(store->io)) {
+        return false;
+    }
+    for (uint32_t i = 0; i < store->max_regions; i++) {
+        RegionFile* region = &store->regions[i];
+        if (region->header_writing || region->header_dirty) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void world_store_destroy(WorldStore* store)
+{
+    for (uint32_t i = 0; i < store->max_regions; i++) {
+        region_close(&store->regions[i]);
+        store->regions[i].~RegionFile();
+    }
+    store->~WorldStore();
+}
@@ -0,0 +1,158 @@
+#ifndef WORLD_STORE_HPP
+#define WORLD_STORE_HPP
+
+#include "chunk.hpp"
+#include "chunk_codec.hpp"
+#include "jobs.hpp"
+#include "world_io.hpp"
+#include <Arena.h>
+#include <cstdint>
+#include <mutex>
+
+// Region files: REGION_SIZE^3 chunks per file. Sector 0 holds a table of (sector, size) per chunk,
+// payloads are chunk_encode output padded to whole sectors. Sectors are allocated first fit, so
+// chunks saved together end up next to each other and their reads merge into one op.
+//
+// A save never overwrites sectors the header on disk points at: the payload goes to fresh
+// sectors and the old ones are only reused once a header pointing elsewhere has landed, so a
+// crash or torn write leaves the previous save readable. The file has room for two full copies
+// of every chunk for that. A header write is fenced by fdatasync on both sides: the payloads it
+// points at are durable before it goes out, and it is durable before the old sectors are reused.
+
+#define REGION_SHIFT 3
+#define REGION_SIZE (1 << REGION_SHIFT)
+#define REGION_MASK (REGION_SIZE - 1)
+#define REGION_CHUNKS (REGION_SIZE * REGION_SIZE * REGION_SIZE)
+#define REGION_HEADER_SECTORS 1
+#define CHUNK_PAYLOAD_SECTORS ((CHUNK_PAYLOAD_MAX_BYTES + IO_SECTOR_SIZE - 1) / IO_SECTOR_SIZE)
+#define REGION_MAX_SECTORS (REGION_HEADER_SECTORS + 2 * REGION_CHUNKS * CHUNK_PAYLOAD_SECTORS)
+
+struct RegionEntry {
+    uint32_t sector;
+    uint32_t size; // payload bytes, 0 if the chunk was never saved
+};
+
+static_assert(REGION_CHUNKS * sizeof(RegionEntry) <= REGION_HEADER_SECTORS * IO_SECTOR_SIZE, "region header does not fit");
+
+// Header write in progress: sync payloads -> write header -> sync header
+enum HeaderStep : uint8_t {
+    HEADER_SYNC_PAYLOADS,
+    HEADER_WRITE,
+    HEADER_SYNC_HEADER,
+};
+
+enum RegionState : uint8_t {
+    REGION_UNUSED,
+    REGION_LOADING_HEADER,
+    REGION_READY,
+    REGION_FAILED,
+};
+
+struct StoreTask;
+
+struct RegionFile {
+    struct WorldStore* store;
+    ChunkPos pos; // region coordinates
+    uint64_t key;
+    int fd;
+    RegionState state;
+
+    // header and sector map are touched by encode jobs, guarded by lock
+    std::mutex lock;
+    RegionEntry header[REGION_CHUNKS]; // latest saves
+    RegionEntry on_disk[REGION_CHUNKS]; // what the last header write that landed says
+    RegionEntry in_flight[REGION_CHUNKS]; // the header write in flight, same as on_disk without one
+    uint64_t used_sectors[(REGION_MAX_SECTORS + 63) / 64]; // sectors of all three
+    uint32_t writes_in_flight;
+    bool header_dirty;
+
+    // main thread only
+    uint8_t header_io[REGION_HEADER_SECTORS * IO_SECTOR_SIZE];
+    bool header_writing;
+    HeaderStep header_step;
+    uint32_t refs; // attached tasks, the file can't be closed while non zero
+    uint64_t last_used;
+    StoreTask* waiting; // tasks waiting for the header read
+};
+
+enum StoreTaskType : uint8_t {
+    STORE_TASK_LOAD,
+    STORE_TASK_SAVE,
+};
+
+enum StoreResultType : uint8_t {
+    STORE_LOADED,
+    STORE_MISSING, // never saved, caller should generate it
+    STORE_SAVED,
+    STORE_FAILED,
+};
+
+struct StoreTask {
+    StoreTaskType type;
+    StoreResultType result;
+    ChunkPos pos;
+    Chunk* dest; // load target
+    RegionFile* region;
+    float priority;
+    uint32_t size;
+
+    BlockID* snapshot; // CHUNK_VOLUME, saves copy the chunk here so the live one stays editable
+    uint8_t* buffer; // CHUNK_PAYLOAD_SECTORS * IO_SECTOR_SIZE
+    uint8_t* scratch; // CHUNK_CODEC_SCRATCH_BYTES
+
+    struct WorldStore* store;
+    StoreTask* next;
+};
+
+struct StoreResult {
+    StoreResultType type;
+    StoreTaskType task;
+    ChunkPos pos;
+    Chunk* chunk; // load target, null for saves
+};
+
+struct WorldStore {
+    IOContext* io;
+    JobSystem* jobs;
+    char dir[256];
+
+    RegionFile* regions;
+    uint32_t max_regions;
+
+    StoreTask* tasks;
+    StoreTask* free_tasks;
+    uint32_t num_tasks;
+    uint32_t active_tasks;
+
+    // finished by worker jobs, handed back to the main thread
+    std::mutex done_lock;
+    StoreTask* done;
+
+    StoreTask* finished; // ready for world_store_poll
+    StoreTask* finished_tail;
+
+    ChunkPos focus;
+    uint64_t frame;
+
+    static WorldStore* Create(Arena* arr, IOContext* io, JobSystem* jobs, const char* dir, uint32_t max_tasks = 32, uint32_t max_regions = 64);
+};
+
+// All functions are main thread only. load/save return false when every task is busy, retry next frame.
+// Stores can share an IOContext (and a job system): whichever one updates first hands every
+// completion to the store it belongs to. world_store_idle waits for the shared IO as a whole.
+bool world_store_load(WorldStore* store, Chunk* dest, float priority);
+bool world_store_save(WorldStore* store, Chunk* chunk);
+
+// Loads near the focus chunk get dispatched first
+void world_store_set_focus(WorldStore* store, ChunkPos focus);
+float world_store_priority(ChunkPos focus, ChunkPos pos);
+
+// Pumps IO and jobs, never blocks
+void world_store_update(WorldStore* store);
+uint32_t world_store_poll(WorldStore* store, StoreResult* out, uint32_t max);
+
+bool world_store_idle(WorldStore* store);
+
+void world_store_destroy(WorldStore* store);
+
+#endif // WORLD_STORE_HPP
@@ -0,0 +1,109 @@
+#include "worldgen.hpp"
+#include <cmath>
+
+static inline uint32_t hash_2d(uint64_t seed, int32_t x, int32_t z)
+{
+    uint64_t h = seed ^ ((uint64_t)(uint32_t)x * 0x9E3779B185EBCA87ULL) ^ ((uint64_t)(uint32_t)z * 0xC2B2AE3D27D4EB4FULL);
+    h ^= h >> 29;
+    h *= 0xBF58476D1CE4E5B9ULL;
+    h ^= h >> 32;
+    return (uint32_t)h;
+}
+
+static inline float fade(float t)
+{
+    return t * t * t * (t * (t * 6.0f - 15.0f) + 10.0f);
+}
+
+static inline float grad(uint32_t h, float dx, float dz)
+{
+    // 8 directions around the unit circle
+    switch (h & 7) {
+    case 0:
+        return dx + dz;
+    case 1:
+        return dx - dz;
+    case 2:
+        return -dx + dz;
+    case 3:
+        return -dx - dz;
+    case 4:
+        return dx;
+    case 5:
+        return -dx;
+    case 6:
+        return dz;
+    default:
+        return -dz;
+    }
+}
+
+float noise_2d(uint64_t seed, float x, float z)
+{
+    float fx = floorf(x);
+    float fz = floorf(z);
+    int32_t ix = (int32_t)fx;
+    int32_t iz = (int32_t)fz;
+    float dx = x - fx;
+    float dz = z - fz;
+
+    float n00 = grad(hash_2d(seed, ix, iz), dx, dz);
+    float n10 = grad(hash_2d(seed, ix + 1, iz), dx - 1.0f, dz);
+    float n01 = grad(hash_2d(seed, ix, iz + 1), dx, dz - 1.0f);
+    float n11 = grad(hash_2d(seed, ix + 1, iz + 1), dx - 1.0f, dz - 1.0f);
+
+    float u = fade(dx);
+    float v = fade(dz);
+    float nx0 = n00 + u * (n10 - n00);
+    float nx1 = n01 + u * (n11 - n01);
+    return (nx0 + v * (nx1 - nx0)) * 0.70710678f;
+}
+
+float fbm_2d(uint64_t seed, float x, float z, int octaves)
+{
+    float sum = 0.0f;
+    float amplitude = 1.0f;
+    float norm = 0.0f;
+    for (int i = 0; i < octaves; i++) {
+        sum += amplitude * noise_2d(seed + i, x, z);
+        norm += amplitude;
+        amplitude *= 0.5f;
+        x *= 2.0f;
+        z *= 2.0f;
+    }
+    return sum / norm;
+}
+
+int32_t terrain_height(uint64_t seed, int32_t x, int32_t z)
+{
+    float n = fbm_2d(seed, x * (1.0f / 256.0f), z * (1.0f / 256.0f), 5);
+    return SEA_LEVEL + (int32_t)(n * 48.0f);
+}
+
+void generate_chunk(uint64_t seed, Chunk* chunk)
+{
+    int32_t base_x = chunk->pos.x * CHUNK_SIZE;
+    int32_t base_y = chunk->pos.y * CHUNK_SIZE;
+    int32_t base_z = chunk->pos.z * CHUNK_SIZE;
+
+    for (uint32_t z = 0; z < CHUNK_SIZE; z++) {
+        for (uint32_t x = 0; x < CHUNK_SIZE; x++) {
+            int32_t height = terrain_height(seed, base_x + x, base_z + z);
+
+            for (uint32_t y = 0; y < CHUNK_SIZE; y++) {
+                int32_t wy = base_y + y;
+                BlockID block = BLOCK_AIR;
+                if (wy < height - 3) {
+                    block = BLOCK_STONE;
+                } else if (wy < height) {
+                    block = height <= SEA_LEVEL + 1 ? BLOCK_SAND : BLOCK_DIRT;
+                } else if (wy == height) {
+                    block = height <= SEA_LEVEL + 1 ? BLOCK_SAND : BLOCK_GRASS;
+                } else if (wy <= SEA_LEVEL) {
+                    block = BLOCK_WATER;
+                }
+                chunk->blocks[chunk_index(x, y, z)] = block;
+            }
+        }
+    }
+}
@@ -0,0 +1,18 @@
+#ifndef WORLDGEN_HPP
+#define WORLDGEN_HPP
+
+#include "chunk.hpp"
+#include <cstdint>
+
+#define SEA_LEVEL 40
+
+// Gradient noise in [-1, 1]. Deterministic for a given seed.
+float noise_2d(uint64_t seed, float x, float z);
+float fbm_2d(uint64_t seed, float x, float z, int octaves);
+
+int32_t terrain_height(uint64_t seed, int32_t x, int32_t z);
+
+// Fills every block of the chunk. Safe to call from any thread.
+void generate_chunk(uint64_t seed, Chunk* chunk);
+
+#endif // WORLDGEN_HPP